@@ -0,0 +1,145 @@
+#include "access_log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <string>
+
+access_log_header* access_log::m_header = NULL;
+access_log_path* access_log::m_paths = NULL;
+char* access_log::m_path_text = NULL;
+char* access_log::m_regions = NULL;
+size_t access_log::m_region_size = 0;
+
+// 线程占用的区域，-1表示还没有占用，-2表示区域已经用完，这个线程不记录
+static thread_local int t_region = -1;
+
+bool access_log::init(const char* spec){
+    std::string file = spec;
+    long records = 65536;
+    size_t comma = file.find(',');
+    if(comma != std::string::npos){
+        records = atol(file.c_str() + comma + 1);
+        file.resize(comma);
+    }
+    if(file.empty() || records <= 0 || records > (1 << 24)){
+        return false;
+    }
+
+    size_t path_offset = 4096;
+    size_t text_offset = path_offset + sizeof(access_log_path) * PATH_SLOTS;
+    size_t region_offset = (text_offset + PATH_BYTES + 4095) & ~(size_t)4095;
+    size_t region_size = sizeof(access_log_region) + sizeof(access_log_record) * records;
+    region_size = (region_size + 63) & ~(size_t)63;
+    size_t total = region_offset + region_size * REGION_COUNT;
+
+    // 每次启动重新创建，旧的日志需要先由解码工具导出
+    int fd = open(file.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd < 0){
+        return false;
+    }
+    if(ftruncate(fd, total) < 0){
+        close(fd);
+        return false;
+    }
+    // 预先建立所有页的映射，请求处理中写日志不会因为缺页进入内核
+    void* addr = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+    close(fd);
+    if(addr == MAP_FAILED){
+        return false;
+    }
+
+    char* base = (char*)addr;
+    access_log_header* h = (access_log_header*)base;
+    memcpy(h->magic, ACCESS_LOG_MAGIC, sizeof(h->magic));
+    h->record_size = sizeof(access_log_record);
+    h->region_count = REGION_COUNT;
+    h->region_records = records;
+    h->path_slots = PATH_SLOTS;
+    h->path_bytes = PATH_BYTES;
+    h->path_offset = path_offset;
+    h->text_offset = text_offset;
+    h->region_offset = region_offset;
+    h->region_size = region_size;
+
+    m_paths = (access_log_path*)(base + path_offset);
+    m_path_text = base + text_offset;
+    m_regions = base + region_offset;
+    m_region_size = region_size;
+    m_header = h;
+    return true;
+}
+
+uint64_t access_log::now_us(){
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// 把路径文本登记到路径表中，已经登记过的路径只比较一次哈希
+// 路径表或者文本区满了就不登记，解码时这些记录只显示哈希
+void access_log::intern(uint64_t hash, std::string_view path){
+    for(int i = 0; i < PATH_PROBE; ++i){
+        access_log_path& slot = m_paths[(hash + i) & (PATH_SLOTS - 1)];
+        uint64_t h = slot.hash.load(std::memory_order_relaxed);
+        if(h == hash){
+            return;
+        }
+        if(h != 0){
+            continue;
+        }
+        if(!slot.hash.compare_exchange_strong(h, hash, std::memory_order_relaxed)){
+            if(h == hash){
+                return;
+            }
+            continue;
+        }
+        // 抢到了空槽，由这个线程写入文本
+        uint32_t len = path.size() ? path.size() : 1;
+        uint32_t off = m_header->path_used.fetch_add(len, std::memory_order_relaxed);
+        if(off + len > PATH_BYTES){
+            return;
+        }
+        memcpy(m_path_text + off, path.data(), path.size());
+        slot.offset = off;
+        slot.len.store(path.size(), std::memory_order_release);
+        return;
+    }
+}
+
+void access_log::append(uint32_t addr, uint16_t port, int method, int status, uint64_t bytes, uint64_t start_us,
+    std::string_view path, uint8_t proto){
+    if(t_region == -1){
+        uint32_t r = m_header->regions_used.fetch_add(1, std::memory_order_relaxed);
+        t_region = (r < REGION_COUNT) ? (int)r : -2;
+    }
+    if(t_region < 0){
+        return;
+    }
+
+    size_t q = path.find('?');
+    if(q != std::string_view::npos){
+        path = path.substr(0, q);
+    }
+    uint64_t hash = access_log_hash(path);
+    intern(hash, path);
+
+    // 区域只属于这个线程，写完记录后再发布计数，解码工具读取运行中的文件时看到的记录是完整的
+    access_log_region* region = (access_log_region*)(m_regions + m_region_size * t_region);
+    uint64_t n = region->written.load(std::memory_order_relaxed);
+    access_log_record* rec = (access_log_record*)(region + 1) + n % m_header->region_records;
+    uint64_t now = now_us();
+    rec->time_us = now;
+    rec->bytes = bytes;
+    rec->url_hash = hash;
+    rec->addr = addr;
+    rec->service_us = (start_us && now > start_us) ? (uint32_t)(now - start_us) : 0;
+    rec->status = status;
+    rec->port = port;
+    rec->method = method;
+    rec->proto = proto;
+    region->written.store(n + 1, std::memory_order_release);
+}
@@ -0,0 +1,100 @@
+#ifndef ACCESS_LOG_H
+#define ACCESS_LOG_H
+#include <stdint.h>
+#include <atomic>
+#include <string_view>
+
+// 二进制访问日志：每个请求一条定长记录，写入内存映射的环形文件，由 tools/access_log_decode 离线解码
+// 文件分成若干区域，每个线程第一次写日志时占用一个区域，之后只写自己的区域，写满后从头覆盖
+// 写一条记录只是几次内存写入，不加锁，也没有系统调用；请求路径只保存哈希，文本在路径表中保存一次
+//
+// 文件布局：
+//   access_log_header（一页），记录了下面各部分的位置
+//   路径表：path_slots 个 access_log_path，按哈希开放寻址
+//   路径文本：path_bytes 字节
+//   region_count 个区域，每个区域是 access_log_region 加上 region_records 条 access_log_record
+
+static const char ACCESS_LOG_MAGIC[8] = {'T', 'H', 'A', 'L', 'O', 'G', '0', '1'};
+
+struct access_log_header{
+    char magic[8];
+    uint32_t record_size;
+    uint32_t region_count;
+    uint32_t region_records;            // 每个区域的记录数
+    uint32_t path_slots;
+    uint32_t path_bytes;
+    uint64_t path_offset;               // 各部分在文件中的位置
+    uint64_t text_offset;
+    uint64_t region_offset;
+    uint64_t region_size;               // 一个区域的字节数，包括头部
+    std::atomic<uint32_t> regions_used; // 已经被线程占用的区域数
+    std::atomic<uint32_t> path_used;    // 路径文本已经使用的字节数
+};
+
+struct access_log_path{
+    std::atomic<uint64_t> hash;         // 0表示空槽
+    uint32_t offset;                    // 文本在路径文本区中的位置
+    std::atomic<uint32_t> len;          // 文本写完后才设置，0表示还没有写完
+};
+
+// 每个区域的头部，独占一条缓存行
+struct alignas(64) access_log_region{
+    std::atomic<uint64_t> written;      // 这个区域累计写入的记录数，下一条写在 written % region_records
+};
+
+// 协议：低4位是HTTP主版本号，最高位表示TLS
+enum ACCESS_PROTO {PROTO_HTTP1 = 1, PROTO_HTTP2 = 2, PROTO_TLS = 0x80};
+
+struct access_log_record{
+    uint64_t time_us;       // 响应发送完毕的时间，微秒级UNIX时间
+    uint64_t bytes;         // 发送的响应字节数，包括响应头
+    uint64_t url_hash;      // 请求路径（不含查询串）的哈希，在路径表中查找文本
+    uint32_t addr;          // 客户端IPv4地址，网络字节序
+    uint32_t service_us;    // 从收到请求的第一个字节到响应发送完毕的时间
+    uint16_t status;        // 状态码，连接被处理函数接管时为0
+    uint16_t port;          // 客户端端口，网络字节序
+    int8_t method;          // http_conn::METHOD，-1表示无法解析
+    uint8_t proto;          // ACCESS_PROTO
+    uint8_t reserved[6];
+};
+static_assert(sizeof(access_log_record) == 48, "access log record layout changed");
+
+// 路径哈希（FNV-1a），0留给空槽
+inline uint64_t access_log_hash(std::string_view path){
+    uint64_t h = 14695981039346656037ull;
+    for(char c : path){
+        h = (h ^ (uint8_t)c) * 1099511628211ull;
+    }
+    return h ? h : 1;
+}
+
+class access_log{
+public:
+    static const uint32_t REGION_COUNT = 32;        // 最多32个线程写日志，之后的线程不记录
+    static const uint32_t PATH_SLOTS = 1 << 16;     // 最多记录的不同路径数
+    static const uint32_t PATH_BYTES = 4 << 20;     // 路径文本区的大小
+    static const int PATH_PROBE = 16;
+
+    // 解析 "file[,records]" 创建并映射日志文件，records是每个线程的区域能保存的记录数，默认65536，启动阶段调用
+    static bool init(const char* spec);
+    static bool enabled(){ return m_header != NULL; }
+
+    // 当前时间，微秒，由vDSO读取，不进入内核
+    static uint64_t now_us();
+
+    // 追加一条记录，start_us是收到请求第一个字节的时间
+    static void append(uint32_t addr, uint16_t port, int method, int status, uint64_t bytes, uint64_t start_us,
+        std::string_view path, uint8_t proto);
+
+private:
+    static void intern(uint64_t hash, std::string_view path);
+
+private:
+    static access_log_header* m_header;
+    static access_log_path* m_paths;
+    static char* m_path_text;
+    static char* m_regions;     // 第一个区域的起始位置
+    static size_t m_region_size;
+};
+
+#endif
@@ -0,0 +1,238 @@
+#include "co_conn.h"
+#include <stdlib.h>
+#include <time.h>
+#include <string>
+#include <algorithm>
+
+extern void log(std::string str);
+
+thread_local co_frame_pool::block* co_frame_pool::m_free_list = nullptr;
+
+void* co_frame_pool::alloc(size_t size){
+    // 超过块大小的协程帧直接走系统分配
+    if(size > BLOCK_SIZE){
+        return ::operator new(size);
+    }
+    if(!m_free_list){
+        // 一次申请一组块串成空闲链表，这些内存归线程所有，不归还给系统
+        char* chunk = (char*)malloc(BLOCK_SIZE * BLOCKS_PER_CHUNK);
+        if(!chunk){
+            throw std::bad_alloc();
+        }
+        for(int i = 0; i < BLOCKS_PER_CHUNK; ++i){
+            block* b = (block*)(chunk + i * BLOCK_SIZE);
+            b->next = m_free_list;
+            m_free_list = b;
+        }
+    }
+    block* b = m_free_list;
+    m_free_list = b->next;
+    return b;
+}
+
+void co_frame_pool::free(void* p, size_t size){
+    if(size > BLOCK_SIZE){
+        ::operator delete(p);
+        return;
+    }
+    block* b = (block*)p;
+    b->next = m_free_list;
+    m_free_list = b;
+}
+
+// 连接协程：读请求 -> 解析 -> 发送响应，在EAGAIN处挂起，长连接时循环处理下一个请求
+// 解析和填充应答复用状态机的process_read/process_write，发送不再需要bytes_have_send等记录
+co_task http_conn::co_process(){
+    // TLS握手，等待对方数据或者发送缓冲区时挂起
+    while(tls_handshaking()){
+        int ev = tls_handshake();
+        if(ev < 0){
+            co_return;
+        }
+        if(ev > 0){
+            co_await co_event_awaiter{m_sockfd, ev};
+        }
+    }
+    // ALPN协商了h2，连接已经交给HTTP/2会话
+    if(is_h2()){
+        co_return;
+    }
+
+    while(true){
+        HTTP_CODE read_ret = NO_REQUEST;
+        while(read_ret == NO_REQUEST){
+            // 上传的请求体由process_read直接从socket splice到文件，这里只等待可读
+            if(m_check_state == CHECK_STATE_CONTENT && m_upload_splice){
+                co_await co_event_awaiter{m_sockfd, EPOLLIN};
+                on_receive();
+                read_ret = process_read();
+                continue;
+            }
+
+            // 超出缓冲区大小
+            if(m_read_idx >= READ_BUFFER_SIZE){
+                co_return;
+            }
+            ssize_t bytes_read = co_await co_recv(this, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx);
+            if(bytes_read < 0 && errno == EAGAIN){
+                continue;
+            }
+            if(bytes_read <= 0){
+                co_return;  // 对方关闭连接或读取错误
+            }
+            if(m_read_idx == 0 && access_log::enabled()){
+                m_req_start = access_log::now_us();
+            }
+            m_read_idx += bytes_read;
+            m_idle.store(false, std::memory_order_relaxed);
+            ++m_request_cnt;
+            if(!admit()){
+                co_return;
+            }
+
+            on_receive();
+            read_ret = process_read();
+        }
+        set_deadline(conn_deadline::WRITE, coarse_clock::now() + conn_deadline::timeout(conn_deadline::WRITE));
+
+        // 切换到HTTP/2，之后的事件由主线程的h2_event处理，协程结束
+        if(read_ret == H2_PREFACE || read_ret == H2_UPGRADE){
+            h2_start(read_ret == H2_UPGRADE);
+            co_return;
+        }
+
+        // 静态文件的stat/open在I/O线程上进行，主线程继续处理其它连接
+        if(read_ret == OPEN_PENDING){
+            co_await co_io_job_awaiter{io_pool::open(this, m_io_gen, m_url)};
+            read_ret = open_done();
+        }
+
+        // 请求体没有读完就出错了，响应后关闭连接，见process
+        if(!m_hijacked && !body_complete()){
+            m_linger = false;
+        }
+
+        if(!process_write(read_ret)){
+            co_return;
+        }
+
+        // 发送响应头，后面还有响应体时带上MSG_MORE，让内核与响应体合并发送
+        int flags = (m_file_fd >= 0 || !m_resp_body.empty()) ? MSG_MORE : 0;
+        int head_sent = 0;
+        while(head_sent < m_write_idx){
+            ssize_t ret = co_await co_send(this, m_write_buf + head_sent, m_write_idx - head_sent, flags);
+            if(ret < 0 && errno == EAGAIN){
+                continue;
+            }
+            if(ret < 0){
+                unmap();
+                co_return;
+            }
+            head_sent += ret;
+        }
+        m_resp_bytes += head_sent;
+        if(m_pace.rule){
+            pacer::consume(m_pace, head_sent);
+        }
+
+        // 用sendfile发送文件内容，数据不经过用户空间
+        // 开启I/O线程池时每次发送前确认接下来的一段在页缓存中，不在时先由I/O线程预读，sendfile不越过确认的范围
+        off_t offset = 0;
+        off_t size = m_bufs->file_stat.st_size;
+        while(m_file_fd >= 0 && offset < size){
+            size_t count = size - offset;
+            if(io_pool::enabled()){
+                if((size_t)offset >= m_io_checked){
+                    size_t len = std::min(io_pool::WINDOW, count);
+                    if(!io_pool::resident(NULL, m_file_fd, offset, len)){
+                        co_await co_io_job_awaiter{io_pool::prefetch(this, m_io_gen, m_file_fd, offset, len)};
+                    }
+                    m_io_checked = offset + len;
+                }
+                count = m_io_checked - offset;
+            }
+            // 限速的响应：令牌不足时挂起，到时间后由主线程恢复
+            if(m_pace.rule){
+                size_t quota;
+                while(!(quota = pacer::quota(m_pace, m_sockfd, count))){
+                    co_await co_pace_awaiter{this};
+                }
+                count = quota;
+            }
+            ssize_t ret = co_await co_sendfile(this, m_file_fd, &offset, count);
+            if(ret < 0 && errno == EAGAIN){
+                continue;
+            }
+            if(ret <= 0){
+                unmap();
+                co_return;
+            }
+            m_resp_bytes += ret;
+            if(m_pace.rule){
+                pacer::consume(m_pace, ret);
+            }
+        }
+        unmap();
+
+        // 处理函数生成的响应体，流式响应发送完一段后由生产函数填充下一段
+        while(true){
+            size_t body_sent = 0;
+            while(body_sent < m_resp_body.size()){
+                size_t len = m_resp_body.size() - body_sent;
+                if(m_pace.rule){
+                    size_t quota;
+                    while(!(quota = pacer::quota(m_pace, m_sockfd, len))){
+                        co_await co_pace_awaiter{this};
+                    }
+                    len = quota;
+                }
+                ssize_t ret = co_await co_send(this, m_resp_body.data() + body_sent, len, 0);
+                if(ret < 0 && errno == EAGAIN){
+                    continue;
+                }
+                if(ret < 0){
+                    co_return;
+                }
+                body_sent += ret;
+                if(m_pace.rule){
+                    pacer::consume(m_pace, ret);
+                }
+            }
+            m_resp_bytes += body_sent;
+            if(!m_resp_producer){
+                break;
+            }
+            if(!next_chunk()){
+                co_return;
+            }
+        }
+
+        log_access();
+        if(!m_linger){
+            co_return;
+        }
+        init();
+    }
+}
+
+// 为新连接创建协程并运行到第一次挂起
+void http_conn::co_start(){
+    m_co_handle = co_process().handle;
+    co_resume();
+}
+
+// 连接上有事件到达，恢复协程；协程结束则关闭连接并销毁协程帧
+// 切换到HTTP/2而结束的协程只销毁协程帧，连接继续由h2_event处理
+void http_conn::co_resume(){
+    if(m_co_handle && !m_co_handle.done()){
+        m_co_handle.resume();
+    }
+    if(m_co_handle && m_co_handle.done()){
+        if(m_h2){
+            m_co_handle.destroy();
+            m_co_handle = nullptr;
+            return;
+        }
+        close_conn();
+    }
+}
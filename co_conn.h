@@ -0,0 +1,143 @@
+#ifndef CO_CONN_H
+#define CO_CONN_H
+#include <coroutine>
+#include <exception>
+#include <new>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+#include <sys/epoll.h>
+#include "http_conn.h"
+
+extern void modfd(int epollfd, int fd, int ev);
+
+// 协程帧内存池，每个线程一个
+// 按固定大小的块分配，释放的块挂回空闲链表，连接建立后不再有堆分配
+class co_frame_pool{
+public:
+    static const size_t BLOCK_SIZE = 512;   // 单个协程帧的最大大小
+    static const int BLOCKS_PER_CHUNK = 64; // 空闲链表为空时一次向系统申请的块数
+
+    static void* alloc(size_t size);
+    static void free(void* p, size_t size);
+
+private:
+    struct block{
+        block* next;
+    };
+    static thread_local block* m_free_list;
+};
+
+// 连接协程的返回类型
+// 创建后先挂起，由http_conn::co_start保存句柄后再恢复；结束时挂起，由close_conn销毁协程帧
+struct co_task{
+    struct promise_type{
+        co_task get_return_object(){
+            return co_task{std::coroutine_handle<promise_type>::from_promise(*this)};
+        }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void(){}
+        void unhandled_exception(){ std::terminate(); }
+
+        static void* operator new(size_t size){
+            return co_frame_pool::alloc(size);
+        }
+        static void operator delete(void* p, size_t size){
+            co_frame_pool::free(p, size);
+        }
+    };
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+// 非阻塞IO的awaitable：先直接尝试一次，返回EAGAIN才挂起
+// 挂起时通过modfd重新注册EPOLLONESHOT事件，事件到达后主线程恢复协程，再重试一次
+template<typename Op>
+struct co_io_awaiter{
+    int fd;
+    int ev;
+    Op op;
+    ssize_t ret;
+    bool waited;
+
+    co_io_awaiter(int fd, int ev, Op op): fd(fd), ev(ev), op(op), ret(-1), waited(false){}
+
+    bool await_ready(){
+        ret = op();
+        return !(ret < 0 && errno == EAGAIN);
+    }
+    void await_suspend(std::coroutine_handle<>){
+        waited = true;
+        modfd(http_conn::m_epollfd, fd, ev);
+    }
+    // 返回值与对应的系统调用一致，仍为EAGAIN时由调用者重新co_await
+    ssize_t await_resume(){
+        if(waited){
+            ret = op();
+        }
+        return ret;
+    }
+};
+
+// 只等待fd就绪、不做IO的awaitable，IO由被恢复的协程自己完成（如上传时的splice）
+struct co_event_awaiter{
+    int fd;
+    int ev;
+
+    bool await_ready(){ return false; }
+    void await_suspend(std::coroutine_handle<>){
+        modfd(http_conn::m_epollfd, fd, ev);
+    }
+    void await_resume(){}
+};
+
+// 等待I/O线程完成文件任务的awaitable：提交失败时不挂起，由协程在主线程上直接完成
+// 任务完成后主线程通过http_conn::io_done恢复协程
+struct co_io_job_awaiter{
+    bool submitted;
+
+    bool await_ready(){ return !submitted; }
+    void await_suspend(std::coroutine_handle<>){}
+    void await_resume(){}
+};
+
+// 限速的响应令牌不足：挂起到pacer计算的时间，主线程通过http_conn::pace_resume恢复协程
+struct co_pace_awaiter{
+    http_conn* conn;
+
+    bool await_ready(){ return false; }
+    void await_suspend(std::coroutine_handle<>){
+        conn->pace_defer();
+    }
+    void await_resume(){}
+};
+
+// 以下IO经过http_conn的sock_*，TLS连接在没有kTLS时由OpenSSL加解密
+// 发送出数据时重新计算发送响应的截止时间，见conn_deadline.h
+inline auto co_recv(http_conn* conn, char* buf, size_t len){
+    return co_io_awaiter(conn->get_sockfd(), EPOLLIN, [=]{ return conn->sock_recv(buf, len); });
+}
+
+inline auto co_send(http_conn* conn, const char* buf, size_t len, int flags){
+    return co_io_awaiter(conn->get_sockfd(), EPOLLOUT, [=]{
+        ssize_t ret = conn->sock_send(buf, len, flags);
+        if(ret > 0){
+            conn->write_progress();
+        }
+        return ret;
+    });
+}
+
+inline auto co_sendfile(http_conn* conn, int in_fd, off_t* offset, size_t count){
+    return co_io_awaiter(conn->get_sockfd(), EPOLLOUT, [=]{
+        ssize_t ret = conn->sock_sendfile(in_fd, offset, count);
+        if(ret > 0){
+            conn->write_progress();
+        }
+        return ret;
+    });
+}
+
+#endif
@@ -0,0 +1,28 @@
+#include "coarse_clock.h"
+#include <stdio.h>
+
+std::atomic<time_t> coarse_clock::m_wall_sec(0);
+std::atomic<uint64_t> coarse_clock::m_mono_ms(0);
+char coarse_clock::m_date[2][DATE_LEN + 1];
+char coarse_clock::m_stamp[2][STAMP_LEN + 1];
+std::atomic<int> coarse_clock::m_current(0);
+
+void coarse_clock::update(){
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    m_mono_ms.store(ts.tv_sec * 1000ull + ts.tv_nsec / 1000000, std::memory_order_relaxed);
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+    if(ts.tv_sec == m_wall_sec.load(std::memory_order_relaxed)){
+        return;
+    }
+
+    // 秒数变了：在没有被读的那一份里生成新的字符串，再切换过去
+    int next = m_current.load(std::memory_order_relaxed) ^ 1;
+    tm gmt, local;
+    gmtime_r(&ts.tv_sec, &gmt);
+    localtime_r(&ts.tv_sec, &local);
+    strftime(m_date[next], sizeof(m_date[next]), "Date: %a, %d %b %Y %H:%M:%S GMT\r\n", &gmt);
+    strftime(m_stamp[next], sizeof(m_stamp[next]), "%a %b %e %H:%M:%S %Y\n", &local);
+    m_current.store(next, std::memory_order_release);
+    m_wall_sec.store(ts.tv_sec, std::memory_order_relaxed);
+}
@@ -0,0 +1,38 @@
+#ifndef COARSE_CLOCK_H
+#define COARSE_CLOCK_H
+#include <stdint.h>
+#include <time.h>
+#include <atomic>
+
+// 进程共用的粗粒度时钟：主线程在每轮事件循环开始时调用一次update，读取墙上时间和单调时间（粗粒度时钟由vDSO读取，不进入内核），
+// 秒数变化时重新生成Date响应头和日志的时间戳，请求处理路径上只读取缓存的值，不再调用time、ctime和strftime
+// 主线程阻塞在epoll_wait时不更新，这时没有请求在处理；定时器每TIMESLOT秒唤醒一次主线程
+// 工作线程、I/O线程和监控线程读到的值最多落后主线程一轮事件处理的时间
+class coarse_clock{
+public:
+    static const int DATE_LEN = 37;         // "Date: Sun, 06 Nov 1994 08:49:37 GMT\r\n"
+    static const int STAMP_LEN = 25;        // ctime的格式 "Sun Nov  6 08:49:37 1994\n"
+
+    static void update();                   // 主线程，启动时和每轮事件循环开始时调用
+
+    static time_t now(){ return m_wall_sec.load(std::memory_order_relaxed); }     // 墙上时间：秒
+    static uint64_t mono_ms(){ return m_mono_ms.load(std::memory_order_relaxed); } // 单调时间：毫秒
+
+    // 当前这一秒的 "Date: ...\r\n"（IMF-fixdate，RFC 9110），DATE_LEN字节，不以'\0'结尾
+    static const char* date_header(){ return m_date[m_current.load(std::memory_order_acquire)]; }
+    // 只有日期的部分，用于HTTP/2的date头部
+    static const char* date_value(){ return date_header() + 6; }
+    static const int DATE_VALUE_LEN = DATE_LEN - 8;
+    // 本地时间的时间戳，和ctime的输出一样以换行结尾，STAMP_LEN字节，以'\0'结尾
+    static const char* log_stamp(){ return m_stamp[m_current.load(std::memory_order_acquire)]; }
+
+private:
+    static std::atomic<time_t> m_wall_sec;
+    static std::atomic<uint64_t> m_mono_ms;
+    // 两份格式化好的字符串轮流写：写完另一份再切换下标，读者拿到的那一份要一秒之后才会被改写
+    static char m_date[2][DATE_LEN + 1];
+    static char m_stamp[2][STAMP_LEN + 1];
+    static std::atomic<int> m_current;
+};
+
+#endif
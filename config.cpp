@@ -0,0 +1,204 @@
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <libgen.h>
+
+Config::Config(){
+    port = 0;
+    conn_model = CONN_STATE_MACHINE;
+    upload_prefix = NULL;
+    proxy_timeout = 10;
+    tls_port = 0;
+    tls_cert = NULL;
+    tls_key = NULL;
+    rate_limit = NULL;
+    access_log = NULL;
+    io_threads = 0;
+    min_threads = 8;
+    max_threads = 8;
+    fair_sched = NULL;
+    busy_poll = 0;
+    watchdog = NULL;
+    metrics_url = NULL;
+    conn_limit = NULL;
+    deadlines = NULL;
+    workers = 0;
+    file_cache = NULL;
+}
+
+void Config::usage(const char* prog){
+    printf("按照如下格式运行: %s port_number [options]\n", prog);
+    printf("  -m fsm|co    连接处理模型：状态机+线程池(默认) 或 C++20协程\n");
+    printf("  -u prefix    允许向该URL前缀下PUT/POST上传文件，如 /upload/\n");
+    printf("  -P rule      反向代理，把URL前缀转发给上游，可以出现多次，如 /api/=127.0.0.1:8080,unix:/run/app.sock\n");
+    printf("  -T seconds   反向代理等待上游的超时时间，默认10秒\n");
+    printf("  -S port      在该端口上提供HTTPS，需要同时给出 -c 证书链 和 -k 私钥（PEM格式）\n");
+    printf("  -R rps,burst[,conns[,prefix]]  按客户端IP限流：每秒请求数、突发数、最大连接数(0不限)、按前缀聚合的长度(默认32)\n");
+    printf("  -A file[,records]  把访问日志写入二进制环形文件，records为每个线程保存的记录数(默认65536)，用tools/access_log_decode解码\n");
+    printf("  -I threads   文件I/O线程数：不在页缓存中的文件先由I/O线程预读，协程模式下的stat/open也交给I/O线程，默认0不启用\n");
+    printf("  -w min,max   处理请求的线程数范围，按队列等待时间和CPU利用率在范围内调整，默认8,8即固定8个线程，上限大于下限时才调整\n");
+    printf("  -F ip|conn[,queue[,addr/len=weight,...]]  线程池按客户端IP或连接做差额轮询，每类最多排队queue个请求(默认64)，可按网段设置权重\n");
+    printf("  -B us        忙轮询：主线程和空闲的工作线程先空转等待us微秒再睡眠，socket开启SO_BUSY_POLL，适合独占CPU的低延迟部署\n");
+    printf("  -W ms[,url]  主线程一轮事件处理超过ms毫秒时把它的调用栈、正在处理的事件和最近几轮的耗时写入日志，给出url时在该路径导出每轮耗时的直方图\n");
+    printf("  -M url       在该路径以Prometheus文本格式导出指标，同时每个定时器周期采样连接的TCP_INFO（RTT、重传、拥塞窗口、发送停滞）\n");
+    printf("  -L addr[,opt...]  再监听一个地址，可以出现多次：port、ip:port、[ipv6]:port、unix:/path、unix:@抽象名字；\n");
+    printf("               选项 tls、backlog=N、mode=0660、reuseport、v6only=0|1、defer=秒、nodelay；给出 -L 时可以省略端口号\n");
+    printf("  -D prefix=rate[,free[,kernel]]  URL匹配前缀的响应在前free字节之后限速为每个连接每秒rate字节(可带k/m)，可以出现多次；\n");
+    printf("               kernel表示用SO_MAX_PACING_RATE交给内核限速（需要fq队列规则或者TCP内部pacing）\n");
+    printf("  -C high[,low]  连接数达到high（或者描述符用完）时关闭最久没有活动的空闲长连接，直到连接数降到low(默认high的90%%)\n");
+    printf("  -O idle=s,header=s,body=s,rate=n,write=s  各阶段的超时(秒，默认都是15)：等待下一个请求、收齐请求头(从第一个字节算起)、\n");
+    printf("               接收请求体(rate为最低平均速率，每收到rate字节多给一秒，可带k/m)、发送响应(多久没有进展)，可以只给出一部分\n");
+    printf("  -N workers   多进程模型：master监听后fork出workers个互不共享状态的worker，异常退出的worker自动重启，\n");
+    printf("               SIGHUP平滑重启（重新加载TLS证书），SIGQUIT处理完已有的连接后退出，共享内存中汇总各worker的计数\n");
+    printf("  -K entries[,ttl]  缓存静态文件的stat结果（包括不存在的路径）ttl秒(默认1)，多进程模型下所有worker共用\n");
+}
+
+bool Config::parse_arg(int argc, char* argv[]){
+    int opt;
+    const char* str = "m:u:P:T:S:c:k:R:A:I:w:F:B:W:M:C:L:D:O:N:K:";
+    while((opt = getopt(argc, argv, str)) != -1){
+        switch(opt){
+            case 'm':{
+                if(strcmp(optarg, "fsm") == 0){
+                    conn_model = CONN_STATE_MACHINE;
+                }else if(strcmp(optarg, "co") == 0){
+                    conn_model = CONN_COROUTINE;
+                }else{
+                    return false;
+                }
+                break;
+            }
+            case 'u':{
+                if(optarg[0] != '/'){
+                    return false;
+                }
+                upload_prefix = optarg;
+                break;
+            }
+            case 'P':{
+                if(optarg[0] != '/' || !strchr(optarg, '=')){
+                    return false;
+                }
+                proxy_passes.push_back(optarg);
+                break;
+            }
+            case 'T':{
+                proxy_timeout = atoi(optarg);
+                if(proxy_timeout <= 0){
+                    return false;
+                }
+                break;
+            }
+            case 'S':{
+                tls_port = atoi(optarg);
+                if(tls_port <= 0){
+                    return false;
+                }
+                break;
+            }
+            case 'c':{
+                tls_cert = optarg;
+                break;
+            }
+            case 'k':{
+                tls_key = optarg;
+                break;
+            }
+            case 'R':{
+                rate_limit = optarg;
+                break;
+            }
+            case 'A':{
+                access_log = optarg;
+                break;
+            }
+            case 'I':{
+                io_threads = atoi(optarg);
+                if(io_threads < 0){
+                    return false;
+                }
+                break;
+            }
+            case 'B':{
+                busy_poll = atoi(optarg);
+                if(busy_poll < 0){
+                    return false;
+                }
+                break;
+            }
+            case 'F':{
+                fair_sched = optarg;
+                break;
+            }
+            case 'W':{
+                watchdog = optarg;
+                break;
+            }
+            case 'M':{
+                if(optarg[0] != '/'){
+                    return false;
+                }
+                metrics_url = optarg;
+                break;
+            }
+            case 'C':{
+                conn_limit = optarg;
+                break;
+            }
+            case 'L':{
+                listens.push_back(optarg);
+                break;
+            }
+            case 'D':{
+                pace_rules.push_back(optarg);
+                break;
+            }
+            case 'O':{
+                deadlines = optarg;
+                break;
+            }
+            case 'N':{
+                workers = atoi(optarg);
+                if(workers <= 0){
+                    return false;
+                }
+                break;
+            }
+            case 'K':{
+                file_cache = optarg;
+                break;
+            }
+            case 'w':{
+                if(sscanf(optarg, "%d,%d", &min_threads, &max_threads) != 2 || min_threads <= 0 || max_threads < min_threads){
+                    return false;
+                }
+                break;
+            }
+            default:
+                return false;
+        }
+    }
+
+    // 反向代理在工作线程上同步等待上游，不能运行在协程模式的主线程上
+    if(!proxy_passes.empty() && conn_model == CONN_COROUTINE){
+        return false;
+    }
+
+    // 公平调度作用于线程池，协程模式没有线程池
+    if(fair_sched && conn_model == CONN_COROUTINE){
+        return false;
+    }
+
+    if(tls_port && (!tls_cert || !tls_key)){
+        return false;
+    }
+
+    // 剩下的第一个非选项参数是端口号，用 -L 给出了监听地址时可以没有
+    if(optind >= argc){
+        return !listens.empty();
+    }
+    port = atoi(argv[optind]);
+    return port > 0;
+}
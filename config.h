@@ -0,0 +1,48 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+#include <vector>
+
+// 连接处理模型
+// CONN_STATE_MACHINE：有限状态机 + 线程池（默认）
+// CONN_COROUTINE：每个连接一个C++20协程，在主线程的epoll循环上恢复执行
+enum CONN_MODEL {CONN_STATE_MACHINE = 0, CONN_COROUTINE};
+
+// 服务器配置，由命令行参数解析得到
+class Config{
+public:
+    Config();
+    ~Config(){};
+
+    // 解析命令行参数，格式: port [-m fsm|co] [-u upload_prefix] [-P prefix=upstream,...] [-T seconds] [-S tls_port -c cert -k key] [-R rps,burst[,conns[,prefix]]] [-A file[,records]] [-I io_threads] [-w min,max] [-F ip|conn[,queue[,addr/len=weight,...]]] [-B spin_us] [-W ms[,metrics_url]] [-M metrics_url] [-C high[,low]] [-L addr[,opt...]] [-D prefix=rate[,free[,kernel]]] [-O idle=s,header=s,body=s,rate=n,write=s] [-N workers] [-K entries[,ttl]]，出错返回false
+    bool parse_arg(int argc, char* argv[]);
+
+    // 打印用法
+    static void usage(const char* prog);
+
+public:
+    int port;           // 监听端口
+    int conn_model;     // 连接处理模型
+    const char* upload_prefix; // 上传目录的URL前缀，NULL表示不接受上传
+    std::vector<const char*> proxy_passes; // 反向代理规则，如 /api/=127.0.0.1:8080,unix:/run/app.sock
+    int proxy_timeout;  // 等待上游的超时时间：秒
+    int tls_port;       // TLS监听端口，0表示不开启
+    const char* tls_cert; // PEM格式的证书链
+    const char* tls_key;  // PEM格式的私钥
+    const char* rate_limit; // 按客户端IP限流的参数，NULL表示不限流
+    const char* access_log; // 二进制访问日志文件和每个线程的记录数，NULL表示不记录
+    int io_threads;     // 文件I/O线程数，0表示不启用，文件I/O在原来的线程上进行
+    int min_threads;    // 处理请求的线程数下限
+    int max_threads;    // 处理请求的线程数上限，等于下限时线程数固定
+    const char* fair_sched; // 线程池按客户端公平调度的参数，NULL表示按到达顺序
+    int busy_poll;      // 忙轮询：主线程和工作线程空转等待的时长(微秒)，0表示阻塞等待
+    const char* watchdog; // 主线程卡顿监控的阈值和导出耗时直方图的URL，NULL表示不监控
+    const char* metrics_url; // 导出指标的URL，同时开启连接的TCP_INFO采样，NULL表示不导出
+    const char* conn_limit; // 淘汰空闲长连接的连接数高低水位，NULL表示连接满时直接关闭新连接
+    const char* deadlines;  // 各阶段的超时，如 idle=15,header=10,body=30,rate=1k,write=30，NULL表示都用默认值
+    int workers;        // 多进程模型的worker进程数，0表示单进程
+    const char* file_cache; // 静态文件元数据缓存的条目数和有效期，NULL表示不缓存
+    std::vector<const char*> pace_rules; // 响应限速规则，如 /downloads/=1m,4m
+    std::vector<const char*> listens; // 其它监听地址和选项，如 unix:/run/tinyhttp.sock,mode=0660 或 [::]:8080,tls
+};
+
+#endif
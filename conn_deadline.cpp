@@ -0,0 +1,68 @@
+#include "conn_deadline.h"
+#include "metrics.h"
+#include "http_conn.h"
+#include <stdlib.h>
+#include <string.h>
+
+time_t conn_deadline::m_timeout[PHASES] = {3 * TIMESLOT, 3 * TIMESLOT, 3 * TIMESLOT, 3 * TIMESLOT};
+uint64_t conn_deadline::m_min_rate = 0;
+time_t conn_deadline::m_min_timeout = 3 * TIMESLOT;
+std::atomic<uint64_t> conn_deadline::m_expired[PHASES];
+
+static const char* const phase_names[conn_deadline::PHASES] = {"idle", "header", "body", "write"};
+
+bool conn_deadline::init(const char* spec){
+    for(const char* p = spec; p && *p; ){
+        const char* eq = strchr(p, '=');
+        if(!eq){
+            return false;
+        }
+        size_t key_len = eq - p;
+        char* end;
+        long long v = strtoll(eq + 1, &end, 10);
+        if(end == eq + 1 || v <= 0){
+            return false;
+        }
+        if(key_len == 4 && strncmp(p, "rate", 4) == 0){
+            // 可以带k/m后缀（1024/1048576）
+            if(*end == 'k' || *end == 'K'){
+                v <<= 10;
+                ++end;
+            }else if(*end == 'm' || *end == 'M'){
+                v <<= 20;
+                ++end;
+            }
+            m_min_rate = v;
+        }else{
+            int phase = 0;
+            while(phase < PHASES && !(strlen(phase_names[phase]) == key_len && strncmp(p, phase_names[phase], key_len) == 0)){
+                ++phase;
+            }
+            if(phase == PHASES){
+                return false;
+            }
+            m_timeout[phase] = v;
+        }
+        if(*end != '\0' && *end != ','){
+            return false;
+        }
+        p = (*end == ',') ? end + 1 : end;
+    }
+    m_min_timeout = *std::min_element(m_timeout, m_timeout + PHASES);
+    metrics::add(export_metrics);
+    return true;
+}
+
+// 各阶段超时关闭的连接数，见metrics.h
+void conn_deadline::export_metrics(std::string& out){
+    static const char* const names[PHASES] = {
+        "tinyhttp_timeouts_idle_total", "tinyhttp_timeouts_header_total", "tinyhttp_timeouts_body_total", "tinyhttp_timeouts_write_total"};
+    static const char* const helps[PHASES] = {
+        "Keep-alive connections closed after waiting too long for the next request.",
+        "Connections closed because the request line and headers did not arrive in time.",
+        "Connections closed because the request body arrived too slowly.",
+        "Connections closed because the client stopped reading the response."};
+    for(int i = 0; i < PHASES; ++i){
+        metrics::value(out, names[i], helps[i], "counter", m_expired[i].load(std::memory_order_relaxed));
+    }
+}
@@ -0,0 +1,51 @@
+#ifndef CONN_DEADLINE_H
+#define CONN_DEADLINE_H
+#include <stdint.h>
+#include <time.h>
+#include <atomic>
+#include <string>
+#include <algorithm>
+
+// 连接在各个阶段的截止时间，超时的原因分别计数：
+//   idle    等待下一个请求（长连接上一个响应发送完，或者新连接还没有发送数据），从进入等待算起
+//   header  收到完整的请求行和头部，从这个请求的第一个字节算起，之后读到数据也不推后，每隔十几秒发送一个字节（slowloris）占不住连接
+//   body    收到请求体：从头部解析完算起body秒；设置了最低速率rate时每收到rate字节推后一秒，平均速率低于rate时超时，
+//           没有设置时是两次读到数据之间的最长间隔
+//   write   发送响应：每次发送出数据后从头计算，对方不读响应、发送缓冲区一直是满的时超时
+// 截止时间保存在连接中，阶段切换和发送进展可能发生在工作线程上，只写连接的原子变量，不修改定时器链表（只在主线程使用）
+// 主线程读到数据时按新的截止时间调整定时器；定时器到期时检查连接的截止时间，被推后了就按新的时间放回链表，否则关闭连接
+// 定时器链表上的到期时间不晚于 now + 各阶段超时的最小值，工作线程之后设置的截止时间都不早于它，定时器不会错过截止时间
+// 超时在定时器处理时检查，最多晚一个定时器周期（TIMESLOT秒）
+class conn_deadline{
+public:
+    enum PHASE { IDLE = 0, HEADER, BODY, WRITE, PHASES };
+
+    // 解析 "idle=15,header=10,body=30,rate=1k,write=30"，可以只给出一部分，其余的阶段为3*TIMESLOT秒，请求体不限最低速率
+    // spec为NULL时全部使用默认值；启动阶段调用一次，同时注册指标
+    static bool init(const char* spec);
+
+    static time_t timeout(int phase){ return m_timeout[phase]; }
+    // 请求体的截止时间：since是解析完头部的时间，received是已经收到的请求体字节数
+    static time_t body_deadline(time_t since, long received, time_t now){
+        if(!m_min_rate){
+            return now + m_timeout[BODY];
+        }
+        return since + m_timeout[BODY] + (time_t)(received / m_min_rate);
+    }
+    // 定时器链表上的到期时间，见上面的说明
+    static time_t next_check(time_t now, time_t deadline){ return std::min(deadline, now + m_min_timeout); }
+
+    // 主线程：连接在phase阶段超时，即将被关闭
+    static void expired(int phase){ m_expired[phase].fetch_add(1, std::memory_order_relaxed); }
+
+private:
+    static void export_metrics(std::string& out);
+
+private:
+    static time_t m_timeout[PHASES];
+    static uint64_t m_min_rate;                         // 请求体的最低平均速率：字节/秒，0表示不限
+    static time_t m_min_timeout;                        // 各阶段超时的最小值
+    static std::atomic<uint64_t> m_expired[PHASES];     // 各阶段超时关闭的连接数
+};
+
+#endif
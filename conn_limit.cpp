@@ -0,0 +1,94 @@
+#include "conn_limit.h"
+#include "metrics.h"
+#include "http_conn.h"
+#include <stdio.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <algorithm>
+
+extern void log(std::string str);
+
+int conn_limit::m_high = 0;
+int conn_limit::m_low = 0;
+std::atomic<uint64_t> conn_limit::m_evicted(0);
+std::atomic<uint64_t> conn_limit::m_rounds(0);
+std::atomic<uint64_t> conn_limit::m_shortfall(0);
+
+// 上一次没有足够的空闲连接可以关闭时，一秒内不再检查，连接都在忙时不在每次accept时遍历链表
+static time_t retry_at = 0;
+
+bool conn_limit::init(const char* spec, int max_conns){
+    int high = 0;
+    int low = -1;
+    if(sscanf(spec, "%d,%d", &high, &low) < 1 || high <= 0){
+        return false;
+    }
+    if(low < 0){
+        low = high / 10 * 9;
+    }
+    if(low >= high){
+        return false;
+    }
+
+    // 高水位不能超过进程能打开的描述符数，否则accept先于水位失败
+    int limit = max_conns;
+    rlimit rl;
+    if(getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY && (long long)rl.rlim_cur - FD_RESERVE < limit){
+        limit = (int)std::max<long long>((long long)rl.rlim_cur - FD_RESERVE, 1);
+    }
+    if(high > limit){
+        char buf[128];
+        snprintf(buf, sizeof(buf), "conn_limit: high watermark %d lowered to %d by the descriptor limit\n", high, limit);
+        log(buf);
+        low = (int)((long long)low * limit / high);
+        high = limit;
+    }
+    m_high = high;
+    m_low = low;
+    metrics::add(export_metrics);
+    return true;
+}
+
+int conn_limit::relieve(sort_timer_lst& timers, bool fd_exhausted){
+    int count = http_conn::m_user_count;
+    int want = 0;
+    if(count >= m_high){
+        want = count - m_low;
+    }else if(fd_exhausted){
+        want = std::max(m_high - m_low, 1);
+    }
+    if(want <= 0){
+        return 0;
+    }
+    time_t now = coarse_clock::now();
+    if(now < retry_at){
+        return 0;
+    }
+
+    int closed = timers.evict_idle(want, 4 * want + SCAN_SLACK);
+    m_rounds.fetch_add(1, std::memory_order_relaxed);
+    m_evicted.fetch_add(closed, std::memory_order_relaxed);
+    if(closed < want){
+        m_shortfall.fetch_add(1, std::memory_order_relaxed);
+        retry_at = now + 1;
+    }
+
+    char buf[160];
+    snprintf(buf, sizeof(buf), "conn_limit: %d connections%s, closed %d of %d idle keep-alive connections (watermarks %d/%d)\n",
+        count, fd_exhausted ? ", out of descriptors" : "", closed, want, m_high, m_low);
+    log(buf);
+    return closed;
+}
+
+// 淘汰的连接数、触发淘汰和空闲连接不足的次数、当前的连接数，见metrics.h
+void conn_limit::export_metrics(std::string& out){
+    metrics::value(out, "tinyhttp_idle_evictions_total", "Idle keep-alive connections closed to admit new connections.", "counter",
+        m_evicted.load(std::memory_order_relaxed));
+    metrics::value(out, "tinyhttp_idle_eviction_rounds_total", "Times the connection count reached the high watermark or accept ran out of descriptors.", "counter",
+        m_rounds.load(std::memory_order_relaxed));
+    metrics::value(out, "tinyhttp_idle_eviction_shortfall_total", "Eviction rounds that found fewer idle connections than needed.", "counter",
+        m_shortfall.load(std::memory_order_relaxed));
+    metrics::value(out, "tinyhttp_connections", "Open client connections.", "gauge",
+        http_conn::m_user_count.load(std::memory_order_relaxed));
+    metrics::value(out, "tinyhttp_connections_high_watermark", "Connection count that triggers idle eviction.", "gauge", m_high);
+}
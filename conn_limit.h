@@ -0,0 +1,38 @@
+#ifndef CONN_LIMIT_H
+#define CONN_LIMIT_H
+#include <stdint.h>
+#include <atomic>
+#include <string>
+
+class sort_timer_lst;
+
+// 连接数的高低水位：连接数达到高水位（或者accept因为描述符用完而失败）时，主线程从定时器链表的头部开始
+// 关闭空闲的长连接（等待下一个请求、还没有读到任何数据），直到连接数降到低水位，给新连接腾出位置
+// 每次读到数据时定时器被移到链表的尾部，链表按最后一次活动的时间排序，从头部开始关闭的就是最久没有活动的连接（LRU）
+// 正在处理请求、发送响应、被处理函数接管的连接和HTTP/2连接不会被关闭
+class conn_limit{
+public:
+    static const int FD_RESERVE = 64;       // 给监听socket、日志、打开的文件、上游连接等保留的描述符数
+    static const int SCAN_SLACK = 64;       // 一次淘汰最多检查 4*n + SCAN_SLACK 个定时器，链表头部都在忙时不遍历整个链表
+
+    // 解析 "high[,low]"，low默认为high的90%；高水位不超过max_conns和RLIMIT_NOFILE减去保留的描述符数，启动阶段调用
+    static bool init(const char* spec, int max_conns);
+    static bool enabled(){ return m_high > 0; }
+    static int high(){ return m_high; }
+
+    // 主线程：连接数达到高水位时关闭空闲连接直到低水位；accept失败(EMFILE/ENFILE)时传入true，同样淘汰一批
+    // 返回关闭的连接数
+    static int relieve(sort_timer_lst& timers, bool fd_exhausted);
+
+private:
+    static void export_metrics(std::string& out);
+
+private:
+    static int m_high;
+    static int m_low;
+    static std::atomic<uint64_t> m_evicted;     // 被淘汰的空闲连接数
+    static std::atomic<uint64_t> m_rounds;      // 触发淘汰的次数
+    static std::atomic<uint64_t> m_shortfall;   // 没有足够的空闲连接可以关闭的次数
+};
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef CONN_TABLE_H
+#define CONN_TABLE_H
+#include <stdlib.h>
+#include <exception>
+
+// 按文件描述符索引的连接表，模板参数T是连接类
+// 表按页分配：一页是PAGE_SIZE个相邻fd的连接对象，某个fd第一次被访问时才分配它所在的页，
+// 启动时只分配页指针数组，没有用到的fd不占内存；页分配后不再释放，对象地址在运行期间不变，可以交给工作线程
+// 只在主线程访问（accept和事件分发），不加锁
+template<typename T>
+class conn_table{
+public:
+    static const int PAGE_BITS = 6;
+    static const int PAGE_SIZE = 1 << PAGE_BITS;   // 每页64个连接
+
+    explicit conn_table(int max_fd);
+    ~conn_table();
+
+    T& operator[](int fd);
+
+private:
+    int m_page_count;
+    T** m_pages;
+};
+
+template<typename T>
+conn_table<T>::conn_table(int max_fd):m_page_count((max_fd + PAGE_SIZE - 1) >> PAGE_BITS), m_pages(NULL){
+    m_pages = (T**)calloc(m_page_count, sizeof(T*));
+    if(!m_pages){
+        throw std::exception();
+    }
+}
+
+template<typename T>
+conn_table<T>::~conn_table(){
+    for(int i = 0; i < m_page_count; ++i){
+        delete [] m_pages[i];
+    }
+    free(m_pages);
+}
+
+template<typename T>
+T& conn_table<T>::operator[](int fd){
+    T*& page = m_pages[fd >> PAGE_BITS];
+    if(!page){
+        page = new T[PAGE_SIZE];
+    }
+    return page[fd & (PAGE_SIZE - 1)];
+}
+
+#endif
@@ -0,0 +1,93 @@
+#include "fair_sched.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+bool fair_sched::m_enabled = false;
+bool fair_sched::m_by_conn = false;
+int fair_sched::m_queue_limit = 64;
+std::vector<fair_sched::rule> fair_sched::m_rules;
+
+const char fair_sched::REJECT_RESPONSE[] =
+    "HTTP/1.1 503 Service Unavailable\r\n"
+    "Content-Type: text/html\r\n"
+    "Content-Length: 30\r\n"
+    "Retry-After: 1\r\n"
+    "Connection: close\r\n"
+    "\r\n"
+    "Too many requests are pending.";
+const int fair_sched::REJECT_LEN = sizeof(REJECT_RESPONSE) - 1;
+
+bool fair_sched::init(const char* spec){
+    char buf[1024];
+    if(strlen(spec) >= sizeof(buf)){
+        return false;
+    }
+    strcpy(buf, spec);
+    char* save = NULL;
+    char* tok = strtok_r(buf, ",", &save);
+    if(!tok){
+        return false;
+    }
+    if(strcmp(tok, "ip") == 0){
+        m_by_conn = false;
+    }else if(strcmp(tok, "conn") == 0){
+        m_by_conn = true;
+    }else{
+        return false;
+    }
+
+    // 第二项是数字时为队列上限，之后都是权重规则
+    tok = strtok_r(NULL, ",", &save);
+    if(tok && !strchr(tok, '=')){
+        m_queue_limit = atoi(tok);
+        if(m_queue_limit <= 0){
+            return false;
+        }
+        tok = strtok_r(NULL, ",", &save);
+    }
+    for(; tok; tok = strtok_r(NULL, ",", &save)){
+        char* eq = strchr(tok, '=');
+        if(!eq){
+            return false;
+        }
+        *eq = '\0';
+        int prefix = 32;
+        char* slash = strchr(tok, '/');
+        if(slash){
+            *slash = '\0';
+            prefix = atoi(slash + 1);
+        }
+        in_addr addr;
+        int weight = atoi(eq + 1);
+        if(inet_pton(AF_INET, tok, &addr) != 1 || prefix < 0 || prefix > 32 || weight <= 0){
+            return false;
+        }
+        rule r;
+        r.mask = (prefix == 0) ? 0 : (prefix == 32) ? 0xffffffff : ~(0xffffffffu >> prefix);
+        r.net = ntohl(addr.s_addr) & r.mask;
+        r.weight = weight;
+        m_rules.push_back(r);
+    }
+    m_enabled = true;
+    return true;
+}
+
+uint64_t fair_sched::key_of(in_addr_t addr, int sockfd, uint32_t gen){
+    if(m_by_conn){
+        return (1ull << 63) | ((uint64_t)gen << 32) | (uint32_t)sockfd;
+    }
+    return addr;
+}
+
+// 第一条匹配的规则生效，规则在启动时配置，数量很少，线性查找
+int fair_sched::weight_of(in_addr_t addr){
+    uint32_t a = ntohl(addr);
+    for(const rule& r : m_rules){
+        if((a & r.mask) == r.net){
+            return r.weight;
+        }
+    }
+    return 1;
+}
@@ -0,0 +1,40 @@
+#ifndef FAIR_SCHED_H
+#define FAIR_SCHED_H
+#include <stdint.h>
+#include <vector>
+#include <netinet/in.h>
+
+// 线程池的公平调度：请求按客户端IP（或者连接）分类，线程池在各类之间做按服务时间计费的差额轮询（DRR），
+// 一个客户端用很多连接或者很慢的请求占住线程时，其它客户端的请求仍然在下一轮就能得到线程
+// 权重按地址规则配置，每类在队列中等待的请求数有上限，超出时应答503
+class fair_sched{
+public:
+    // 解析 "ip|conn[,queue[,addr[/len]=weight,...]]"，启动阶段调用
+    // ip：同一个客户端地址的所有连接为一类；conn：每个连接为一类
+    // queue：每类最多排队的请求数，默认64；weight：匹配该网段的客户端的权重，默认1
+    static bool init(const char* spec);
+    static bool enabled(){ return m_enabled; }
+    static int queue_limit(){ return m_queue_limit; }
+
+    // 连接所属的类，gen为连接的代数，按连接分类时区分复用同一个fd的先后两个连接
+    static uint64_t key_of(in_addr_t addr, int sockfd, uint32_t gen);
+    static int weight_of(in_addr_t addr);
+
+    // 预先生成的503应答，请求所在的类排队已满时发送，然后关闭连接
+    static const char REJECT_RESPONSE[];
+    static const int REJECT_LEN;
+
+private:
+    struct rule{
+        uint32_t net;       // 网段地址（主机字节序）
+        uint32_t mask;
+        int weight;
+    };
+
+    static bool m_enabled;
+    static bool m_by_conn;
+    static int m_queue_limit;
+    static std::vector<rule> m_rules;
+};
+
+#endif
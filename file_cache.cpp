@@ -0,0 +1,103 @@
+#include "file_cache.h"
+#include "metrics.h"
+#include "coarse_clock.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <new>
+
+file_cache::table* file_cache::m_table = NULL;
+int file_cache::m_ttl_ms = 1000;
+std::atomic<uint64_t> file_cache::m_hits(0);
+std::atomic<uint64_t> file_cache::m_misses(0);
+
+// FNV-1a
+static uint64_t hash_path(const char* s){
+    uint64_t h = 14695981039346656037ull;
+    for(; *s; ++s){
+        h = (h ^ (unsigned char)*s) * 1099511628211ull;
+    }
+    return h;
+}
+
+bool file_cache::init(const char* spec){
+    int entries = 0;
+    int ttl = 1;
+    if(sscanf(spec, "%d,%d", &entries, &ttl) < 1 || entries <= 0 || entries > (1 << 20) || ttl <= 0){
+        return false;
+    }
+    // 条目数取2的幂，路径的散列值直接取低位
+    uint32_t n = 1;
+    while(n < (uint32_t)entries){
+        n <<= 1;
+    }
+    size_t size = sizeof(table) + sizeof(entry) * n;
+    void* addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(addr == MAP_FAILED){
+        return false;
+    }
+    // 匿名映射的内容是0：所有条目的序号为0，到期时间为0，都不会命中
+    m_table = (table*)addr;
+    m_table->mask = n - 1;
+    m_ttl_ms = ttl * 1000;
+    metrics::add(export_metrics);
+    return true;
+}
+
+bool file_cache::lookup(const char* path, int* result, struct stat* st){
+    uint64_t h = hash_path(path);
+    entry& e = m_table->entries[h & m_table->mask];
+    uint32_t seq = e.seq.load(std::memory_order_acquire);
+    bool match = !(seq & 1) && e.hash == h && e.epoch == m_table->epoch.load(std::memory_order_relaxed)
+        && e.expire_ms > (int64_t)coarse_clock::mono_ms() && strncmp(e.path, path, PATH_LEN) == 0;
+    int r = e.result;
+    st->st_dev = e.dev;
+    st->st_ino = e.ino;
+    st->st_size = e.size;
+    st->st_mode = e.mode;
+    st->st_mtim = e.mtime;
+    // 读的过程中条目被改写了，当作没有命中
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if(!match || e.seq.load(std::memory_order_relaxed) != seq){
+        m_misses.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    *result = r;
+    m_hits.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+void file_cache::store(const char* path, int result, const struct stat* st){
+    size_t len = strlen(path);
+    if(len >= PATH_LEN){
+        return;
+    }
+    uint64_t h = hash_path(path);
+    entry& e = m_table->entries[h & m_table->mask];
+    uint32_t seq = e.seq.load(std::memory_order_relaxed);
+    if((seq & 1) || !e.seq.compare_exchange_strong(seq, seq + 1, std::memory_order_acquire)){
+        return;
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+    e.hash = h;
+    e.epoch = m_table->epoch.load(std::memory_order_relaxed);
+    e.expire_ms = coarse_clock::mono_ms() + m_ttl_ms;
+    e.result = result;
+    if(st){
+        e.dev = st->st_dev;
+        e.ino = st->st_ino;
+        e.size = st->st_size;
+        e.mode = st->st_mode;
+        e.mtime = st->st_mtim;
+    }
+    memcpy(e.path, path, len + 1);
+    e.seq.store(seq + 2, std::memory_order_release);
+}
+
+// 命中和没有命中的次数（每个进程自己的），见metrics.h
+void file_cache::export_metrics(std::string& out){
+    metrics::value(out, "tinyhttp_file_cache_hits_total", "Static file lookups answered from the metadata cache.", "counter",
+        m_hits.load(std::memory_order_relaxed));
+    metrics::value(out, "tinyhttp_file_cache_misses_total", "Static file lookups that had to stat the file.", "counter",
+        m_misses.load(std::memory_order_relaxed));
+}
@@ -0,0 +1,57 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+#include <stdint.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <string>
+
+// 静态文件的元数据缓存：按文件路径保存stat的结果（包括文件不存在、没有权限、是目录），有效期ttl秒
+// 命中不存在、禁止访问等结果时不再调用stat，大量请求不存在的路径时不进入内核
+// 命中普通文件时省去stat，直接open再fstat，用fstat的结果发送并校验缓存的条目（一次路径查找而不是两次）
+// 表放在MAP_SHARED的匿名内存中，在fork之前创建，多进程模型下所有worker共用，一个worker stat过的路径其它worker直接命中
+// 每个条目有一个序号（seqlock）：写者把序号从偶数改成奇数后写入，再加一；读者复制条目后序号没有变化才使用
+// 写者之间抢不到序号时放弃这次写入，缓存只是尽力而为
+class file_cache{
+public:
+    static const int PATH_LEN = 200;        // 和http_conn::FILENAME_LEN相同，更长的路径不缓存
+
+    // 解析 "entries[,ttl]"，ttl默认1秒，启动阶段（fork之前）调用
+    static bool init(const char* spec);
+    static bool enabled(){ return m_table != NULL; }
+
+    // 查找path，命中时返回true，result是缓存的http_conn::HTTP_CODE，st是缓存的状态（只对普通文件有意义）
+    static bool lookup(const char* path, int* result, struct stat* st);
+    // 保存path的stat结果
+    static void store(const char* path, int result, const struct stat* st);
+    // 让所有条目失效，平滑重启时由master调用
+    static void clear(){ m_table->epoch.fetch_add(1, std::memory_order_relaxed); }
+
+private:
+    struct entry{
+        std::atomic<uint32_t> seq;
+        uint32_t epoch;
+        uint64_t hash;
+        int64_t expire_ms;                  // 单调时间
+        int result;
+        dev_t dev;
+        ino_t ino;
+        off_t size;
+        mode_t mode;
+        struct timespec mtime;
+        char path[PATH_LEN];
+    };
+    struct table{
+        std::atomic<uint32_t> epoch;
+        uint32_t mask;
+        entry entries[];
+    };
+    static void export_metrics(std::string& out);
+
+private:
+    static table* m_table;
+    static int m_ttl_ms;
+    static std::atomic<uint64_t> m_hits;
+    static std::atomic<uint64_t> m_misses;
+};
+
+#endif
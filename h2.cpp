@@ -0,0 +1,915 @@
+#include "h2.h"
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <netinet/tcp.h>
+#include <algorithm>
+#include "http_conn.h"
+#include "probes.h"
+
+extern void log(std::string str);
+extern void modfd(int epollfd, int fd, int ev);
+
+extern const char* ok_200_title;
+extern const char* error_400_form;
+extern const char* error_403_form;
+extern const char* error_404_form;
+extern const char* error_405_form;
+extern const char* error_500_form;
+static const char* error_501_form = "This resource cannot be served over HTTP/2.\n";
+static const char* error_429_form = "You are sending requests too fast.";
+
+static const char H2_PREFACE[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+static const size_t H2_PREFACE_LEN = 24;
+static const size_t H2_FRAME_HEADER_LEN = 9;
+
+// 帧标志
+static const uint8_t FLAG_END_STREAM = 0x1;
+static const uint8_t FLAG_ACK = 0x1;
+static const uint8_t FLAG_END_HEADERS = 0x4;
+static const uint8_t FLAG_PADDED = 0x8;
+static const uint8_t FLAG_PRIORITY = 0x20;
+
+// SETTINGS参数
+static const uint16_t SETTINGS_ENABLE_PUSH = 0x2;
+static const uint16_t SETTINGS_MAX_CONCURRENT_STREAMS = 0x3;
+static const uint16_t SETTINGS_INITIAL_WINDOW_SIZE = 0x4;
+static const uint16_t SETTINGS_MAX_FRAME_SIZE = 0x5;
+
+static uint32_t get32(const uint8_t* p){
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void put32(std::string& out, uint32_t v){
+    char b[4] = {(char)(v >> 24), (char)(v >> 16), (char)(v >> 8), (char)v};
+    out.append(b, 4);
+}
+
+// HTTP2-Settings头部是base64url编码、没有填充的SETTINGS帧负载
+static bool base64url_decode(const char* in, std::string& out){
+    unsigned bits = 0;
+    int nbits = 0;
+    for(; *in; ++in){
+        char c = *in;
+        int v;
+        if(c >= 'A' && c <= 'Z') v = c - 'A';
+        else if(c >= 'a' && c <= 'z') v = c - 'a' + 26;
+        else if(c >= '0' && c <= '9') v = c - '0' + 52;
+        else if(c == '-' || c == '+') v = 62;
+        else if(c == '_' || c == '/') v = 63;
+        else if(c == '=') break;
+        else return false;
+        bits = (bits << 6) | v;
+        nbits += 6;
+        if(nbits >= 8){
+            nbits -= 8;
+            out.push_back((char)(bits >> nbits));
+        }
+    }
+    return true;
+}
+
+// 和HTTP/1.1不同，HTTP/2中连接相关的头部是不允许的，处理函数添加的这些头部不转发
+static bool hop_by_hop(std::string_view name){
+    return name == "connection" || name == "keep-alive" || name == "transfer-encoding"
+        || name == "upgrade" || name == "proxy-connection";
+}
+
+h2_session::h2_session(http_conn* conn): m_conn(conn), m_preface(false), m_out_sent(0), m_last_stream_id(0),
+    m_next_send(0), m_continuation_sid(0), m_continuation_end_stream(false), m_send_window(DEFAULT_WINDOW),
+    m_peer_initial_window(DEFAULT_WINDOW), m_peer_max_frame(MAX_FRAME_SIZE), m_recv_unacked(0),
+    m_goaway_sent(false), m_goaway_received(false){
+}
+
+h2_session::~h2_session(){
+    for(auto& it : m_streams){
+        if(it.second.file_address){
+            munmap(it.second.file_address, it.second.file_size);
+        }
+    }
+}
+
+void h2_session::start(){
+    // 只需要声明并发流的上限，其它参数使用默认值
+    write_frame_header(6, H2_SETTINGS, 0, 0);
+    m_out.push_back(0);
+    m_out.push_back(SETTINGS_MAX_CONCURRENT_STREAMS);
+    put32(m_out, MAX_CONCURRENT_STREAMS);
+}
+
+bool h2_session::upgrade(int method, const char* url, const char* host, const char* settings){
+    m_out.append("HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n");
+    start();
+
+    // 升级请求中的设置视为已经确认，不回应ACK
+    std::string payload;
+    if(!base64url_decode(settings, payload)
+        || !on_settings(0, 0, (const uint8_t*)payload.data(), payload.size(), false)){
+        return false;
+    }
+
+    m_last_stream_id = 1;
+    h2_stream* s = open_stream(1, method, url, host ? host : "", 0);
+    s->remote_closed = true;
+    respond(*s);
+    return true;
+}
+
+void h2_session::consume(size_t n){
+    m_out_sent += n;
+    if(m_out_sent == m_out.size()){
+        m_out.clear();
+        m_out_sent = 0;
+    }
+}
+
+bool h2_session::finished() const{
+    if(pending_len() > 0){
+        return false;
+    }
+    return m_goaway_sent || (m_goaway_received && m_streams.empty());
+}
+
+void h2_session::on_input(const char* data, size_t len){
+    if(m_goaway_sent){
+        return;
+    }
+    m_in.append(data, len);
+
+    size_t off = 0;
+    if(!m_preface){
+        size_t n = std::min(m_in.size(), H2_PREFACE_LEN);
+        if(memcmp(m_in.data(), H2_PREFACE, n) != 0){
+            connection_error(H2_PROTOCOL_ERROR, "bad connection preface");
+            return;
+        }
+        if(n < H2_PREFACE_LEN){
+            return;
+        }
+        m_preface = true;
+        off = H2_PREFACE_LEN;
+    }
+
+    // 逐个处理完整的帧，不完整的帧留到下次
+    while(m_in.size() - off >= H2_FRAME_HEADER_LEN){
+        const uint8_t* p = (const uint8_t*)m_in.data() + off;
+        uint32_t frame_len = ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+        if(frame_len > MAX_FRAME_SIZE){
+            connection_error(H2_FRAME_SIZE_ERROR, "frame too large");
+            return;
+        }
+        if(m_in.size() - off < H2_FRAME_HEADER_LEN + frame_len){
+            break;
+        }
+        if(!on_frame(p[3], p[4], get32(p + 5) & 0x7fffffff, p + H2_FRAME_HEADER_LEN, frame_len)){
+            return;
+        }
+        off += H2_FRAME_HEADER_LEN + frame_len;
+    }
+    m_in.erase(0, off);
+
+    // 收到的请求体已经交给处理函数，一次性归还连接窗口
+    if(m_recv_unacked > 0){
+        write_window_update(0, m_recv_unacked);
+        m_recv_unacked = 0;
+    }
+}
+
+bool h2_session::on_frame(uint8_t type, uint8_t flags, uint32_t sid, const uint8_t* p, uint32_t len){
+    // 头部块没有结束之前只能出现同一个流的CONTINUATION
+    if(m_continuation_sid && (type != H2_CONTINUATION || sid != m_continuation_sid)){
+        return connection_error(H2_PROTOCOL_ERROR, "expected CONTINUATION");
+    }
+
+    switch(type){
+        case H2_DATA:
+            return on_data(flags, sid, p, len);
+        case H2_HEADERS:
+            return on_headers(flags, sid, p, len);
+        case H2_CONTINUATION:{
+            if(!m_continuation_sid){
+                return connection_error(H2_PROTOCOL_ERROR, "unexpected CONTINUATION");
+            }
+            if(m_header_block.size() + len > MAX_HEADER_BLOCK){
+                return connection_error(H2_PROTOCOL_ERROR, "header block too large");
+            }
+            m_header_block.append((const char*)p, len);
+            if(flags & FLAG_END_HEADERS){
+                m_continuation_sid = 0;
+                return end_headers(sid, m_continuation_end_stream);
+            }
+            return true;
+        }
+        case H2_PRIORITY:
+            // 不实现优先级，所有流轮流发送
+            if(sid == 0){
+                return connection_error(H2_PROTOCOL_ERROR, "PRIORITY on stream 0");
+            }
+            return true;
+        case H2_RST_STREAM:
+            if(sid == 0 || len != 4){
+                return connection_error(H2_PROTOCOL_ERROR, "bad RST_STREAM");
+            }
+            close_stream(sid);
+            return true;
+        case H2_SETTINGS:
+            return on_settings(flags, sid, p, len, true);
+        case H2_PUSH_PROMISE:
+            return connection_error(H2_PROTOCOL_ERROR, "PUSH_PROMISE from client");
+        case H2_PING:
+            if(sid != 0){
+                return connection_error(H2_PROTOCOL_ERROR, "PING on a stream");
+            }
+            if(len != 8){
+                return connection_error(H2_FRAME_SIZE_ERROR, "bad PING");
+            }
+            if(!(flags & FLAG_ACK)){
+                write_frame_header(8, H2_PING, FLAG_ACK, 0);
+                m_out.append((const char*)p, 8);
+            }
+            return true;
+        case H2_GOAWAY:
+            if(sid != 0){
+                return connection_error(H2_PROTOCOL_ERROR, "GOAWAY on a stream");
+            }
+            m_goaway_received = true;
+            return true;
+        case H2_WINDOW_UPDATE:
+            return on_window_update(sid, p, len);
+        default:
+            return true;    // 未知类型的帧必须忽略
+    }
+}
+
+bool h2_session::on_data(uint8_t flags, uint32_t sid, const uint8_t* p, uint32_t len){
+    if(sid == 0){
+        return connection_error(H2_PROTOCOL_ERROR, "DATA on stream 0");
+    }
+    // 整个帧（包括填充）都计入流量控制
+    m_recv_unacked += len;
+    uint32_t n = len;
+    if(flags & FLAG_PADDED){
+        if(len < 1 || p[0] >= len){
+            return connection_error(H2_PROTOCOL_ERROR, "bad padding");
+        }
+        n = len - 1 - p[0];
+        ++p;
+    }
+
+    auto it = m_streams.find(sid);
+    if(it == m_streams.end()){
+        if(sid > m_last_stream_id){
+            return connection_error(H2_PROTOCOL_ERROR, "DATA on idle stream");
+        }
+        return true;    // 已经关闭的流上还在路上的数据
+    }
+    h2_stream& s = it->second;
+    if(s.remote_closed){
+        reset_stream(sid, H2_STREAM_CLOSED);
+        return true;
+    }
+
+    // 数据交给处理函数后马上归还流的窗口，流的结束不需要再归还
+    if(len > 0 && !(flags & FLAG_END_STREAM)){
+        write_window_update(sid, len);
+    }
+    if(n > 0 && s.on_body && !s.body_failed && !s.on_body(s.request, (const char*)p, n)){
+        s.body_failed = true;
+    }
+    if(flags & FLAG_END_STREAM){
+        s.remote_closed = true;
+        respond(s);
+    }
+    return true;
+}
+
+bool h2_session::on_headers(uint8_t flags, uint32_t sid, const uint8_t* p, uint32_t len){
+    // 客户端发起的流ID是奇数
+    if(sid == 0 || !(sid & 1)){
+        return connection_error(H2_PROTOCOL_ERROR, "bad stream id");
+    }
+    uint32_t pad = 0;
+    if(flags & FLAG_PADDED){
+        if(len < 1){
+            return connection_error(H2_PROTOCOL_ERROR, "bad padding");
+        }
+        pad = p[0];
+        ++p;
+        --len;
+    }
+    if(flags & FLAG_PRIORITY){
+        if(len < 5){
+            return connection_error(H2_FRAME_SIZE_ERROR, "bad HEADERS");
+        }
+        p += 5;
+        len -= 5;
+    }
+    if(pad > len){
+        return connection_error(H2_PROTOCOL_ERROR, "bad padding");
+    }
+
+    m_header_block.assign((const char*)p, len - pad);
+    bool end_stream = flags & FLAG_END_STREAM;
+    if(!(flags & FLAG_END_HEADERS)){
+        m_continuation_sid = sid;
+        m_continuation_end_stream = end_stream;
+        return true;
+    }
+    return end_headers(sid, end_stream);
+}
+
+// 头部块完整了：解码，打开新的流，或者作为已有流的trailer
+bool h2_session::end_headers(uint32_t sid, bool end_stream){
+    // 即使流会被拒绝也要解码，动态表在整个连接上共享
+    m_fields.clear();
+    if(!m_decoder.decode((const uint8_t*)m_header_block.data(), m_header_block.size(), m_fields)){
+        return connection_error(H2_COMPRESSION_ERROR, "header decoding failed");
+    }
+
+    auto it = m_streams.find(sid);
+    if(it != m_streams.end()){
+        // trailer必须结束请求，我们不使用其中的字段
+        h2_stream& s = it->second;
+        if(s.remote_closed){
+            reset_stream(sid, H2_STREAM_CLOSED);
+        }else if(!end_stream){
+            reset_stream(sid, H2_PROTOCOL_ERROR);
+        }else{
+            s.remote_closed = true;
+            respond(s);
+        }
+        return true;
+    }
+    if(sid <= m_last_stream_id){
+        return connection_error(H2_PROTOCOL_ERROR, "stream id reused");
+    }
+    m_last_stream_id = sid;
+    if(m_streams.size() >= MAX_CONCURRENT_STREAMS){
+        reset_stream(sid, H2_REFUSED_STREAM);
+        return true;
+    }
+
+    // 伪头部必须出现在普通头部之前，名称必须是小写
+    std::string_view method, path, scheme, authority;
+    long content_length = -1;
+    bool regular = false;
+    bool bad = false;
+    for(const hpack_field& f : m_fields){
+        if(!f.name.empty() && f.name[0] == ':'){
+            if(regular){
+                bad = true;
+            }else if(f.name == ":method"){
+                method = f.value;
+            }else if(f.name == ":path"){
+                path = f.value;
+            }else if(f.name == ":scheme"){
+                scheme = f.value;
+            }else if(f.name == ":authority"){
+                authority = f.value;
+            }else{
+                bad = true;
+            }
+            continue;
+        }
+        regular = true;
+        if(std::any_of(f.name.begin(), f.name.end(), [](char c){ return c >= 'A' && c <= 'Z'; }) || hop_by_hop(f.name)){
+            bad = true;
+        }else if(f.name == "content-length"){
+            content_length = 0;
+            for(char c : f.value){
+                if(c < '0' || c > '9'){
+                    bad = true;
+                    break;
+                }
+                content_length = content_length * 10 + (c - '0');
+            }
+        }else if(f.name == "host" && authority.empty()){
+            authority = f.value;
+        }
+    }
+    if(bad || method.empty() || path.empty() || scheme.empty()){
+        reset_stream(sid, H2_PROTOCOL_ERROR);
+        return true;
+    }
+
+    h2_stream* s = open_stream(sid, method_from_name(std::string(method).c_str()), path, authority,
+        (content_length > 0) ? content_length : 0);
+    // 没有Content-Length的请求体和HTTP/1.1的chunked请求体一样，分段交给处理函数
+    s->request.chunked = !end_stream && content_length < 0;
+
+    // 每个流算一个请求；超限时马上应答429，请求体还没有发完时只发送响应头，再用RST_STREAM(NO_ERROR)通知对方停止
+    if(rate_limiter::enabled() && !rate_limiter::on_request(m_conn->m_client_addr)){
+        if(end_stream){
+            s->remote_closed = true;
+            respond_error(*s, 429, error_429_form);
+        }else{
+            respond_error(*s, 429, NULL);
+            reset_stream(sid, H2_NO_ERROR);
+        }
+        return true;
+    }
+    if(end_stream){
+        s->remote_closed = true;
+        respond(*s);
+    }
+    return true;
+}
+
+bool h2_session::on_settings(uint8_t flags, uint32_t sid, const uint8_t* p, uint32_t len, bool ack){
+    if(sid != 0){
+        return connection_error(H2_PROTOCOL_ERROR, "SETTINGS on a stream");
+    }
+    if(flags & FLAG_ACK){
+        return (len == 0) ? true : connection_error(H2_FRAME_SIZE_ERROR, "bad SETTINGS ack");
+    }
+    if(len % 6 != 0){
+        return connection_error(H2_FRAME_SIZE_ERROR, "bad SETTINGS");
+    }
+
+    for(uint32_t i = 0; i < len; i += 6){
+        uint16_t id = (p[i] << 8) | p[i + 1];
+        uint32_t value = get32(p + i + 2);
+        switch(id){
+            case SETTINGS_ENABLE_PUSH:
+                if(value > 1){
+                    return connection_error(H2_PROTOCOL_ERROR, "bad ENABLE_PUSH");
+                }
+                break;
+            case SETTINGS_INITIAL_WINDOW_SIZE:{
+                // 新的初始窗口对所有已经打开的流生效
+                if(value > MAX_WINDOW){
+                    return connection_error(H2_FLOW_CONTROL_ERROR, "bad INITIAL_WINDOW_SIZE");
+                }
+                int64_t delta = (int64_t)value - m_peer_initial_window;
+                for(auto& it : m_streams){
+                    it.second.send_window += delta;
+                    if(it.second.send_window > MAX_WINDOW){
+                        return connection_error(H2_FLOW_CONTROL_ERROR, "window overflow");
+                    }
+                }
+                m_peer_initial_window = value;
+                break;
+            }
+            case SETTINGS_MAX_FRAME_SIZE:
+                if(value < 16384 || value > 16777215){
+                    return connection_error(H2_PROTOCOL_ERROR, "bad MAX_FRAME_SIZE");
+                }
+                m_peer_max_frame = value;
+                break;
+            default:
+                // HEADER_TABLE_SIZE只影响编码端的动态表，我们的编码器不使用动态表
+                break;
+        }
+    }
+    if(ack){
+        write_frame_header(0, H2_SETTINGS, FLAG_ACK, 0);
+    }
+    return true;
+}
+
+bool h2_session::on_window_update(uint32_t sid, const uint8_t* p, uint32_t len){
+    if(len != 4){
+        return connection_error(H2_FRAME_SIZE_ERROR, "bad WINDOW_UPDATE");
+    }
+    uint32_t increment = get32(p) & 0x7fffffff;
+    if(sid == 0){
+        if(increment == 0){
+            return connection_error(H2_PROTOCOL_ERROR, "zero WINDOW_UPDATE");
+        }
+        m_send_window += increment;
+        if(m_send_window > MAX_WINDOW){
+            return connection_error(H2_FLOW_CONTROL_ERROR, "window overflow");
+        }
+        return true;
+    }
+
+    auto it = m_streams.find(sid);
+    if(it == m_streams.end()){
+        return true;    // 已经关闭的流
+    }
+    h2_stream& s = it->second;
+    s.send_window += increment;
+    if(increment == 0){
+        reset_stream(sid, H2_PROTOCOL_ERROR);
+    }else if(s.send_window > MAX_WINDOW){
+        reset_stream(sid, H2_FLOW_CONTROL_ERROR);
+    }
+    return true;
+}
+
+h2_stream* h2_session::open_stream(uint32_t sid, int method, std::string_view path, std::string_view authority, long content_length){
+    h2_stream& s = m_streams[sid];
+    s.id = sid;
+    ++m_conn->m_conn_requests;
+    s.send_window = m_peer_initial_window;
+    if(access_log::enabled()){
+        s.start_us = access_log::now_us();
+    }
+    s.path = path;
+    s.authority = authority;
+
+    // 和HTTP/1.1的fill_request一样建立请求视图，字符串指向流自己保存的副本
+    http_request& r = s.request;
+    r.method = method;
+    r.url = s.path;
+    r.path = r.url;
+    r.query = std::string_view();
+    size_t pos = r.url.find('?');
+    if(pos != std::string_view::npos){
+        r.path = r.url.substr(0, pos);
+        r.query = r.url.substr(pos + 1);
+    }
+    r.version = "HTTP/2.0";
+    r.host = s.authority;
+    r.content_length = content_length;
+    r.chunked = false;
+    r.params.count = 0;
+
+    if(method >= 0){
+        s.node = route_match(http_conn::m_routes, r.path, r.params);
+        if(s.node && !s.node->targets[method].takeover){
+            s.on_body = s.node->targets[method].on_body;
+        }
+    }
+    return &s;
+}
+
+// 请求完整了，生成响应头，响应体留给produce发送
+// 没有响应体时响应头带上END_STREAM，流随之关闭，调用后不能再使用s
+void h2_session::respond(h2_stream& s){
+    int method = s.request.method;
+    if(method < 0){
+        respond_error(s, 400, error_400_form);
+        return;
+    }
+    if(s.body_failed){
+        respond_error(s, 500, error_500_form);
+        return;
+    }
+
+    http_conn* c = m_conn;
+    std::string block;
+    if(s.node){
+        // 没有单独注册HEAD时使用GET的处理函数，只发送响应头
+        int m = (method == http_conn::HEAD && !s.node->targets[http_conn::HEAD].handler) ? (int)http_conn::GET : method;
+        const route_target& target = s.node->targets[m];
+        if(!target.handler){
+            std::string allow = route_allow(s.node);
+            if(method == http_conn::OPTIONS){
+                respond_error(s, 204, NULL, allow.c_str());
+            }else{
+                respond_error(s, 405, error_405_form, allow.c_str());
+            }
+            return;
+        }
+        // 接管连接的路由（如反向代理）需要独占socket，HTTP/2连接上还有别的流
+        if(target.takeover){
+            respond_error(s, 501, error_501_form);
+            return;
+        }
+
+        // 处理函数通过http_response写入连接对象上的响应字段，调用后转存到流里
+        // m_version为NULL，流式响应不会被加上chunked编码
+        c->m_version = NULL;
+        c->m_linger = true;
+        c->m_resp_status = 200;
+        c->m_resp_title = ok_200_title;
+        c->m_resp_type = NULL;
+        c->m_resp_headers.clear();
+        c->m_resp_body.clear();
+        c->m_resp_producer = NULL;
+        c->m_resp_ctx = NULL;
+        c->m_resp_chunked = false;
+        http_response resp(c);
+        target.handler(s.request, resp);
+
+        s.status = c->m_resp_status;
+        hpack_encoder::encode_status(block, c->m_resp_status);
+        hpack_encoder::encode_header(block, "date", std::string_view(coarse_clock::date_value(), coarse_clock::DATE_VALUE_LEN));
+        hpack_encoder::encode_header(block, "content-type", c->m_resp_type ? c->m_resp_type : "text/html");
+        if(!c->m_resp_producer){
+            hpack_encoder::encode_header(block, "content-length", std::to_string(c->m_resp_body.size()));
+        }
+        // 处理函数添加的头部是 "Name: value\r\n" 的形式，HTTP/2要求名称小写
+        std::string_view extra = c->m_resp_headers;
+        while(!extra.empty()){
+            size_t eol = extra.find("\r\n");
+            std::string_view line = extra.substr(0, eol);
+            extra = (eol == std::string_view::npos) ? std::string_view() : extra.substr(eol + 2);
+            size_t colon = line.find(':');
+            if(colon == std::string_view::npos){
+                continue;
+            }
+            std::string name(line.substr(0, colon));
+            std::transform(name.begin(), name.end(), name.begin(), [](char ch){ return (ch >= 'A' && ch <= 'Z') ? ch + 32 : ch; });
+            std::string_view value = line.substr(colon + 1);
+            value.remove_prefix(std::min(value.find_first_not_of(" \t"), value.size()));
+            if(!hop_by_hop(name)){
+                hpack_encoder::encode_header(block, name, value);
+            }
+        }
+
+        s.body.swap(c->m_resp_body);
+        s.producer = c->m_resp_producer;
+        s.ctx = c->m_resp_ctx;
+        if(method == http_conn::HEAD){
+            s.body.clear();
+            s.producer = NULL;
+        }
+        s.data = s.body.data();
+        s.data_len = s.body.size();
+        send_headers(s, block, s.data_len == 0 && !s.producer);
+        return;
+    }
+
+    // 静态文件，和HTTP/1.1一样只支持GET、HEAD和POST
+    if(method == http_conn::OPTIONS){
+        respond_error(s, 204, NULL, "GET, HEAD, POST, OPTIONS");
+        return;
+    }
+    if(method != http_conn::GET && method != http_conn::HEAD && method != http_conn::POST){
+        respond_error(s, 405, error_405_form, "GET, HEAD, POST, OPTIONS");
+        return;
+    }
+    struct stat st;
+    int fd = -1;
+    std::string path(s.request.path);
+    switch(http_conn::open_file(path.c_str(), &st, &fd)){
+        case http_conn::FILE_REQUEST:
+            PROBE(file_resolved, m_conn->m_sockfd, path.c_str(), (long)st.st_size);
+            break;
+        case http_conn::NO_RESOURCE:
+            respond_error(s, 404, error_404_form);
+            return;
+        case http_conn::FORBIDDEN_RERQUEST:
+            respond_error(s, 403, error_403_form);
+            return;
+        default:
+            respond_error(s, 400, error_400_form);
+            return;
+    }
+    if(method != http_conn::HEAD && st.st_size > 0){
+        void* addr = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(addr == MAP_FAILED){
+            close(fd);
+            respond_error(s, 500, error_500_form);
+            return;
+        }
+        s.file_address = (char*)addr;
+        s.file_size = st.st_size;
+        s.data = s.file_address;
+        s.data_len = s.file_size;
+    }
+    close(fd);
+
+    s.status = 200;
+    hpack_encoder::encode_status(block, 200);
+    hpack_encoder::encode_header(block, "date", std::string_view(coarse_clock::date_value(), coarse_clock::DATE_VALUE_LEN));
+    hpack_encoder::encode_header(block, "content-type", "text/html");
+    hpack_encoder::encode_header(block, "content-length", std::to_string(st.st_size));
+    send_headers(s, block, s.data_len == 0);
+}
+
+// 错误页面和OPTIONS应答，form为NULL时没有响应体
+void h2_session::respond_error(h2_stream& s, int status, const char* form, const char* allow){
+    std::string block;
+    s.status = status;
+    hpack_encoder::encode_status(block, status);
+    hpack_encoder::encode_header(block, "date", std::string_view(coarse_clock::date_value(), coarse_clock::DATE_VALUE_LEN));
+    if(allow){
+        hpack_encoder::encode_header(block, "allow", allow);
+    }
+    if(form){
+        hpack_encoder::encode_header(block, "content-type", "text/html");
+        hpack_encoder::encode_header(block, "content-length", std::to_string(strlen(form)));
+        if(s.request.method != http_conn::HEAD){
+            s.body = form;
+            s.data = s.body.data();
+            s.data_len = s.body.size();
+        }
+    }
+    send_headers(s, block, s.data_len == 0);
+}
+
+// 响应头不受流量控制，直接进入输出缓冲区；超过对方的最大帧长度时拆成CONTINUATION
+void h2_session::send_headers(h2_stream& s, const std::string& block, bool end_stream){
+    s.responded = true;
+    s.sent += block.size();
+    size_t off = 0;
+    bool first = true;
+    do{
+        size_t n = std::min<size_t>(block.size() - off, m_peer_max_frame);
+        uint8_t flags = (off + n == block.size()) ? FLAG_END_HEADERS : 0;
+        if(first && end_stream){
+            flags |= FLAG_END_STREAM;
+        }
+        write_frame_header(n, first ? H2_HEADERS : H2_CONTINUATION, flags, s.id);
+        m_out.append(block, off, n);
+        off += n;
+        first = false;
+    }while(off < block.size());
+
+    if(end_stream){
+        close_stream(s.id);
+    }
+}
+
+// 流式响应的上一段发送完毕，调用生产函数得到下一段
+bool h2_session::next_chunk(h2_stream& s){
+    http_conn* c = m_conn;
+    c->m_resp_body.clear();
+    c->m_resp_producer = s.producer;
+    c->m_resp_ctx = s.ctx;
+    c->m_resp_chunked = false;
+    http_response resp(c);
+    if(!s.producer(resp, s.ctx)){
+        return false;
+    }
+    s.body.swap(c->m_resp_body);
+    s.producer = c->m_resp_producer;
+    s.ctx = c->m_resp_ctx;
+    s.data = s.body.data();
+    s.data_len = s.body.size();
+    s.data_off = 0;
+    // 生产函数必须写入数据或者结束响应，否则会一直被调用
+    return !s.body.empty() || s.producer == NULL;
+}
+
+void h2_session::produce(){
+    if(m_goaway_sent){
+        return;
+    }
+    // 每一轮从上次停下的流开始，给每个有数据的流切一个DATA帧，直到窗口用完或者输出缓冲区足够多
+    bool progress = true;
+    while(progress && !m_streams.empty() && pending_len() < OUTPUT_HIGH_WATER){
+        progress = false;
+        auto it = m_streams.lower_bound(m_next_send);
+        size_t count = m_streams.size();
+        for(size_t i = 0; i < count && pending_len() < OUTPUT_HIGH_WATER; ++i){
+            if(it == m_streams.end()){
+                it = m_streams.begin();
+            }
+            h2_stream& s = it->second;
+            uint32_t sid = it->first;
+            ++it;
+            if(!s.responded){
+                continue;
+            }
+            if(s.data_off == s.data_len && s.producer && !next_chunk(s)){
+                reset_stream(sid, H2_INTERNAL_ERROR);
+                progress = true;
+                continue;
+            }
+
+            size_t remain = s.data_len - s.data_off;
+            int64_t n = std::min<int64_t>({(int64_t)remain, (int64_t)m_peer_max_frame, s.send_window, m_send_window});
+            bool last = !s.producer && n == (int64_t)remain;
+            if(n <= 0 && !(last && remain == 0)){
+                continue;   // 流或者连接的窗口用完了，等待WINDOW_UPDATE
+            }
+            n = std::max<int64_t>(n, 0);
+            write_frame_header(n, H2_DATA, last ? FLAG_END_STREAM : 0, sid);
+            m_out.append(s.data + s.data_off, n);
+            s.data_off += n;
+            s.send_window -= n;
+            s.sent += n;
+            m_send_window -= n;
+            m_next_send = sid + 1;
+            progress = true;
+            if(last){
+                close_stream(sid);
+            }
+        }
+    }
+}
+
+void h2_session::close_stream(uint32_t sid){
+    auto it = m_streams.find(sid);
+    if(it == m_streams.end()){
+        return;
+    }
+    h2_stream& s = it->second;
+    if(s.file_address){
+        munmap(s.file_address, s.file_size);
+    }
+    // 发送过响应的流记一条访问日志，被对方重置的流记录已经发送的部分
+    if(s.start_us && s.responded){
+        access_log::append(m_conn->m_client_addr, m_conn->m_client_port, s.request.method, s.status, s.sent, s.start_us, s.path,
+            m_conn->m_ssl ? (PROTO_HTTP2 | PROTO_TLS) : PROTO_HTTP2);
+    }
+    m_streams.erase(it);
+}
+
+void h2_session::reset_stream(uint32_t sid, uint32_t code){
+    write_frame_header(4, H2_RST_STREAM, 0, sid);
+    put32(m_out, code);
+    close_stream(sid);
+}
+
+void h2_session::write_frame_header(uint32_t len, uint8_t type, uint8_t flags, uint32_t sid){
+    char h[H2_FRAME_HEADER_LEN] = {(char)(len >> 16), (char)(len >> 8), (char)len, (char)type, (char)flags};
+    m_out.append(h, 5);
+    put32(m_out, sid);
+}
+
+void h2_session::write_window_update(uint32_t sid, uint32_t increment){
+    write_frame_header(4, H2_WINDOW_UPDATE, 0, sid);
+    put32(m_out, increment);
+}
+
+// 连接错误：发送GOAWAY，丢弃之后的输入，输出发送完后关闭连接
+bool h2_session::connection_error(uint32_t code, const char* reason){
+    log(std::string("h2 connection error: ") + reason + "\n");
+    write_frame_header(8, H2_GOAWAY, 0, 0);
+    put32(m_out, m_last_stream_id);
+    put32(m_out, code);
+    m_goaway_sent = true;
+    return false;
+}
+
+// 切换到HTTP/2：创建会话，读缓冲区中已经收到的数据交给会话
+// 失败时删除会话，连接由调用者关闭
+bool http_conn::h2_start(bool upgraded){
+    m_h2 = new h2_session(this);
+    // 流量控制窗口用完后要等对方的WINDOW_UPDATE，Nagle算法会让最后一个不满的报文段等待对方的延迟ACK
+    int one = 1;
+    setsockopt(m_sockfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    const char* pending = m_read_buf;
+    int pending_len = m_read_idx;
+    if(upgraded){
+        if(!m_h2->upgrade(m_method, m_url, m_host, m_h2_settings)){
+            delete m_h2;
+            m_h2 = NULL;
+            return false;
+        }
+        // 客户端可能在请求之后紧接着发送了连接前言
+        pending = m_read_buf + m_checked_idx;
+        pending_len = m_read_idx - m_checked_idx;
+    }else{
+        m_h2->start();
+    }
+    if(pending_len > 0){
+        m_h2->on_input(pending, pending_len);
+    }
+    m_read_idx = 0;
+    if(!h2_receive()){
+        delete m_h2;
+        m_h2 = NULL;
+        return false;
+    }
+    return true;
+}
+
+// 由主线程调用；定时器链表只在主线程修改，所以h2_start（可能在工作线程）直接调用h2_receive
+bool http_conn::h2_event(){
+    // HTTP/2连接上的请求和响应交错进行，不区分阶段，有事件时按等待请求的超时推后
+    time_t curr_time = coarse_clock::now();
+    set_deadline(conn_deadline::IDLE, curr_time + conn_deadline::timeout(conn_deadline::IDLE));
+    if(timer){
+        m_timer_lst.reset_timer(timer, conn_deadline::next_check(curr_time, deadline()));
+    }
+    return h2_receive();
+}
+
+bool http_conn::h2_receive(){
+    // 读到EAGAIN为止，EPOLLONESHOT下不读完就不会再有通知
+    char buf[16384];
+    while(true){
+        ssize_t n = sock_recv(buf, sizeof(buf));
+        if(n > 0){
+            m_h2->on_input(buf, n);
+            ++m_request_cnt;
+            continue;
+        }
+        if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)){
+            break;
+        }
+        return false;   // 对方关闭连接或者读取错误
+    }
+    return h2_pump();
+}
+
+// 发送会话的输出，发送缓冲区满时等待EPOLLOUT；响应体被流量控制阻塞时只等待对方的WINDOW_UPDATE
+bool http_conn::h2_pump(){
+    m_h2->produce();
+    while(m_h2->pending_len() > 0){
+        ssize_t n = sock_send(m_h2->pending(), m_h2->pending_len(), 0);
+        if(n < 0){
+            if(errno == EAGAIN){
+                break;
+            }
+            return false;
+        }
+        m_h2->consume(n);
+        if(m_h2->pending_len() == 0){
+            m_h2->produce();
+        }
+    }
+    if(m_h2->finished()){
+        return false;
+    }
+    modfd(m_epollfd, m_sockfd, (m_h2->pending_len() > 0) ? (EPOLLIN | EPOLLOUT) : EPOLLIN);
+    return true;
+}
@@ -0,0 +1,136 @@
+#ifndef H2_H
+#define H2_H
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include "hpack.h"
+#include "router.h"
+
+class http_conn;
+
+// HTTP/2（RFC 7540）
+
+// 帧类型
+enum H2_FRAME {H2_DATA = 0, H2_HEADERS, H2_PRIORITY, H2_RST_STREAM, H2_SETTINGS, H2_PUSH_PROMISE, H2_PING, H2_GOAWAY,
+    H2_WINDOW_UPDATE, H2_CONTINUATION};
+
+// 错误码，用于RST_STREAM和GOAWAY
+enum H2_ERROR {H2_NO_ERROR = 0, H2_PROTOCOL_ERROR, H2_INTERNAL_ERROR, H2_FLOW_CONTROL_ERROR, H2_SETTINGS_TIMEOUT,
+    H2_STREAM_CLOSED, H2_FRAME_SIZE_ERROR, H2_REFUSED_STREAM, H2_CANCEL, H2_COMPRESSION_ERROR};
+
+// 一个流：请求头部解析后生成，响应发送完并且对方也结束发送后删除
+struct h2_stream{
+    uint32_t id;
+    bool remote_closed;             // 对方已经发送了END_STREAM，请求完整
+    bool responded;                 // 已经发送了响应头，之后由produce发送响应体
+    int64_t send_window;            // 流级别的发送窗口
+
+    // 请求，request中的字符串指向下面的path和authority
+    std::string path;
+    std::string authority;
+    http_request request;
+    const route_node* node;         // 匹配到的路由，NULL表示静态文件
+    route_body_handler on_body;     // 请求体处理函数，NULL时丢弃请求体
+    bool body_failed;               // 请求体处理函数返回了false
+
+    // 响应体：文件映射或者处理函数生成的数据，流式响应发送完一段后由生产函数填充下一段
+    std::string body;
+    char* file_address;
+    size_t file_size;
+    const char* data;
+    size_t data_len;
+    size_t data_off;
+    stream_producer producer;
+    void* ctx;
+
+    // 访问日志
+    uint64_t start_us;              // 流打开的时间，没有开启访问日志时为0
+    int status;                     // 响应的状态码
+    uint64_t sent;                  // 已经发送的响应头块和DATA的字节数
+
+    h2_stream(): id(0), remote_closed(false), responded(false), send_window(0), request(), node(NULL), on_body(NULL),
+        body_failed(false), file_address(NULL), file_size(0), data(NULL), data_len(0), data_off(0), producer(NULL), ctx(NULL),
+        start_us(0), status(0), sent(0){}
+};
+
+// 一个HTTP/2连接上的会话，属于http_conn，只在主线程（切换时在处理请求的工作线程）访问
+// 输入的字节流被切成帧处理，所有输出（控制帧、响应头、DATA）追加到同一个输出缓冲区，由连接发送
+// 各个流的响应体按轮转的方式每次切出一个DATA帧，同一连接上的多个响应交错发送，受对方的流量控制窗口限制
+class h2_session{
+public:
+    static const uint32_t MAX_CONCURRENT_STREAMS = 100;    // 我们允许对方同时打开的流数
+    static const uint32_t MAX_FRAME_SIZE = 16384;          // 我们接收的最大帧，即协议的默认值
+    static const size_t OUTPUT_HIGH_WATER = 256 * 1024;    // 输出缓冲区中未发送的数据超过这个大小时不再切DATA帧
+    static const int64_t DEFAULT_WINDOW = 65535;           // 流量控制窗口的初始值
+    static const int64_t MAX_WINDOW = 0x7fffffff;
+    static const size_t MAX_HEADER_BLOCK = 65536;          // HEADERS加上CONTINUATION的最大长度
+
+    explicit h2_session(http_conn* conn);
+    ~h2_session();
+
+    void start();   // 连接前言之后：发送服务端的SETTINGS
+    // h2c升级：回应101并发送SETTINGS，应用HTTP2-Settings头部，升级请求成为流1并立即应答
+    bool upgrade(int method, const char* url, const char* host, const char* settings);
+
+    void on_input(const char* data, size_t len);    // 处理收到的数据
+    void produce();                                 // 把各个流的响应体切成DATA帧追加到输出缓冲区
+
+    // 待发送的输出
+    const char* pending() const { return m_out.data() + m_out_sent; }
+    size_t pending_len() const { return m_out.size() - m_out_sent; }
+    void consume(size_t n);
+
+    // 连接可以关闭了：出错或者对方发送了GOAWAY，并且输出已经发送完毕
+    bool finished() const;
+
+private:
+    bool on_frame(uint8_t type, uint8_t flags, uint32_t sid, const uint8_t* p, uint32_t len);
+    bool on_data(uint8_t flags, uint32_t sid, const uint8_t* p, uint32_t len);
+    bool on_headers(uint8_t flags, uint32_t sid, const uint8_t* p, uint32_t len);
+    bool on_settings(uint8_t flags, uint32_t sid, const uint8_t* p, uint32_t len, bool ack);
+    bool on_window_update(uint32_t sid, const uint8_t* p, uint32_t len);
+    bool end_headers(uint32_t sid, bool end_stream);
+
+    h2_stream* open_stream(uint32_t sid, int method, std::string_view path, std::string_view authority, long content_length);
+    void respond(h2_stream& s);
+    void respond_error(h2_stream& s, int status, const char* form, const char* allow = NULL);
+    void send_headers(h2_stream& s, const std::string& block, bool end_stream);
+    bool next_chunk(h2_stream& s);
+    void close_stream(uint32_t sid);
+    void reset_stream(uint32_t sid, uint32_t code);
+
+    void write_frame_header(uint32_t len, uint8_t type, uint8_t flags, uint32_t sid);
+    void write_window_update(uint32_t sid, uint32_t increment);
+    bool connection_error(uint32_t code, const char* reason);
+
+private:
+    http_conn* m_conn;
+    hpack_decoder m_decoder;
+    std::vector<hpack_field> m_fields;      // 解码得到的头部，复用容量
+
+    std::string m_in;                       // 还没有凑成完整帧的输入
+    bool m_preface;                         // 已经收到连接前言
+    std::string m_out;                      // 输出缓冲区
+    size_t m_out_sent;                      // 输出缓冲区中已经发送的字节数
+
+    std::map<uint32_t, h2_stream> m_streams;// 打开的流，按流ID有序，轮转发送时从上次的位置继续
+    uint32_t m_last_stream_id;              // 对方打开过的最大流ID
+    uint32_t m_next_send;                   // 下一轮从这个流ID开始切DATA帧
+
+    std::string m_header_block;             // HEADERS和CONTINUATION拼接的头部块
+    uint32_t m_continuation_sid;            // 正在等待CONTINUATION的流，0表示没有
+    bool m_continuation_end_stream;         // 这个头部块带有END_STREAM
+
+    int64_t m_send_window;                  // 连接级别的发送窗口
+    int64_t m_peer_initial_window;          // 对方SETTINGS_INITIAL_WINDOW_SIZE
+    uint32_t m_peer_max_frame;              // 对方SETTINGS_MAX_FRAME_SIZE
+    uint32_t m_recv_unacked;                // 收到的DATA中还没有通过WINDOW_UPDATE归还给连接窗口的字节数
+
+    bool m_goaway_sent;                     // 发生了连接错误，GOAWAY已经排队，之后的输入被丢弃
+    bool m_goaway_received;                 // 对方要求关闭连接，处理完已有的流后关闭
+};
+
+#endif
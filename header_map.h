@@ -0,0 +1,164 @@
+#ifndef HEADER_MAP_H
+#define HEADER_MAP_H
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <string_view>
+
+// 请求级的bump分配器：从内嵌的第一块开始顺序分配，用完后按块向后追加，不单独释放
+// reset只把位置移回第一块的开头，O(1)；追加的块保留下来给之后的请求使用，稳定后不再分配内存
+class request_arena{
+public:
+    static const size_t INLINE_SIZE = 1024;     // 内嵌的第一块，大多数请求用不完
+    static const size_t BLOCK_SIZE = 4096;      // 之后每次追加的块的最小大小
+
+    request_arena(): m_cur(&m_first), m_pos(0){
+        m_first.next = NULL;
+        m_first.size = INLINE_SIZE;
+        m_first.data = m_inline;
+    }
+    ~request_arena(){
+        block* b = m_first.next;
+        while(b){
+            block* next = b->next;
+            free(b);
+            b = next;
+        }
+    }
+    request_arena(const request_arena&) = delete;
+    request_arena& operator=(const request_arena&) = delete;
+
+    void reset(){
+        m_cur = &m_first;
+        m_pos = 0;
+    }
+
+    // 分配len字节，按8字节对齐，内存不足时返回NULL
+    void* alloc(size_t len){
+        len = (len + 7) & ~(size_t)7;
+        while(m_pos + len > m_cur->size){
+            if(!m_cur->next){
+                size_t size = len > BLOCK_SIZE ? len : BLOCK_SIZE;
+                block* b = (block*)malloc(sizeof(block) + size);
+                if(!b){
+                    return NULL;
+                }
+                b->next = NULL;
+                b->size = size;
+                b->data = (char*)(b + 1);
+                m_cur->next = b;
+            }
+            m_cur = m_cur->next;
+            m_pos = 0;
+        }
+        void* p = m_cur->data + m_pos;
+        m_pos += len;
+        return p;
+    }
+
+private:
+    struct block{
+        block* next;
+        size_t size;
+        char* data;
+    };
+    block m_first;
+    block* m_cur;
+    size_t m_pos;
+    alignas(8) char m_inline[INLINE_SIZE];
+};
+
+// 头部名字的哈希：按小写计算的FNV-1a，大小写不同的名字哈希相同
+// constexpr，已知的头部名字在编译期算好，解析时按哈希分派，查找时先比哈希再比名字
+constexpr uint32_t header_hash(std::string_view name){
+    uint32_t h = 2166136261u;
+    for(char c : name){
+        if(c >= 'A' && c <= 'Z'){
+            c += 'a' - 'A';
+        }
+        h = (h ^ (uint8_t)c) * 16777619u;
+    }
+    return h;
+}
+
+// 一个请求头，名字和值都指向读缓冲区，值去掉了两边的空白
+struct http_header{
+    uint32_t hash;
+    std::string_view name;
+    std::string_view value;
+};
+
+// 请求的全部头部，按出现的顺序保存
+// 前INLINE_HEADERS个放在对象内的数组里，更多的放在请求的arena中，clear是O(1)的
+class header_map{
+public:
+    static const int INLINE_HEADERS = 16;
+    static const int MAX_HEADERS = 128;         // 超过时add返回false，按错误请求处理
+
+    header_map(): m_count(0), m_spill(NULL), m_spill_cap(0), m_arena(NULL){}
+    void set_arena(request_arena* arena){ m_arena = arena; }
+
+    void clear(){
+        m_count = 0;
+        m_spill = NULL;
+        m_spill_cap = 0;
+    }
+
+    bool add(uint32_t hash, std::string_view name, std::string_view value){
+        if(m_count >= MAX_HEADERS){
+            return false;
+        }
+        if(m_count >= INLINE_HEADERS){
+            int idx = m_count - INLINE_HEADERS;
+            if(idx == m_spill_cap){
+                // 溢出部分放满了，在arena中分配两倍大小的数组，旧数组留在arena里，reset时一起回收
+                int cap = m_spill_cap ? m_spill_cap * 2 : INLINE_HEADERS;
+                http_header* spill = m_arena ? (http_header*)m_arena->alloc(cap * sizeof(http_header)) : NULL;
+                if(!spill){
+                    return false;
+                }
+                if(idx){
+                    memcpy((void*)spill, m_spill, idx * sizeof(http_header));
+                }
+                m_spill = spill;
+                m_spill_cap = cap;
+            }
+            m_spill[idx] = http_header{hash, name, value};
+        }else{
+            m_inline[m_count] = http_header{hash, name, value};
+        }
+        ++m_count;
+        return true;
+    }
+
+    int size() const { return m_count; }
+    const http_header& operator[](int i) const { return i < INLINE_HEADERS ? m_inline[i] : m_spill[i - INLINE_HEADERS]; }
+
+    // 按名字查找第一个，大小写无关，没有时返回NULL
+    const http_header* find(uint32_t hash, std::string_view name) const {
+        for(int i = 0; i < m_count; ++i){
+            const http_header& h = (*this)[i];
+            if(h.hash == hash && h.name.size() == name.size() && strncasecmp(h.name.data(), name.data(), name.size()) == 0){
+                return &h;
+            }
+        }
+        return NULL;
+    }
+    const http_header* find(std::string_view name) const { return find(header_hash(name), name); }
+
+    // 头部的值，没有这个头部时返回空串
+    std::string_view get(std::string_view name) const {
+        const http_header* h = find(name);
+        return h ? h->value : std::string_view();
+    }
+
+private:
+    int m_count;
+    http_header m_inline[INLINE_HEADERS];
+    http_header* m_spill;
+    int m_spill_cap;
+    request_arena* m_arena;
+};
+
+#endif
@@ -0,0 +1,356 @@
+#include "hpack.h"
+#include <stdio.h>
+
+// 静态表（RFC 7541 附录A），下标从1开始
+static const hpack_field static_table[] = {
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""},
+};
+static const size_t STATIC_TABLE_SIZE = sizeof(static_table) / sizeof(static_table[0]);
+
+// Huffman编码表（RFC 7541 附录B），每个符号的编码和位数，最后一个是EOS
+struct huffman_code{
+    uint32_t code;
+    uint8_t bits;
+};
+static const huffman_code huffman_table[257] = {
+    {0x1ff8, 13}, {0x7fffd8, 23}, {0xfffffe2, 28}, {0xfffffe3, 28}, {0xfffffe4, 28}, {0xfffffe5, 28},
+    {0xfffffe6, 28}, {0xfffffe7, 28}, {0xfffffe8, 28}, {0xffffea, 24}, {0x3ffffffc, 30}, {0xfffffe9, 28},
+    {0xfffffea, 28}, {0x3ffffffd, 30}, {0xfffffeb, 28}, {0xfffffec, 28}, {0xfffffed, 28}, {0xfffffee, 28},
+    {0xfffffef, 28}, {0xffffff0, 28}, {0xffffff1, 28}, {0xffffff2, 28}, {0x3ffffffe, 30}, {0xffffff3, 28},
+    {0xffffff4, 28}, {0xffffff5, 28}, {0xffffff6, 28}, {0xffffff7, 28}, {0xffffff8, 28}, {0xffffff9, 28},
+    {0xffffffa, 28}, {0xffffffb, 28}, {0x14, 6}, {0x3f8, 10}, {0x3f9, 10}, {0xffa, 12},
+    {0x1ff9, 13}, {0x15, 6}, {0xf8, 8}, {0x7fa, 11}, {0x3fa, 10}, {0x3fb, 10},
+    {0xf9, 8}, {0x7fb, 11}, {0xfa, 8}, {0x16, 6}, {0x17, 6}, {0x18, 6},
+    {0x0, 5}, {0x1, 5}, {0x2, 5}, {0x19, 6}, {0x1a, 6}, {0x1b, 6},
+    {0x1c, 6}, {0x1d, 6}, {0x1e, 6}, {0x1f, 6}, {0x5c, 7}, {0xfb, 8},
+    {0x7ffc, 15}, {0x20, 6}, {0xffb, 12}, {0x3fc, 10}, {0x1ffa, 13}, {0x21, 6},
+    {0x5d, 7}, {0x5e, 7}, {0x5f, 7}, {0x60, 7}, {0x61, 7}, {0x62, 7},
+    {0x63, 7}, {0x64, 7}, {0x65, 7}, {0x66, 7}, {0x67, 7}, {0x68, 7},
+    {0x69, 7}, {0x6a, 7}, {0x6b, 7}, {0x6c, 7}, {0x6d, 7}, {0x6e, 7},
+    {0x6f, 7}, {0x70, 7}, {0x71, 7}, {0x72, 7}, {0xfc, 8}, {0x73, 7},
+    {0xfd, 8}, {0x1ffb, 13}, {0x7fff0, 19}, {0x1ffc, 13}, {0x3ffc, 14}, {0x22, 6},
+    {0x7ffd, 15}, {0x3, 5}, {0x23, 6}, {0x4, 5}, {0x24, 6}, {0x5, 5},
+    {0x25, 6}, {0x26, 6}, {0x27, 6}, {0x6, 5}, {0x74, 7}, {0x75, 7},
+    {0x28, 6}, {0x29, 6}, {0x2a, 6}, {0x7, 5}, {0x2b, 6}, {0x76, 7},
+    {0x2c, 6}, {0x8, 5}, {0x9, 5}, {0x2d, 6}, {0x77, 7}, {0x78, 7},
+    {0x79, 7}, {0x7a, 7}, {0x7b, 7}, {0x7ffe, 15}, {0x7fc, 11}, {0x3ffd, 14},
+    {0x1ffd, 13}, {0xffffffc, 28}, {0xfffe6, 20}, {0x3fffd2, 22}, {0xfffe7, 20}, {0xfffe8, 20},
+    {0x3fffd3, 22}, {0x3fffd4, 22}, {0x3fffd5, 22}, {0x7fffd9, 23}, {0x3fffd6, 22}, {0x7fffda, 23},
+    {0x7fffdb, 23}, {0x7fffdc, 23}, {0x7fffdd, 23}, {0x7fffde, 23}, {0xffffeb, 24}, {0x7fffdf, 23},
+    {0xffffec, 24}, {0xffffed, 24}, {0x3fffd7, 22}, {0x7fffe0, 23}, {0xffffee, 24}, {0x7fffe1, 23},
+    {0x7fffe2, 23}, {0x7fffe3, 23}, {0x7fffe4, 23}, {0x1fffdc, 21}, {0x3fffd8, 22}, {0x7fffe5, 23},
+    {0x3fffd9, 22}, {0x7fffe6, 23}, {0x7fffe7, 23}, {0xffffef, 24}, {0x3fffda, 22}, {0x1fffdd, 21},
+    {0xfffe9, 20}, {0x3fffdb, 22}, {0x3fffdc, 22}, {0x7fffe8, 23}, {0x7fffe9, 23}, {0x1fffde, 21},
+    {0x7fffea, 23}, {0x3fffdd, 22}, {0x3fffde, 22}, {0xfffff0, 24}, {0x1fffdf, 21}, {0x3fffdf, 22},
+    {0x7fffeb, 23}, {0x7fffec, 23}, {0x1fffe0, 21}, {0x1fffe1, 21}, {0x3fffe0, 22}, {0x1fffe2, 21},
+    {0x7fffed, 23}, {0x3fffe1, 22}, {0x7fffee, 23}, {0x7fffef, 23}, {0xfffea, 20}, {0x3fffe2, 22},
+    {0x3fffe3, 22}, {0x3fffe4, 22}, {0x7ffff0, 23}, {0x3fffe5, 22}, {0x3fffe6, 22}, {0x7ffff1, 23},
+    {0x3ffffe0, 26}, {0x3ffffe1, 26}, {0xfffeb, 20}, {0x7fff1, 19}, {0x3fffe7, 22}, {0x7ffff2, 23},
+    {0x3fffe8, 22}, {0x1ffffec, 25}, {0x3ffffe2, 26}, {0x3ffffe3, 26}, {0x3ffffe4, 26}, {0x7ffffde, 27},
+    {0x7ffffdf, 27}, {0x3ffffe5, 26}, {0xfffff1, 24}, {0x1ffffed, 25}, {0x7fff2, 19}, {0x1fffe3, 21},
+    {0x3ffffe6, 26}, {0x7ffffe0, 27}, {0x7ffffe1, 27}, {0x3ffffe7, 26}, {0x7ffffe2, 27}, {0xfffff2, 24},
+    {0x1fffe4, 21}, {0x1fffe5, 21}, {0x3ffffe8, 26}, {0x3ffffe9, 26}, {0xffffffd, 28}, {0x7ffffe3, 27},
+    {0x7ffffe4, 27}, {0x7ffffe5, 27}, {0xfffec, 20}, {0xfffff3, 24}, {0xfffed, 20}, {0x1fffe6, 21},
+    {0x3fffe9, 22}, {0x1fffe7, 21}, {0x1fffe8, 21}, {0x7ffff3, 23}, {0x3fffea, 22}, {0x3fffeb, 22},
+    {0x1ffffee, 25}, {0x1ffffef, 25}, {0xfffff4, 24}, {0xfffff5, 24}, {0x3ffffea, 26}, {0x7ffff4, 23},
+    {0x3ffffeb, 26}, {0x7ffffe6, 27}, {0x3ffffec, 26}, {0x3ffffed, 26}, {0x7ffffe7, 27}, {0x7ffffe8, 27},
+    {0x7ffffe9, 27}, {0x7ffffea, 27}, {0x7ffffeb, 27}, {0xffffffe, 28}, {0x7ffffec, 27}, {0x7ffffed, 27},
+    {0x7ffffee, 27}, {0x7ffffef, 27}, {0x7fffff0, 27}, {0x3ffffee, 26}, {0x3fffffff, 30},
+};
+
+// Huffman解码树，第一次使用时由编码表构建，之后只读
+struct huffman_tree{
+    struct node{
+        int16_t child[2];
+        int16_t sym;        // 叶子节点的符号，内部节点为-1
+    };
+    node nodes[512];
+    int count;
+
+    huffman_tree(): count(1){
+        nodes[0] = node{{-1, -1}, -1};
+        for(int sym = 0; sym < 257; ++sym){
+            int cur = 0;
+            for(int i = huffman_table[sym].bits - 1; i >= 0; --i){
+                int bit = (huffman_table[sym].code >> i) & 1;
+                if(nodes[cur].child[bit] < 0){
+                    nodes[count] = node{{-1, -1}, -1};
+                    nodes[cur].child[bit] = count++;
+                }
+                cur = nodes[cur].child[bit];
+            }
+            nodes[cur].sym = sym;
+        }
+    }
+};
+
+bool hpack_huffman_decode(const uint8_t* data, size_t len, std::string& out){
+    static const huffman_tree tree;
+    int cur = 0;
+    int depth = 0;          // 当前未完成的符号已经读入的位数
+    bool all_ones = true;   // 这些位是否全为1
+    for(size_t i = 0; i < len; ++i){
+        for(int bit = 7; bit >= 0; --bit){
+            int b = (data[i] >> bit) & 1;
+            cur = tree.nodes[cur].child[b];
+            if(cur < 0){
+                return false;
+            }
+            ++depth;
+            all_ones = all_ones && b;
+            int sym = tree.nodes[cur].sym;
+            if(sym >= 0){
+                if(sym == 256){
+                    return false;   // 字符串中不能出现EOS
+                }
+                out.push_back((char)sym);
+                cur = 0;
+                depth = 0;
+                all_ones = true;
+            }
+        }
+    }
+    // 结尾的填充是EOS编码的前缀：不超过7位且全为1
+    return depth < 8 && all_ones;
+}
+
+bool hpack_decode_int(const uint8_t*& p, const uint8_t* end, int prefix_bits, uint64_t& value){
+    if(p >= end){
+        return false;
+    }
+    uint64_t mask = (1u << prefix_bits) - 1;
+    value = *p++ & mask;
+    if(value < mask){
+        return true;
+    }
+    int shift = 0;
+    while(p < end && shift <= 56){
+        uint8_t b = *p++;
+        value += (uint64_t)(b & 0x7f) << shift;
+        shift += 7;
+        if(!(b & 0x80)){
+            return true;
+        }
+    }
+    return false;
+}
+
+void hpack_encode_int(std::string& out, uint8_t first, int prefix_bits, uint64_t value){
+    uint64_t mask = (1u << prefix_bits) - 1;
+    if(value < mask){
+        out.push_back((char)(first | value));
+        return;
+    }
+    out.push_back((char)(first | mask));
+    value -= mask;
+    while(value >= 0x80){
+        out.push_back((char)(0x80 | (value & 0x7f)));
+        value >>= 7;
+    }
+    out.push_back((char)value);
+}
+
+hpack_decoder::hpack_decoder(): m_table_size(0), m_max_size(DEFAULT_TABLE_SIZE){
+}
+
+bool hpack_decoder::lookup(uint64_t index, hpack_field& field){
+    if(index == 0){
+        return false;
+    }
+    if(index <= STATIC_TABLE_SIZE){
+        field = static_table[index - 1];
+        return true;
+    }
+    index -= STATIC_TABLE_SIZE + 1;
+    if(index >= m_table.size()){
+        return false;
+    }
+    // 动态表的条目可能被同一个头部块中后面的插入淘汰，拷贝到暂存区
+    const entry& e = m_table[index];
+    field.name = m_scratch.emplace_back(e.name);
+    field.value = m_scratch.emplace_back(e.value);
+    return true;
+}
+
+bool hpack_decoder::read_string(const uint8_t*& p, const uint8_t* end, std::string_view& out){
+    if(p >= end){
+        return false;
+    }
+    bool huffman = *p & 0x80;
+    uint64_t len;
+    if(!hpack_decode_int(p, end, 7, len) || len > (uint64_t)(end - p)){
+        return false;
+    }
+    if(huffman){
+        std::string& s = m_scratch.emplace_back();
+        if(!hpack_huffman_decode(p, len, s)){
+            return false;
+        }
+        out = s;
+    }else{
+        out = std::string_view((const char*)p, len);
+    }
+    p += len;
+    return true;
+}
+
+void hpack_decoder::evict(size_t max_size){
+    while(m_table_size > max_size && !m_table.empty()){
+        const entry& e = m_table.back();
+        m_table_size -= e.name.size() + e.value.size() + 32;
+        m_table.pop_back();
+    }
+}
+
+void hpack_decoder::insert(std::string_view name, std::string_view value){
+    size_t size = name.size() + value.size() + 32;
+    if(size > m_max_size){
+        evict(0);   // 比整个表还大的条目清空动态表，自身不加入
+        return;
+    }
+    entry e{std::string(name), std::string(value)};
+    evict(m_max_size - size);
+    m_table.push_front(std::move(e));
+    m_table_size += size;
+}
+
+bool hpack_decoder::decode(const uint8_t* data, size_t len, std::vector<hpack_field>& fields){
+    m_scratch.clear();
+    fields.clear();
+    const uint8_t* p = data;
+    const uint8_t* end = data + len;
+    while(p < end){
+        uint8_t b = *p;
+        uint64_t index;
+        hpack_field field;
+        if(b & 0x80){
+            // 索引头部
+            if(!hpack_decode_int(p, end, 7, index) || !lookup(index, field)){
+                return false;
+            }
+        }else if((b & 0xe0) == 0x20){
+            // 动态表大小更新，不能超过我们在SETTINGS中给出的大小
+            if(!hpack_decode_int(p, end, 5, index) || index > DEFAULT_TABLE_SIZE){
+                return false;
+            }
+            m_max_size = index;
+            evict(m_max_size);
+            continue;
+        }else{
+            // 字面值：01为加入索引，0000为不加入索引，0001为永不索引
+            bool indexing = (b & 0xc0) == 0x40;
+            if(!hpack_decode_int(p, end, indexing ? 6 : 4, index)){
+                return false;
+            }
+            if(index){
+                if(!lookup(index, field)){
+                    return false;
+                }
+            }else if(!read_string(p, end, field.name)){
+                return false;
+            }
+            if(!read_string(p, end, field.value)){
+                return false;
+            }
+            if(indexing){
+                insert(field.name, field.value);
+            }
+        }
+        fields.push_back(field);
+    }
+    return true;
+}
+
+void hpack_encoder::encode_status(std::string& out, int status){
+    // 静态表8~14
+    static const int indexed[] = {200, 204, 206, 304, 400, 404, 500};
+    for(int i = 0; i < 7; ++i){
+        if(indexed[i] == status){
+            out.push_back((char)(0x80 | (8 + i)));
+            return;
+        }
+    }
+    char value[4];
+    snprintf(value, sizeof(value), "%03d", status);
+    hpack_encode_int(out, 0x00, 4, 8);
+    hpack_encode_int(out, 0x00, 7, 3);
+    out.append(value, 3);
+}
+
+void hpack_encoder::encode_header(std::string& out, std::string_view name, std::string_view value){
+    // 不加入索引的字面值，名称在静态表中时用索引
+    size_t index = 0;
+    for(size_t i = 14; i < STATIC_TABLE_SIZE; ++i){
+        if(static_table[i].name == name){
+            index = i + 1;
+            break;
+        }
+    }
+    hpack_encode_int(out, 0x00, 4, index);
+    if(!index){
+        hpack_encode_int(out, 0x00, 7, name.size());
+        out.append(name);
+    }
+    hpack_encode_int(out, 0x00, 7, value.size());
+    out.append(value);
+}
@@ -0,0 +1,63 @@
+#ifndef HPACK_H
+#define HPACK_H
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <string_view>
+#include <deque>
+#include <vector>
+
+// HPACK头部压缩（RFC 7541）
+
+// 解码得到的一个头部，指向静态表或者解码器的暂存区，在下一次decode之前有效
+struct hpack_field{
+    std::string_view name;
+    std::string_view value;
+};
+
+// 解码器，每个HTTP/2连接一个，动态表随连接上的头部块依次更新
+class hpack_decoder{
+public:
+    static const size_t DEFAULT_TABLE_SIZE = 4096;  // SETTINGS_HEADER_TABLE_SIZE的初始值，我们不修改它
+
+    hpack_decoder();
+
+    // 解码一个完整的头部块，出错返回false（连接错误COMPRESSION_ERROR）
+    // 静态表中的头部直接引用静态表，不做拷贝
+    bool decode(const uint8_t* data, size_t len, std::vector<hpack_field>& fields);
+
+private:
+    struct entry{
+        std::string name;
+        std::string value;
+    };
+
+    bool lookup(uint64_t index, hpack_field& field);
+    bool read_string(const uint8_t*& p, const uint8_t* end, std::string_view& out);
+    void insert(std::string_view name, std::string_view value);
+    void evict(size_t max_size);
+
+private:
+    std::deque<entry> m_table;          // 动态表，最新的条目在前面
+    size_t m_table_size;                // 动态表当前大小，每个条目计 name + value + 32
+    size_t m_max_size;                  // 编码端通过动态表大小更新指令设置的上限
+    std::deque<std::string> m_scratch;  // 字面值和动态表引用的暂存区，元素地址不会因为插入而变化
+};
+
+// 编码器：响应头只用静态表索引和不加入索引的字面值，不维护动态表，没有连接状态
+class hpack_encoder{
+public:
+    // :status，常见状态码直接用静态表索引编码成一个字节
+    static void encode_status(std::string& out, int status);
+    // 普通头部，名称必须是小写；名称在静态表中时只编码索引
+    static void encode_header(std::string& out, std::string_view name, std::string_view value);
+};
+
+// 整数编码和解码，prefix_bits为前缀的位数
+bool hpack_decode_int(const uint8_t*& p, const uint8_t* end, int prefix_bits, uint64_t& value);
+void hpack_encode_int(std::string& out, uint8_t first, int prefix_bits, uint64_t value);
+
+// Huffman解码，出错返回false
+bool hpack_huffman_decode(const uint8_t* data, size_t len, std::string& out);
+
+#endif
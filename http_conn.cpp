@@ -1,4 +1,7 @@
 #include "http_conn.h"
+#include "co_conn.h"
+#include "h2.h"
+#include "probes.h"
 #include <sys/types.h>
 #include <fcntl.h>
 #include <sys/stat.h>
@@ -10,37 +13,44 @@
 #include <chrono>
 #include <string>
 #include <fstream>
+#include <algorithm>
 
 // 定义HTTP响应的一些状态信息
 const char* ok_200_title = "OK";
+const char* ok_201_title = "Created";
+const char* ok_201_form = "The file was uploaded.\n";
 const char* error_400_title = "Bad Request";
 const char* error_400_form = "Your request has bad syntax or is inherently impossible to satisfy.\n";
 const char* error_403_title = "Forbidden";
 const char* error_403_form = "You do not have permission to get file from this server.\n";
 const char* error_404_title = "Not Found";
 const char* error_404_form = "The requested file was not found on this server.\n";
+const char* error_405_title = "Method Not Allowed";
+const char* error_405_form = "The requested method is not supported for this resource.\n";
 const char* error_500_title = "Internal Error";
 const char* error_500_form = "There was an unusual problem serving the requested file.\n";
 
 const char* doc_root = "/home/panda/Desktop/TinyHttp/resource";
 
 int http_conn::m_epollfd = -1; 
-int http_conn::m_user_count = 0;
+std::atomic<int> http_conn::m_user_count(0);
 int http_conn::m_request_cnt = 0;
 sort_timer_lst http_conn::m_timer_lst;
+const char* http_conn::m_upload_prefix = NULL;
+http_conn::body_handler http_conn::m_body_handler = NULL;
+route_view http_conn::m_routes = {NULL, 0};
+int http_conn::m_busy_poll = 0;
 
 // log函数
 void log(std::string message){
-    // 获取当前时间
-    time_t now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
-
     // 打开log文件
     std::ofstream logfile;
     logfile.open("server.log", std::ios::out | std::ios::app);
 
     // 写入error数据
     if (logfile.is_open()){
-        logfile << "[" << ctime(&now) << "]" << message << std::endl;
+        // 时间戳由coarse_clock每秒生成一次，格式和ctime相同
+        logfile << "[" << coarse_clock::log_stamp() << "]" << message << std::endl;
         logfile.close();
     }else{
         std::cerr << "Unable to open log file" << std::endl;
@@ -85,76 +95,208 @@ void modfd(int epollfd, int fd, int ev){
     epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &event);
 }
 
+// IPv4映射的IPv6地址取出其中的IPv4地址；其它IPv6地址把/64前缀折叠成32位，同一个/64网段的客户端算作一个；
+// UNIX socket上的客户端都是本机的127.0.0.1，端口为0
+in_addr_t http_conn::client_key(const sockaddr* addr, in_port_t* port){
+    *port = 0;
+    if(addr->sa_family == AF_INET){
+        const sockaddr_in* in = (const sockaddr_in*)addr;
+        *port = in->sin_port;
+        return in->sin_addr.s_addr;
+    }
+    if(addr->sa_family == AF_INET6){
+        const sockaddr_in6* in6 = (const sockaddr_in6*)addr;
+        *port = in6->sin6_port;
+        uint32_t w[4];
+        memcpy(w, &in6->sin6_addr, sizeof(w));
+        if(IN6_IS_ADDR_V4MAPPED(&in6->sin6_addr)){
+            return w[3];
+        }
+        return w[0] ^ (w[1] * 0x9e3779b1u);
+    }
+    return htonl(INADDR_LOOPBACK);
+}
+
 // 初始化新接收的连接
-void http_conn::init(int sockfd, const sockaddr_in &addr){
+void http_conn::init(int sockfd, const sockaddr* addr, socklen_t addr_len, SSL* ssl){
+    // 缓冲区在这个对象第一次接收连接时分配
+    if(!m_bufs){
+        m_bufs = new buffers;
+        m_read_buf = m_bufs->read_buf;
+        m_write_buf = m_bufs->write_buf;
+        m_bufs->request.headers.set_arena(&m_bufs->arena);
+    }
     m_sockfd = sockfd;
-    m_address = addr;
+    memset(&m_address, 0, sizeof(m_address));
+    memcpy(&m_address, addr, std::min<size_t>(addr_len, sizeof(m_address)));
+    m_client_addr = client_key(addr, &m_client_port);
+    m_sched_weight = fair_sched::enabled() ? fair_sched::weight_of(m_client_addr) : 1;
+    m_conn_requests = 0;
+    m_tcp = tcp_conn_sample();
+    m_pace = pace_state();
+    m_ssl = ssl;
+    m_tls_ready = false;
+    m_ktls_send = false;
+    m_ktls_recv = false;
+    m_h2 = NULL;
+    m_file_address = nullptr;
+    m_file_fd = -1;
+    m_upload_fd = -1;
     
     // 端口复用
     int reuse = 1;
     setsockopt(m_sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
 
+    // 忙轮询：socket上的读等待在内核中先轮询网卡的接收队列，超过net.core.busy_read的值需要CAP_NET_ADMIN，失败时忽略
+    if(m_busy_poll){
+        int one = 1;
+        setsockopt(m_sockfd, SOL_SOCKET, SO_BUSY_POLL, &m_busy_poll, sizeof(m_busy_poll));
+        setsockopt(m_sockfd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &one, sizeof(one));
+    }
+
     // 添加到epoll对象中
     addfd(m_epollfd, m_sockfd, true, ET);
     m_user_count++;
     init();
 
+    // 上一个使用这个fd的连接被关闭时没有删除它的定时器，不能让它到期时关闭新连接
+    if(timer){
+        m_timer_lst.del_timer(timer);
+    }
+
     // 创建定时器，设置其回调函数与超时时间，然后绑定定时器与用户数据，最后将定时器添加到链表m_timer_lst
+    // 新连接处于等待请求的阶段，截止时间在init中设置
     util_timer* new_timer = new util_timer;
     new_timer->user_data = this;
-    time_t curr_time = time(NULL);
-    new_timer -> expire = curr_time + 3 * TIMESLOT;
+    new_timer -> expire = conn_deadline::next_check(coarse_clock::now(), deadline());
     this -> timer = new_timer;
     m_timer_lst.add_timer(new_timer);
 }
 
+void http_conn::peer_name(char* buf, size_t len) const{
+    char ip[INET6_ADDRSTRLEN];
+    if(m_address.ss_family == AF_INET){
+        inet_ntop(AF_INET, &((const sockaddr_in*)&m_address)->sin_addr, ip, sizeof(ip));
+        snprintf(buf, len, "%s:%d", ip, ntohs(m_client_port));
+    }else if(m_address.ss_family == AF_INET6){
+        inet_ntop(AF_INET6, &((const sockaddr_in6*)&m_address)->sin6_addr, ip, sizeof(ip));
+        snprintf(buf, len, "[%s]:%d", ip, ntohs(m_client_port));
+    }else{
+        snprintf(buf, len, "unix");
+    }
+}
+
 // 关闭连接
 void http_conn::close_conn(){
+    // 协程模式下销毁挂起的协程帧，并释放它持有的文件
+    if(m_co_handle){
+        m_co_handle.destroy();
+        m_co_handle = nullptr;
+        unmap();
+    }
+    abort_upload();
+    delete m_h2;
+    m_h2 = NULL;
     if(m_sockfd != -1){
-        removefd(m_epollfd, m_sockfd);
+        // 尽力发送close_notify，不等待对方的回应
+        if(m_ssl){
+            if(m_tls_ready){
+                SSL_shutdown(m_ssl);
+            }
+            SSL_free(m_ssl);
+            m_ssl = NULL;
+        }
+        if(rate_counted){
+            rate_limiter::release(m_client_addr);
+            rate_counted = false;
+        }
+        // 关闭socket放在最后：工作线程关闭连接时，fd一旦关闭就可能被主线程accept给新连接并初始化这个对象
+        int fd = m_sockfd;
+        PROBE(conn_close, fd, m_conn_requests);
         m_sockfd = -1;
         m_user_count--;
+        ++m_io_gen;
+        removefd(m_epollfd, fd);
     }
 }
 
 void http_conn::init(){
-    bzero(m_read_buf, READ_BUFFER_SIZE);  // 读缓冲区
+    abort_upload();                       // 上一个请求未完成的上传
+
+    // 解析和发送只访问下标之前的部分，缓冲区不需要每个请求清零
     m_read_idx = 0;                     // 标识读缓冲区中已经读入的客户端数据的最后一个字节的下一个位置
     m_checked_idx = 0;                  // 当前正在分析的字符在读缓冲区中的位置
     m_start_line = 0;                   // 当前正在解析的行的起始位置
+    m_header_start = 0;                 // 请求头的起始位置
 
     m_check_state = CHECK_STATE_REQUESTLINE;          // 主状态机当前所处的状态
     m_method = GET;                    // 请求方法
 
-    bzero(m_real_file, FILENAME_LEN);     // 客户请求的目标文件的完整路径= doc_root + m_url
+    m_bufs->real_file[0] = '\0';          // 客户请求的目标文件的完整路径= doc_root + m_url
+    m_bufs->request.headers.clear();      // 头部表和arena只移回开头，不释放也不清零
+    m_bufs->arena.reset();
     m_url = 0;                        // 客户请求目标文件的文件名
     m_version= 0;                    // HTTP协议版本号
     m_host = 0;                       // 主机名
     m_content_length = 0;               // HTTP请求的消息总长度
     m_linger = false;                      // HTTP请求是否要求保持连接
 
-    bzero(m_write_buf, WRITE_BUFFER_SIZE);// 写缓冲区
+    m_chunked = false;                  // 请求体采用chunked传输编码
+    m_expect_continue = false;          // 客户端等待100 Continue
+    m_upgrade_h2c = false;              // 升级到h2c
+    m_h2_settings = NULL;
+    m_body_start = 0;                   // 请求体在读缓冲区中的起始位置
+    m_body_received = 0;                // 已经交给处理函数的请求体字节数
+    m_chunk_state = CHUNK_SIZE;         // chunked解码器的状态
+    m_chunk_left = 0;                   // 当前块还未接收的字节数
+    m_upload_splice = false;            // 上传的请求体用splice搬运
+
+    m_route_node = NULL;                // 匹配到的路由
+    m_resp_status = 200;                // 处理函数的响应
+    m_resp_title = ok_200_title;
+    m_resp_type = NULL;
+    m_resp_headers.clear();             // 保留容量，长连接上的后续请求不再分配内存
+    m_resp_body.clear();
+    m_resp_producer = NULL;
+    m_resp_ctx = NULL;
+    m_resp_chunked = false;
+    m_hijacked = false;
+    m_body_address = NULL;
+    m_io_checked = 0;
+
     m_write_idx = 0;                    // 写缓冲区中待发送的字节数
     bytes_to_send = 0;                  // 将要发送的数据字节数
     bytes_have_send = 0;                // 已经发送的字节数
+
+    // 开始等待下一个请求
+    set_deadline(conn_deadline::IDLE, coarse_clock::now() + conn_deadline::timeout(conn_deadline::IDLE));
+
+    // 放在最后：工作线程置位之后只剩下注册可读事件，主线程看到置位时可以关闭连接
+    m_idle.store(true, std::memory_order_release);
 }
 bool http_conn::read(){
-    if (timer){
-        time_t curr_time = time(NULL);
-        timer->expire = curr_time + 3 * TIMESLOT;
-        m_timer_lst.adjust_timer(timer);
+    m_idle.store(false, std::memory_order_relaxed);
+    on_receive();
+
+    // 上传的请求体由工作线程直接从socket splice到文件，这里不读取
+    if(m_check_state == CHECK_STATE_CONTENT && m_upload_splice){
+        return true;
     }
 
     // 超出缓冲区大小
     if(m_read_idx >= READ_BUFFER_SIZE){
         return false;
     }
+    if(m_read_idx == 0 && access_log::enabled()){
+        m_req_start = access_log::now_us();
+    }
     int bytes_read = 0;
+    [[maybe_unused]] int start_idx = m_read_idx;   // 只有read_done探针使用
 
-    // 一次性全部读进来
-    while(true){
+    // 一次性全部读进来，缓冲区满时先交给工作线程消费请求体，腾出空间后再读
+    while(m_read_idx < READ_BUFFER_SIZE){
         // 从m_read_buf + m_read_idx索引处开始保存数据，大小是READ_BUFFER_SIZE - m_read_idx
-        bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0);
+        bytes_read = sock_recv(m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx);
         if(bytes_read == -1){
             if( errno == EAGAIN || errno == EWOULDBLOCK){
                 break;  // 非阻塞读取，没有数据了
@@ -167,9 +309,37 @@ bool http_conn::read(){
         
     }
     ++m_request_cnt;
+    PROBE(read_done, m_sockfd, m_read_idx - start_idx, m_read_idx);
     return true;
 }
 
+// 读请求头的截止时间从请求的第一个字节算起，之后不再推后；请求体按已经收到的字节数推后，见conn_deadline.h
+// 在工作线程上进入的阶段（等待请求、接收请求体）由这里把新的截止时间同步到定时器
+void http_conn::on_receive(){
+    time_t now = coarse_clock::now();
+    int phase = deadline_phase();
+    if(phase == conn_deadline::IDLE){
+        set_deadline(conn_deadline::HEADER, now + conn_deadline::timeout(conn_deadline::HEADER));
+    }else if(phase == conn_deadline::BODY){
+        set_deadline(conn_deadline::BODY, conn_deadline::body_deadline(m_body_since, m_body_received, now));
+    }
+    if(timer){
+        m_timer_lst.reset_timer(timer, conn_deadline::next_check(now, deadline()));
+    }
+}
+
+// 一个请求只在读到它的第一段数据时检查一次，请求行或者请求体的后续数据不再计数
+bool http_conn::admit(){
+    if(!rate_limiter::enabled() || m_check_state != CHECK_STATE_REQUESTLINE || m_checked_idx != 0){
+        return true;
+    }
+    if(rate_limiter::on_request(m_client_addr)){
+        return true;
+    }
+    sock_send(rate_limiter::REJECT_RESPONSE, rate_limiter::REJECT_LEN, 0);
+    return false;
+}
+
 // 根据\r\n解析一行数据
 http_conn::LINE_STATUS http_conn::parse_line(){
     char temp = '\0';
@@ -223,13 +393,12 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char* text){
     *m_url++ = '\0';
 
     // Check if method is valid
-    char* method = text;
-    if (strcasecmp(method, "GET") == 0){
-        method = 0;
-    }else{
+    int method = method_from_name(text);
+    if (method < 0){
         log("Unsupported method\n");
         return BAD_REQUEST;
     }
+    m_method = (METHOD)method;
 
     // Find the HTTP version
     m_url += strspn(m_url, " \t"); // 不存在的第一个下标
@@ -261,51 +430,477 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char* text){
         return BAD_REQUEST;
     }
     m_check_state = CHECK_STATE_HEADER; // 检查状态变成检查头
+    m_header_start = m_checked_idx;
     return NO_REQUEST;
 }    
 
 
 //  解析HTTP请求头信息
+// 头部的名字或者值是否等于s，大小写无关
+static bool token_is(std::string_view v, std::string_view s){
+    return v.size() == s.size() && strncasecmp(v.data(), s.data(), s.size()) == 0;
+}
+
+// 解析一行头部：全部加入请求的头部表，服务器自己用到的几个按名字的哈希分派
 http_conn::HTTP_CODE http_conn::parse_headers(char* text){
     // 遇到空行，表示头部字段解析完毕
+    // 没有请求体说明我们已经得到了一个完整的HTTP请求，否则开始接收请求体
     if (text[0] == '\0'){
-        if (m_content_length != 0){
-            m_check_state = CHECK_STATE_CONTENT;
-            return NO_REQUEST;
+        return begin_body();
+    }
+
+    // 名字和值以冒号分隔，没有冒号的行（包括已经废弃的折行）忽略
+    // 缓冲区保持原样（接管连接的处理函数还会读原始的头部），值的视图不含两边的空白
+    char* colon = strchr(text, ':');
+    if(!colon){
+        return NO_REQUEST;
+    }
+    std::string_view name(text, colon - text);
+    char* value = colon + 1;
+    value += strspn(value, " \t"); // 找到第一个不等于这个字符/str的位置
+    size_t len = strlen(value);
+    while(len && (value[len - 1] == ' ' || value[len - 1] == '\t')){
+        --len;
+    }
+    std::string_view v(value, len);
+    uint32_t hash = header_hash(name);
+    if(!m_bufs->request.headers.add(hash, name, v)){
+        return BAD_REQUEST;
+    }
+
+    switch(hash){
+        case header_hash("connection"):
+            // Connection: keep-alive
+            if(token_is(name, "connection") && token_is(v, "keep-alive")){
+                m_linger = true;
+            }
+            break;
+        case header_hash("content-length"):
+            // 处理Content-Length头部字段
+            if(token_is(name, "content-length")){
+                m_content_length = atol(value); //ascii to long
+            }
+            break;
+        case header_hash("host"):
+            if(token_is(name, "host")){
+                m_host = value;
+            }
+            break;
+        case header_hash("transfer-encoding"):
+            // Transfer-Encoding: chunked，同时出现Content-Length时以chunked为准
+            if(token_is(name, "transfer-encoding") && token_is(v, "chunked")){
+                m_chunked = true;
+            }
+            break;
+        case header_hash("expect"):
+            // Expect: 100-continue
+            if(token_is(name, "expect") && token_is(v, "100-continue")){
+                m_expect_continue = true;
+            }
+            break;
+        case header_hash("upgrade"):
+            // Upgrade: h2c，只在明文连接上有效，TLS连接通过ALPN协商h2
+            if(token_is(name, "upgrade") && token_is(v, "h2c") && !m_ssl){
+                m_upgrade_h2c = true;
+            }
+            break;
+        case header_hash("http2-settings"):
+            if(token_is(name, "http2-settings")){
+                m_h2_settings = value;
+            }
+            break;
+    }
+    return NO_REQUEST;
+}
+
+// 请求头解析完毕，准备接收请求体
+// 上传目录下的PUT/POST请求把请求体写入doc_root + m_url，其余请求的请求体交给m_body_handler
+http_conn::HTTP_CODE http_conn::begin_body(){
+    m_body_start = m_checked_idx;
+
+    // 建立请求视图并匹配路由，请求体处理函数和路由处理函数看到的是同一个请求
+    fill_request();
+    m_route_node = route_match(m_routes, m_bufs->request.path, m_bufs->request.params);
+
+    // 接管连接的路由：请求体由处理函数自己读取，现在就调用它
+    // 处理函数直接读写socket，TLS连接只有两个方向都卸载到内核后才能接管
+    if(m_route_node && m_route_node->targets[m_method].takeover){
+        if(m_ssl && !(m_ktls_send && m_ktls_recv)){
+            log("takeover route needs kTLS on TLS connections\n");
+            return INTERNAL_ERROR;
+        }
+        if(m_expect_continue && (m_content_length > 0 || m_chunked) && m_read_idx == m_checked_idx){
+            const char* resp = "HTTP/1.1 100 Continue\r\n\r\n";
+            sock_send(resp, strlen(resp), 0);
+        }
+        return do_route();
+    }
+
+    bool upload = !m_route_node && m_upload_prefix && (m_method == PUT || m_method == POST)
+        && strncmp(m_url, m_upload_prefix, strlen(m_upload_prefix)) == 0;
+    if(!m_route_node && m_method == PUT && !upload){
+        return FORBIDDEN_RERQUEST;
+    }
+    if(upload){
+        if(strstr(m_url, "..")){
+            return FORBIDDEN_RERQUEST;
         }
-        // 否则说明我们已经得到了一个完整的HTTP请求
+        strcpy(m_bufs->real_file, doc_root);
+        int len = strlen(doc_root);
+        strncpy(m_bufs->real_file + len, m_url, FILENAME_LEN - len - 1);
+
+        m_upload_fd = open(m_bufs->real_file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if(m_upload_fd < 0){
+            return (errno == ENOENT) ? NO_RESOURCE : FORBIDDEN_RERQUEST;
+        }
+        // chunked请求体需要解码，只有定长的请求体才能直接splice；TLS连接需要内核解密
+        m_upload_splice = !m_chunked && (!m_ssl || m_ktls_recv);
+    }
+
+    if(m_content_length == 0 && !m_chunked){
         return GET_REQUEST;
-    }else if (strncasecmp(text, "Connection:", 11) == 0){
-        // Connection: keep-alive
-        text += 11;
-        text += strspn(text, "\t"); // 找到第一个不等于这个字符/str的位置
-        if(strcasecmp(text, "keep-alive") == 0){
-            m_linger = true;
-        }
-    }else if (strncasecmp(text, "Content-Length:", 15) == 0){
-        // 处理Content-Length头部字段
-        text += 15;
-        text += strspn(text, "\t"); // 找到第一个不等于这个字符/str的位置
-        m_content_length = atol(text); //ascii to long
-    }else if (strncasecmp(text, "Host:", 5) == 0){
-        // 处理Content-Length头部字段
-        text += 5;
-        text += strspn(text, "\t"); // 找到第一个不等于这个字符/str的位置
-        m_host = text; //ascii to long
-    }else{
-        printf("unknown header %s\n", text);
+    }
+    m_check_state = CHECK_STATE_CONTENT;
+    m_body_since = coarse_clock::now();
+    set_deadline(conn_deadline::BODY, m_body_since + conn_deadline::timeout(conn_deadline::BODY));
+
+    // 请求体还没有到达，回复100 Continue让客户端开始发送
+    if(m_expect_continue && m_read_idx == m_checked_idx){
+        const char* resp = "HTTP/1.1 100 Continue\r\n\r\n";
+        sock_send(resp, strlen(resp), 0);
     }
     return NO_REQUEST;
 }
 
-// 没有完全解析HTTP请求体，只是判断其是否被完整的读入了
-http_conn::HTTP_CODE http_conn::parse_content(char* text){
-    if(m_read_idx >= (m_content_length + m_checked_idx)){
-        text[m_content_length] = '\0';
-        return GET_REQUEST;
+// 处理读缓冲区中已有的请求体数据，交给处理函数后腾出缓冲区空间继续接收
+http_conn::HTTP_CODE http_conn::parse_content(){
+    HTTP_CODE ret = NO_REQUEST;
+    if(m_chunked){
+        ret = parse_chunked();
+    }else{
+        long remain = m_content_length - m_body_received;
+        int len = m_read_idx - m_checked_idx;
+        if(len > remain){
+            len = remain;
+        }
+        if(len > 0){
+            if(!deliver_body(m_read_buf + m_checked_idx, len)){
+                return INTERNAL_ERROR;
+            }
+            m_checked_idx += len;
+            m_body_received += len;
+        }
+        m_start_line = m_checked_idx;
+
+        if(m_body_received >= m_content_length){
+            ret = GET_REQUEST;
+        }else if(m_upload_splice){
+            ret = splice_body();
+        }
+    }
+
+    if(ret == NO_REQUEST){
+        compact_body();
+    }
+    return ret;
+}
+
+// chunked请求体的增量解码，每次处理读缓冲区中已有的数据，不完整的行留到下次
+http_conn::HTTP_CODE http_conn::parse_chunked(){
+    while(m_checked_idx < m_read_idx){
+        if(m_chunk_state == CHUNK_DATA){
+            int len = m_read_idx - m_checked_idx;
+            if(len > m_chunk_left){
+                len = m_chunk_left;
+            }
+            if(!deliver_body(m_read_buf + m_checked_idx, len)){
+                return INTERNAL_ERROR;
+            }
+            m_checked_idx += len;
+            m_body_received += len;
+            m_chunk_left -= len;
+            m_start_line = m_checked_idx;
+            if(m_chunk_left == 0){
+                m_chunk_state = CHUNK_DATA_END;
+            }
+            continue;
+        }
+
+        // 其余状态都按行处理
+        m_start_line = m_checked_idx;
+        LINE_STATUS line_status = parse_line();
+        if(line_status == LINE_BAD){
+            return BAD_REQUEST;
+        }
+        if(line_status == LINE_OPEN){
+            // 一行就占满了请求体可用的缓冲区
+            if(m_read_idx - m_start_line >= READ_BUFFER_SIZE - m_body_start){
+                return BAD_REQUEST;
+            }
+            break;
+        }
+        char* text = get_line();
+        m_start_line = m_checked_idx;
+
+        switch(m_chunk_state){
+            case CHUNK_SIZE:{
+                // 块大小是十六进制，后面可能跟着以;开头的扩展
+                char* end = NULL;
+                m_chunk_left = strtol(text, &end, 16);
+                if(end == text || m_chunk_left < 0){
+                    return BAD_REQUEST;
+                }
+                m_chunk_state = (m_chunk_left == 0) ? CHUNK_TRAILER : CHUNK_DATA;
+                break;
+            }
+            case CHUNK_DATA_END:{
+                if(text[0] != '\0'){
+                    return BAD_REQUEST;
+                }
+                m_chunk_state = CHUNK_SIZE;
+                break;
+            }
+            case CHUNK_TRAILER:{
+                // 忽略trailer头部，遇到空行表示请求体结束
+                if(text[0] == '\0'){
+                    m_chunk_state = CHUNK_DONE;
+                    return GET_REQUEST;
+                }
+                break;
+            }
+            default:
+                return INTERNAL_ERROR;
+        }
     }
     return NO_REQUEST;
 }
+
+bool http_conn::body_complete() const{
+    if(m_content_length == 0 && !m_chunked){
+        return true;
+    }
+    // 解析头部时就出错了（如上传目录不存在），请求体一个字节也没有读
+    if(m_check_state != CHECK_STATE_CONTENT){
+        return false;
+    }
+    return m_chunked ? m_chunk_state == CHUNK_DONE : m_body_received >= m_content_length;
+}
+
+// 上传模式：请求体不经过用户空间，socket -> 管道 -> 文件
+// 管道每个线程一个，每次都把管道里的数据全部搬进文件，所以下次使用时管道是空的
+http_conn::HTTP_CODE http_conn::splice_body(){
+    static const int SPLICE_PIPE_SIZE = 1 << 20;
+    static thread_local int splice_pipe[2] = {-1, -1};
+    if(splice_pipe[0] < 0){
+        if(pipe2(splice_pipe, O_CLOEXEC) < 0){
+            return INTERNAL_ERROR;
+        }
+        fcntl(splice_pipe[1], F_SETPIPE_SZ, SPLICE_PIPE_SIZE);
+    }
+
+    while(m_body_received < m_content_length){
+        long want = m_content_length - m_body_received;
+        if(want > SPLICE_PIPE_SIZE){
+            want = SPLICE_PIPE_SIZE;
+        }
+        ssize_t n = splice(m_sockfd, NULL, splice_pipe[1], NULL, want, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if(n == 0){
+            return CLOSED_CONNECTION;
+        }
+        if(n < 0){
+            if(errno == EAGAIN){
+                return NO_REQUEST;  // socket上暂时没有数据，等待下一次EPOLLIN
+            }
+            return INTERNAL_ERROR;
+        }
+        while(n > 0){
+            ssize_t m = splice(splice_pipe[0], NULL, m_upload_fd, NULL, n, SPLICE_F_MOVE);
+            if(m <= 0){
+                // 管道里还留着数据，关闭后下次重新创建
+                close(splice_pipe[0]);
+                close(splice_pipe[1]);
+                splice_pipe[0] = splice_pipe[1] = -1;
+                return INTERNAL_ERROR;
+            }
+            n -= m;
+            m_body_received += m;
+        }
+    }
+    return GET_REQUEST;
+}
+
+// 把一段请求体交给上传文件或者请求体处理函数
+bool http_conn::deliver_body(const char* data, int len){
+    if(m_upload_fd >= 0){
+        while(len > 0){
+            ssize_t n = ::write(m_upload_fd, data, len);
+            if(n < 0){
+                if(errno == EINTR){
+                    continue;
+                }
+                return false;
+            }
+            data += n;
+            len -= n;
+        }
+        return true;
+    }
+    if(m_route_node){
+        route_body_handler on_body = m_route_node->targets[m_method].on_body;
+        return on_body ? on_body(m_bufs->request, data, len) : true;
+    }
+    if(m_body_handler){
+        return m_body_handler(this, data, len);
+    }
+    return true;
+}
+
+// 请求体已经处理的部分不再需要，把未处理的数据移到请求体起始位置，请求行和头部保持不动
+void http_conn::compact_body(){
+    int left = m_read_idx - m_start_line;
+    if(m_start_line > m_body_start){
+        memmove(m_read_buf + m_body_start, m_read_buf + m_start_line, left);
+    }
+    m_read_idx = m_body_start + left;
+    m_checked_idx = m_start_line = m_body_start;
+}
+
+// 上传没有完成就结束了，删除写了一半的文件
+void http_conn::abort_upload(){
+    if(m_upload_fd >= 0){
+        close(m_upload_fd);
+        m_upload_fd = -1;
+        unlink(m_bufs->real_file);
+    }
+}
+
+// 建立交给处理函数的请求视图，字符串都指向读缓冲区
+void http_conn::fill_request(){
+    m_bufs->request.method = m_method;
+    m_bufs->request.url = m_url;
+    m_bufs->request.path = m_bufs->request.url;
+    m_bufs->request.query = std::string_view();
+    size_t pos = m_bufs->request.url.find('?');
+    if(pos != std::string_view::npos){
+        m_bufs->request.path = m_bufs->request.url.substr(0, pos);
+        m_bufs->request.query = m_bufs->request.url.substr(pos + 1);
+    }
+    m_bufs->request.version = m_version;
+    m_bufs->request.host = m_host ? std::string_view(m_host) : std::string_view();
+    m_bufs->request.content_length = m_content_length;
+    m_bufs->request.chunked = m_chunked;
+    m_bufs->request.params.count = 0;
+}
+
+// 调用匹配到的路由处理函数
+http_conn::HTTP_CODE http_conn::do_route(){
+    // 没有单独注册HEAD时使用GET的处理函数，只发送响应头
+    int method = m_method;
+    if(method == HEAD && !m_route_node->targets[HEAD].handler){
+        method = GET;
+    }
+    route_handler handler = m_route_node->targets[method].handler;
+    if(!handler){
+        return (m_method == OPTIONS) ? OPTIONS_REQUEST : METHOD_NOT_ALLOWED;
+    }
+    http_response resp(this);
+    handler(m_bufs->request, resp);
+    return HANDLER_REQUEST;
+}
+
+// 流式响应的上一段发送完毕，调用生产函数得到下一段
+bool http_conn::next_chunk(){
+    m_resp_body.clear();
+    http_response resp(this);
+    if(!m_resp_producer(resp, m_resp_ctx)){
+        return false;
+    }
+    // 生产函数必须写入数据或者结束响应，否则会一直被调用
+    if(m_resp_body.empty()){
+        return m_resp_producer == NULL;
+    }
+
+    m_write_idx = 0;
+    bytes_have_send = 0;
+    m_body_address = &m_resp_body[0];
+    m_iv[0].iov_base = m_write_buf;
+    m_iv[0].iov_len = 0;
+    m_iv[1].iov_base = m_body_address;
+    m_iv[1].iov_len = m_resp_body.size();
+    m_iv_count = 2;
+    bytes_to_send = m_resp_body.size();
+    return true;
+}
+
+void http_response::set_status(int status, const char* title){
+    m_conn->m_resp_status = status;
+    m_conn->m_resp_title = title;
+}
+
+void http_response::set_content_type(const char* type){
+    m_conn->m_resp_type = type;
+}
+
+bool http_response::add_header(const char* name, const char* value){
+    m_conn->m_resp_headers.append(name).append(": ").append(value).append("\r\n");
+    return true;
+}
+
+bool http_response::send(const char* data, size_t len){
+    m_conn->m_resp_body.assign(data, len);
+    return true;
+}
+
+void http_response::stream(stream_producer producer, void* ctx){
+    m_conn->m_resp_producer = producer;
+    m_conn->m_resp_ctx = ctx;
+    m_conn->m_resp_chunked = m_conn->m_version && strcasecmp(m_conn->m_version, "HTTP/1.1") == 0;
+}
+
+bool http_response::write_chunk(const char* data, size_t len){
+    if(len == 0){
+        return true;    // 长度为0的块表示结束，由end写入
+    }
+    std::string& body = m_conn->m_resp_body;
+    if(m_conn->m_resp_chunked){
+        char size_line[32];
+        snprintf(size_line, sizeof(size_line), "%zx\r\n", len);
+        body.append(size_line);
+    }
+    body.append(data, len);
+    if(m_conn->m_resp_chunked){
+        body.append("\r\n");
+    }
+    return true;
+}
+
+void http_response::end(){
+    if(m_conn->m_resp_chunked){
+        m_conn->m_resp_body.append("0\r\n\r\n");
+    }
+    m_conn->m_resp_producer = NULL;
+}
+
+http_hijack http_response::hijack(){
+    http_conn* c = m_conn;
+    c->m_hijacked = true;
+    http_hijack h;
+    h.fd = c->m_sockfd;
+    h.addr = (const sockaddr*)&c->m_address;
+    h.headers = c->m_read_buf + c->m_header_start;
+    h.headers_len = c->m_body_start - c->m_header_start;
+    h.pending = c->m_read_buf + c->m_body_start;
+    h.pending_len = c->m_read_idx - c->m_body_start;
+    return h;
+}
+
+bool http_response::keep_alive() const{
+    return m_conn->m_linger;
+}
+
+void http_response::set_keep_alive(bool keep){
+    m_conn->m_linger = keep;
+}
 char* http_conn::get_line(){
     return m_read_buf + m_start_line;
 }
@@ -315,6 +910,11 @@ http_conn::HTTP_CODE http_conn::process_read(){
     LINE_STATUS line_status = LINE_OK;
     HTTP_CODE ret = NO_REQUEST;
     char* text = nullptr;
+
+    // HTTP/2连接前言以 "PRI * HTTP/2.0" 开头，交给HTTP/2会话
+    if(m_check_state == CHECK_STATE_REQUESTLINE && m_start_line == 0 && m_read_idx >= 4 && memcmp(m_read_buf, "PRI ", 4) == 0){
+        return H2_PREFACE;
+    }
     while(((m_check_state == CHECK_STATE_CONTENT) && (line_status == LINE_OK)) || ((line_status = parse_line()) == LINE_OK)){
         // 获取一行数据
         text = get_line();
@@ -338,18 +938,23 @@ http_conn::HTTP_CODE http_conn::process_read(){
                     return BAD_REQUEST;
                 }else if(ret == GET_REQUEST){
                     log("get request!");
+                    // 没有请求体的升级请求，由HTTP/2会话在流1上应答
+                    if(m_upgrade_h2c && m_h2_settings && m_upload_fd < 0){
+                        return H2_UPGRADE;
+                    }
                     return do_request();
+                }else if(ret != NO_REQUEST){
+                    return ret;
                 }
                 break;
             }
             case CHECK_STATE_CONTENT:{
-                ret = parse_content(text);
+                ret = parse_content();
                 if(ret == GET_REQUEST){
                     log("get request2!");
                     return do_request();
                 }
-                line_status = LINE_OPEN;
-                break;
+                return ret;
             }
             default:{
                 return INTERNAL_ERROR;
@@ -363,43 +968,129 @@ http_conn::HTTP_CODE http_conn::process_read(){
 // 如果目标文件存在、对所有用户可读，且不是目录，则使用mmap将其映射到内存地址m_file_address处
 // 告诉调用者获取成功
 http_conn::HTTP_CODE http_conn::do_request(){
+    PROBE(request_parsed, m_sockfd, (int)m_method, m_url, m_content_length);
+    ++m_conn_requests;
 
-    strcpy(m_real_file, doc_root); //把doc_root复制到m_real_file里
+    // 上传的请求体已经全部写入文件
+    if(m_upload_fd >= 0){
+        close(m_upload_fd);
+        m_upload_fd = -1;
+        return CREATED_REQUEST;
+    }
+
+    // 匹配到路由的请求交给处理函数
+    if(m_route_node){
+        return do_route();
+    }
+
+    // 静态文件只支持GET、HEAD和POST
+    if(m_method == OPTIONS){
+        return OPTIONS_REQUEST;
+    }
+    if(m_method != GET && m_method != HEAD && m_method != POST){
+        return METHOD_NOT_ALLOWED;
+    }
+
+    // 协程模式下主线程不能阻塞在stat/open上，交给I/O线程
+    if(m_co_handle && io_pool::enabled()){
+        return OPEN_PENDING;
+    }
+
+    int fd = -1;
+    HTTP_CODE ret = open_file(m_url, &m_bufs->file_stat, &fd);
+    if(ret != FILE_REQUEST){
+        return ret;
+    }
+    PROBE(file_resolved, m_sockfd, m_url, (long)m_bufs->file_stat.st_size);
+
+    // 协程模式使用sendfile发送文件，保留文件描述符，不做内存映射
+    if(m_co_handle){
+        m_file_fd = fd;
+        return FILE_REQUEST;
+    }
+    // 创建内存映射，开启I/O线程池时保留文件描述符用于预读
+    m_file_address = (char*)mmap(0, m_bufs->file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(io_pool::enabled()){
+        m_file_fd = fd;
+    }else{
+        close(fd);
+    }
+    printf("file requested!\n");
+
+    return FILE_REQUEST;
+}
+
+// 静态文件：把URL映射到doc_root下的文件，检查文件是否存在、对所有用户可读、不是目录，然后以只读方式打开
+// HTTP/1.1和HTTP/2共用这条路径
+http_conn::HTTP_CODE http_conn::open_file(const char* url, struct stat* st, int* fd){
+    char real_file[FILENAME_LEN];
+    strcpy(real_file, doc_root); //把doc_root复制到real_file里
     int len = strlen(doc_root);
-    strncpy(m_real_file + len, m_url, FILENAME_LEN -len - 1);  // 相当于把url加到doc_root后面
+    strncpy(real_file + len, url, FILENAME_LEN - len - 1);  // 相当于把url加到doc_root后面
+    real_file[FILENAME_LEN - 1] = '\0';
 
-    //  获取m_real_file文件的相关状态信息，-1失败，0成功
-    if (stat(m_real_file, &m_file_stat) < 0){
+    // 元数据缓存：文件不存在、禁止访问、是目录时直接返回缓存的结果；普通文件先open，再用fstat的结果校验缓存的条目
+    int cached;
+    struct stat cached_st;
+    if(file_cache::enabled() && file_cache::lookup(real_file, &cached, &cached_st)){
+        if(cached != FILE_REQUEST){
+            return (HTTP_CODE)cached;
+        }
+        *fd = open(real_file, O_RDONLY);
+        if(*fd >= 0 && fstat(*fd, st) == 0 && !S_ISDIR(st->st_mode) && (st->st_mode & S_IROTH)){
+            if(st->st_ino != cached_st.st_ino || st->st_size != cached_st.st_size || st->st_mtim.tv_nsec != cached_st.st_mtim.tv_nsec
+                || st->st_mtim.tv_sec != cached_st.st_mtim.tv_sec){
+                file_cache::store(real_file, FILE_REQUEST, st);
+            }
+            return FILE_REQUEST;
+        }
+        // 文件在缓存的有效期内被删除或者修改了权限，按下面的流程重新检查
+        if(*fd >= 0){
+            close(*fd);
+        }
+    }
+    HTTP_CODE ret = stat_open(real_file, st, fd);
+    if(file_cache::enabled()){
+        file_cache::store(real_file, ret, st);
+    }
+    return ret;
+}
+
+http_conn::HTTP_CODE http_conn::stat_open(const char* real_file, struct stat* st, int* fd){
+    //  获取文件的相关状态信息，-1失败，0成功
+    if (stat(real_file, st) < 0){
         return NO_RESOURCE;
     }
 
     // 判断访问权限
-    if(!(m_file_stat.st_mode & S_IROTH)){
+    if(!(st->st_mode & S_IROTH)){
         return FORBIDDEN_RERQUEST;
     }
 
     // 判断是否是目录
-    if (S_ISDIR(m_file_stat.st_mode)){
+    if (S_ISDIR(st->st_mode)){
         log("m_file is dir\n");
         return BAD_REQUEST;
     }
 
     // 以只读方式打开文件
-    int fd = open(m_real_file, O_RDONLY);
-    // 创建内存映射
-    m_file_address = (char*)mmap(0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
-    close(fd);
-    printf("file requested!\n");
-
+    *fd = open(real_file, O_RDONLY);
+    if(*fd < 0){
+        return FORBIDDEN_RERQUEST;
+    }
     return FILE_REQUEST;
 }
 
-// 对内存映射去执行munmap操作
+// 对内存映射去执行munmap操作，关闭sendfile使用的文件
 void http_conn::unmap(){
     if(m_file_address){
-        munmap(m_file_address, m_file_stat.st_size);
+        munmap(m_file_address, m_bufs->file_stat.st_size);
         m_file_address = nullptr;
     }
+    if(m_file_fd >= 0){
+        close(m_file_fd);
+        m_file_fd = -1;
+    }
 }
 
 // 写HTTP响应
@@ -407,18 +1098,48 @@ bool http_conn::write(){
     int temp = 0;
 
     if (bytes_to_send == 0){
-        // 将要发送的字节为0，这一次响应结束，改为可读
-        modfd(m_epollfd, m_sockfd, EPOLLIN);
+        // 将要发送的字节为0（或者响应已经由接管连接的处理函数发送），这一次响应结束，改为可读
+        log_access();
+        if(!m_linger){
+            return false;
+        }
         init();
+        modfd(m_epollfd, m_sockfd, EPOLLIN);
         return true;
     }
     while(1){
+        // 文件响应体的下一段不在页缓存中时交给I/O线程预读，主线程不等待磁盘，预读完成后由io_done重新调用write
+        if(m_file_address && m_body_address == m_file_address && io_pool::enabled() && !file_window()){
+            return true;
+        }
+
+        // 限速的响应：这一次最多发送quota字节，令牌不足时交给pacer，到时间后由主线程继续发送
+        // 连接的事件没有重新注册，等待期间只有pacer会再访问它
+        struct iovec* iv = m_iv;
+        struct iovec paced[2];
+        if(m_pace.rule){
+            size_t quota = pacer::quota(m_pace, m_sockfd, bytes_to_send);
+            if(quota == 0){
+                pace_defer();
+                return true;
+            }
+            if(quota < (size_t)bytes_to_send){
+                iv = paced;
+                for(int i = 0; i < m_iv_count; ++i){
+                    paced[i].iov_base = m_iv[i].iov_base;
+                    paced[i].iov_len = std::min(m_iv[i].iov_len, quota);
+                    quota -= paced[i].iov_len;
+                }
+            }
+        }
+
         // writev将多个数据存储在一起，将驻留在两个或更多的不连接的缓冲区中的数据一次写出去。
-        temp = writev(m_sockfd, m_iv, m_iv_count);
+        temp = sock_writev(iv, m_iv_count);
         if (temp <= -1){
             // 如果TCP写缓冲没有空间，则等待下一轮EPOLLOUT事件
             // 此时，服务器无法立刻接受同一客户的下一个请求，但可以保证连接的完整性
             if (errno == EAGAIN){
+                PROBE(write_partial, m_sockfd, (long)bytes_have_send, (long)bytes_to_send);
                 modfd(m_epollfd, m_sockfd, EPOLLOUT);
                 return true;
             }
@@ -428,15 +1149,20 @@ bool http_conn::write(){
 
         bytes_have_send += temp;
         bytes_to_send -= temp;
+        m_resp_bytes += temp;
+        write_progress();
+        if(m_pace.rule){
+            pacer::consume(m_pace, temp);
+        }
 
         // 如果当前已经发送的字节数大于等于第一个iovec的长度
         if (bytes_have_send >= m_iv[0].iov_len){
             // 把第一个iovec的长度置为0，因为已经发送完了
             m_iv[0].iov_len = 0;
             
-            // 把第二个iovec的base指针设为文件地址加上已发送的字节数减去响应头的长度
+            // 把第二个iovec的base指针设为响应体地址加上已发送的字节数减去响应头的长度
             // 这样第二个iovec就指向了响应体
-            m_iv[1].iov_base = m_file_address + (bytes_have_send - m_write_idx);
+            m_iv[1].iov_base = m_body_address + (bytes_have_send - m_write_idx);
             m_iv[1].iov_len = bytes_to_send;
         }
         else{
@@ -447,13 +1173,23 @@ bool http_conn::write(){
             m_iv[0].iov_len = m_iv[0].iov_len - temp;
         }
         if (bytes_to_send <= 0){
+            // 流式响应：这一段发送完了，让生产函数填充下一段
+            if (m_resp_producer){
+                if (!next_chunk()){
+                    return false;
+                }
+                continue;
+            }
+
             // 没有数据要发送了，改为可读，等待下一次事件
             unmap();
-            modfd(m_epollfd, m_sockfd, EPOLLIN);
+            log_access();
 
             // 如果支持HTTP长连接，需要调用init()函数，初始化HTTP对象
+            // 先初始化再注册可读：write可能运行在工作线程上，注册之后主线程随时会处理这个连接
             if(m_linger){
                 init();
+                modfd(m_epollfd, m_sockfd, EPOLLIN);
                 return true;
             }else{
                 return false;
@@ -463,6 +1199,85 @@ bool http_conn::write(){
     }
 }
 
+// 热文件的页都在页缓存中，检查通过后直接发送；writev不越过已经确认的范围
+bool http_conn::file_window(){
+    size_t size = m_bufs->file_stat.st_size;
+    size_t off = (bytes_have_send > m_write_idx) ? bytes_have_send - m_write_idx : 0;
+    if(off >= m_io_checked && off < size){
+        size_t len = std::min(io_pool::WINDOW, size - off);
+        if(!io_pool::resident(m_file_address, -1, off, len) && io_pool::prefetch(this, m_io_gen, m_file_fd, off, len)){
+            return false;
+        }
+        m_io_checked = off + len;
+    }
+    if(m_iv[1].iov_len > m_io_checked - off){
+        m_iv[1].iov_len = m_io_checked - off;
+    }
+    return true;
+}
+
+http_conn::HTTP_CODE http_conn::open_done(){
+    HTTP_CODE ret;
+    int fd = -1;
+    if(m_io_job){
+        ret = (HTTP_CODE)m_io_job->result;
+        fd = m_io_job->file_fd;
+        m_bufs->file_stat = m_io_job->st;
+        delete m_io_job;
+        m_io_job = NULL;
+    }else{
+        // 任务没有提交成功，在主线程上直接打开
+        ret = open_file(m_url, &m_bufs->file_stat, &fd);
+    }
+    if(ret == FILE_REQUEST){
+        PROBE(file_resolved, m_sockfd, m_url, (long)m_bufs->file_stat.st_size);
+        m_file_fd = fd;
+    }
+    return ret;
+}
+
+void http_conn::io_done(io_job* job){
+    if(job->type == io_job::OPEN){
+        m_io_job = job;
+        co_resume();
+        return;
+    }
+    m_io_checked = job->off + job->len;
+    delete job;
+    if(m_co_handle){
+        co_resume();
+    }else if(!write()){
+        close_conn();
+    }
+}
+
+void http_conn::pace_defer(){
+    pacer::defer(this, m_io_gen, m_pace);
+}
+
+// 等待令牌不是对方不读响应，重新计算发送的截止时间，速率很低的长下载不会被当成发送停滞关闭
+void http_conn::pace_resume(){
+    write_progress();
+    if(m_co_handle){
+        co_resume();
+    }else if(!write()){
+        close_conn();
+    }
+}
+
+// 接管连接的处理函数自己发送响应，状态码和字节数记为0
+void http_conn::log_access(){
+    PROBE(response_sent, m_sockfd, m_log_status, (long)m_resp_bytes);
+    prefork::on_response(m_resp_bytes);
+    if(m_req_start){
+        access_log::append(m_client_addr, m_client_port, m_method, m_hijacked ? 0 : m_log_status, m_resp_bytes,
+            m_req_start, m_url ? m_url : "", m_ssl ? (PROTO_HTTP1 | PROTO_TLS) : PROTO_HTTP1);
+        m_req_start = 0;
+    }
+    m_resp_bytes = 0;
+    m_log_status = 0;
+}
+
 // 往写中写入待发送的数据缓冲
 bool http_conn::add_response(const char* format, ...){
     if(m_write_idx >= WRITE_BUFFER_SIZE){
@@ -487,7 +1302,18 @@ bool http_conn::add_response(const char* format, ...){
     return true;
 }
 bool http_conn::add_status_line(int status, const char* title){
-    return add_response("%s %d %s\r\n", "HTTP/1.1", status, title);
+    m_log_status = status;
+    return add_response("%s %d %s\r\n", "HTTP/1.1", status, title) && add_date();
+}
+
+// Date头部每秒格式化一次，这里直接复制
+bool http_conn::add_date(){
+    if(m_write_idx + coarse_clock::DATE_LEN >= WRITE_BUFFER_SIZE - 1){
+        return false;
+    }
+    memcpy(m_write_buf + m_write_idx, coarse_clock::date_header(), coarse_clock::DATE_LEN);
+    m_write_idx += coarse_clock::DATE_LEN;
+    return true;
 }
 
 void http_conn::add_headers(int content_len){
@@ -498,7 +1324,7 @@ void http_conn::add_headers(int content_len){
 }
 
 bool http_conn::add_content_length(int content_len){
-    return add_response("Content-Length: %d\r\n", "HTTP/1.1", content_len);
+    return add_response("Content-Length: %d\r\n", content_len);
 }
 
 bool http_conn::add_content_type(){
@@ -517,8 +1343,18 @@ bool http_conn::add_content(const char* content){
     return add_response("%s", content);
 }
 
+bool http_conn::add_allow(){
+    if(m_route_node){
+        return add_response("Allow: %s\r\n", route_allow(m_route_node).c_str());
+    }
+    return add_response("Allow: %s\r\n", "GET, HEAD, POST, OPTIONS");
+}
+
 // 根据服务器处理HTTP请求的结果，决定返回给客户端的内容
 bool http_conn::process_write(HTTP_CODE ret){
+    if(pacer::enabled()){
+        pacer::start(m_pace, m_url, m_sockfd);
+    }
     switch (ret)
     {
         case INTERNAL_ERROR:
@@ -553,16 +1389,86 @@ bool http_conn::process_write(HTTP_CODE ret){
             }
             log("Response code is FORBIDDEN_RERQUEST\n");
             break;
+        case CREATED_REQUEST:
+            add_status_line(201, ok_201_title);
+            add_headers(strlen(ok_201_form));
+            if(!add_content(ok_201_form)){
+                return false;
+            }
+            log("Response code is CREATED_REQUEST\n");
+            break;
+        case METHOD_NOT_ALLOWED:
+            add_status_line(405, error_405_title);
+            add_allow();
+            add_headers(strlen(error_405_form));
+            if(!add_content(error_405_form)){
+                return false;
+            }
+            log("Response code is METHOD_NOT_ALLOWED\n");
+            break;
+        case OPTIONS_REQUEST:
+            add_status_line(204, "No Content");
+            add_allow();
+            add_linger();
+            if(!add_blank_line()){
+                return false;
+            }
+            break;
+        case HANDLER_REQUEST:
+            // 处理函数接管了连接，响应已经由它发送完毕
+            if(m_hijacked){
+                m_iv_count = 0;
+                bytes_to_send = 0;
+                return true;
+            }
+            add_status_line(m_resp_status, m_resp_title);
+            if(m_resp_producer){
+                if(m_resp_chunked){
+                    add_response("Transfer-Encoding: chunked\r\n");
+                }else{
+                    m_linger = false;   // HTTP/1.0的流式响应以关闭连接结束
+                }
+            }else{
+                add_content_length(m_resp_body.size());
+            }
+            add_response("Content-Type: %s\r\n", m_resp_type ? m_resp_type : "text/html");
+            if(!m_resp_headers.empty()){
+                add_response("%s", m_resp_headers.c_str());
+            }
+            add_linger();
+            if(!add_blank_line()){
+                return false;
+            }
+
+            // HEAD请求只发送响应头
+            if(m_method == HEAD){
+                m_resp_body.clear();
+                m_resp_producer = NULL;
+            }
+            m_body_address = &m_resp_body[0];
+            m_iv[0].iov_base = m_write_buf;
+            m_iv[0].iov_len = m_write_idx;
+            m_iv[1].iov_base = m_body_address;
+            m_iv[1].iov_len = m_resp_body.size();
+            m_iv_count = 2;
+            bytes_to_send = m_write_idx + m_resp_body.size();
+            log("Response code is HANDLER_REQUEST\n");
+            return true;
         case FILE_REQUEST:
             add_status_line(200, ok_200_title);
-            add_headers(m_file_stat.st_size);
+            add_headers(m_bufs->file_stat.st_size);
+            if(m_method == HEAD){
+                unmap();
+                break;
+            }
+            m_body_address = m_file_address;
             m_iv[0].iov_base = m_write_buf;
             m_iv[0].iov_len = m_write_idx;
             m_iv[1].iov_base = m_file_address;
-            m_iv[1].iov_len = m_file_stat.st_size;
+            m_iv[1].iov_len = m_bufs->file_stat.st_size;
             m_iv_count = 2;
 
-            bytes_to_send = m_write_idx + m_file_stat.st_size; 
+            bytes_to_send = m_write_idx + m_bufs->file_stat.st_size; 
             log("Response code is FILE_REQUEST\n");        
             return true;
         default:
@@ -579,6 +1485,16 @@ bool http_conn::process_write(HTTP_CODE ret){
 // 由线程池中的工作线程调用，处理HTTP请求的入口函数
 void http_conn::process(){
     HTTP_CODE read_ret = process_read();
+
+    // 读缓冲区满时OpenSSL中可能还留着同一条记录解密出来的数据，socket上已经没有数据，注册EPOLLIN后不会再有通知
+    // 请求体腾出空间后在这个线程上接着读，直到取完OpenSSL中的数据或者请求完整
+    while (read_ret == NO_REQUEST && sock_pending() > 0){
+        if (!read()){
+            close_conn();
+            return;
+        }
+        read_ret = process_read();
+    }
     
     if (read_ret == BAD_REQUEST){
         log("process_read = BAD_REQUEST");
@@ -591,12 +1507,40 @@ void http_conn::process(){
         return;
     }
 
+    // 请求接收完了，之后是处理和发送响应的阶段
+    set_deadline(conn_deadline::WRITE, coarse_clock::now() + conn_deadline::timeout(conn_deadline::WRITE));
+
+    // 切换到HTTP/2，之后的事件由主线程的h2_event处理
+    if (read_ret == H2_PREFACE || read_ret == H2_UPGRADE){
+        if(!h2_start(read_ret == H2_UPGRADE)){
+            close_conn();
+        }
+        return;
+    }
+
+    // 请求体没有被完整读取就出错了，剩下的数据无法和下一个请求区分，响应后关闭连接
+    // 接管连接的处理函数自己读完了请求体
+    if (!m_hijacked && !body_complete()){
+        m_linger = false;
+    }
+
     // 调用process_write完成报文响应
     bool write_ret = process_write(read_ret);
     log("answer over!\n");
     if (!write_ret){
         close_conn();
+        return;
+    }
+    PROBE(response_queued, m_sockfd, m_log_status, (long)bytes_to_send);
+
+    // 发送缓冲区通常是空的，直接在工作线程上发送，省去一次epoll_ctl和主线程的唤醒；发送缓冲区满(EAGAIN)时write注册EPOLLOUT交给主线程
+    // 连接注册了EPOLLONESHOT，重新注册事件之前只有这个线程在处理它，write在重新注册之后不再访问连接
+    // 流式响应的生产函数约定在主线程上调用，仍然交给主线程发送
+    if (m_resp_producer){
+        modfd(m_epollfd, m_sockfd, EPOLLOUT);
+        return;
+    }
+    if (!write()){
+        close_conn();
     }
-    //注册并监听写事件
-    modfd(m_epollfd, m_sockfd, EPOLLOUT);
 }
@@ -11,27 +11,53 @@
 #include <fcntl.h>
 #include <sys/epoll.h>
 #include <signal.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <coroutine>
+#include <atomic>
+#include <string>
 #include "web_timer.h"
+#include "router.h"
+#include "tls.h"
+#include "ratelimit.h"
+#include "access_log.h"
+#include "io_pool.h"
+#include "fair_sched.h"
+#include "tcp_health.h"
+#include "coarse_clock.h"
+#include "pacer.h"
+#include "conn_deadline.h"
+#include "prefork.h"
+#include "file_cache.h"
 
 class sort_timer_lst;
 class util_timer;
+struct co_task;
+class h2_session;
 
 #define COUT_OPEN 1
 const bool ET = true;
 #define TIMESLOT 5   // 定时器周期：秒
 
-class http_conn{
+// 对象按缓存行对齐，相邻fd的连接被不同工作线程同时写入时不会落在同一条缓存行上（伪共享）
+class alignas(64) http_conn{
+    friend class http_response;
+    friend class h2_session;
 public:
     static int m_epollfd; // 所有的socket上的事件都被注册到同一个epoll对象中，所以设置成静态
-    static int m_user_count; // 统计用户的数量
+    static std::atomic<int> m_user_count; // 统计用户的数量，工作线程发送完响应后也可能关闭连接
     static int m_request_cnt; // 接收到的请求次数
     static sort_timer_lst m_timer_lst; // 定时器链表
+    static const char* m_upload_prefix; // 上传目录的URL前缀，为NULL时不接受上传
+    static route_view m_routes; // 路由表，没有匹配路由的请求按doc_root提供静态文件
+    static int m_busy_poll; // 忙轮询的时长：微秒，0表示不开启，新连接的socket设置SO_BUSY_POLL
 
     static const int FILENAME_LEN = 200; // 文件名的最大长度
     static const int READ_BUFFER_SIZE = 2048; // 读缓冲区的大小
     static const int WRITE_BUFFER_SIZE = 1024; // 写缓冲区的大小
 
-    util_timer* timer; // 定时器
+    util_timer* timer = NULL; // 定时器，连接关闭后可能还留在链表中，fd被新连接复用时在init中删除
+    bool rate_counted = false; // 连接计入了rate_limiter中客户端的连接数，关闭时归还
 
 public:
     // HTTP请求方法
@@ -43,6 +69,16 @@ public:
     CHECK_STATE_CONTENT：分析请求体
     */
    enum CHECK_STATE {CHECK_STATE_REQUESTLINE = 0, CHECK_STATE_HEADER, CHECK_STATE_CONTENT};
+
+    /*
+    chunked请求体解码器的状态
+    CHUNK_SIZE：分析块大小行
+    CHUNK_DATA：接收块数据
+    CHUNK_DATA_END：块数据之后的CRLF
+    CHUNK_TRAILER：最后一个块之后的trailer头部，直到空行
+    CHUNK_DONE：请求体已经全部读取
+    */
+    enum CHUNK_STATE {CHUNK_SIZE = 0, CHUNK_DATA, CHUNK_DATA_END, CHUNK_TRAILER, CHUNK_DONE};
     
     /*
     服务器处理HTTP请求的可能结果，报文解析的结果
@@ -54,74 +90,239 @@ public:
     FILE_REQUEST：文件请求，获取文件成功
     INTERNAL_ERROR：表示服务器内部错误
     CLOSED_CONNECTION：表示客户端已经关闭连接了
+    CREATED_REQUEST：上传的请求体已经全部写入文件
+    HANDLER_REQUEST：路由处理函数已经填充了响应
+    METHOD_NOT_ALLOWED：资源不支持该请求方法
+    OPTIONS_REQUEST：OPTIONS请求，应答允许的方法
+    H2_PREFACE：客户端直接发送了HTTP/2连接前言（h2c prior knowledge）
+    H2_UPGRADE：客户端请求升级到h2c
+    OPEN_PENDING：协程模式下静态文件的stat/open交给了I/O线程，由open_done取得结果
     */ 
-    enum HTTP_CODE {NO_REQUEST, GET_REQUEST, BAD_REQUEST, NO_RESOURCE, FORBIDDEN_RERQUEST, FILE_REQUEST, INTERNAL_ERROR, CLOSED_CONNECTION};
+    enum HTTP_CODE {NO_REQUEST, GET_REQUEST, BAD_REQUEST, NO_RESOURCE, FORBIDDEN_RERQUEST, FILE_REQUEST, INTERNAL_ERROR, CLOSED_CONNECTION, CREATED_REQUEST,
+        HANDLER_REQUEST, METHOD_NOT_ALLOWED, OPTIONS_REQUEST, H2_PREFACE, H2_UPGRADE, OPEN_PENDING};
+
+    // 请求体处理函数，请求体数据每到达一段就调用一次，返回false表示处理失败
+    typedef bool (*body_handler)(http_conn* conn, const char* data, int len);
+    static body_handler m_body_handler; // 为NULL时丢弃非上传请求的请求体
     
     // 行的读取状态，0-读取到一个完整的行 1-行出错 2- 行数据尚且不完整
     enum LINE_STATUS {LINE_OK = 0, LINE_BAD, LINE_OPEN};
 
  public:   
     http_conn(){};
-    ~http_conn(){};
+    ~http_conn(){ delete m_bufs; };
 
     void process(); // 响应，处理客户端的请求
-    void init(int sockfd, const sockaddr_in &addr); // 初始化新接收的连接
+    void init(int sockfd, const sockaddr* addr, socklen_t addr_len, SSL* ssl = NULL); // 初始化新接收的连接，ssl为TLS监听socket上的会话
     void close_conn(); // 关闭连接
     bool read(); // 非阻塞读数据
     bool write(); // 非阻塞写数据
+    bool admit(); // 读到新请求的开头时按客户端IP限流，超限时发送429并返回false，由调用者关闭连接
+
+    // 协程模式，见co_conn.cpp
+    void co_start(); // 为新连接创建协程
+    void co_resume(); // 连接上有事件，恢复协程
+
+    // TLS握手，见tls.cpp
+    bool tls_handshaking() const { return m_ssl && !m_tls_ready; }
+    int tls_handshake(); // 推进握手：完成返回0，需要等待时返回等待的事件(EPOLLIN/EPOLLOUT)，出错返回-1
+
+    // HTTP/2，见h2.cpp
+    // 切换后连接上的所有事件都由h2_event在主线程处理，不再经过线程池或者协程
+    bool is_h2() const { return m_h2 != NULL; }
+    bool h2_start(bool upgraded); // 切换到HTTP/2，读缓冲区中还未处理的数据交给会话，失败返回false
+    bool h2_event(); // 连接上有事件：读入并处理帧，发送输出，重新注册事件；返回false时关闭连接
+
+    // 静态文件，HTTP/1.1和HTTP/2共用
+    static HTTP_CODE open_file(const char* url, struct stat* st, int* fd);
+
+    // 文件I/O线程池，见io_pool.h
+    // 连接关闭时代数加一，完成的任务代数不同时说明提交它的连接已经不在了
+    uint32_t io_generation() const { return m_io_gen; }
+    void io_done(io_job* job); // 主线程：任务完成，继续发送或者恢复协程
+
+    // 响应限速，见pacer.h
+    void pace_defer(); // 令牌不足，等待pacer
+    void pace_resume(); // 主线程：等待到期，继续发送或者恢复协程
+
+    // socket读写，TLS连接在没有kTLS时经过OpenSSL，返回值和errno与对应的系统调用一致
+    int get_sockfd() const { return m_sockfd; }
+    ssize_t sock_recv(char* buf, size_t len);
+    int sock_pending() const; // OpenSSL中已经解密、还没有被sock_recv取走的字节数，这部分数据不会再触发EPOLLIN
+    ssize_t sock_send(const char* buf, size_t len, int flags);
+    ssize_t sock_writev(const struct iovec* iov, int count);
+    ssize_t sock_sendfile(int in_fd, off_t* offset, size_t count);
+
+    // 连接是否被处理函数接管，接管期间工作线程在同步收发，定时器不能关闭它
+    bool hijacked() const { return m_hijacked; }
+
+    // 空闲的长连接：上一个响应已经发送完（或者还没有收到第一个请求），还没有读到下一个请求的数据，没有线程在使用它
+    // 连接数达到高水位时可以被主线程关闭，见conn_limit.h
+    bool idle() const { return m_sockfd >= 0 && m_idle.load(std::memory_order_acquire) && !m_hijacked && !m_h2; }
+
+    // 当前阶段的截止时间和阶段（conn_deadline::PHASE），工作线程切换阶段或者发送有进展时更新，主线程的定时器处理中读取
+    time_t deadline() const { return m_deadline.load(std::memory_order_relaxed); }
+    int deadline_phase() const { return m_phase.load(std::memory_order_relaxed); }
+    // 发送出了数据，重新计算发送响应的截止时间
+    void write_progress(){ m_deadline.store(coarse_clock::now() + conn_deadline::timeout(conn_deadline::WRITE), std::memory_order_relaxed); }
+
+    // 线程池公平调度时请求所属的类和权重，见fair_sched.h
+    uint64_t sched_key() const { return fair_sched::key_of(m_client_addr, m_sockfd, m_io_gen); }
+    int sched_weight() const { return m_sched_weight; }
+
+    // TCP_INFO采样，见tcp_health.cpp；只在主线程的定时器处理中调用
+    void tcp_sample();
+
+    // 限流、公平调度和访问日志按32位的IPv4地址（网络字节序）区分客户端，其它地址族的映射见http_conn.cpp
+    static in_addr_t client_key(const sockaddr* addr, in_port_t* port);
+    in_addr_t client_addr() const { return m_client_addr; }
+    // 用于日志的对方地址，如 1.2.3.4:5678、[::1]:5678、unix
+    void peer_name(char* buf, size_t len) const;
 
 private:
     void init(); // 初始化连接
+    void set_deadline(int phase, time_t deadline){
+        m_phase.store(phase, std::memory_order_relaxed);
+        m_deadline.store(deadline, std::memory_order_relaxed);
+    }
+    void on_receive(); // 主线程读到数据：新请求开始计算读请求头的时间，请求体按收到的字节数推后截止时间，并调整定时器
     HTTP_CODE process_read(); // 解析HTTP请求
     bool process_write(HTTP_CODE ret); // 填充HTTP应答
 
     // 下面这组函数被process_read调用以分析HTTP请求
     HTTP_CODE parse_request_line(char* text);
     HTTP_CODE parse_headers(char* text);
-    HTTP_CODE parse_content(char* text);
+    HTTP_CODE parse_content();
     HTTP_CODE do_request();
+
+    // 下面这组函数处理流式请求体
+    HTTP_CODE begin_body();
+    HTTP_CODE parse_chunked();
+    HTTP_CODE splice_body();
+    bool deliver_body(const char* data, int len);
+    void compact_body();
+    void abort_upload();
+    bool body_complete() const; // 请求体已经全部读取（或者没有请求体），响应之后可以继续处理这个连接上的下一个请求
+
+    // 路由分发
+    void fill_request();
+    HTTP_CODE do_route();
+    bool next_chunk();
     char* get_line();
     LINE_STATUS parse_line();
 
+    static HTTP_CODE stat_open(const char* real_file, struct stat* st, int* fd); // open_file没有命中元数据缓存时stat并打开文件
+
     // 下面这组函数被process_write调用以填充HTTP应答
     void unmap();
     bool add_response(const char* format, ...);
     bool add_content(const char* content);
     bool add_content_type();
     bool add_status_line(int status, const char* title);
+    bool add_date();
     void add_headers(int content_length);
     bool add_content_length(int content_length);
     bool add_linger();
     bool add_blank_line();
+    bool add_allow();
+
+    void log_access(); // 响应发送完毕，写一条访问日志
+    bool file_window(); // 发送文件响应体之前确认下一段在页缓存中
+    HTTP_CODE open_done(); // 协程模式：取得I/O线程打开文件的结果
+
+    bool h2_receive(); // 读入并处理帧，然后发送输出
+    bool h2_pump(); // 发送HTTP/2会话的输出
+
+    co_task co_process(); // 连接协程
 
 private:
-    int m_sockfd; // 该HTTP连接的socket
-    sockaddr_in m_address; // 通信的socket地址
+    // 热字段：主线程分发事件、工作线程每次读写都会访问，和前面的timer一起放在对象开头的两条缓存行里
+    int m_sockfd = -1;                  // 该HTTP连接的socket
+    CHECK_STATE m_check_state;          // 主状态机当前所处的状态
+    int m_read_idx = 0;                 // 标识读缓冲区中已经读入的客户端数据的最后一个字节的下一个位置
+    int m_checked_idx = 0;              // 当前正在分析的字符在读缓冲区中的位置
+    int m_start_line = 0;               // 当前正在解析的行的起始位置
+    int m_write_idx = 0;                // 写缓冲区中待发送的字节数
+    int m_iv_count;                     // 被写内存块的数量
+    int bytes_to_send;                  // 将要发送的数据字节数
+    int bytes_have_send;                // 已经发送的字节数
+    struct iovec m_iv[2];               // 采用writev来执行写操作
+    char* m_read_buf = NULL;            // 读缓冲区，指向m_bufs
+    char* m_write_buf = NULL;           // 写缓冲区，指向m_bufs
+    SSL* m_ssl;                         // TLS会话，明文连接为NULL
+    h2_session* m_h2 = NULL;            // HTTP/2会话，HTTP/1.x连接为NULL
+    std::coroutine_handle<> m_co_handle;// 协程模式下该连接的协程
+    bool m_tls_ready;                   // 握手已经完成
+    bool m_ktls_send;                   // 发送方向已经卸载到内核，可以直接writev/sendfile
+    bool m_ktls_recv;                   // 接收方向已经卸载到内核，可以直接recv/splice
+    bool m_linger;                      // HTTP请求是否要求保持连接
+    std::atomic<bool> m_hijacked;       // 处理函数接管了连接，响应已经由它发送
+    std::atomic<bool> m_idle;           // 在等待下一个请求，init的最后置位，主线程读到数据时清除
+    std::atomic<uint8_t> m_phase;       // 所处的阶段，见conn_deadline.h
+    std::atomic<time_t> m_deadline;     // 当前阶段的截止时间
 
 private:
-    char m_read_buf[READ_BUFFER_SIZE];  // 读缓冲区
-    int m_read_idx;                     // 标识读缓冲区中已经读入的客户端数据的最后一个字节的下一个位置
-    int m_checked_idx;                  // 当前正在分析的字符在读缓冲区中的位置
-    int m_start_line;                   // 当前正在解析的行的起始位置
+    // 冷字段：只在解析请求和生成响应的某些阶段使用
+    sockaddr_storage m_address;         // 通信的socket地址，IPv4、IPv6或者UNIX socket
+    in_addr_t m_client_addr;            // 按IPv4地址区分客户端的模块使用的地址，见client_key
+    in_port_t m_client_port;            // 对方端口（网络字节序），UNIX socket为0
+    int m_sched_weight = 1;             // 公平调度的权重，按客户端地址在init中确定
+    int m_conn_requests = 0;            // 这个连接处理过的请求数，HTTP/2按流计算，新连接时清零
+    tcp_conn_sample m_tcp;              // 上一次TCP_INFO采样的结果，新连接时清零
+    pace_state m_pace;                  // 当前响应的限速状态，每个响应开始时由pacer::start设置
+    bool m_upgrade_h2c;                 // 请求带有 Upgrade: h2c
+    char* m_h2_settings;                // 升级请求的HTTP2-Settings头部
 
-    CHECK_STATE m_check_state;          // 主状态机当前所处的状态
+    int m_header_start;                 // 请求头在读缓冲区中的起始位置，即请求行之后
     METHOD m_method;                    // 请求方法
-
-    char m_real_file[FILENAME_LEN];     // 客户请求的目标文件的完整路径= doc_root + m_url
     char* m_url;                        // 客户请求目标文件的文件名
     char* m_version;                    // HTTP协议版本号
     char* m_host;                       // 主机名
-    int m_content_length;               // HTTP请求的消息总长度
-    bool m_linger;                      // HTTP请求是否要求保持连接
+    long m_content_length;              // HTTP请求的消息总长度
+
+    bool m_chunked;                     // 请求体采用chunked传输编码
+    bool m_expect_continue;             // 客户端等待100 Continue后再发送请求体
+    int m_body_start;                   // 请求体在读缓冲区中的起始位置，之前是请求行和头部
+    long m_body_received;               // 已经交给处理函数的请求体字节数
+    time_t m_body_since;                // 开始接收请求体（解析完头部）的时间
+    CHUNK_STATE m_chunk_state;          // chunked解码器当前所处的状态
+    long m_chunk_left;                  // 当前块还未接收的字节数
+    int m_upload_fd = -1;               // 上传模式下写入的目标文件，-1表示不是上传
+    bool m_upload_splice;               // 上传的请求体直接用splice从socket搬运到文件
+
+    const route_node* m_route_node;     // 匹配到的路由，NULL表示静态文件
+
+    int m_resp_status;                  // 处理函数设置的状态码
+    const char* m_resp_title;           // 状态码对应的描述
+    const char* m_resp_type;            // Content-Type，NULL时为text/html
+    std::string m_resp_headers;         // 处理函数添加的其它响应头
+    std::string m_resp_body;            // 处理函数生成的响应体，流式响应时为当前这一段
+    stream_producer m_resp_producer;    // 流式响应的生产函数，NULL表示没有后续数据
+    void* m_resp_ctx;                   // 生产函数的参数
+    bool m_resp_chunked;                // 流式响应采用chunked编码，HTTP/1.0时以关闭连接结束
 
-    char m_write_buf[WRITE_BUFFER_SIZE];// 写缓冲区
-    int m_write_idx;                    // 写缓冲区中待发送的字节数
     char* m_file_address;               // 客户请求的目标文件被mmap到内存中的起始位置
-    struct stat m_file_stat;            // 目标文件的状态，判断文件是否存在，是否为目录，是否可读，文件大小
-    struct iovec m_iv[2];               // 采用writev来执行写操作
-    int m_iv_count;                     // 被写内存块的数量
-    int bytes_to_send;                  // 将要发送的数据字节数
-    int bytes_have_send;                // 已经发送的字节数
+    char* m_body_address;               // 响应体的起始位置，即文件映射或者m_resp_body
+    int m_file_fd;                      // 协程模式下用sendfile发送的目标文件描述符
+
+    uint64_t m_req_start = 0;           // 收到请求第一个字节的时间(us)，只在开启访问日志时记录，0表示没有待记录的请求
+    uint64_t m_resp_bytes = 0;          // 已经发送的响应字节数
+    int m_log_status = 0;               // 响应的状态码
+
+    uint32_t m_io_gen = 0;              // 连接的代数，见io_generation
+    size_t m_io_checked = 0;            // 文件响应体中已经确认在页缓存中的范围的末尾
+    io_job* m_io_job = NULL;            // I/O线程完成的打开文件任务，等待open_done取走
+
+    // 缓冲区和较大的请求状态放在对象之外，连接第一次使用时分配，关闭后留给复用这个fd的新连接
+    struct buffers{
+        char read_buf[READ_BUFFER_SIZE];    // 读缓冲区
+        char write_buf[WRITE_BUFFER_SIZE];  // 写缓冲区
+        char real_file[FILENAME_LEN];       // 客户请求的目标文件的完整路径= doc_root + m_url
+        struct stat file_stat;              // 目标文件的状态，判断文件是否存在，是否为目录，是否可读，文件大小
+        http_request request;               // 交给处理函数的请求视图，指向读缓冲区
+        request_arena arena;                // 请求级的分配器，放不下的头部等，每个请求开始时重置
+    };
+    buffers* m_bufs = NULL;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,147 @@
+#include "io_pool.h"
+#include "http_conn.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+
+threadpool<io_job>* io_pool::m_pool = NULL;
+int io_pool::m_eventfd = -1;
+locker io_pool::m_lock;
+std::vector<io_job*> io_pool::m_done;
+
+void io_job::process(){
+    if(type == OPEN){
+        result = http_conn::open_file(url.c_str(), &st, &file_fd);
+        io_pool::complete(this);
+        return;
+    }
+    // 临时映射这段文件并逐页读一个字节，缺页时在这个线程上等待磁盘，页缓存中的页保留下来
+    long page = sysconf(_SC_PAGESIZE);
+    off_t start = off & ~(off_t)(page - 1);
+    size_t map_len = len + (off - start);
+    void* addr = mmap(NULL, map_len, PROT_READ, MAP_SHARED, fd, start);
+    if(addr != MAP_FAILED){
+        madvise(addr, map_len, MADV_WILLNEED);
+        volatile const char* p = (const char*)addr;
+        char sum = 0;
+        for(size_t i = 0; i < map_len; i += page){
+            sum += p[i];
+        }
+        (void)sum;
+        munmap(addr, map_len);
+    }
+    close(fd);
+    fd = -1;
+    io_pool::complete(this);
+}
+
+bool io_pool::init(int threads){
+    if(threads <= 0){
+        return true;
+    }
+    m_eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(m_eventfd < 0){
+        return false;
+    }
+    try{
+        m_pool = new threadpool<io_job>(threads, threads);
+    }catch(...){
+        close(m_eventfd);
+        m_eventfd = -1;
+        return false;
+    }
+    return true;
+}
+
+bool io_pool::resident(const char* addr, int fd, off_t off, size_t len){
+    if(len == 0){
+        return true;
+    }
+    long page = sysconf(_SC_PAGESIZE);
+    off_t start = off & ~(off_t)(page - 1);
+    size_t map_len = len + (off - start);
+    bool mapped = false;
+    if(addr){
+        addr += start;
+    }else{
+        void* p = mmap(NULL, map_len, PROT_READ, MAP_SHARED, fd, start);
+        if(p == MAP_FAILED){
+            return true;    // 无法检查时按在内存中处理，退回到直接发送
+        }
+        addr = (const char*)p;
+        mapped = true;
+    }
+    size_t pages = (map_len + page - 1) / page;
+    unsigned char vec[WINDOW / 4096 + 2];
+    bool ret = true;
+    if(pages > sizeof(vec) || mincore((void*)addr, map_len, vec) < 0){
+        ret = true;
+    }else{
+        for(size_t i = 0; i < pages; ++i){
+            if(!(vec[i] & 1)){
+                ret = false;
+                break;
+            }
+        }
+    }
+    if(mapped){
+        munmap((void*)addr, map_len);
+    }
+    return ret;
+}
+
+bool io_pool::submit(io_job* job){
+    if(!m_pool->append(job)){
+        if(job->fd >= 0){
+            close(job->fd);
+        }
+        delete job;
+        return false;
+    }
+    return true;
+}
+
+bool io_pool::prefetch(http_conn* conn, uint32_t gen, int fd, off_t off, size_t len){
+    // 连接关闭时会关闭自己的文件描述符，任务使用一份复制
+    int dup_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if(dup_fd < 0){
+        return false;
+    }
+    io_job* job = new io_job;
+    job->type = io_job::PREFETCH;
+    job->conn = conn;
+    job->gen = gen;
+    job->fd = dup_fd;
+    job->off = off;
+    job->len = len;
+    job->file_fd = -1;
+    return submit(job);
+}
+
+bool io_pool::open(http_conn* conn, uint32_t gen, const char* url){
+    io_job* job = new io_job;
+    job->type = io_job::OPEN;
+    job->conn = conn;
+    job->gen = gen;
+    job->fd = -1;
+    job->url = url;
+    job->file_fd = -1;
+    return submit(job);
+}
+
+void io_pool::complete(io_job* job){
+    m_lock.lock();
+    m_done.push_back(job);
+    m_lock.unlock();
+    uint64_t one = 1;
+    ::write(m_eventfd, &one, sizeof(one));
+}
+
+void io_pool::drain(std::vector<io_job*>& done){
+    uint64_t count;
+    ::read(m_eventfd, &count, sizeof(count));
+    m_lock.lock();
+    done.swap(m_done);
+    m_lock.unlock();
+}
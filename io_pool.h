@@ -0,0 +1,66 @@
+#ifndef IO_POOL_H
+#define IO_POOL_H
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#include "locker.h"
+#include "threadpool.h"
+
+class http_conn;
+
+// 一个文件I/O任务，由I/O线程执行，完成后交回主线程
+// PREFETCH：把文件的[off, off + len)读入页缓存，之后主线程的writev/sendfile不会因为缺页阻塞在磁盘上
+// OPEN：协程模式下检查并打开静态文件，stat/open在慢速存储上也可能阻塞
+struct io_job{
+    enum TYPE {PREFETCH = 0, OPEN};
+    TYPE type;
+    http_conn* conn;
+    uint32_t gen;           // 提交时连接的代数，完成时不同说明连接已经关闭，结果作废
+
+    int fd;                 // PREFETCH：提交时dup的文件描述符，任务结束时关闭
+    off_t off;
+    size_t len;
+
+    std::string url;        // OPEN：请求的URL，从读缓冲区复制，连接关闭后复用缓冲区也不受影响
+    int result;             // OPEN：http_conn::HTTP_CODE
+    int file_fd;            // OPEN：打开的文件，没有交给连接时由主线程关闭
+    struct stat st;
+
+    void process();         // 在I/O线程上执行
+};
+
+// 文件I/O线程池：和处理请求的线程池分开，阻塞在磁盘上的任务不会占用处理请求的线程
+// 任务完成后放入完成队列并写eventfd，主线程在epoll循环中取出，恢复等待的连接
+class io_pool{
+public:
+    static const size_t WINDOW = 4 << 20;   // 一次检查和预读的文件范围
+
+    static bool init(int threads);          // 启动阶段调用，threads为0时不启用，文件I/O都在原来的线程上进行
+    static bool enabled(){ return m_pool != NULL; }
+    static int event_fd(){ return m_eventfd; }
+
+    // 文件范围是否都在页缓存中（mincore）；addr是整个文件的映射，为NULL时临时映射fd
+    static bool resident(const char* addr, int fd, off_t off, size_t len);
+
+    // 提交任务，队列满或者dup失败时返回false，调用者在当前线程上直接做
+    static bool prefetch(http_conn* conn, uint32_t gen, int fd, off_t off, size_t len);
+    static bool open(http_conn* conn, uint32_t gen, const char* url);
+
+    // 主线程：读eventfd，取出所有完成的任务，由调用者处理后delete
+    static void drain(std::vector<io_job*>& done);
+
+    static void complete(io_job* job);      // I/O线程：任务完成
+
+private:
+    static bool submit(io_job* job);
+
+private:
+    static threadpool<io_job>* m_pool;
+    static int m_eventfd;
+    static locker m_lock;
+    static std::vector<io_job*> m_done;     // 完成队列
+};
+
+#endif
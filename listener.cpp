@@ -0,0 +1,196 @@
+#include "listener.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stddef.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+extern void log(std::string str);
+
+std::vector<listener*> listeners::m_listeners;
+std::vector<listener*> listeners::m_by_fd;
+
+bool listeners::parse_addr(const char* s, listener* l){
+    memset(&l->addr, 0, sizeof(l->addr));
+    if(strncmp(s, "unix:", 5) == 0){
+        sockaddr_un* un = (sockaddr_un*)&l->addr;
+        const char* path = s + 5;
+        size_t len = strlen(path);
+        if(len == 0 || len >= sizeof(un->sun_path) || (path[0] == '@' && len == 1)){
+            return false;
+        }
+        un->sun_family = AF_UNIX;
+        if(path[0] == '@'){
+            // 抽象命名空间：sun_path以'\0'开头，名字不以'\0'结尾，长度由addr_len决定，不在文件系统中创建文件
+            memcpy(un->sun_path + 1, path + 1, len - 1);
+            l->addr_len = offsetof(sockaddr_un, sun_path) + len;
+        }else{
+            memcpy(un->sun_path, path, len + 1);
+            l->addr_len = offsetof(sockaddr_un, sun_path) + len + 1;
+        }
+        return true;
+    }
+
+    // 只有端口：监听所有IPv4地址
+    const char* colon = strrchr(s, ':');
+    const char* port_str = colon ? colon + 1 : s;
+    int port = atoi(port_str);
+    if(port <= 0 || port > 65535 || strspn(port_str, "0123456789") != strlen(port_str)){
+        return false;
+    }
+    std::string host = colon ? std::string(s, colon - s) : std::string();
+    if(host.size() > 2 && host.front() == '[' && host.back() == ']'){
+        sockaddr_in6* in6 = (sockaddr_in6*)&l->addr;
+        in6->sin6_family = AF_INET6;
+        in6->sin6_port = htons(port);
+        l->addr_len = sizeof(sockaddr_in6);
+        return inet_pton(AF_INET6, host.substr(1, host.size() - 2).c_str(), &in6->sin6_addr) == 1;
+    }
+    sockaddr_in* in = (sockaddr_in*)&l->addr;
+    in->sin_family = AF_INET;
+    in->sin_port = htons(port);
+    l->addr_len = sizeof(sockaddr_in);
+    if(host.empty()){
+        in->sin_addr.s_addr = INADDR_ANY;
+        return true;
+    }
+    return inet_pton(AF_INET, host.c_str(), &in->sin_addr) == 1;
+}
+
+bool listeners::add(const char* spec){
+    listener* l = new listener;
+    l->name = spec;
+    std::string s(spec);
+    size_t comma = s.find(',');
+    if(!parse_addr(s.substr(0, comma).c_str(), l)){
+        delete l;
+        return false;
+    }
+    bool unix_sock = l->addr.ss_family == AF_UNIX;
+    while(comma != std::string::npos){
+        size_t next = s.find(',', comma + 1);
+        std::string opt = s.substr(comma + 1, next == std::string::npos ? std::string::npos : next - comma - 1);
+        comma = next;
+        bool ok = true;
+        if(opt == "tls"){
+            l->tls = true;
+        }else if(opt.compare(0, 8, "backlog=") == 0){
+            l->backlog = atoi(opt.c_str() + 8);
+            ok = l->backlog > 0;
+        }else if(opt.compare(0, 5, "mode=") == 0){
+            l->mode = strtol(opt.c_str() + 5, NULL, 8);
+            ok = unix_sock && l->mode >= 0 && l->mode <= 0777;
+        }else if(opt == "reuseport"){
+            l->reuseport = true;
+            ok = !unix_sock;
+        }else if(opt.compare(0, 7, "v6only=") == 0){
+            l->v6only = atoi(opt.c_str() + 7) != 0;
+            ok = l->addr.ss_family == AF_INET6;
+        }else if(opt.compare(0, 6, "defer=") == 0){
+            l->defer_accept = atoi(opt.c_str() + 6);
+            ok = !unix_sock && l->defer_accept > 0;
+        }else if(opt == "nodelay"){
+            l->nodelay = true;
+            ok = !unix_sock;
+        }else{
+            ok = false;
+        }
+        if(!ok){
+            delete l;
+            return false;
+        }
+    }
+    m_listeners.push_back(l);
+    return true;
+}
+
+bool listeners::add_port(int port, bool tls){
+    char spec[16];
+    snprintf(spec, sizeof(spec), "%d%s", port, tls ? ",tls" : "");
+    return add(spec);
+}
+
+bool listeners::has_tls(){
+    for(listener* l : m_listeners){
+        if(l->tls){
+            return true;
+        }
+    }
+    return false;
+}
+
+bool listeners::open(listener* l){
+    int family = l->addr.ss_family;
+    l->fd = socket(family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(l->fd < 0){
+        return false;
+    }
+    int one = 1;
+    if(family != AF_UNIX){
+        // 端口复用
+        setsockopt(l->fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if(l->reuseport && setsockopt(l->fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) != 0){
+            return false;
+        }
+        if(family == AF_INET6 && l->v6only >= 0){
+            setsockopt(l->fd, IPPROTO_IPV6, IPV6_V6ONLY, &l->v6only, sizeof(l->v6only));
+        }
+        if(l->defer_accept){
+            setsockopt(l->fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &l->defer_accept, sizeof(l->defer_accept));
+        }
+    }
+
+    // 上一次运行留下的socket文件会让bind失败，只删除socket类型的文件
+    const sockaddr_un* un = (const sockaddr_un*)&l->addr;
+    bool unix_path = family == AF_UNIX && un->sun_path[0] != '\0';
+    struct stat st;
+    if(unix_path && lstat(un->sun_path, &st) == 0 && S_ISSOCK(st.st_mode)){
+        unlink(un->sun_path);
+    }
+
+    if(bind(l->fd, (const sockaddr*)&l->addr, l->addr_len) < 0){
+        return false;
+    }
+    if(unix_path && l->mode >= 0 && chmod(un->sun_path, l->mode) < 0){
+        return false;
+    }
+    return listen(l->fd, l->backlog) == 0;
+}
+
+bool listeners::open_all(){
+    for(listener* l : m_listeners){
+        if(!open(l)){
+            char buf[256];
+            snprintf(buf, sizeof(buf), "Listening on %s failed: %s\n", l->name.c_str(), strerror(errno));
+            log(buf);
+            printf("%s", buf);
+            return false;
+        }
+        if(l->fd >= (int)m_by_fd.size()){
+            m_by_fd.resize(l->fd + 1, NULL);
+        }
+        m_by_fd[l->fd] = l;
+    }
+    return true;
+}
+
+void listeners::close_all(bool remove_files){
+    for(listener* l : m_listeners){
+        if(l->fd < 0){
+            continue;
+        }
+        close(l->fd);
+        const sockaddr_un* un = (const sockaddr_un*)&l->addr;
+        if(remove_files && l->addr.ss_family == AF_UNIX && un->sun_path[0] != '\0'){
+            unlink(un->sun_path);
+        }
+        l->fd = -1;
+    }
+    m_by_fd.clear();
+}
@@ -0,0 +1,56 @@
+#ifndef LISTENER_H
+#define LISTENER_H
+#include <sys/socket.h>
+#include <string>
+#include <vector>
+
+// 一个监听socket和它的选项
+struct listener{
+    std::string name;               // 配置中的写法，用于日志
+    sockaddr_storage addr;
+    socklen_t addr_len;
+    int fd = -1;
+    bool tls = false;               // 在这个监听socket上接收的连接先进行TLS握手
+    int backlog = 5;                // listen的队列长度
+    int mode = -1;                  // UNIX socket文件的权限，-1表示按umask
+    bool reuseport = false;         // SO_REUSEPORT，多个进程监听同一个端口
+    int v6only = -1;                // IPV6_V6ONLY，-1表示按系统默认(net.ipv6.bindv6only)
+    int defer_accept = 0;           // TCP_DEFER_ACCEPT：连接上有数据到达时才通知accept，秒
+    bool nodelay = false;           // 接收的连接设置TCP_NODELAY
+};
+
+// 所有的监听socket：TCP（IPv4、IPv6）和UNIX域流式socket（包括抽象命名空间）
+// 都注册到同一个epoll对象中，接收的连接进入同一个连接表，之后的处理和监听socket无关
+// 本机的服务通过UNIX socket访问时不经过TCP/IP协议栈的回环设备
+class listeners{
+public:
+    // 解析 "addr[,option...]"，启动阶段调用
+    // addr：port、ip:port、[ipv6]:port、unix:/path、unix:@name（抽象命名空间）
+    // option：tls、backlog=N、mode=0660(UNIX socket文件的权限)、reuseport、v6only=0|1、defer=秒、nodelay
+    static bool add(const char* spec);
+    // 位置参数的端口和-S的端口，监听所有IPv4地址
+    static bool add_port(int port, bool tls);
+
+    // 创建、绑定并开始监听，失败时在日志中写明是哪一个，返回false
+    static bool open_all();
+    // 关闭监听socket，remove_files为true时删除创建的UNIX socket文件（多进程模型的worker退出时文件仍然属于master）
+    static void close_all(bool remove_files = true);
+
+    static const std::vector<listener*>& all(){ return m_listeners; }
+    static bool has_tls();
+
+    // fd是监听socket时返回它，否则返回NULL，主线程分发每个事件时调用
+    static const listener* find(int fd){
+        return (fd >= 0 && fd < (int)m_by_fd.size()) ? m_by_fd[fd] : NULL;
+    }
+
+private:
+    static bool parse_addr(const char* s, listener* l);
+    static bool open(listener* l);
+
+private:
+    static std::vector<listener*> m_listeners;
+    static std::vector<listener*> m_by_fd;     // 按fd索引，监听socket在启动时创建，fd都很小
+};
+
+#endif
@@ -4,6 +4,15 @@
 #include <exception>
 #include <semaphore.h>
 
+// 自旋等待时每次检查之间的停顿：提示CPU这是忙等循环，减少功耗和对同核超线程的干扰
+inline void cpu_relax(){
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
 // 线程同步机制封装类
 class locker{
 public:
@@ -72,6 +81,14 @@ public:
     bool wait(){
         return sem_wait(&m_sem) == 0;
     }
+    // 等待信号量，超过绝对时间t(CLOCK_REALTIME)时返回false
+    bool timewait(struct timespec t){
+        return sem_timedwait(&m_sem, &t) == 0;
+    }
+    // 不等待：信号量为0时直接返回false
+    bool trywait(){
+        return sem_trywait(&m_sem) == 0;
+    }
     // 增加信号量
     bool post(){
         return sem_post(&m_sem) == 0;
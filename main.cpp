@@ -2,12 +2,17 @@
 #include <stdlib.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <sys/epoll.h>
+#include <sys/ioctl.h>
 #include <signal.h>
+#include <time.h>
+#include <sched.h>
+#include <linux/types.h>
 #include <ctime>
 #include <chrono>
 #include <iostream>
@@ -18,10 +23,35 @@
 #include "threadpool.h"
 #include "http_conn.h"
 #include "web_timer.h"
+#include "config.h"
+#include "router.h"
+#include "proxy.h"
+#include "tls.h"
+#include "conn_table.h"
+#include "probes.h"
+#include "watchdog.h"
+#include "metrics.h"
+#include "conn_limit.h"
+#include "conn_deadline.h"
+#include "prefork.h"
+#include "file_cache.h"
+#include "listener.h"
+#include "io_pool.h"
 
 #define MAX_FD 65535 // 最大的文件描述符个数
 #define MAX_EVENT_NUMBER 10000 // 最大的一次监听次数
 
+// epoll实例的忙轮询参数（Linux 6.9），旧的头文件中没有
+#ifndef EPIOCSPARAMS
+struct epoll_params{
+    __u32 busy_poll_usecs;
+    __u16 busy_poll_budget;
+    __u8 prefer_busy_poll;
+    __u8 __pad;
+};
+#define EPIOCSPARAMS _IOW(0x8A, 0x01, struct epoll_params)
+#endif
+
 static int pipefd[2]; // 管道文件描述符 0为读 1为写
 
 
@@ -41,6 +71,26 @@ void sig_to_pipe(int sig){
     send(pipefd[1], (char*)&msg, 1, 0);
     errno = save_errno;
 }
+// 等待事件；spin_us不为0时先不阻塞地反复轮询，连续spin_us微秒没有事件后才阻塞等待
+// 事件到达时主线程正在运行，省去了从睡眠中唤醒的调度延迟，代价是空转的CPU
+// 每次轮询之间让出CPU：独占CPU时立即返回，和工作线程共用CPU时不会挡住它们
+static int wait_events(int epollfd, epoll_event* events, int spin_us){
+    if(spin_us){
+        timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        uint64_t deadline = now.tv_sec * 1000000000ull + now.tv_nsec + spin_us * 1000ull;
+        do{
+            int num = epoll_wait(epollfd, events, MAX_EVENT_NUMBER, 0);
+            if(num != 0){
+                return num;
+            }
+            sched_yield();
+            clock_gettime(CLOCK_MONOTONIC, &now);
+        }while(now.tv_sec * 1000000000ull + now.tv_nsec < deadline);
+    }
+    return epoll_wait(epollfd, events, MAX_EVENT_NUMBER, -1);
+}
+
 extern void setnonblocking(int fd);
 // 添加文件描述符到epoll
 extern void addfd(int epollfd, int fd, bool one_shot, bool et);
@@ -54,82 +104,223 @@ extern void modfd(int epollfd, int fd, int ev);
 // log函数
 extern void log(std::string str);
 
+// 多进程模型的平滑重启（master收到SIGHUP）：重新加载TLS证书，让文件元数据缓存失效，之后fork的worker使用新的证书
+static const Config* reload_config = NULL;
+static bool reload(){
+    if(listeners::has_tls() && !tls_context::init(reload_config->tls_cert, reload_config->tls_key)){
+        return false;
+    }
+    if(file_cache::enabled()){
+        file_cache::clear();
+    }
+    return true;
+}
+
 int main(int argc, char* argv[]){
+    // 缓存的时钟和Date头部，之后每轮事件循环更新一次
+    coarse_clock::update();
 
-    if (argc <= 1){
-        printf("按照如下格式运行: %s port_number\n", basename(argv[0]));
+    // 解析命令行参数，获取端口号和连接处理模型
+    Config config;
+    if (!config.parse_arg(argc, argv)){
+        Config::usage(basename(argv[0]));
         exit(-1);
     }
+    int port = config.port;
+    http_conn::m_upload_prefix = config.upload_prefix;
+    http_conn::m_busy_poll = config.busy_poll;
 
-    // 获取端口号
-    int port = atoi(argv[1]);
+    // 注册路由，请求先按路由分发，没有匹配的请求按doc_root提供静态文件
+    // 路由表在创建线程池之前整理完毕，之后只读
+    router routes;
+    reverse_proxy::m_timeout_ms = config.proxy_timeout * 1000;
+    for(const char* spec : config.proxy_passes){
+        if(!reverse_proxy::add_pass(spec, routes)){
+            printf("invalid proxy rule: %s\n", spec);
+            exit(-1);
+        }
+    }
+    // 主线程卡顿监控，导出直方图的URL也是一条路由
+    if(config.watchdog && !loop_watchdog::init(config.watchdog, routes)){
+        printf("invalid watchdog: %s\n", config.watchdog);
+        exit(-1);
+    }
+    // 指标导出和连接的TCP_INFO采样
+    if(config.metrics_url){
+        if(!metrics::serve(config.metrics_url, routes)){
+            printf("invalid metrics url: %s\n", config.metrics_url);
+            exit(-1);
+        }
+        tcp_health::init();
+    }
+    http_conn::m_routes = routes.finalize();
 
-    // 对SIGPIE信号进行处理,SIGPIE信号进程异常终止
-    addsig(SIGPIPE, SIG_IGN);
-    
-    // 创建线程池，初始化信息 模拟proactor模式
-    threadpool<http_conn> * pool = NULL;
-    try{
-        pool = new threadpool<http_conn>;
-    }catch(...){
+    // 按客户端IP限流
+    if(config.rate_limit && !rate_limiter::init(config.rate_limit)){
+        printf("invalid rate limit: %s\n", config.rate_limit);
         exit(-1);
     }
-    // 创建一个数组用于保存所有的客户端信息
-    http_conn * users = new http_conn[MAX_FD];
 
-    log("Creating socket...\n");
-    // 网络socket通信
-    int listenfd = socket(PF_INET, SOCK_STREAM, 0);
-    if (listenfd < 0){
-        log("Socket creation failed.");
-        exit(1);
+    // 连接数的高低水位，达到高水位时淘汰空闲的长连接
+    if(config.conn_limit && !conn_limit::init(config.conn_limit, MAX_FD)){
+        printf("invalid connection limit: %s\n", config.conn_limit);
+        exit(-1);
     }
-    // assert(listenfd >=0)
 
-    //设置端口复用
-    int reuse = 1;
-    setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    // 各阶段的超时
+    if(!conn_deadline::init(config.deadlines)){
+        printf("invalid timeouts: %s\n", config.deadlines);
+        exit(-1);
+    }
 
-    // bind绑定
-    struct sockaddr_in address;
-    address.sin_family = AF_INET;
-    address.sin_addr.s_addr = INADDR_ANY;
-    address.sin_port = htons(port);
+    // 响应限速
+    for(const char* spec : config.pace_rules){
+        if(!pacer::add_rule(spec)){
+            printf("invalid pacing rule: %s\n", spec);
+            exit(-1);
+        }
+    }
+    // 线程池的公平调度
+    if(config.fair_sched && !fair_sched::init(config.fair_sched)){
+        printf("invalid fair scheduling: %s\n", config.fair_sched);
+        exit(-1);
+    }
+
+    // 按fd保存所有的客户端信息，连接对象在对应的fd第一次被使用时才分配
+    conn_table<http_conn> users(MAX_FD);
 
-    log("Binding socket to address and port...\n");
-    int ret = bind(listenfd, (struct sockaddr*) &address, sizeof(address));
-    if(ret < 0){
-        log("Socket binding failed.");
+    // 监听socket：位置参数的明文端口、-S的HTTPS端口和-L给出的TCP/UNIX socket
+    if((port && !listeners::add_port(port, false)) || (config.tls_port && !listeners::add_port(config.tls_port, true))){
         exit(1);
     }
-
-    // 监听
-    log("Listening for incoming connections...\n");
-    ret = listen(listenfd, 5);
-    if (ret < 0) {
-        log("Listening failed.");
+    for(const char* spec : config.listens){
+        if(!listeners::add(spec)){
+            printf("invalid listener: %s\n", spec);
+            exit(1);
+        }
+    }
+    if(listeners::has_tls() && !tls_context::init(config.tls_cert, config.tls_key)){
+        printf("TLS initialization failed\n");
+        exit(1);
+    }
+    if(!listeners::open_all()){
         exit(1);
     }
 
+    // 静态文件的元数据缓存，在fork之前创建，多进程模型下所有worker共用
+    if(config.file_cache && !file_cache::init(config.file_cache)){
+        printf("invalid file cache: %s\n", config.file_cache);
+        exit(-1);
+    }
+
+    // 多进程模型：master在这里fork出worker，之后只管理worker，不会返回
+    // 下面的线程、timerfd、epoll等都是每个进程自己的，由每个worker在fork之后创建
+    reload_config = &config;
+    if(config.workers && !prefork::run(config.workers, reload)){
+        printf("cannot create worker processes\n");
+        exit(-1);
+    }
+
+    // 主线程卡顿监控
+    if(!loop_watchdog::start()){
+        printf("cannot start watchdog\n");
+        exit(-1);
+    }
+
+    // 限速等待的timerfd
+    if(!pacer::init()){
+        printf("cannot create pacing timer\n");
+        exit(-1);
+    }
+
+    // 二进制访问日志
+    // 多进程模型下每个worker写自己的文件，文件名后加上pid，重启的worker不会覆盖崩溃的worker留下的记录
+    std::string access_spec = config.access_log ? config.access_log : "";
+    if(config.access_log && prefork::enabled()){
+        size_t comma = access_spec.find(',');
+        access_spec.insert(comma == std::string::npos ? access_spec.size() : comma, "." + std::to_string(getpid()));
+    }
+    if(config.access_log && !access_log::init(access_spec.c_str())){
+        printf("cannot create access log: %s\n", config.access_log);
+        exit(-1);
+    }
+
+    // 文件I/O线程池
+    if(!io_pool::init(config.io_threads)){
+        printf("cannot create I/O threads\n");
+        exit(-1);
+    }
+
+    // 对SIGPIE信号进行处理,SIGPIE信号进程异常终止
+    addsig(SIGPIPE, SIG_IGN);
+    
+    // 创建线程池，初始化信息 模拟proactor模式
+    // 协程模式下所有连接都在主线程上运行，不需要线程池
+    threadpool<http_conn> * pool = NULL;
+    if (config.conn_model == CONN_STATE_MACHINE){
+        try{
+            pool = new threadpool<http_conn>(config.min_threads, config.max_threads);
+            if(fair_sched::enabled()){
+                pool->set_fair(fair_sched::queue_limit());
+            }
+            pool->set_spin(config.busy_poll);
+            pool->add_metrics();
+        }catch(...){
+            exit(-1);
+        }
+    }
+
     // 创建epoll对象，事件数组，添加监听的文件描述符
     epoll_event events[MAX_EVENT_NUMBER];
     int epollfd = epoll_create(5);
 
+    // 忙轮询模式下让内核在epoll_wait中也轮询网卡队列（需要网卡驱动支持NAPI，失败时只在用户态轮询）
+    if(config.busy_poll){
+        epoll_params params = {};
+        params.busy_poll_usecs = config.busy_poll;
+        params.busy_poll_budget = 8;
+        params.prefer_busy_poll = 1;
+        ioctl(epollfd, EPIOCSPARAMS, &params);
+    }
+
     // 将监听的文件描述符添加到epoll对象中
-    addfd(epollfd, listenfd, false, false);
+    // 多进程模型下所有worker监听同一组socket，EPOLLEXCLUSIVE让一个新连接只唤醒其中一个worker
+    for(const listener* l : listeners::all()){
+        if(prefork::enabled()){
+            epoll_event event;
+            event.data.fd = l->fd;
+            event.events = EPOLLIN | EPOLLEXCLUSIVE;
+            epoll_ctl(epollfd, EPOLL_CTL_ADD, l->fd, &event);
+            setnonblocking(l->fd);
+        }else{
+            addfd(epollfd, l->fd, false, false);
+        }
+    }
     http_conn::m_epollfd = epollfd;
     assert(epollfd != -1);
 
     // 创建管道
-    ret = socketpair(PF_UNIX, SOCK_STREAM, 0, pipefd);
+    int ret = socketpair(PF_UNIX, SOCK_STREAM, 0, pipefd);
     assert(ret != -1);
     setnonblocking(pipefd[1]);
     addfd(epollfd, pipefd[0], false, false); // epoll检测管道
+    if(io_pool::enabled()){
+        addfd(epollfd, io_pool::event_fd(), false, false); // 文件I/O完成的通知
+    }
+    if(pacer::enabled()){
+        addfd(epollfd, pacer::event_fd(), false, false); // 限速等待到期
+    }
+    std::vector<io_job*> io_done;
+    std::vector<pacer::waiter> paced;
+    std::vector<threadpool<http_conn>::submission> submits;   // 一轮事件循环中读完的请求，循环结束后批量提交给线程池
 
     // 设置信号处理函数
     addsig(SIGALRM, sig_to_pipe); // 定时器信号
     addsig(SIGTERM, sig_to_pipe); // SIGTERM 关闭服务器
+    addsig(SIGQUIT, sig_to_pipe); // SIGQUIT 处理完已有的连接后关闭服务器
     bool stop_server = false;   // 关闭服务器标志位
+    bool draining = false;      // 收到SIGQUIT，不再接收新连接
+    time_t drain_deadline = 0;  // 超过这个时间仍然没有处理完的连接直接关闭
 
     // 定时器设置
     bool timeout = false; // 定时器周期已到
@@ -138,7 +329,10 @@ int main(int argc, char* argv[]){
     // 循环检测有无事件发生
     while(true){
         log("Waiting for events...\n");
-        int num = epoll_wait(epollfd, events, MAX_EVENT_NUMBER, -1); // 检测到了几个事件
+        loop_watchdog::loop_end();
+        int num = wait_events(epollfd, events, config.busy_poll); // 检测到了几个事件
+        loop_watchdog::loop_begin(num);
+        coarse_clock::update();
         if((num < 0) && (errno != EINTR)){
             log("Epoll wait failure");
             printf("epoll failure\n");
@@ -148,15 +342,24 @@ int main(int argc, char* argv[]){
         // 循环遍历事件数组
         for(int i = 0; i < num; i++){
             int sockfd = events[i].data.fd;
+            loop_watchdog::on_event(sockfd, events[i].events);
             log("Event detected on sockfd\n");
 
             // 有客户端连接进来连接
-            if(sockfd == listenfd){  // 监听文件描述符的事件响应
-                struct sockaddr_in client_address;
+            if(const listener* l = listeners::find(sockfd)){  // 监听文件描述符的事件响应
+                // 连接数达到高水位时先关闭最久没有活动的空闲长连接，给新连接腾出描述符
+                if(conn_limit::enabled()){
+                    conn_limit::relieve(http_conn::m_timer_lst, false);
+                }
+                struct sockaddr_storage client_address;
                 socklen_t client_addrlen = sizeof(client_address);
-                int connfd = accept(listenfd, (struct sockaddr*)&client_address, &client_addrlen);
+                int connfd = accept(sockfd, (struct sockaddr*)&client_address, &client_addrlen);
                 log("client connected!\n");
                 if (connfd < 0){
+                    // 描述符用完，淘汰一批空闲连接；监听socket是水平触发的，连接留在队列中，下一轮再accept
+                    if((errno == EMFILE || errno == ENFILE) && conn_limit::enabled()){
+                        conn_limit::relieve(http_conn::m_timer_lst, true);
+                    }
                     printf("error is: %d\n", errno);
                     continue;
                 }
@@ -169,8 +372,41 @@ int main(int argc, char* argv[]){
                     continue;
                 }
 
+                // 按客户端IP限制连接数，拒绝时发送预先生成的429；TLS端口上还没有握手，只能直接关闭
+                in_port_t client_port;
+                in_addr_t client_addr = http_conn::client_key((sockaddr*)&client_address, &client_port);
+                bool counted = false;
+                if(rate_limiter::enabled() && !rate_limiter::on_accept(client_addr, &counted)){
+                    if(!l->tls){
+                        send(connfd, rate_limiter::REJECT_RESPONSE, rate_limiter::REJECT_LEN, MSG_DONTWAIT);
+                    }
+                    close(connfd);
+                    continue;
+                }
+
+                // HTTPS端口上的连接先创建TLS会话，握手在之后的事件中推进
+                SSL* ssl = NULL;
+                if(l->tls && !(ssl = tls_context::accept(connfd))){
+                    if(counted){
+                        rate_limiter::release(client_addr);
+                    }
+                    close(connfd);
+                    continue;
+                }
+
+                if(l->nodelay){
+                    int one = 1;
+                    setsockopt(connfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                }
+
                 // 将新的客户的数据初始化，放到数组中
-                users[connfd].init(connfd, client_address);
+                users[connfd].init(connfd, (sockaddr*)&client_address, client_addrlen, ssl);
+                users[connfd].rate_counted = counted;
+                prefork::on_accept();
+                PROBE(conn_accept, connfd, ntohl(client_addr), ntohs(client_port));
+                if(config.conn_model == CONN_COROUTINE){
+                    users[connfd].co_start();
+                }
 
             }else if(events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)){
                 // 对方异常断开或者错误等事件
@@ -194,15 +430,59 @@ int main(int argc, char* argv[]){
                                 break;
                             case SIGTERM:
                                 stop_server = true;
+                                break;
+                            case SIGQUIT:
+                                draining = true;
+                                break;
                         }
                     }
                 }
+            }else if(sockfd == io_pool::event_fd()){
+                // 文件I/O完成，恢复等待的连接；提交后关闭了的连接直接丢弃结果
+                io_pool::drain(io_done);
+                for(io_job* job : io_done){
+                    if(job->conn->io_generation() != job->gen){
+                        if(job->file_fd >= 0){
+                            close(job->file_fd);
+                        }
+                        delete job;
+                        continue;
+                    }
+                    job->conn->io_done(job);
+                }
+                io_done.clear();
+            }else if(sockfd == pacer::event_fd()){
+                // 限速等待到期，继续发送；等待期间关闭了的连接直接丢弃
+                pacer::drain(paced);
+                for(const pacer::waiter& w : paced){
+                    if(w.conn->io_generation() == w.gen){
+                        w.conn->pace_resume();
+                    }
+                }
+                paced.clear();
+            }else if(users[sockfd].is_h2()){
+                // HTTP/2连接的帧处理和发送都在主线程完成
+                if(!users[sockfd].h2_event()){
+                    users[sockfd].close_conn();
+                }
+            }else if(config.conn_model == CONN_COROUTINE){
+                // 协程模式：恢复在该连接上挂起的协程
+                users[sockfd].co_resume();
+            }else if(users[sockfd].tls_handshaking()){
+                // TLS握手在主线程推进，完成后等待请求到达
+                int ev = users[sockfd].tls_handshake();
+                if(ev < 0){
+                    users[sockfd].close_conn();
+                }else if(!users[sockfd].is_h2()){
+                    modfd(epollfd, sockfd, ev ? ev : (int)EPOLLIN);
+                }
             }else if(events[i].events & EPOLLIN){
                 log("read event happen!\n");
                 // 是否有读的事件发生
-                if(users[sockfd].read()){
-                    // 一次性把所有数据都读完
-                    pool->append(users + sockfd);
+                if(users[sockfd].read() && users[sockfd].admit()){
+                    // 一次性把所有数据都读完，超过速率限制的请求不进入线程池
+                    // 先收集起来，这一轮的事件处理完后一次提交；EPOLLONESHOT保证同一个连接在一轮中只出现一次
+                    submits.push_back({&users[sockfd], users[sockfd].sched_key(), users[sockfd].sched_weight()});
                     log("reading all data...\n");
                     log("*************************\n");
                 }else{
@@ -220,23 +500,59 @@ int main(int argc, char* argv[]){
                 // 对方异常断开或错误等事件
                 users[sockfd].close_conn();
                 http_conn::m_timer_lst.del_timer(users[sockfd].timer);
+                users[sockfd].timer = NULL;
+            }
+        }
+        // 批量提交这一轮读完的请求，要在定时器处理之前，收集的连接不会被超时关闭
+        // 队列已满（公平调度时是这个客户端的队列已满）时应答503并关闭连接
+        if(!submits.empty()){
+            pool->append_batch(submits);
+            for(auto& rejected : submits){
+                rejected.request->sock_send(fair_sched::REJECT_RESPONSE, fair_sched::REJECT_LEN, 0);
+                rejected.request->close_conn();
             }
+            submits.clear();
         }
         // 最后处理定时事件，因为IO事件有更高的优先级，虽然这样定时任务不能精准按照预定时间进行
         if(timeout){
             // 定时处理任务，实际上就是调用tick()函数
             http_conn::m_timer_lst.tick();
+            reverse_proxy::health_check();
+            if(tcp_health::enabled()){
+                tcp_health::sample(http_conn::m_timer_lst);
+            }
 
             // 因为一次 alarm 调用只会引起一次SIGALARM 信号，所以我们要重新定时，以不断触发 SIGALARM信号。
             alarm(TIMESLOT);
             timeout = false;  // 重置timeout
         }
+        prefork::publish(http_conn::m_user_count);
+
+        // 平滑退出：关闭监听socket（多进程模型下其它worker继续accept），空闲的长连接直接关闭，
+        // 正在处理的请求发送完响应后再关闭，全部关闭或者超过DRAIN_SECONDS秒后退出
+        if(draining){
+            if(!drain_deadline){
+                drain_deadline = coarse_clock::now() + prefork::DRAIN_SECONDS;
+                for(const listener* l : listeners::all()){
+                    if(l->fd >= 0){
+                        epoll_ctl(epollfd, EPOLL_CTL_DEL, l->fd, NULL);
+                    }
+                }
+                listeners::close_all(!prefork::enabled());
+            }
+            http_conn::m_timer_lst.evict_idle(http_conn::m_user_count, http_conn::m_user_count);
+            if(http_conn::m_user_count == 0 || coarse_clock::now() >= drain_deadline){
+                break;
+            }
+        }
+        if(stop_server){
+            break;
+        }
     }
     close(epollfd);
-    close(listenfd);
+    listeners::close_all(!prefork::enabled());
     close(pipefd[1]);
     close(pipefd[0]);
-    delete [] users;
     delete pool;
 
     return 0;
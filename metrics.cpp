@@ -0,0 +1,60 @@
+#include "metrics.h"
+#include "router.h"
+#include <stdio.h>
+
+std::vector<metrics::source> metrics::m_sources;
+std::vector<std::string> metrics::m_urls;
+
+void metrics::add(source s){
+    m_sources.push_back(s);
+}
+
+bool metrics::serve(const char* url, router& routes){
+    if(url[0] != '/'){
+        return false;
+    }
+    for(const std::string& u : m_urls){
+        if(u == url){
+            return true;
+        }
+    }
+    if(!routes.add(0, url, handler)){
+        return false;
+    }
+    m_urls.push_back(url);
+    return true;
+}
+
+void metrics::histogram(std::string& out, const char* name, const char* help, const double* bounds, int n,
+    const std::atomic<uint64_t>* counts, double sum){
+    char buf[256];
+    snprintf(buf, sizeof(buf), "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+    out += buf;
+    uint64_t total = 0;
+    for(int i = 0; i <= n; ++i){
+        total += counts[i].load(std::memory_order_relaxed);
+        if(i < n){
+            snprintf(buf, sizeof(buf), "%s_bucket{le=\"%.9g\"} %lu\n", name, bounds[i], (unsigned long)total);
+        }else{
+            snprintf(buf, sizeof(buf), "%s_bucket{le=\"+Inf\"} %lu\n", name, (unsigned long)total);
+        }
+        out += buf;
+    }
+    snprintf(buf, sizeof(buf), "%s_sum %.9g\n%s_count %lu\n", name, sum, name, (unsigned long)total);
+    out += buf;
+}
+
+void metrics::value(std::string& out, const char* name, const char* help, const char* type, double v){
+    char buf[256];
+    snprintf(buf, sizeof(buf), "# HELP %s %s\n# TYPE %s %s\n%s %.9g\n", name, help, name, type, name, v);
+    out += buf;
+}
+
+void metrics::handler(const http_request&, http_response& resp){
+    std::string out;
+    for(source s : m_sources){
+        s(out);
+    }
+    resp.set_content_type("text/plain; version=0.0.4");
+    resp.send(out);
+}
@@ -0,0 +1,36 @@
+#ifndef METRICS_H
+#define METRICS_H
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+class router;
+class http_response;
+struct http_request;
+
+// 指标导出：各模块在启动阶段注册一个函数，按Prometheus文本格式把自己的指标追加到输出中
+// serve注册的URL返回所有模块的指标，在工作线程上生成，计数器由各模块用原子变量维护
+class metrics{
+public:
+    typedef void (*source)(std::string& out);
+
+    static void add(source s);                          // 启动阶段调用
+    static bool serve(const char* url, router& routes); // 注册导出指标的URL，同一个URL只注册一次
+    static bool enabled(){ return !m_urls.empty(); }
+
+    // 输出一个直方图：counts[i]是落在(bounds[i-1], bounds[i]]中的样本数，counts[n]是超过bounds[n-1]的样本数
+    static void histogram(std::string& out, const char* name, const char* help, const double* bounds, int n,
+        const std::atomic<uint64_t>* counts, double sum);
+    // 输出一个计数器或者瞬时值，type为"counter"或"gauge"
+    static void value(std::string& out, const char* name, const char* help, const char* type, double v);
+
+private:
+    static void handler(const http_request& req, http_response& resp);
+
+private:
+    static std::vector<source> m_sources;
+    static std::vector<std::string> m_urls;
+};
+
+#endif
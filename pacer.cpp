@@ -0,0 +1,201 @@
+#include "pacer.h"
+#include "metrics.h"
+#include "http_conn.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+#include <algorithm>
+
+std::vector<pace_rule*> pacer::m_rules;
+int pacer::m_timerfd = -1;
+locker pacer::m_lock;
+std::vector<pacer::waiter> pacer::m_heap;
+uint64_t pacer::m_armed_ms = 0;
+std::atomic<uint64_t> pacer::m_throttled_bytes(0);
+std::atomic<uint64_t> pacer::m_waits(0);
+std::atomic<uint64_t> pacer::m_kernel_paced(0);
+
+// 小根堆的比较函数
+static bool later(const pacer::waiter& a, const pacer::waiter& b){
+    return a.deadline_ms > b.deadline_ms;
+}
+
+// "100", "64k", "2m"
+static bool parse_size(const char* s, uint64_t* v){
+    char* end;
+    *v = strtoull(s, &end, 10);
+    if(end == s){
+        return false;
+    }
+    if(*end == 'k' || *end == 'K'){
+        *v <<= 10;
+        ++end;
+    }else if(*end == 'm' || *end == 'M'){
+        *v <<= 20;
+        ++end;
+    }
+    return *end == '\0' || *end == ',';
+}
+
+bool pacer::add_rule(const char* spec){
+    const char* eq = strchr(spec, '=');
+    if(spec[0] != '/' || !eq){
+        return false;
+    }
+    pace_rule* r = new pace_rule;
+    r->prefix.assign(spec, eq - spec);
+    r->free = 0;
+    r->kernel = false;
+    const char* p = eq + 1;
+    bool ok = parse_size(p, &r->rate) && r->rate > 0;
+    if(ok && (p = strchr(p, ','))){
+        ok = parse_size(p + 1, &r->free);
+        if(ok && (p = strchr(p + 1, ','))){
+            ok = strcmp(p + 1, "kernel") == 0;
+            r->kernel = true;
+        }
+    }
+    if(!ok){
+        delete r;
+        return false;
+    }
+    m_rules.push_back(r);
+    return true;
+}
+
+bool pacer::init(){
+    if(m_rules.empty()){
+        return true;
+    }
+    m_timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if(m_timerfd < 0){
+        return false;
+    }
+    metrics::add(export_metrics);
+    return true;
+}
+
+uint64_t pacer::now_ms(){
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000ull + ts.tv_nsec / 1000000;
+}
+
+void pacer::start(pace_state& s, const char* url, int sockfd){
+    // 上一个响应交给了内核限速，先恢复成不限速
+    if(s.kernel){
+        unsigned int unlimited = ~0u;
+        setsockopt(sockfd, SOL_SOCKET, SO_MAX_PACING_RATE, &unlimited, sizeof(unlimited));
+    }
+    s = pace_state();
+    if(!url){
+        return;
+    }
+    size_t best = 0;
+    for(const pace_rule* r : m_rules){
+        if(r->prefix.size() > best && strncmp(url, r->prefix.c_str(), r->prefix.size()) == 0){
+            s.rule = r;
+            best = r->prefix.size();
+        }
+    }
+    if(s.rule){
+        s.last_ms = now_ms();
+        s.tokens = std::max<int64_t>(s.rule->rate * BURST_MS / 1000, QUANTUM);
+    }
+}
+
+size_t pacer::quota(pace_state& s, int sockfd, size_t want){
+    if(s.sent < s.rule->free){
+        return std::min<uint64_t>(want, s.rule->free - s.sent);
+    }
+    if(s.kernel){
+        return want;
+    }
+    // 不限速的部分发送完了：让内核限速，SO_MAX_PACING_RATE的单位是字节/秒，超过32位时不限速
+    if(s.rule->kernel){
+        unsigned int rate = (unsigned int)std::min<uint64_t>(s.rule->rate, ~0u);
+        if(setsockopt(sockfd, SOL_SOCKET, SO_MAX_PACING_RATE, &rate, sizeof(rate)) == 0){
+            s.kernel = true;
+            m_kernel_paced.fetch_add(1, std::memory_order_relaxed);
+            return want;
+        }
+    }
+
+    // 补充令牌，桶满后不再累积
+    uint64_t now = now_ms();
+    int64_t burst = std::max<int64_t>(s.rule->rate * BURST_MS / 1000, QUANTUM);
+    s.tokens = std::min<int64_t>(burst, s.tokens + (int64_t)((now - s.last_ms) * s.rule->rate / 1000));
+    s.last_ms = now;
+    if(s.tokens < QUANTUM && s.tokens < (int64_t)want){
+        return 0;
+    }
+    return std::min<uint64_t>(want, s.tokens);
+}
+
+void pacer::consume(pace_state& s, size_t n){
+    uint64_t free_part = (s.sent < s.rule->free) ? std::min<uint64_t>(n, s.rule->free - s.sent) : 0;
+    s.sent += n;
+    if(n > free_part){
+        m_throttled_bytes.fetch_add(n - free_part, std::memory_order_relaxed);
+        if(!s.kernel){
+            s.tokens -= n - free_part;
+        }
+    }
+}
+
+void pacer::defer(http_conn* conn, uint32_t gen, const pace_state& s){
+    int64_t need = QUANTUM - s.tokens;
+    uint64_t deadline = now_ms() + (need > 0 ? need * 1000 / s.rule->rate : 0) + 1;
+    m_waits.fetch_add(1, std::memory_order_relaxed);
+
+    m_lock.lock();
+    m_heap.push_back(waiter{deadline, conn, gen});
+    std::push_heap(m_heap.begin(), m_heap.end(), later);
+    if(!m_armed_ms || deadline < m_armed_ms){
+        arm(deadline);
+    }
+    m_lock.unlock();
+}
+
+// 在锁中调用
+void pacer::arm(uint64_t deadline_ms){
+    itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = deadline_ms / 1000;
+    its.it_value.tv_nsec = deadline_ms % 1000 * 1000000;
+    timerfd_settime(m_timerfd, TFD_TIMER_ABSTIME, &its, NULL);
+    m_armed_ms = deadline_ms;
+}
+
+void pacer::drain(std::vector<waiter>& due){
+    uint64_t expirations;
+    ::read(m_timerfd, &expirations, sizeof(expirations));
+    uint64_t now = now_ms();
+    m_lock.lock();
+    while(!m_heap.empty() && m_heap.front().deadline_ms <= now){
+        std::pop_heap(m_heap.begin(), m_heap.end(), later);
+        due.push_back(m_heap.back());
+        m_heap.pop_back();
+    }
+    m_armed_ms = 0;
+    if(!m_heap.empty()){
+        arm(m_heap.front().deadline_ms);
+    }
+    m_lock.unlock();
+}
+
+// 限速发送的字节数、等待次数、交给内核限速的响应数和正在等待的连接数，见metrics.h
+void pacer::export_metrics(std::string& out){
+    metrics::value(out, "tinyhttp_pacing_throttled_bytes_total", "Response bytes sent under a bandwidth limit.", "counter",
+        m_throttled_bytes.load(std::memory_order_relaxed));
+    metrics::value(out, "tinyhttp_pacing_waits_total", "Times a response paused because its connection ran out of send budget.", "counter",
+        m_waits.load(std::memory_order_relaxed));
+    metrics::value(out, "tinyhttp_pacing_kernel_responses_total", "Responses paced by the kernel through SO_MAX_PACING_RATE.", "counter",
+        m_kernel_paced.load(std::memory_order_relaxed));
+    m_lock.lock();
+    size_t waiting = m_heap.size();
+    m_lock.unlock();
+    metrics::value(out, "tinyhttp_pacing_waiting_connections", "Connections waiting for send budget.", "gauge", waiting);
+}
@@ -0,0 +1,77 @@
+#ifndef PACER_H
+#define PACER_H
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include "locker.h"
+
+class http_conn;
+
+// 一条限速规则：URL匹配前缀的响应先不限速地发送free字节，之后每秒最多发送rate字节，每个连接单独计算
+struct pace_rule{
+    std::string prefix;
+    uint64_t rate;                  // 字节/秒
+    uint64_t free;                  // 每个响应开头不限速的字节数
+    bool kernel;                    // 用SO_MAX_PACING_RATE让内核的TCP pacing限速，失败时回到用户态限速
+};
+
+// 一个连接上当前响应的限速状态，在process_write中由pacer::start设置
+struct pace_state{
+    const pace_rule* rule = NULL;   // NULL表示不限速
+    uint64_t sent = 0;              // 这个响应已经发送的字节数
+    uint64_t last_ms = 0;           // 上一次补充令牌的时间
+    int64_t tokens = 0;             // 还可以发送的字节数
+    bool kernel = false;            // socket上设置了SO_MAX_PACING_RATE，下一个响应开始时恢复
+};
+
+// 响应限速：令牌桶，令牌用完时write不再发送，把连接交给pacer，到令牌足够的时间由主线程继续发送
+// 等待的连接按到期时间放在一个小根堆中，最早的到期时间设置到timerfd上，timerfd和其它事件一起由epoll等待
+// 状态机模式下工作线程和主线程都可能让连接等待，堆由锁保护；协程在co_pace_awaiter中挂起，到期后由主线程恢复
+class pacer{
+public:
+    static const int64_t QUANTUM = 16 * 1024;   // 令牌至少攒够这么多再发送（剩下的数据更少时除外），不产生很小的报文段
+    static const int BURST_MS = 50;             // 桶的容量：rate的50ms，不小于QUANTUM
+
+    // 解析 "prefix=rate[,free[,kernel]]"，rate和free可以带k/m后缀（1024/1048576），启动阶段调用，可以多次
+    static bool add_rule(const char* spec);
+    static bool init();                         // 有规则时创建timerfd并注册指标
+    static bool enabled(){ return m_timerfd >= 0; }
+    static int event_fd(){ return m_timerfd; }
+
+    // 响应开始：按URL选择最长匹配的规则，重置状态
+    static void start(pace_state& s, const char* url, int sockfd);
+    // 这一次最多可以发送的字节数，0表示要等待
+    static size_t quota(pace_state& s, int sockfd, size_t want);
+    // 发送了n字节
+    static void consume(pace_state& s, size_t n);
+    // 令牌不足：连接等待到令牌足够，到期时由主线程调用conn->pace_resume()
+    static void defer(http_conn* conn, uint32_t gen, const pace_state& s);
+
+    // 主线程：timerfd可读，取出所有到期的连接，由调用者检查代数后恢复
+    struct waiter{
+        uint64_t deadline_ms;
+        http_conn* conn;
+        uint32_t gen;               // 连接的代数，不同说明等待期间连接被关闭了
+    };
+    static void drain(std::vector<waiter>& due);
+
+private:
+    static uint64_t now_ms();
+    static void arm(uint64_t deadline_ms);
+    static void export_metrics(std::string& out);
+
+private:
+    static std::vector<pace_rule*> m_rules;
+    static int m_timerfd;
+    static locker m_lock;
+    static std::vector<waiter> m_heap;          // 按deadline_ms的小根堆
+    static uint64_t m_armed_ms;                 // timerfd上设置的到期时间，0表示没有设置
+
+    static std::atomic<uint64_t> m_throttled_bytes;    // 超过不限速部分之后发送的字节数
+    static std::atomic<uint64_t> m_waits;              // 因为令牌不足而等待的次数
+    static std::atomic<uint64_t> m_kernel_paced;       // 交给内核限速的响应数
+};
+
+#endif
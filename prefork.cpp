@@ -0,0 +1,231 @@
+#include "prefork.h"
+#include "metrics.h"
+#include "listener.h"
+#include "coarse_clock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#include <new>
+#include <vector>
+
+extern void log(std::string str);
+
+// 共享内存：master在fork之前创建，所有worker映射同一份
+struct prefork::shared{
+    std::atomic<uint64_t> restarts;         // 异常退出后重新fork的次数
+    std::atomic<uint64_t> reloads;          // 平滑重启的次数
+    int slot_count;
+    prefork_slot slots[];                   // worker数的4倍，平滑重启期间新旧两组worker同时存在
+};
+
+prefork::shared* prefork::m_shared = NULL;
+prefork_slot* prefork::m_slot = NULL;
+int prefork::m_index = -1;
+int prefork::m_workers = 0;
+bool (*prefork::m_reload)() = NULL;
+
+// master：活着的worker，只在master中使用
+struct child{
+    pid_t pid;
+    int index;                              // 第几个worker
+    int slot;                               // 共享内存中的槽位
+    time_t started;
+    bool retiring;                          // 平滑重启中被替换的旧worker，退出后不再fork
+};
+static std::vector<child> children;
+static std::vector<time_t> respawn_at;      // 按worker序号，推迟fork的时间，0表示没有等待
+static sigset_t master_signals;             // master用sigtimedwait同步处理的信号
+static sigset_t saved_mask;                 // fork出的worker恢复成原来的信号屏蔽字
+
+bool prefork::run(int workers, bool (*reload)()){
+    size_t size = sizeof(shared) + sizeof(prefork_slot) * workers * 4;
+    void* addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(addr == MAP_FAILED){
+        return false;
+    }
+    m_shared = new (addr) shared();
+    m_shared->slot_count = workers * 4;
+    for(int i = 0; i < m_shared->slot_count; ++i){
+        new (&m_shared->slots[i]) prefork_slot();
+    }
+    m_workers = workers;
+    m_reload = reload;
+    respawn_at.assign(workers, 0);
+    metrics::add(export_metrics);
+
+    // 信号在master中同步处理，fork之前屏蔽，worker中恢复
+    sigemptyset(&master_signals);
+    int sigs[] = {SIGCHLD, SIGHUP, SIGQUIT, SIGTERM, SIGINT};
+    for(int sig : sigs){
+        sigaddset(&master_signals, sig);
+    }
+    sigprocmask(SIG_BLOCK, &master_signals, &saved_mask);
+
+    master_loop();
+    if(m_slot){
+        return true;
+    }
+    // 所有worker都退出了
+    exit(0);
+}
+
+// 返回子进程的pid，在worker中返回0，没有空闲的槽位或者fork失败时返回-1
+pid_t prefork::spawn(int index){
+    int slot = 0;
+    while(slot < m_shared->slot_count && m_shared->slots[slot].pid.load(std::memory_order_relaxed)){
+        ++slot;
+    }
+    if(slot == m_shared->slot_count){
+        log("prefork: no free worker slot\n");
+        return -1;
+    }
+    pid_t master = getpid();
+    pid_t pid = fork();
+    if(pid < 0){
+        log("prefork: fork failed\n");
+        return -1;
+    }
+    if(pid == 0){
+        // master退出（包括被kill -9）时worker也退出，不留下没有人管理的进程
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+        if(getppid() != master){
+            _exit(0);
+        }
+        sigprocmask(SIG_SETMASK, &saved_mask, NULL);
+        children.clear();
+        m_index = index;
+        m_slot = &m_shared->slots[slot];
+        m_slot->connections.store(0, std::memory_order_relaxed);
+        return 0;
+    }
+    m_shared->slots[slot].pid.store(pid, std::memory_order_relaxed);
+    children.push_back(child{pid, index, slot, coarse_clock::now(), false});
+    char buf[128];
+    snprintf(buf, sizeof(buf), "prefork: worker %d started, pid %d\n", index, pid);
+    log(buf);
+    return pid;
+}
+
+void prefork::signal_all(int sig){
+    for(const child& c : children){
+        kill(c.pid, sig);
+    }
+}
+
+// 在worker中返回，m_slot不为NULL；在master中所有worker退出后返回
+void prefork::master_loop(){
+    for(int i = 0; i < m_workers; ++i){
+        if(spawn(i) == 0){
+            return;
+        }
+    }
+    bool stopping = false;
+    while(!stopping || !children.empty()){
+        timespec timeout = {1, 0};
+        int sig = sigtimedwait(&master_signals, NULL, &timeout);
+        coarse_clock::update();
+        time_t now = coarse_clock::now();
+        char buf[160];
+
+        if(sig == SIGHUP && !stopping){
+            // 先启动新的worker，再让旧的worker处理完已有的连接后退出，监听socket上一直有worker在accept
+            if(m_reload && !m_reload()){
+                log("prefork: reload failed, keeping the current workers\n");
+                continue;
+            }
+            m_shared->reloads.fetch_add(1, std::memory_order_relaxed);
+            std::vector<child> old = children;
+            for(const child& c : old){
+                if(c.retiring){
+                    continue;
+                }
+                pid_t pid = spawn(c.index);
+                if(pid == 0){
+                    return;
+                }
+                if(pid > 0){
+                    for(child& o : children){
+                        if(o.pid == c.pid){
+                            o.retiring = true;
+                        }
+                    }
+                    kill(c.pid, SIGQUIT);
+                }
+            }
+        }else if(sig == SIGQUIT || sig == SIGTERM || sig == SIGINT){
+            // SIGQUIT：处理完已有的连接后退出；SIGTERM/SIGINT：立即退出
+            // master也关闭监听socket，新的连接直接被拒绝，不会留在没有人accept的队列中
+            stopping = true;
+            signal_all(sig == SIGQUIT ? SIGQUIT : SIGTERM);
+            listeners::close_all();
+        }
+
+        // 回收退出的worker，SIGCHLD可能合并，每一轮都检查
+        int status;
+        pid_t pid;
+        while((pid = waitpid(-1, &status, WNOHANG)) > 0){
+            for(size_t i = 0; i < children.size(); ++i){
+                if(children[i].pid != pid){
+                    continue;
+                }
+                child c = children[i];
+                children.erase(children.begin() + i);
+                prefork_slot& slot = m_shared->slots[c.slot];
+                slot.connections.store(0, std::memory_order_relaxed);
+                slot.pid.store(0, std::memory_order_relaxed);
+                if(c.retiring || stopping){
+                    break;
+                }
+                if(WIFSIGNALED(status)){
+                    snprintf(buf, sizeof(buf), "prefork: worker %d (pid %d) killed by signal %d, respawning\n", c.index, pid, WTERMSIG(status));
+                }else{
+                    snprintf(buf, sizeof(buf), "prefork: worker %d (pid %d) exited with status %d, respawning\n", c.index, pid, WEXITSTATUS(status));
+                }
+                log(buf);
+                m_shared->restarts.fetch_add(1, std::memory_order_relaxed);
+                // 刚启动就退出的worker推迟一秒再fork
+                respawn_at[c.index] = (now - c.started < 1) ? now + 1 : now;
+                break;
+            }
+        }
+
+        for(int i = 0; i < m_workers && !stopping; ++i){
+            if(respawn_at[i] && respawn_at[i] <= now){
+                pid_t pid = spawn(i);
+                if(pid == 0){
+                    return;
+                }
+                // 没有空闲的槽位或者fork失败，一秒后再试
+                respawn_at[i] = (pid < 0) ? now + 1 : 0;
+            }
+        }
+    }
+}
+
+// 所有worker的汇总，见metrics.h；退出的worker的计数保留在它的槽位中
+void prefork::export_metrics(std::string& out){
+    int workers = 0;
+    double connections = 0, accepted = 0, responses = 0, bytes = 0;
+    for(int i = 0; i < m_shared->slot_count; ++i){
+        const prefork_slot& s = m_shared->slots[i];
+        workers += s.pid.load(std::memory_order_relaxed) != 0;
+        connections += s.connections.load(std::memory_order_relaxed);
+        accepted += s.accepted.load(std::memory_order_relaxed);
+        responses += s.responses.load(std::memory_order_relaxed);
+        bytes += s.bytes.load(std::memory_order_relaxed);
+    }
+    metrics::value(out, "tinyhttp_workers", "Worker processes alive, including ones draining after a reload.", "gauge", workers);
+    metrics::value(out, "tinyhttp_worker_restarts_total", "Workers respawned after exiting unexpectedly.", "counter",
+        m_shared->restarts.load(std::memory_order_relaxed));
+    metrics::value(out, "tinyhttp_worker_reloads_total", "Graceful reloads triggered by SIGHUP.", "counter",
+        m_shared->reloads.load(std::memory_order_relaxed));
+    metrics::value(out, "tinyhttp_all_workers_connections", "Open connections across all workers.", "gauge", connections);
+    metrics::value(out, "tinyhttp_all_workers_accepted_total", "Connections accepted by all workers.", "counter", accepted);
+    metrics::value(out, "tinyhttp_all_workers_responses_total", "HTTP/1.x responses completed by all workers.", "counter", responses);
+    metrics::value(out, "tinyhttp_all_workers_response_bytes_total", "HTTP/1.x response bytes sent by all workers.", "counter", bytes);
+}
@@ -0,0 +1,74 @@
+#ifndef PREFORK_H
+#define PREFORK_H
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+#include <atomic>
+#include <string>
+
+// 一个worker进程在共享内存中的计数，每个进程独占一条缓存行
+// 进程退出后计数器保留（汇总的计数单调增加），只有连接数清零，槽位留给之后启动的worker
+struct alignas(64) prefork_slot{
+    std::atomic<int> pid;                   // 0表示空闲
+    std::atomic<int> connections;           // 当前的连接数，每轮事件循环更新
+    std::atomic<uint64_t> accepted;         // 接收的连接数
+    std::atomic<uint64_t> responses;        // 发送完的响应数
+    std::atomic<uint64_t> bytes;            // 发送的响应字节数
+};
+
+// 多进程模型（nginx的master/worker）：master绑定所有监听socket后fork出n个worker，
+// worker之间不共享任何状态，各自运行原来的事件循环、线程池和定时器，一个worker崩溃只影响它自己的连接
+// 监听socket由所有worker共同accept，注册时带EPOLLEXCLUSIVE，一个连接只唤醒一个worker
+// master只处理信号，不处理连接：
+//   SIGCHLD  worker异常退出时重新fork一个，启动后1秒内就退出的worker推迟1秒再fork，避免启动即崩溃时不停地fork
+//   SIGHUP   平滑重启：重新加载TLS证书，清空文件元数据缓存，fork一组新的worker，旧的worker收到SIGQUIT后不再accept，
+//            处理完已有的连接后退出
+//   SIGQUIT  所有worker处理完已有的连接后退出，然后master退出
+//   SIGTERM/SIGINT  所有worker立即退出，然后master退出
+// 共享内存中的计数由每个worker写自己的槽位，任何一个worker的指标URL导出所有worker的汇总
+// 限流、连接数水位等按进程计算，每个worker各自生效
+class prefork{
+public:
+    static const int DRAIN_SECONDS = 30;    // 平滑退出的worker最多等待这么久，之后关闭剩下的连接
+
+    // master：fork出workers个worker并管理它们，在master中不返回（所有worker退出后exit）
+    // worker：返回true，之后创建线程池等每个进程自己的资源；共享内存创建失败时返回false
+    // reload在SIGHUP时由master调用，重新加载配置（如TLS证书），返回false时不重启worker
+    static bool run(int workers, bool (*reload)());
+    static bool enabled(){ return m_slot != NULL; }
+    static int worker_index(){ return m_index; }    // 第几个worker，从0开始；单进程模式为-1
+
+    // worker：更新自己槽位的计数
+    static void on_accept(){
+        if(m_slot){
+            m_slot->accepted.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    static void on_response(uint64_t bytes){
+        if(m_slot){
+            m_slot->responses.fetch_add(1, std::memory_order_relaxed);
+            m_slot->bytes.fetch_add(bytes, std::memory_order_relaxed);
+        }
+    }
+    static void publish(int connections){
+        if(m_slot){
+            m_slot->connections.store(connections, std::memory_order_relaxed);
+        }
+    }
+
+private:
+    struct shared;
+    static pid_t spawn(int index);
+    static void master_loop();
+    static void signal_all(int sig);
+    static void export_metrics(std::string& out);
+
+private:
+    static shared* m_shared;
+    static prefork_slot* m_slot;            // worker自己的槽位，master和单进程模式为NULL
+    static int m_index;
+    static int m_workers;
+    static bool (*m_reload)();
+};
+
+#endif
@@ -0,0 +1,24 @@
+#!/bin/bash
+# 缓存测试：长连接压测期间用 perf stat 统计服务器进程的L1数据缓存和最后一级缓存(LLC)的缺失率，以及请求速率和内存占用
+# 需要 perf 和 tools/keepalive_bench（编译方法见源文件开头），服务器在本机运行
+# 服务器进程按监听端口查找，也可以通过环境变量SERVER_PID指定
+# 用法: ./cache_bench.sh [port] [连接数] [秒数] [路径]
+
+PORT=${1:-9006}
+CONNS=${2:-200}
+SECONDS_=${3:-10}
+URL=${4:-/index.html}
+BENCH=${BENCH:-$(dirname $0)/../keepalive_bench}
+PID=${SERVER_PID:-$(ss -Hltnp "sport = :$PORT" | grep -o "pid=[0-9]*" | head -1 | cut -d= -f2)}
+
+echo "server pid $PID, RSS $(awk '/VmRSS/{print $2}' /proc/$PID/status) KB"
+perf stat -p $PID -e L1-dcache-loads,L1-dcache-load-misses,LLC-loads,LLC-load-misses -o /tmp/cache_bench.perf -- sleep $SECONDS_ &
+$BENCH $PORT $CONNS $SECONDS_ $URL
+wait
+awk '/L1-dcache-loads|L1-dcache-load-misses|LLC-loads|LLC-load-misses/{gsub(",", "", $1); v[$2] = $1}
+    END{
+        if(v["L1-dcache-loads"]) printf "L1d miss rate %.2f%%\n", 100 * v["L1-dcache-load-misses"] / v["L1-dcache-loads"];
+        if(v["LLC-loads"]) printf "LLC miss rate %.2f%%\n", 100 * v["LLC-load-misses"] / v["LLC-loads"];
+    }' /tmp/cache_bench.perf
+echo "RSS after $(awk '/VmRSS/{print $2}' /proc/$PID/status) KB"
+rm -f /tmp/cache_bench.perf
@@ -0,0 +1,83 @@
+#!/bin/bash
+# HTTP/2测试：一个带50个子资源的页面，对比HTTP/1.1（每个客户端最多6个连接，和浏览器一样）和h2c（一个连接多路复用）
+# 统计服务器上同时建立的连接数、服务器进程的内存占用(RSS)以及整个页面的加载时间
+# 需要 nghttp（nghttp2-client）和 curl，服务器在本机运行，doc_root 需要可写，用来生成测试页面
+# 服务器进程按监听端口查找，也可以通过环境变量SERVER_PID指定
+# 用法: ./h2_bench.sh [doc_root] [port] [并发客户端数] [每个客户端加载页面的次数]
+
+ROOT=${1:-/home/panda/Desktop/TinyHttp/resource}
+PORT=${2:-9006}
+CLIENTS=${3:-50}
+LOOPS=${4:-20}
+BASE=http://127.0.0.1:$PORT
+PID=${SERVER_PID:-$(ss -Hltnp "sport = :$PORT" | grep -o "pid=[0-9]*" | head -1 | cut -d= -f2)}
+
+# 测试页面：50个4KB到20KB的子资源
+mkdir -p $ROOT/h2bench
+{
+    echo "<html><head>"
+    for i in $(seq 1 50); do
+        head -c $((4096 + i * 320)) /dev/zero | tr '\0' 'x' > $ROOT/h2bench/r$i.css
+        echo "<link rel=\"stylesheet\" href=\"/h2bench/r$i.css\">"
+    done
+    echo "</head><body>h2 bench</body></html>"
+} > $ROOT/h2bench/index.html
+chmod -R a+r $ROOT/h2bench
+URLS="$BASE/h2bench/index.html $(for i in $(seq 1 50); do echo -n "$BASE/h2bench/r$i.css "; done)"
+
+# 一个客户端反复加载页面（页面和50个子资源同时请求），每次加载的耗时(微秒)写到标准输出
+load_h1(){
+    for n in $(seq 1 $LOOPS); do
+        s=$(date +%s%N)
+        curl -s --parallel --parallel-max 6 $(for u in $URLS; do echo "-o /dev/null $u"; done) 2>/dev/null
+        echo $(( ($(date +%s%N) - s) / 1000 ))
+    done
+}
+load_h2(){
+    for n in $(seq 1 $LOOPS); do
+        s=$(date +%s%N)
+        nghttp -n $URLS > /dev/null
+        echo $(( ($(date +%s%N) - s) / 1000 ))
+    done
+}
+
+# 负载期间采样：服务器端口上已建立的连接数和服务器进程的RSS，取最大值
+# 连接对象数组在启动时就分配好了，RSS报告相对空闲时的增量
+sample(){
+    max_conn=0; max_rss=0
+    while [ -f /tmp/h2_bench.running ]; do
+        c=$(ss -Htn state established "( sport = :$PORT )" | wc -l)
+        r=$(awk '/VmRSS/{print $2}' /proc/$PID/status)
+        [ $c -gt $max_conn ] && max_conn=$c
+        [ $r -gt $max_rss ] && max_rss=$r
+        sleep 0.05
+    done
+    echo "$max_conn $max_rss"
+}
+
+run(){
+    touch /tmp/h2_bench.running
+    sample > /tmp/h2_bench.sample &
+    local sampler=$!
+    local clients=()
+    for c in $(seq 1 $CLIENTS); do
+        $1 > /tmp/h2_bench.$c &
+        clients+=($!)
+    done
+    wait ${clients[@]}
+    rm -f /tmp/h2_bench.running
+    wait $sampler
+    read conn rss < /tmp/h2_bench.sample
+    rss=$(( rss - BASE_RSS ))
+    sort -n /tmp/h2_bench.[0-9]* > /tmp/h2_bench.all
+    total=$(wc -l < /tmp/h2_bench.all)
+    p50=$(sed -n "$(( total / 2 ))p" /tmp/h2_bench.all)
+    p99=$(sed -n "$(( total * 99 / 100 ))p" /tmp/h2_bench.all)
+    printf "%-10s %10s %12s %12s %12s\n" $2 $conn $rss $((p50 / 1000)) $((p99 / 1000))
+    rm -f /tmp/h2_bench.*
+}
+
+BASE_RSS=$(awk '/VmRSS/{print $2}' /proc/$PID/status)
+printf "%-10s %10s %12s %12s %12s\n" protocol "max conns" "+RSS(KB)" "p50 page(ms)" "p99 page(ms)"
+run load_h1 http/1.1
+run load_h2 h2c
@@ -0,0 +1,57 @@
+#!/bin/bash
+# 文件I/O测试：若干客户端下载不在页缓存中的大文件，同时另一个客户端反复请求一个小的热文件，
+# 统计热文件请求的延迟分布；主线程阻塞在磁盘上时，所有连接的延迟都会升高
+# 每个大文件在下载前用 dd iflag=nocache 从页缓存中逐出，相当于工作集大于页缓存
+# 对比服务器以 -I 0（不启用I/O线程）和 -I 2 启动时的结果，doc_root 需要可写，用来生成测试文件
+# 用法: ./io_bench.sh [doc_root] [port] [大文件个数] [大文件MB] [并发下载数]
+
+ROOT=${1:-/home/panda/Desktop/TinyHttp/resource}
+PORT=${2:-9006}
+FILES=${3:-16}
+SIZE_MB=${4:-64}
+CLIENTS=${5:-4}
+BASE=http://127.0.0.1:$PORT
+
+mkdir -p $ROOT/iobench
+for i in $(seq 1 $FILES); do
+    f=$ROOT/iobench/f$i
+    [ -f $f ] && [ $(stat -c %s $f) -eq $((SIZE_MB << 20)) ] || head -c $((SIZE_MB << 20)) /dev/urandom > $f
+    chmod a+r $f
+    dd if=$f iflag=nocache count=0 2>/dev/null
+done
+
+# 下载客户端：轮流下载分到的冷文件
+download(){
+    for i in $(seq $1 $CLIENTS $FILES); do
+        curl -s -o /dev/null $BASE/iobench/f$i
+    done
+}
+
+# 探测客户端：下载进行期间反复请求热文件，记录每次的耗时(微秒)
+touch /tmp/io_bench.running
+(
+    while [ -f /tmp/io_bench.running ]; do
+        curl -s -o /dev/null -w "%{time_total}\n" $BASE/index.html
+    done
+) > /tmp/io_bench.probe &
+probe=$!
+
+start=$(date +%s%N)
+pids=()
+for c in $(seq 1 $CLIENTS); do
+    download $c &
+    pids+=($!)
+done
+wait ${pids[@]}
+elapsed=$(( ($(date +%s%N) - start) / 1000000 ))
+rm -f /tmp/io_bench.running
+wait $probe
+
+awk '{printf "%d\n", $1 * 1000000}' /tmp/io_bench.probe | sort -n > /tmp/io_bench.sorted
+total=$(wc -l < /tmp/io_bench.sorted)
+p50=$(sed -n "$(( total / 2 ))p" /tmp/io_bench.sorted)
+p99=$(sed -n "$(( total * 99 / 100 ))p" /tmp/io_bench.sorted)
+max=$(tail -1 /tmp/io_bench.sorted)
+printf "cold download: %d x %dMB in %d ms (%d MB/s)\n" $FILES $SIZE_MB $elapsed $(( FILES * SIZE_MB * 1000 / elapsed ))
+printf "hot probe: %d requests, p50 %d us, p99 %d us, max %d us\n" $total $p50 $p99 $max
+rm -f /tmp/io_bench.*
@@ -0,0 +1,38 @@
+#!/bin/bash
+# 反向代理测试：对比直接访问上游桩服务和经过服务器转发的吞吐量与延迟
+# 服务器需要以 -P /api/=127.0.0.1:8081 启动（或者 unix:/tmp/stub.sock），桩服务由本脚本启动
+# 用法: ./proxy_bench.sh [server host:port] [upstream port|unix:/path] [body_bytes]
+
+TARGET=${1:-127.0.0.1:9006}
+UPSTREAM=${2:-8081}
+BODY=${3:-1024}
+DIR=$(cd $(dirname $0); pwd)
+WEBBENCH=${WEBBENCH:-$DIR/webbench-1.5/webbench}
+
+g++ -O2 $DIR/stub_upstream.cpp -o /tmp/stub_upstream || exit 1
+/tmp/stub_upstream $UPSTREAM $BODY &
+STUB=$!
+trap "kill $STUB" EXIT
+sleep 0.5
+
+# 平均延迟：串行发送请求，取curl统计的总时间
+latency(){
+    local url=$1 unix=$2
+    for i in $(seq 200); do
+        curl -s -o /dev/null $unix -w "%{time_total}\n" $url
+    done | awk '{sum += $1} END {printf "%.1f", sum / NR * 1000000}'
+}
+
+if [[ $UPSTREAM == unix:* ]]; then
+    DIRECT_LAT=$(latency http://localhost/api/bench "--unix-socket ${UPSTREAM#unix:}")
+    DIRECT_QPS="-"
+else
+    DIRECT_LAT=$(latency http://127.0.0.1:$UPSTREAM/api/bench)
+    DIRECT_QPS=$($WEBBENCH -c 100 -t 10 http://127.0.0.1:$UPSTREAM/api/bench 2>/dev/null | awk '/Speed=/{sub("Speed=","",$1); print $1}')
+fi
+PROXY_LAT=$(latency http://$TARGET/api/bench)
+PROXY_QPS=$($WEBBENCH -c 100 -t 10 http://$TARGET/api/bench 2>/dev/null | awk '/Speed=/{sub("Speed=","",$1); print $1}')
+
+printf "%-8s %-16s %s\n" path "pages/min" "latency(us)"
+printf "%-8s %-16s %s\n" direct "$DIRECT_QPS" "$DIRECT_LAT"
+printf "%-8s %-16s %s\n" proxy "$PROXY_QPS" "$PROXY_LAT"
@@ -0,0 +1,139 @@
+// 反向代理测试用的上游桩服务：对每个请求返回固定大小的200响应，支持长连接和定长请求体
+// 编译: g++ -O2 stub_upstream.cpp -o stub_upstream
+// 用法: ./stub_upstream port|unix:/path [body_bytes]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <string>
+#include <unordered_map>
+
+struct client{
+    std::string in;
+    long body_left = 0;     // 当前请求还未读完的请求体
+};
+
+static int listen_on(const char* where){
+    int fd;
+    if(strncmp(where, "unix:", 5) == 0){
+        sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, where + 5, sizeof(addr.sun_path) - 1);
+        unlink(addr.sun_path);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if(bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0){
+            return -1;
+        }
+    }else{
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(atoi(where));
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        int reuse = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        if(bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0){
+            return -1;
+        }
+    }
+    listen(fd, 1024);
+    return fd;
+}
+
+int main(int argc, char* argv[]){
+    if(argc < 2){
+        printf("usage: %s port|unix:/path [body_bytes]\n", argv[0]);
+        return 1;
+    }
+    long body_size = (argc > 2) ? atol(argv[2]) : 64;
+    signal(SIGPIPE, SIG_IGN);
+
+    std::string resp = "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: "
+        + std::to_string(body_size) + "\r\n\r\n" + std::string(body_size, 'x');
+
+    int listenfd = listen_on(argv[1]);
+    if(listenfd < 0){
+        perror("bind");
+        return 1;
+    }
+    int epfd = epoll_create1(0);
+    epoll_event ev = {EPOLLIN, {.fd = listenfd}};
+    epoll_ctl(epfd, EPOLL_CTL_ADD, listenfd, &ev);
+
+    std::unordered_map<int, client> clients;
+    epoll_event events[256];
+    char buf[65536];
+    while(true){
+        int n = epoll_wait(epfd, events, 256, -1);
+        for(int i = 0; i < n; ++i){
+            int fd = events[i].data.fd;
+            if(fd == listenfd){
+                int c = accept4(listenfd, NULL, NULL, 0);
+                if(c >= 0){
+                    epoll_event cev = {EPOLLIN, {.fd = c}};
+                    epoll_ctl(epfd, EPOLL_CTL_ADD, c, &cev);
+                    clients[c];
+                }
+                continue;
+            }
+
+            client& cl = clients[fd];
+            ssize_t len = recv(fd, buf, sizeof(buf), 0);
+            if(len <= 0){
+                close(fd);
+                clients.erase(fd);
+                continue;
+            }
+            cl.in.append(buf, len);
+            bool alive = true;
+            while(alive){
+                // 先丢弃上一个请求的请求体
+                if(cl.body_left > 0){
+                    long skip = std::min<long>(cl.body_left, cl.in.size());
+                    cl.in.erase(0, skip);
+                    cl.body_left -= skip;
+                    if(cl.body_left > 0){
+                        break;
+                    }
+                }
+                size_t end = cl.in.find("\r\n\r\n");
+                if(end == std::string::npos){
+                    break;
+                }
+                std::string head = cl.in.substr(0, end);
+                cl.in.erase(0, end + 4);
+                const char* cl_hdr = strcasestr(head.c_str(), "\r\nContent-Length:");
+                cl.body_left = cl_hdr ? atol(cl_hdr + 17) : 0;
+                // HTTP/1.0默认响应后关闭连接（webbench直接访问时）
+                bool close_after = head.find("HTTP/1.0\r\n") != std::string::npos && !strcasestr(head.c_str(), "keep-alive");
+
+                size_t sent = 0;
+                while(sent < resp.size()){
+                    ssize_t w = send(fd, resp.data() + sent, resp.size() - sent, 0);
+                    if(w <= 0){
+                        alive = false;
+                        break;
+                    }
+                    sent += w;
+                }
+                if(close_after){
+                    alive = false;
+                }
+            }
+            if(!alive){
+                close(fd);
+                clients.erase(fd);
+            }
+        }
+    }
+}
@@ -0,0 +1,37 @@
+#!/bin/bash
+# TLS测试：握手速率（完整握手 / 会话恢复）和大文件的加密吞吐量，对比明文
+# 服务器需要以 -S 9443 -c cert.pem -k key.pem 启动，doc_root 下放一个大文件用于吞吐量测试
+# 最后向 /index.html POST 几个大于读缓冲区的请求体，检查TLS连接上的上传不会卡住
+# 用法: ./tls_bench.sh [host] [plain_port] [tls_port] [大文件的URL路径]
+
+HOST=${1:-127.0.0.1}
+PLAIN=${2:-9006}
+TLS=${3:-9443}
+FILE=${4:-/bench_256M}
+
+# 握手速率：openssl s_time 在10秒内反复建立连接并请求一个页面
+handshakes(){
+    openssl s_time -connect $HOST:$TLS -www /index.html -time 10 $1 2>/dev/null \
+        | awk '/connections in .* real seconds/{print $1 / $4}' | tail -1
+}
+printf "%-24s %s\n" "new handshakes/s" $(handshakes -new)
+printf "%-24s %s\n" "resumed handshakes/s" $(handshakes -reuse)
+
+# 吞吐量：单连接下载大文件
+speed(){
+    curl -sk -o /dev/null -w "%{speed_download}" $1 | awk '{printf "%.1f", $1 / 1048576}'
+}
+printf "%-24s %s\n" "plain MB/s" $(speed http://$HOST:$PLAIN$FILE)
+printf "%-24s %s\n" "tls MB/s" $(speed https://$HOST:$TLS$FILE)
+
+# 请求体大于读缓冲区(2048字节)的上传：读缓冲区满时OpenSSL中还留着解密好的数据，不能只等epoll通知
+# 每个请求10秒内没有响应算作失败
+upload(){
+    head -c $1 /dev/zero > $TMPFILE
+    curl -sk -o /dev/null -m 10 --data-binary @$TMPFILE -w "%{http_code} %{time_total}" https://$HOST:$TLS/index.html
+}
+TMPFILE=$(mktemp)
+trap "rm -f $TMPFILE" EXIT
+for size in 1500 4000 40000 1048576; do
+    printf "%-24s %s\n" "tls upload ${size}B" "$(upload $size)"
+done
@@ -0,0 +1,26 @@
+#!/bin/bash
+# 上传吞吐量测试：对 1MB ~ 1GB 的请求体分别测试定长(splice)和chunked两种上传
+# 服务器需要以 -u /upload/ 启动，并且 doc_root 下存在 upload 目录
+# 用法: ./upload_bench.sh [host:port]
+
+TARGET=${1:-127.0.0.1:9006}
+TMPDIR=$(mktemp -d)
+trap "rm -rf $TMPDIR" EXIT
+
+printf "%-8s %-10s %-8s %s\n" size mode status "speed(MB/s)"
+for size in 1 16 256 1024; do
+    file=$TMPDIR/body_${size}M
+    head -c ${size}M /dev/urandom > $file
+    for mode in length chunked; do
+        if [ $mode = chunked ]; then
+            header="Transfer-Encoding: chunked"
+        else
+            header="X-Upload-Mode: length"
+        fi
+        result=$(curl -s -o /dev/null -H "$header" -T $file \
+            -w "%{http_code} %{speed_upload}" http://$TARGET/upload/bench_${size}M)
+        set -- $result
+        printf "%-8s %-10s %-8s %s\n" ${size}M $mode $1 $(awk "BEGIN{printf \"%.1f\", $2 / 1048576}")
+    done
+    rm -f $file
+done
@@ -0,0 +1,30 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+// USDT静态探针：provider为tinyhttp，bpftrace/perf按名字挂载，不依赖会随编译变化的符号名
+//   bpftrace -l 'usdt:./server:tinyhttp:*'         列出所有探针
+//   tools/req_latency.bt、tools/queue_depth.bt       现成的延迟分解和队列深度脚本
+// 每个探针编译成一条nop，参数只放在寄存器或栈上不做额外计算，没有挂载时没有开销
+// 系统没有sys/sdt.h（systemtap-sdt-dev）或者定义了TINYHTTP_NO_PROBES时探针展开为空
+//
+// 探针和参数：
+//   conn_accept(fd, 客户端IPv4地址, 端口)         主线程accept之后
+//   conn_close(fd, 这个连接处理过的请求数)
+//   read_done(fd, 这次读到的字节数, 缓冲区中的字节数)
+//   request_parsed(fd, 方法, URL, Content-Length) 方法是http_conn::METHOD的值，URL以'\0'结尾
+//   file_resolved(fd, URL, 文件大小)              静态文件打开成功，URL相对于doc_root
+//   response_queued(fd, 状态码, 响应字节数)      process_write完成，开始发送
+//   write_partial(fd, 已发送字节数, 剩余字节数)  发送缓冲区满，等待EPOLLOUT
+//   response_sent(fd, 状态码, 响应字节数)        最后一个字节发送完
+//   timer_expire(fd, 阶段)                         连接超时，即将关闭；阶段是conn_deadline::PHASE的值
+//   conn_evict(fd)                                 连接数达到高水位，空闲的长连接即将被关闭
+//   pool_enqueue(任务指针, 入队后的排队数)
+//   pool_dequeue(任务指针, 排队等待的纳秒数, 当前的排队数)    排队数不加锁读取，是近似值
+#if __has_include(<sys/sdt.h>) && !defined(TINYHTTP_NO_PROBES)
+#include <sys/sdt.h>
+#define PROBE(name, ...) STAP_PROBEV(tinyhttp, name, __VA_ARGS__)
+#else
+#define PROBE(name, ...) do{}while(0)
+#endif
+
+#endif
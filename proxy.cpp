@@ -0,0 +1,821 @@
+#include "proxy.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "http_conn.h"
+
+extern void log(std::string str);
+
+int reverse_proxy::m_timeout_ms = 10000;
+
+// 启动阶段写入，之后只读
+static std::vector<proxy_pass*> passes;
+static std::vector<upstream*> upstreams;
+
+// 线程连接池中的空闲上游连接
+struct idle_conn{
+    int fd;
+    time_t since;
+};
+static thread_local std::vector<std::vector<idle_conn>> t_idle;
+
+// 每个线程一个管道作为splice的中转
+static thread_local int t_pipe[2] = {-1, -1};
+static thread_local int t_pipe_size = 0;
+
+// 转发的结果
+// PROXY_DONE：完成，PROXY_RETRY：复用的连接已经被上游关闭，可以换一个连接重试
+// PROXY_BAD_GATEWAY / PROXY_TIMEOUT：上游出错或超时，还没有向客户端发送任何内容
+// PROXY_ABORT：响应已经开始发送或者客户端出错，只能关闭客户端连接
+enum PROXY_RESULT {PROXY_DONE = 0, PROXY_RETRY, PROXY_BAD_GATEWAY, PROXY_TIMEOUT, PROXY_ABORT};
+
+// 上游响应头中与转发有关的信息
+struct upstream_resp{
+    int status;
+    long content_length;    // -1表示没有Content-Length
+    bool chunked;
+    bool close;             // 上游要求关闭连接
+};
+
+// chunked消息体的块边界跟踪，只判断消息在哪里结束，数据原样转发
+enum TRACK_STATE {TRACK_SIZE = 0, TRACK_EXT, TRACK_DATA, TRACK_DATA_END, TRACK_TRAILER, TRACK_DONE, TRACK_BAD};
+struct chunk_tracker{
+    int state = TRACK_SIZE;
+    long size = 0;
+    bool digits = false;
+    bool line_data = false;
+};
+
+static long now_ms(){
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// 等待fd就绪，超时返回false并把errno置为ETIMEDOUT
+static bool wait_fd(int fd, short events){
+    long deadline = now_ms() + reverse_proxy::m_timeout_ms;
+    while(true){
+        long left = deadline - now_ms();
+        if(left <= 0){
+            errno = ETIMEDOUT;
+            return false;
+        }
+        pollfd p = {fd, events, 0};
+        int ret = poll(&p, 1, left);
+        if(ret > 0){
+            return true;    // 包括出错和挂断，具体错误由之后的读写返回
+        }
+        if(ret < 0 && errno != EINTR){
+            return false;
+        }
+    }
+}
+
+static bool send_all(int fd, const char* data, size_t len, int flags){
+    while(len > 0){
+        ssize_t n = send(fd, data, len, flags | MSG_NOSIGNAL);
+        if(n > 0){
+            data += n;
+            len -= n;
+        }else if(n < 0 && errno == EAGAIN){
+            if(!wait_fd(fd, POLLOUT)){
+                return false;
+            }
+        }else if(n < 0 && errno != EINTR){
+            return false;
+        }
+    }
+    return true;
+}
+
+// 读取一些数据，返回读到的字节数，0表示对方关闭，-1表示出错或超时
+static ssize_t recv_some(int fd, char* buf, size_t len){
+    while(true){
+        ssize_t n = recv(fd, buf, len, 0);
+        if(n >= 0){
+            return n;
+        }
+        if(errno == EAGAIN){
+            if(!wait_fd(fd, POLLIN)){
+                return -1;
+            }
+        }else if(errno != EINTR){
+            return -1;
+        }
+    }
+}
+
+static int* get_pipe(){
+    if(t_pipe[0] < 0){
+        if(pipe2(t_pipe, O_NONBLOCK | O_CLOEXEC) < 0){
+            return NULL;
+        }
+        fcntl(t_pipe[1], F_SETPIPE_SZ, 1024 * 1024);
+        t_pipe_size = fcntl(t_pipe[1], F_GETPIPE_SZ);
+    }
+    return t_pipe;
+}
+
+// 中途出错时管道里可能留有数据，关闭它，下次使用时重建
+static void drop_pipe(){
+    close(t_pipe[0]);
+    close(t_pipe[1]);
+    t_pipe[0] = t_pipe[1] = -1;
+}
+
+// 经过管道把from上的n个字节搬运到to，数据不经过用户空间；n为-1时搬运到from关闭为止
+static bool splice_stream(int from, int to, long n){
+    int* p = get_pipe();
+    if(!p){
+        return false;
+    }
+    long in_pipe = 0;
+    while(n != 0 || in_pipe > 0){
+        if(n != 0 && in_pipe < t_pipe_size){
+            long want = t_pipe_size - in_pipe;
+            if(n > 0 && n < want){
+                want = n;
+            }
+            ssize_t r = splice(from, NULL, p[1], NULL, want, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if(r > 0){
+                in_pipe += r;
+                if(n > 0){
+                    n -= r;
+                }
+            }else if(r == 0){
+                if(n > 0){
+                    drop_pipe();
+                    return false;   // 数据还没收完对方就关闭了
+                }
+                n = 0;
+            }else if(errno == EAGAIN){
+                if(in_pipe == 0 && !wait_fd(from, POLLIN)){
+                    drop_pipe();
+                    return false;
+                }
+            }else if(errno != EINTR){
+                drop_pipe();
+                return false;
+            }
+        }
+        if(in_pipe > 0){
+            ssize_t w = splice(p[0], NULL, to, NULL, in_pipe, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if(w > 0){
+                in_pipe -= w;
+            }else if(w < 0 && errno == EAGAIN){
+                if(!wait_fd(to, POLLOUT)){
+                    drop_pipe();
+                    return false;
+                }
+            }else if(w < 0 && errno == EINTR){
+                continue;
+            }else{
+                drop_pipe();
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static int hex_value(char c){
+    if(c >= '0' && c <= '9') return c - '0';
+    if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// 跟踪一段chunked数据，返回属于这个消息的字节数，消息结束后的数据不计入
+static size_t chunk_feed(chunk_tracker& t, const char* data, size_t len){
+    size_t i = 0;
+    while(i < len && t.state != TRACK_DONE && t.state != TRACK_BAD){
+        char c = data[i];
+        switch(t.state){
+            case TRACK_SIZE:
+            case TRACK_EXT:
+                ++i;
+                if(c == '\n'){
+                    if(!t.digits){
+                        t.state = TRACK_BAD;
+                    }else if(t.size == 0){
+                        t.state = TRACK_TRAILER;
+                        t.line_data = false;
+                    }else{
+                        t.state = TRACK_DATA;
+                    }
+                    t.digits = false;
+                }else if(t.state == TRACK_SIZE && hex_value(c) >= 0){
+                    if(t.size > (1L << 40)){
+                        t.state = TRACK_BAD;
+                        break;
+                    }
+                    t.size = t.size * 16 + hex_value(c);
+                    t.digits = true;
+                }else if(c == ';'){
+                    t.state = TRACK_EXT;    // 块扩展，忽略到行尾
+                }else if(t.state == TRACK_SIZE && c != '\r' && c != ' ' && c != '\t'){
+                    t.state = TRACK_BAD;
+                }
+                break;
+            case TRACK_DATA:{
+                size_t n = len - i;
+                if((long)n > t.size){
+                    n = t.size;
+                }
+                i += n;
+                t.size -= n;
+                if(t.size == 0){
+                    t.state = TRACK_DATA_END;
+                }
+                break;
+            }
+            case TRACK_DATA_END:
+                ++i;
+                if(c == '\n'){
+                    t.state = TRACK_SIZE;
+                }
+                break;
+            case TRACK_TRAILER:
+                ++i;
+                if(c == '\n'){
+                    if(!t.line_data){
+                        t.state = TRACK_DONE;
+                    }
+                    t.line_data = false;
+                }else if(c != '\r'){
+                    t.line_data = true;
+                }
+                break;
+        }
+    }
+    return i;
+}
+
+// 转发一个chunked消息体：先转发已经读到的pending，再从from读取，直到最后一个块和trailer结束
+static bool forward_chunked(int from, int to, const char* pending, size_t pending_len){
+    chunk_tracker t;
+    size_t n = chunk_feed(t, pending, pending_len);
+    if(t.state == TRACK_BAD || !send_all(to, pending, n, 0)){
+        return false;
+    }
+    char buf[16384];
+    while(t.state != TRACK_DONE){
+        ssize_t len = recv_some(from, buf, sizeof(buf));
+        if(len <= 0){
+            return false;
+        }
+        n = chunk_feed(t, buf, len);
+        if(t.state == TRACK_BAD || !send_all(to, buf, n, 0)){
+            return false;
+        }
+    }
+    return true;
+}
+
+// 从rest中取出一行（不含CRLF），没有更多行时返回false
+static bool next_line(std::string_view& rest, std::string_view& line){
+    size_t pos = rest.find("\r\n");
+    if(pos == std::string_view::npos){
+        return false;
+    }
+    line = rest.substr(0, pos);
+    rest = rest.substr(pos + 2);
+    return true;
+}
+
+// 头部名称比较，不区分大小写
+static bool header_is(std::string_view line, const char* name, std::string_view& value){
+    size_t len = strlen(name);
+    if(line.size() <= len || line[len] != ':' || strncasecmp(line.data(), name, len) != 0){
+        return false;
+    }
+    value = line.substr(len + 1);
+    while(!value.empty() && (value[0] == ' ' || value[0] == '\t')){
+        value = value.substr(1);
+    }
+    return true;
+}
+
+static bool contains_token(std::string_view value, const char* token){
+    size_t len = strlen(token);
+    for(size_t i = 0; i + len <= value.size(); ++i){
+        if(strncasecmp(value.data() + i, token, len) == 0){
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool name_is(std::string_view name, std::string_view s){
+    return name.size() == s.size() && strncasecmp(name.data(), s.data(), s.size()) == 0;
+}
+
+// 逐跳头部，只在一个连接上有意义，不转发
+static bool hop_by_hop(std::string_view name){
+    static const std::string_view names[] = {"Connection", "Keep-Alive", "Proxy-Connection", "TE", "Upgrade",
+        "Transfer-Encoding", "Content-Length", "Expect"};
+    for(std::string_view n : names){
+        if(name_is(name, n)){
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool parse_addr(const char* s, upstream* up){
+    memset(&up->addr, 0, sizeof(up->addr));
+    if(strncmp(s, "unix:", 5) == 0){
+        sockaddr_un* un = (sockaddr_un*)&up->addr;
+        const char* path = s + 5;
+        if(path[0] == '\0' || strlen(path) >= sizeof(un->sun_path)){
+            return false;
+        }
+        un->sun_family = AF_UNIX;
+        strcpy(un->sun_path, path);
+        up->addr_len = sizeof(sockaddr_un);
+        return true;
+    }
+
+    const char* colon = strrchr(s, ':');
+    if(!colon || atoi(colon + 1) <= 0 || atoi(colon + 1) > 65535){
+        return false;
+    }
+    int port = atoi(colon + 1);
+    std::string host(s, colon - s);
+    if(host.size() > 2 && host.front() == '[' && host.back() == ']'){
+        sockaddr_in6* in6 = (sockaddr_in6*)&up->addr;
+        in6->sin6_family = AF_INET6;
+        in6->sin6_port = htons(port);
+        up->addr_len = sizeof(sockaddr_in6);
+        return inet_pton(AF_INET6, host.substr(1, host.size() - 2).c_str(), &in6->sin6_addr) == 1;
+    }
+    sockaddr_in* in = (sockaddr_in*)&up->addr;
+    in->sin_family = AF_INET;
+    in->sin_port = htons(port);
+    up->addr_len = sizeof(sockaddr_in);
+    return inet_pton(AF_INET, host.empty() ? "127.0.0.1" : host.c_str(), &in->sin_addr) == 1;
+}
+
+static int open_socket(upstream* up){
+    int fd = socket(up->addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(fd >= 0 && up->addr.ss_family != AF_UNIX){
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    return fd;
+}
+
+static int connect_upstream(upstream* up){
+    int fd = open_socket(up);
+    if(fd < 0){
+        return -1;
+    }
+    if(connect(fd, (sockaddr*)&up->addr, up->addr_len) == 0){
+        return fd;
+    }
+    int err = errno;
+    if(err == EINPROGRESS && wait_fd(fd, POLLOUT)){
+        socklen_t len = sizeof(err);
+        getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        if(err == 0){
+            return fd;
+        }
+    }
+    close(fd);
+    errno = (err == EINPROGRESS) ? ETIMEDOUT : err;
+    return -1;
+}
+
+// 记录转发结果，连续失败MAX_FAILS次的上游不再参与选择，直到健康检查或者转发成功
+static void report(upstream* up, bool ok){
+    if(ok){
+        up->fails = 0;
+        if(!up->healthy.exchange(true)){
+            log("upstream " + up->name + " is up\n");
+        }
+    }else if(++up->fails >= reverse_proxy::MAX_FAILS){
+        if(up->healthy.exchange(false)){
+            log("upstream " + up->name + " is down\n");
+        }
+    }
+}
+
+// 最少连接：在可用的上游中选正在转发的请求最少的，都不可用时仍然在全部上游中选，避免误判导致整体不可用
+static upstream* pick(proxy_pass* pass){
+    int n = pass->upstreams.size();
+    unsigned start = pass->next.fetch_add(1, std::memory_order_relaxed);
+    upstream* best = NULL;
+    int best_active = 0;
+    for(int round = 0; round < 2 && !best; ++round){
+        for(int i = 0; i < n; ++i){
+            upstream* up = pass->upstreams[(start + i) % n];
+            if(round == 0 && !up->healthy){
+                continue;
+            }
+            int active = up->active.load(std::memory_order_relaxed);
+            if(!best || active < best_active){
+                best = up;
+                best_active = active;
+            }
+        }
+    }
+    return best;
+}
+
+// 从线程的连接池中取一个空闲连接，没有则新建
+static int acquire(upstream* up, bool* reused){
+    if(t_idle.size() < upstreams.size()){
+        t_idle.resize(upstreams.size());
+    }
+    std::vector<idle_conn>& idle = t_idle[up->id];
+    time_t now = coarse_clock::now();
+    while(!idle.empty()){
+        idle_conn c = idle.back();
+        idle.pop_back();
+        // 空闲太久的连接可能已经被上游关闭；仍然可读说明上游关闭了连接或者发来了多余的数据
+        char b;
+        if(now - c.since < reverse_proxy::IDLE_TIMEOUT && recv(c.fd, &b, 1, MSG_PEEK | MSG_DONTWAIT) < 0 && errno == EAGAIN){
+            *reused = true;
+            return c.fd;
+        }
+        close(c.fd);
+    }
+    *reused = false;
+    return connect_upstream(up);
+}
+
+static void release(upstream* up, int fd, bool reusable){
+    std::vector<idle_conn>& idle = t_idle[up->id];
+    if(!reusable || (int)idle.size() >= reverse_proxy::MAX_IDLE){
+        close(fd);
+        return;
+    }
+    idle.push_back(idle_conn{fd, coarse_clock::now()});
+}
+
+// 生成转发给上游的请求头：原样保留端到端头部，重新生成逐跳头部，追加X-Forwarded-For
+static std::string build_head(const http_request& req, const http_hijack& conn, upstream* up){
+    std::string head;
+    head.reserve(conn.headers_len + 256);
+    head.append(method_name(req.method)).append(" ").append(req.url).append(" HTTP/1.1\r\n");
+
+    // 请求头在解析时已经全部放进了头部表，不用再扫描原始的头部
+    std::string_view forwarded_for;
+    bool has_host = false;
+    for(int i = 0; i < req.headers.size(); ++i){
+        const http_header& h = req.headers[i];
+        if(hop_by_hop(h.name)){
+            continue;
+        }
+        if(name_is(h.name, "X-Forwarded-For")){
+            forwarded_for = h.value;
+            continue;
+        }
+        if(name_is(h.name, "Host")){
+            has_host = true;
+        }
+        head.append(h.name).append(": ").append(h.value).append("\r\n");
+    }
+    if(!has_host){
+        head.append("Host: ").append(up->name).append("\r\n");
+    }
+
+    if(req.chunked){
+        head.append("Transfer-Encoding: chunked\r\n");
+    }else if(req.content_length > 0){
+        head.append("Content-Length: ").append(std::to_string(req.content_length)).append("\r\n");
+    }
+
+    char ip[INET6_ADDRSTRLEN] = "unknown";
+    if(conn.addr->sa_family == AF_INET){
+        inet_ntop(AF_INET, &((const sockaddr_in*)conn.addr)->sin_addr, ip, sizeof(ip));
+    }else if(conn.addr->sa_family == AF_INET6){
+        inet_ntop(AF_INET6, &((const sockaddr_in6*)conn.addr)->sin6_addr, ip, sizeof(ip));
+    }
+    head.append("X-Forwarded-For: ");
+    if(!forwarded_for.empty()){
+        head.append(forwarded_for).append(", ");
+    }
+    head.append(ip).append("\r\n");
+    head.append("Connection: keep-alive\r\n\r\n");
+    return head;
+}
+
+// 读取上游的响应头，返回头部长度，have为buf中已经读到的字节数（可能包含响应体的开头）
+// 返回0表示还没读到任何数据上游就关闭了连接，-1表示出错、超时或者头部过长
+static int read_head(int fd, char* buf, int& have){
+    while(true){
+        std::string_view data(buf, have);
+        size_t pos = data.find("\r\n\r\n");
+        if(pos != std::string_view::npos){
+            return pos + 4;
+        }
+        if(have >= reverse_proxy::HEAD_BUFFER_SIZE){
+            errno = EMSGSIZE;
+            return -1;
+        }
+        ssize_t n = recv_some(fd, buf + have, reverse_proxy::HEAD_BUFFER_SIZE - have);
+        if(n <= 0){
+            if(n == 0){
+                errno = ECONNRESET;
+            }
+            return (n == 0 && have == 0) ? 0 : -1;
+        }
+        have += n;
+    }
+}
+
+static bool parse_head(std::string_view head, upstream_resp& r){
+    std::string_view line;
+    if(!next_line(head, line) || line.size() < 12 || line.substr(0, 7) != "HTTP/1." || line[8] != ' '){
+        return false;
+    }
+    r.status = atoi(line.data() + 9);
+    r.close = (line[7] == '0');     // HTTP/1.0默认不保持连接
+    r.content_length = -1;
+    r.chunked = false;
+    while(next_line(head, line) && !line.empty()){
+        std::string_view value;
+        if(header_is(line, "Content-Length", value)){
+            r.content_length = strtol(std::string(value).c_str(), NULL, 10);
+        }else if(header_is(line, "Transfer-Encoding", value)){
+            r.chunked = contains_token(value, "chunked");
+        }else if(header_is(line, "Connection", value)){
+            if(contains_token(value, "close")){
+                r.close = true;
+            }else if(contains_token(value, "keep-alive")){
+                r.close = false;
+            }
+        }
+    }
+    return r.status >= 100 && r.status < 600;
+}
+
+// 生成发给客户端的响应头：去掉上游的逐跳头部，按客户端连接的情况重新生成Connection
+static std::string rewrite_head(std::string_view head, bool keep_alive){
+    std::string out;
+    out.reserve(head.size() + 32);
+    std::string_view line;
+    next_line(head, line);
+    out.append(line).append("\r\n");
+    while(next_line(head, line) && !line.empty()){
+        std::string_view value;
+        if(header_is(line, "Connection", value) || header_is(line, "Keep-Alive", value)
+            || header_is(line, "Proxy-Connection", value)){
+            continue;
+        }
+        out.append(line).append("\r\n");
+    }
+    out.append(keep_alive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n");
+    return out;
+}
+
+static void send_error(int fd, int status, const char* title){
+    char buf[256];
+    int body = strlen(title);
+    int len = snprintf(buf, sizeof(buf), "HTTP/1.1 %d %s\r\nContent-Length: %d\r\nContent-Type: text/html\r\n"
+        "Connection: close\r\n\r\n%s", status, title, body, title);
+    send_all(fd, buf, len, 0);
+}
+
+// 在一个上游连接上完成一次请求转发
+static int exchange(const http_request& req, const http_hijack& conn, http_response& resp,
+        int fd, bool reused, const std::string& head, bool* reusable){
+    *reusable = false;
+    bool has_req_body = req.chunked || req.content_length > 0;
+    long in_buffer = (req.content_length < conn.pending_len) ? req.content_length : conn.pending_len;
+    // 请求体全部在缓冲区里时，复用的连接失效可以换一个连接重发
+    bool replayable = reused && (!has_req_body || (!req.chunked && in_buffer == req.content_length));
+
+    // 请求头和请求体
+    if(!send_all(fd, head.data(), head.size(), has_req_body ? MSG_MORE : 0)){
+        return replayable ? PROXY_RETRY : PROXY_BAD_GATEWAY;
+    }
+    if(req.chunked){
+        if(!forward_chunked(conn.fd, fd, conn.pending, conn.pending_len)){
+            return PROXY_ABORT;
+        }
+    }else if(req.content_length > 0){
+        if(!send_all(fd, conn.pending, in_buffer, 0)){
+            return replayable ? PROXY_RETRY : PROXY_BAD_GATEWAY;
+        }
+        if(!splice_stream(conn.fd, fd, req.content_length - in_buffer)){
+            return PROXY_ABORT;
+        }
+    }
+
+    // 响应头，跳过1xx临时响应
+    char buf[reverse_proxy::HEAD_BUFFER_SIZE];
+    int have = 0;
+    int head_len;
+    upstream_resp r;
+    while(true){
+        head_len = read_head(fd, buf, have);
+        if(head_len == 0 && replayable){
+            return PROXY_RETRY;
+        }
+        if(head_len <= 0){
+            return (errno == ETIMEDOUT) ? PROXY_TIMEOUT : PROXY_BAD_GATEWAY;
+        }
+        if(!parse_head(std::string_view(buf, head_len), r)){
+            return PROXY_BAD_GATEWAY;
+        }
+        if(r.status >= 200 || r.status == 101){
+            break;
+        }
+        memmove(buf, buf + head_len, have - head_len);
+        have -= head_len;
+    }
+    if(r.status == 101){
+        return PROXY_BAD_GATEWAY;   // 没有转发Upgrade，上游不应该切换协议
+    }
+
+    // 响应体的长度：定长、chunked，或者以关闭连接结束
+    bool has_body = req.method != http_conn::HEAD && r.status != 204 && r.status != 304;
+    bool until_close = has_body && !r.chunked && r.content_length < 0;
+    bool keep_alive = resp.keep_alive() && !until_close;
+    resp.set_keep_alive(keep_alive);
+
+    std::string out = rewrite_head(std::string_view(buf, head_len), keep_alive);
+    if(!send_all(conn.fd, out.data(), out.size(), has_body ? MSG_MORE : 0)){
+        return PROXY_ABORT;
+    }
+
+    const char* rest = buf + head_len;
+    long rest_len = have - head_len;
+    bool ok = true;
+    if(!has_body){
+        *reusable = !r.close && rest_len == 0;
+    }else if(r.chunked){
+        ok = forward_chunked(fd, conn.fd, rest, rest_len);
+        *reusable = !r.close;
+    }else if(r.content_length >= 0){
+        long n = (rest_len < r.content_length) ? rest_len : r.content_length;
+        ok = send_all(conn.fd, rest, n, 0) && splice_stream(fd, conn.fd, r.content_length - n);
+        *reusable = !r.close && rest_len <= r.content_length;
+    }else{
+        ok = send_all(conn.fd, rest, rest_len, 0) && splice_stream(fd, conn.fd, -1);
+    }
+    if(!ok){
+        *reusable = false;
+        return PROXY_ABORT;
+    }
+    return PROXY_DONE;
+}
+
+void reverse_proxy::handle(const http_request& req, http_response& resp){
+    http_hijack conn = resp.hijack();
+
+    // 前缀最长的规则，路由已经保证至少有一条匹配
+    proxy_pass* pass = NULL;
+    for(proxy_pass* p : passes){
+        std::string_view prefix = p->prefix;
+        bool match = req.path.substr(0, prefix.size()) == prefix || req.path == prefix.substr(0, prefix.size() - 1);
+        if(match && (!pass || p->prefix.size() > pass->prefix.size())){
+            pass = p;
+        }
+    }
+    if(!pass){
+        send_error(conn.fd, 502, "Bad Gateway");
+        resp.set_keep_alive(false);
+        return;
+    }
+
+    std::string head;
+    int ret = PROXY_BAD_GATEWAY;
+    // 失败时最多换一个上游再试一次；复用的连接失效时换一个连接重发
+    for(int attempt = 0; attempt < 2; ++attempt){
+        upstream* up = pick(pass);
+        bool reused = false;
+        int fd = acquire(up, &reused);
+        if(fd < 0){
+            report(up, false);
+            ret = (errno == ETIMEDOUT) ? PROXY_TIMEOUT : PROXY_BAD_GATEWAY;
+            continue;
+        }
+        if(head.empty()){
+            head = build_head(req, conn, up);
+        }
+
+        bool reusable = false;
+        ++up->active;
+        ret = exchange(req, conn, resp, fd, reused, head, &reusable);
+        --up->active;
+        release(up, fd, ret == PROXY_DONE && reusable);
+
+        if(ret == PROXY_RETRY){
+            continue;
+        }
+        if(ret == PROXY_DONE){
+            report(up, true);
+            return;
+        }
+        if(ret == PROXY_BAD_GATEWAY || ret == PROXY_TIMEOUT){
+            report(up, false);
+            log("upstream " + up->name + ((ret == PROXY_TIMEOUT) ? " timed out\n" : " failed\n"));
+        }
+        break;
+    }
+
+    // 还没有向客户端发送内容时给出错误响应，请求体可能没有读完，之后关闭连接
+    if(ret == PROXY_TIMEOUT){
+        send_error(conn.fd, 504, "Gateway Timeout");
+    }else if(ret != PROXY_ABORT){
+        send_error(conn.fd, 502, "Bad Gateway");
+    }
+    resp.set_keep_alive(false);
+}
+
+bool reverse_proxy::add_pass(const char* spec, router& routes){
+    const char* eq = strchr(spec, '=');
+    if(spec[0] != '/' || !eq || eq[1] == '\0'){
+        return false;
+    }
+    proxy_pass* pass = new proxy_pass;
+    pass->prefix.assign(spec, eq - spec);
+    if(pass->prefix.back() != '/'){
+        pass->prefix += '/';
+    }
+    pass->next = 0;
+
+    std::string list(eq + 1);
+    size_t begin = 0;
+    while(begin <= list.size()){
+        size_t end = list.find(',', begin);
+        if(end == std::string::npos){
+            end = list.size();
+        }
+        upstream* up = new upstream;
+        up->name = list.substr(begin, end - begin);
+        up->id = upstreams.size();
+        up->active = 0;
+        up->fails = 0;
+        up->healthy = true;
+        up->check_fd = -1;
+        if(!parse_addr(up->name.c_str(), up)){
+            log("bad upstream address: " + up->name + "\n");
+            delete up;
+            return false;
+        }
+        upstreams.push_back(up);
+        pass->upstreams.push_back(up);
+        begin = end + 1;
+    }
+    passes.push_back(pass);
+
+    // 前缀下的所有路径、除CONNECT外的所有方法都转发
+    std::string pattern = pass->prefix + "*rest";
+    for(int method = 0; method < ROUTE_METHOD_COUNT; ++method){
+        if(method != http_conn::CONNECT && !routes.add_takeover(method, pattern.c_str(), handle)){
+            return false;
+        }
+    }
+    return true;
+}
+
+void reverse_proxy::health_check(){
+    for(upstream* up : upstreams){
+        // 上个周期发起的探测连接：已经连上说明上游可用
+        if(up->check_fd >= 0){
+            pollfd p = {up->check_fd, POLLOUT, 0};
+            int err = 0;
+            socklen_t len = sizeof(err);
+            bool ok = poll(&p, 1, 0) == 1 && getsockopt(up->check_fd, SOL_SOCKET, SO_ERROR, &err, &len) == 0 && err == 0;
+            close(up->check_fd);
+            up->check_fd = -1;
+            if(ok){
+                report(up, true);
+            }else{
+                up->fails = MAX_FAILS - 1;
+                report(up, false);
+            }
+        }
+
+        // 发起新一轮探测，UNIX socket通常立刻得到结果
+        int fd = open_socket(up);
+        if(fd < 0){
+            continue;
+        }
+        if(connect(fd, (sockaddr*)&up->addr, up->addr_len) == 0){
+            close(fd);
+            report(up, true);
+        }else if(errno == EINPROGRESS){
+            up->check_fd = fd;
+        }else{
+            close(fd);
+            up->fails = MAX_FAILS - 1;
+            report(up, false);
+        }
+    }
+}
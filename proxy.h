@@ -0,0 +1,52 @@
+#ifndef PROXY_H
+#define PROXY_H
+#include <sys/socket.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include "router.h"
+
+// 一个上游地址，TCP（host:port）或者UNIX socket（unix:/path）
+struct upstream{
+    std::string name;               // 配置中的写法，用于日志
+    int id;                         // 在所有上游中的下标，线程的连接池按它索引
+    sockaddr_storage addr;
+    socklen_t addr_len;
+    std::atomic<int> active;        // 正在转发的请求数，用于最少连接负载均衡
+    std::atomic<int> fails;         // 连续失败的次数
+    std::atomic<bool> healthy;      // 是否可用，由健康检查和转发结果更新
+    int check_fd;                   // 主动健康检查中尚未完成的非阻塞connect，只在主线程访问
+};
+
+// 一条转发规则：URL前缀 -> 一组上游
+struct proxy_pass{
+    std::string prefix;             // 以/结尾，如 /api/
+    std::vector<upstream*> upstreams;
+    std::atomic<unsigned> next;     // 连接数相同时轮流选择的起点
+};
+
+// 反向代理
+// 匹配前缀的请求以接管连接的方式交给工作线程同步转发：请求体从客户端socket直接splice到上游，
+// 定长和以关闭连接结束的响应体从上游socket直接splice回客户端，chunked响应体需要解析块边界，拷贝转发
+// 上游连接按线程缓存复用，每个工作线程有自己的空闲连接池，不需要加锁
+class reverse_proxy{
+public:
+    static const int MAX_FAILS = 3;             // 连续失败这么多次后标记为不可用
+    static const int MAX_IDLE = 16;             // 每个线程对每个上游最多缓存的空闲连接数
+    static const int IDLE_TIMEOUT = 15;         // 空闲连接的最长保留时间：秒
+    static const int HEAD_BUFFER_SIZE = 8192;   // 上游响应头的最大长度
+
+    // 解析 "prefix=addr[,addr...]" 并注册接管路由，在启动阶段finalize路由表之前调用
+    static bool add_pass(const char* spec, router& routes);
+
+    // 主动健康检查：检查上个周期发起的探测连接的结果，然后发起新一轮探测
+    // 由主线程在定时器周期调用，不会阻塞
+    static void health_check();
+
+    static int m_timeout_ms;    // 连接上游、等待上游数据以及两端收发时单次等待的超时时间
+
+private:
+    static void handle(const http_request& req, http_response& resp);
+};
+
+#endif
@@ -0,0 +1,146 @@
+#include "ratelimit.h"
+#include "coarse_clock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+rate_limiter::slot* rate_limiter::m_slots = NULL;
+uint32_t rate_limiter::m_rate = 0;
+uint32_t rate_limiter::m_burst = 0;
+uint32_t rate_limiter::m_max_conns = 0;
+uint32_t rate_limiter::m_mask = 0xffffffff;
+
+const char rate_limiter::REJECT_RESPONSE[] =
+    "HTTP/1.1 429 Too Many Requests\r\n"
+    "Content-Type: text/html\r\n"
+    "Content-Length: 34\r\n"
+    "Retry-After: 1\r\n"
+    "Connection: close\r\n"
+    "\r\n"
+    "You are sending requests too fast.";
+const int rate_limiter::REJECT_LEN = sizeof(REJECT_RESPONSE) - 1;
+
+bool rate_limiter::init(const char* spec){
+    int rate = 0, burst = 0, conns = 0, prefix = 32;
+    if(sscanf(spec, "%d,%d,%d,%d", &rate, &burst, &conns, &prefix) < 2
+        || rate <= 0 || burst <= 0 || conns < 0 || prefix < 1 || prefix > 32){
+        return false;
+    }
+    m_rate = rate;
+    m_burst = burst;
+    m_max_conns = conns;
+    m_mask = (prefix == 32) ? 0xffffffff : ~(0xffffffffu >> prefix);
+
+    // calloc得到的零页在第一次写入时才占用物理内存，全零就是空槽
+    m_slots = (slot*)calloc(TABLE_SIZE, sizeof(slot));
+    return m_slots != NULL;
+}
+
+uint32_t rate_limiter::key_of(in_addr_t addr){
+    return (ntohl(addr) & m_mask) + 1;
+}
+
+// 毫秒级的单调时间，读取主线程每轮事件循环更新的缓存
+uint32_t rate_limiter::now_ms(){
+    return (uint32_t)coarse_clock::mono_ms();
+}
+
+// 查找key对应的槽位，create为true时不存在就占用一个空槽或者淘汰一个旧槽
+// 返回NULL表示没有跟踪这个客户端（探测范围内都是有连接的客户端，或者淘汰时被其它线程抢先），调用者放行
+rate_limiter::slot* rate_limiter::find(uint32_t key, bool create, uint32_t now){
+    uint32_t h = (key * 2654435761u) >> (32 - TABLE_BITS);
+    slot* victim = NULL;
+    uint32_t oldest = 0;
+    for(int i = 0; i < PROBE; ++i){
+        slot* s = &m_slots[(h + i) & (TABLE_SIZE - 1)];
+        uint32_t k = s->key.load(std::memory_order_acquire);
+        if(k == key){
+            return s;
+        }
+        if(k == 0){
+            if(!create){
+                return NULL;
+            }
+            if(s->key.compare_exchange_strong(k, key, std::memory_order_acq_rel)){
+                s->bucket.store(((uint64_t)now << 32) | ((uint64_t)m_burst * 1000), std::memory_order_release);
+                return s;
+            }
+            if(k == key){
+                return s;   // 其它线程刚刚插入了同一个客户端
+            }
+            continue;
+        }
+        // 槽位从不删除，只会被替换，所以遇到别的key要继续探测
+        uint32_t idle = now - (uint32_t)(s->bucket.load(std::memory_order_relaxed) >> 32);
+        if(create && s->conns.load(std::memory_order_relaxed) == 0 && (!victim || idle > oldest)){
+            victim = s;
+            oldest = idle;
+        }
+    }
+    if(!victim){
+        return NULL;
+    }
+    uint32_t old = victim->key.load(std::memory_order_relaxed);
+    if(!victim->key.compare_exchange_strong(old, key, std::memory_order_acq_rel)){
+        return NULL;
+    }
+    victim->bucket.store(((uint64_t)now << 32) | ((uint64_t)m_burst * 1000), std::memory_order_release);
+    return victim;
+}
+
+bool rate_limiter::on_accept(in_addr_t addr, bool* counted){
+    *counted = false;
+    if(m_max_conns == 0){
+        return true;
+    }
+    slot* s = find(key_of(addr), true, now_ms());
+    if(!s){
+        return true;
+    }
+    if(s->conns.fetch_add(1, std::memory_order_relaxed) >= m_max_conns){
+        s->conns.fetch_sub(1, std::memory_order_relaxed);
+        return false;
+    }
+    *counted = true;
+    return true;
+}
+
+void rate_limiter::release(in_addr_t addr){
+    slot* s = find(key_of(addr), false, 0);
+    if(!s){
+        return;
+    }
+    uint32_t c = s->conns.load(std::memory_order_relaxed);
+    while(c > 0 && !s->conns.compare_exchange_weak(c, c - 1, std::memory_order_relaxed)){
+    }
+}
+
+bool rate_limiter::on_request(in_addr_t addr){
+    uint32_t now = now_ms();
+    slot* s = find(key_of(addr), true, now);
+    if(!s){
+        return true;
+    }
+    uint64_t limit = (uint64_t)m_burst * 1000;
+    uint64_t cur = s->bucket.load(std::memory_order_relaxed);
+    while(true){
+        uint32_t last = cur >> 32;
+        uint64_t tokens = (uint32_t)cur;
+        // 经过的毫秒数乘以每秒的令牌数，正好是千分之一令牌的个数；其它线程可能已经写入了更晚的时间
+        int32_t elapsed = (int32_t)(now - last);
+        if(elapsed > 0){
+            tokens += (uint64_t)elapsed * m_rate;
+            if(tokens > limit){
+                tokens = limit;
+            }
+            last = now;
+        }
+        // 拒绝时同样写回补充后的令牌和时间，让被拒绝的客户端在淘汰时看起来是活跃的
+        bool ok = tokens >= 1000;
+        uint64_t next = ((uint64_t)last << 32) | (ok ? tokens - 1000 : tokens);
+        if(s->bucket.compare_exchange_weak(cur, next, std::memory_order_relaxed)){
+            return ok;
+        }
+    }
+}
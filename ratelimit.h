@@ -0,0 +1,52 @@
+#ifndef RATELIMIT_H
+#define RATELIMIT_H
+#include <stdint.h>
+#include <atomic>
+#include <netinet/in.h>
+
+// 按客户端IP限流：每个地址（或者按前缀聚合的网段）一个令牌桶限制请求速率，一个计数器限制同时的连接数
+// 状态放在固定大小的开放寻址哈希表里，每个槽位16字节，所有操作都是对槽位的原子读写和CAS，不加锁，
+// 主线程和工作线程可以同时调用；探测范围内没有空槽时淘汰其中最久没有请求、也没有连接的槽位（近似LRU）
+// 服务器只监听IPv4，网段聚合按IPv4前缀（如/24）
+class rate_limiter{
+public:
+    static const int TABLE_BITS = 21;
+    static const uint32_t TABLE_SIZE = 1u << TABLE_BITS;   // 2M个槽位，负载一半时跟踪1M个客户端，共32MB
+    static const int PROBE = 8;                             // 线性探测的长度，一次查找最多访问两条缓存行
+
+    // 解析 "rps,burst[,conns[,prefix]]" 并分配哈希表，启动阶段调用
+    // rps：每秒的请求数；burst：桶的容量；conns：每个客户端的最大连接数，0不限制；prefix：聚合的前缀长度，默认32
+    static bool init(const char* spec);
+    static bool enabled(){ return m_slots != NULL; }
+
+    // 新连接：超过连接数上限返回false；计入了连接数时counted为true，连接关闭时要调用release归还
+    static bool on_accept(in_addr_t addr, bool* counted);
+    static void release(in_addr_t addr);
+
+    // 一个新请求：从令牌桶中取一个令牌，令牌不足返回false
+    static bool on_request(in_addr_t addr);
+
+    // 预先生成的429应答，拒绝时直接发送，然后关闭连接
+    static const char REJECT_RESPONSE[];
+    static const int REJECT_LEN;
+
+private:
+    struct slot{
+        std::atomic<uint32_t> key;      // 网段地址（主机字节序）+ 1，0表示空槽
+        std::atomic<uint32_t> conns;    // 当前连接数
+        std::atomic<uint64_t> bucket;   // 高32位：上次取令牌的时间(ms)，低32位：剩余的令牌数 * 1000
+    };
+
+    static uint32_t key_of(in_addr_t addr);
+    static slot* find(uint32_t key, bool create, uint32_t now);
+    static uint32_t now_ms();
+
+private:
+    static slot* m_slots;
+    static uint32_t m_rate;         // 每秒补充的令牌数
+    static uint32_t m_burst;        // 桶的容量
+    static uint32_t m_max_conns;    // 每个客户端的最大连接数，0不限制
+    static uint32_t m_mask;         // 网段掩码（主机字节序）
+};
+
+#endif
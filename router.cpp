@@ -0,0 +1,154 @@
+#include "router.h"
+#include <strings.h>
+#include "http_conn.h"
+
+// 请求方法名，顺序与http_conn::METHOD一致
+static const char* const method_names[ROUTE_METHOD_COUNT] = {
+    "GET", "POST", "HEAD", "PUT", "DELETE", "TRACE", "OPTIONS", "CONNECT"
+};
+
+const char* method_name(int method){
+    if(method < 0 || method >= ROUTE_METHOD_COUNT){
+        return "UNKNOWN";
+    }
+    return method_names[method];
+}
+
+int method_from_name(const char* name){
+    for(int i = 0; i < ROUTE_METHOD_COUNT; ++i){
+        if(strcasecmp(name, method_names[i]) == 0){
+            return i;
+        }
+    }
+    return -1;
+}
+
+std::string_view route_params::get(std::string_view name) const{
+    for(int i = 0; i < count; ++i){
+        if(names[i] == name){
+            return values[i];
+        }
+    }
+    return std::string_view();
+}
+
+static bool has_target(const route_node& node){
+    for(int i = 0; i < ROUTE_METHOD_COUNT; ++i){
+        if(node.targets[i].handler){
+            return true;
+        }
+    }
+    return false;
+}
+
+// 从节点idx开始匹配剩余路径rest（不含开头的/）
+static const route_node* match_node(const route_node* nodes, int idx, std::string_view rest, route_params& params){
+    const route_node& node = nodes[idx];
+
+    if(rest.empty()){
+        if(has_target(node)){
+            return &node;
+        }
+        // 前缀路由也匹配前缀本身，如 /static/* 匹配 /static/
+        if(node.wildcard_child >= 0 && params.count < ROUTE_MAX_PARAMS){
+            params.names[params.count] = nodes[node.wildcard_child].segment;
+            params.values[params.count++] = rest;
+            return &nodes[node.wildcard_child];
+        }
+        return NULL;
+    }
+
+    size_t pos = rest.find('/');
+    std::string_view seg = rest.substr(0, pos);
+    std::string_view next = (pos == std::string_view::npos) ? std::string_view() : rest.substr(pos + 1);
+
+    // 静态子节点有序排列，二分查找
+    const route_node* first = nodes + node.child_begin;
+    const route_node* last = nodes + node.child_end;
+    const route_node* it = std::lower_bound(first, last, seg, [](const route_node& n, std::string_view s){
+        return n.segment < s;
+    });
+    if(it != last && it->segment == seg){
+        const route_node* ret = match_node(nodes, it - nodes, next, params);
+        if(ret){
+            return ret;
+        }
+    }
+
+    if(node.param_child >= 0 && !seg.empty() && params.count < ROUTE_MAX_PARAMS){
+        int saved = params.count;
+        params.names[params.count] = nodes[node.param_child].segment;
+        params.values[params.count++] = seg;
+        const route_node* ret = match_node(nodes, node.param_child, next, params);
+        if(ret){
+            return ret;
+        }
+        params.count = saved;
+    }
+
+    if(node.wildcard_child >= 0 && params.count < ROUTE_MAX_PARAMS){
+        params.names[params.count] = nodes[node.wildcard_child].segment;
+        params.values[params.count++] = rest;
+        return &nodes[node.wildcard_child];
+    }
+    return NULL;
+}
+
+const route_node* route_match(route_view routes, std::string_view path, route_params& params){
+    if(routes.count == 0 || path.empty() || path[0] != '/'){
+        return NULL;
+    }
+    return match_node(routes.nodes, 0, path.substr(1), params);
+}
+
+std::string route_allow(const route_node* node){
+    std::string allow;
+    for(int i = 0; i < ROUTE_METHOD_COUNT; ++i){
+        // GET的处理函数同时处理HEAD，OPTIONS总是由服务器应答
+        bool allowed = node->targets[i].handler != NULL;
+        if(i == http_conn::HEAD && node->targets[http_conn::GET].handler){
+            allowed = true;
+        }
+        if(i == http_conn::OPTIONS){
+            allowed = true;
+        }
+        if(allowed){
+            if(!allow.empty()){
+                allow += ", ";
+            }
+            allow += method_names[i];
+        }
+    }
+    return allow;
+}
+
+router::router(): m_nodes(1), m_count(1){
+}
+
+bool router::add(int method, const char* pattern, route_handler handler, route_body_handler on_body){
+    route_target target = {handler, on_body};
+    return insert(method, pattern, target);
+}
+
+bool router::add_takeover(int method, const char* pattern, route_handler handler){
+    route_target target = {handler, NULL, true};
+    return insert(method, pattern, target);
+}
+
+bool router::insert(int method, const char* pattern, route_target target){
+    m_patterns.push_back(pattern);
+    const std::string& saved = m_patterns.back();
+
+    // 每个路径段最多新增一个节点
+    size_t segments = std::count(saved.begin(), saved.end(), '/');
+    if(m_nodes.size() < m_count + segments){
+        m_nodes.resize(m_count + segments);
+    }
+    return route_insert(m_nodes, m_count, m_nodes.size(), method, saved, target);
+}
+
+route_view router::finalize(){
+    route_finalize(m_nodes, m_count);
+    m_nodes.resize(m_count);
+    return route_view{m_nodes.data(), m_count};
+}
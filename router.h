@@ -0,0 +1,329 @@
+#ifndef ROUTER_H
+#define ROUTER_H
+#include <stddef.h>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <array>
+#include <algorithm>
+#include <sys/socket.h>
+#include "header_map.h"
+
+class http_conn;
+class http_response;
+struct http_request;
+
+// 路由处理函数：根据请求填充响应
+typedef void (*route_handler)(const http_request& req, http_response& resp);
+// 请求体处理函数：请求体每到达一段就调用一次，返回false表示处理失败
+typedef bool (*route_body_handler)(const http_request& req, const char* data, int len);
+// 流式响应的生产函数：每次发送完上一段后调用，写入下一段或者结束响应，返回false表示出错
+// 在主线程的写事件中调用，不能阻塞
+typedef bool (*stream_producer)(http_response& resp, void* ctx);
+
+static const int ROUTE_METHOD_COUNT = 8;    // http_conn::METHOD 的个数
+static const int ROUTE_MAX_PARAMS = 8;      // 一条路由最多的参数个数
+
+// 路由节点类型
+// ROUTE_STATIC：静态路径段，如 /api
+// ROUTE_PARAM：参数段，如 /:id，匹配任意一段
+// ROUTE_WILDCARD：通配段，如 /*path，匹配剩余的全部路径（前缀路由），只能是最后一段
+enum ROUTE_KIND {ROUTE_STATIC = 0, ROUTE_PARAM, ROUTE_WILDCARD};
+
+// 每个请求方法对应的处理函数
+// takeover为true时处理函数在请求头解析完后立即调用，请求体留给处理函数通过http_response::hijack自己读取
+struct route_target{
+    route_handler handler = NULL;
+    route_body_handler on_body = NULL;
+    bool takeover = false;
+};
+
+// 路由树节点，以路径段为单位的前缀树，所有节点存放在一个连续数组里
+// 构建时子节点用链表串起来，整理(route_finalize)之后同一父节点的静态子节点在数组中连续并按字典序排列，查找时二分
+struct route_node{
+    std::string_view segment;   // 静态段的文本，参数段和通配段为参数名
+    int kind;
+    int first_child;            // 构建阶段：静态子节点链表
+    int next_sibling;
+    int child_begin;            // 整理后：静态子节点为[child_begin, child_end)
+    int child_end;
+    int param_child;            // 参数子节点，没有为-1
+    int wildcard_child;         // 通配子节点，没有为-1
+    route_target targets[ROUTE_METHOD_COUNT];
+
+    constexpr route_node(): segment(), kind(ROUTE_STATIC), first_child(-1), next_sibling(-1),
+        child_begin(0), child_end(0), param_child(-1), wildcard_child(-1), targets(){}
+};
+
+// 路由匹配得到的参数，值指向请求的读缓冲区
+struct route_params{
+    std::string_view names[ROUTE_MAX_PARAMS];
+    std::string_view values[ROUTE_MAX_PARAMS];
+    int count;
+
+    route_params(): count(0){}
+    std::string_view get(std::string_view name) const;
+};
+
+// 整理后的路由表，运行时构建的router和编译期构建的static_router都以这种形式交给http_conn
+struct route_view{
+    const route_node* nodes;
+    int count;
+};
+
+// 请求方法名和http_conn::METHOD之间的转换，未知的方法名返回-1
+const char* method_name(int method);
+int method_from_name(const char* name);
+
+// 在路由表中查找路径，返回匹配的节点，没有匹配返回NULL
+// 优先级：静态段 > 参数段 > 通配段，静态段匹配失败会回溯
+const route_node* route_match(route_view routes, std::string_view path, route_params& params);
+
+// 生成节点允许的请求方法列表，如 "GET, HEAD, OPTIONS"
+std::string route_allow(const route_node* node);
+
+// 编译期路由表中的一条路由
+struct route_def{
+    int method;
+    std::string_view pattern;
+    route_handler handler;
+    route_body_handler on_body;
+};
+
+// 在parent下查找或者创建路径段seg对应的子节点，返回子节点下标，节点数组已满返回-1
+template<typename Nodes>
+constexpr int route_child(Nodes& nodes, int& count, int capacity, int parent, std::string_view seg){
+    int kind = ROUTE_STATIC;
+    if(!seg.empty() && seg[0] == ':'){
+        kind = ROUTE_PARAM;
+        seg = seg.substr(1);
+    }else if(!seg.empty() && seg[0] == '*'){
+        kind = ROUTE_WILDCARD;
+        seg = (seg.size() > 1) ? seg.substr(1) : std::string_view("*");
+    }
+
+    if(kind == ROUTE_PARAM && nodes[parent].param_child >= 0){
+        return nodes[parent].param_child;
+    }
+    if(kind == ROUTE_WILDCARD && nodes[parent].wildcard_child >= 0){
+        return nodes[parent].wildcard_child;
+    }
+    if(kind == ROUTE_STATIC){
+        for(int c = nodes[parent].first_child; c >= 0; c = nodes[c].next_sibling){
+            if(nodes[c].segment == seg){
+                return c;
+            }
+        }
+    }
+
+    if(count >= capacity){
+        return -1;
+    }
+    int idx = count++;
+    nodes[idx].segment = seg;
+    nodes[idx].kind = kind;
+    if(kind == ROUTE_PARAM){
+        nodes[parent].param_child = idx;
+    }else if(kind == ROUTE_WILDCARD){
+        nodes[parent].wildcard_child = idx;
+    }else{
+        nodes[idx].next_sibling = nodes[parent].first_child;
+        nodes[parent].first_child = idx;
+    }
+    return idx;
+}
+
+// 插入一条路由，模式串以/开头，如 /api/users/:id、/static/*path
+// 下标0是根节点，调用前count至少为1
+template<typename Nodes>
+constexpr bool route_insert(Nodes& nodes, int& count, int capacity, int method,
+        std::string_view pattern, route_target target){
+    if(pattern.empty() || pattern[0] != '/' || method < 0 || method >= ROUTE_METHOD_COUNT){
+        return false;
+    }
+    int cur = 0;
+    std::string_view rest = pattern.substr(1);
+    while(!rest.empty()){
+        size_t pos = rest.find('/');
+        std::string_view seg = rest.substr(0, pos);
+        rest = (pos == std::string_view::npos) ? std::string_view() : rest.substr(pos + 1);
+
+        cur = route_child(nodes, count, capacity, cur, seg);
+        if(cur < 0){
+            return false;
+        }
+        if(nodes[cur].kind == ROUTE_WILDCARD){
+            if(!rest.empty()){
+                return false;   // 通配段只能是最后一段
+            }
+            break;
+        }
+    }
+    nodes[cur].targets[method] = target;
+    return true;
+}
+
+// 整理路由树：按广度优先重新排列节点，让每个节点的静态子节点连续且有序
+template<typename Nodes>
+constexpr void route_finalize(Nodes& nodes, int count){
+    std::vector<int> order;
+    order.reserve(count);
+    order.push_back(0);
+    std::vector<int> begin(count, 0), end(count, 0);
+    for(size_t i = 0; i < order.size(); ++i){
+        int n = order[i];
+        begin[n] = order.size();
+        for(int c = nodes[n].first_child; c >= 0; c = nodes[c].next_sibling){
+            order.push_back(c);
+        }
+        std::sort(order.begin() + begin[n], order.end(), [&nodes](int a, int b){
+            return nodes[a].segment < nodes[b].segment;
+        });
+        end[n] = order.size();
+        if(nodes[n].param_child >= 0){
+            order.push_back(nodes[n].param_child);
+        }
+        if(nodes[n].wildcard_child >= 0){
+            order.push_back(nodes[n].wildcard_child);
+        }
+    }
+
+    std::vector<int> new_index(count, -1);
+    for(int i = 0; i < count; ++i){
+        new_index[order[i]] = i;
+    }
+    std::vector<route_node> old(count);
+    for(int i = 0; i < count; ++i){
+        old[i] = nodes[i];
+    }
+    for(int i = 0; i < count; ++i){
+        const route_node& src = old[order[i]];
+        route_node& dst = nodes[i];
+        dst = src;
+        dst.first_child = -1;
+        dst.next_sibling = -1;
+        dst.child_begin = begin[order[i]];
+        dst.child_end = end[order[i]];
+        dst.param_child = (src.param_child >= 0) ? new_index[src.param_child] : -1;
+        dst.wildcard_child = (src.wildcard_child >= 0) ? new_index[src.wildcard_child] : -1;
+    }
+}
+
+// 运行时构建的路由表，在启动阶段注册完所有路由后调用finalize，之后只读，可以被多个工作线程同时查找
+class router{
+public:
+    router();
+
+    // 注册路由，模式串会被复制保存
+    bool add(int method, const char* pattern, route_handler handler, route_body_handler on_body = NULL);
+    // 注册接管连接的路由，如反向代理
+    bool add_takeover(int method, const char* pattern, route_handler handler);
+
+    // 整理路由树，返回给http_conn使用的路由表
+    route_view finalize();
+
+private:
+    bool insert(int method, const char* pattern, route_target target);
+
+private:
+    std::vector<route_node> m_nodes;
+    std::deque<std::string> m_patterns; // 节点中的路径段指向这里
+    int m_count;
+};
+
+// 计算编译期路由表需要的节点数上限：根节点加上所有路径段
+template<size_t N>
+constexpr size_t route_node_bound(const route_def (&defs)[N]){
+    size_t n = 1;
+    for(size_t i = 0; i < N; ++i){
+        for(char c : defs[i].pattern){
+            if(c == '/'){
+                ++n;
+            }
+        }
+    }
+    return n;
+}
+
+// 编译期构建的路由表
+// 用法：
+//   constexpr route_def defs[] = {{http_conn::GET, "/api/users/:id", get_user, NULL}, ...};
+//   constexpr static_router<route_node_bound(defs)> routes(defs);
+//   static_assert(routes.ok());
+template<size_t MaxNodes>
+class static_router{
+public:
+    template<size_t N>
+    constexpr static_router(const route_def (&defs)[N]): m_nodes(), m_count(1), m_ok(true){
+        for(size_t i = 0; i < N; ++i){
+            route_target target = {defs[i].handler, defs[i].on_body};
+            if(!route_insert(m_nodes, m_count, MaxNodes, defs[i].method, defs[i].pattern, target)){
+                m_ok = false;
+            }
+        }
+        route_finalize(m_nodes, m_count);
+    }
+
+    constexpr bool ok() const { return m_ok; }
+    route_view view() const { return route_view{m_nodes.data(), m_count}; }
+
+private:
+    std::array<route_node, MaxNodes> m_nodes;
+    int m_count;
+    bool m_ok;
+};
+
+// 交给处理函数的请求，所有字符串都指向连接的读缓冲区，不做拷贝
+struct http_request{
+    int method;                     // http_conn::METHOD
+    std::string_view url;           // 请求行中的URL，包含查询串
+    std::string_view path;          // 路径部分
+    std::string_view query;         // ?之后的查询串
+    std::string_view version;
+    std::string_view host;
+    long content_length;
+    bool chunked;
+    route_params params;            // 路由参数
+    header_map headers;             // HTTP/1.x请求的全部头部，指向读缓冲区；HTTP/2请求为空，只有上面的伪头部
+
+    std::string_view param(std::string_view name) const { return params.get(name); }
+    std::string_view header(std::string_view name) const { return headers.get(name); }
+};
+
+// 接管连接时交给处理函数的客户端连接信息
+struct http_hijack{
+    int fd;                         // 客户端socket，非阻塞
+    const sockaddr* addr;           // 客户端地址
+    const char* headers;            // 原始请求头，解析时每行的CRLF被替换成了两个'\0'，以空行结束
+    int headers_len;
+    const char* pending;            // 已经读入缓冲区的请求体，其余部分还在socket中
+    int pending_len;
+};
+
+// 处理函数通过它填充响应，状态保存在连接对象里
+// 定长响应体用send一次给出；流式响应调用stream注册生产函数，之后每段用write_chunk写入，最后调用end
+// 接管路由的处理函数调用hijack后自己完成请求体的读取和响应的发送，服务器不再发送任何内容
+class http_response{
+public:
+    explicit http_response(http_conn* conn): m_conn(conn){}
+
+    void set_status(int status, const char* title);
+    void set_content_type(const char* type);
+    bool add_header(const char* name, const char* value);
+    bool send(const char* data, size_t len);
+    bool send(std::string_view body){ return send(body.data(), body.size()); }
+
+    void stream(stream_producer producer, void* ctx);
+    bool write_chunk(const char* data, size_t len);
+    void end();
+
+    http_hijack hijack();
+    bool keep_alive() const;
+    void set_keep_alive(bool keep);     // 响应结束后是否继续在连接上处理下一个请求
+
+private:
+    http_conn* m_conn;
+};
+
+#endif
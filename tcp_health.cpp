@@ -0,0 +1,148 @@
+#include "tcp_health.h"
+#include "metrics.h"
+#include "web_timer.h"
+#include "http_conn.h"
+#include <stddef.h>
+#include <string.h>
+#include <linux/tcp.h>
+#include <algorithm>
+
+extern void log(std::string str);
+
+bool tcp_health::m_enabled = false;
+uint64_t tcp_health::m_round = 0;
+std::atomic<uint64_t> tcp_health::m_rtt[RTT_BUCKETS + 1];
+std::atomic<uint64_t> tcp_health::m_rtt_sum_us(0);
+std::atomic<uint64_t> tcp_health::m_cwnd[CWND_BUCKETS + 1];
+std::atomic<uint64_t> tcp_health::m_cwnd_sum(0);
+std::atomic<uint64_t> tcp_health::m_retrans[RETRANS_BUCKETS + 1];
+std::atomic<uint64_t> tcp_health::m_retrans_total(0);
+std::atomic<int> tcp_health::m_sampled(0);
+std::atomic<int> tcp_health::m_slow(0);
+std::atomic<uint64_t> tcp_health::m_slow_total(0);
+int tcp_health::m_round_slow = 0;
+
+// tcp_info的tcpi_state，linux/tcp.h中没有定义
+static const int STATE_ESTABLISHED = 1;
+
+// 样本落在第几个桶：上界依次为first、2*first、4*first ...，超过最后一个上界时为n
+static int bucket_of(uint64_t v, uint64_t first, int n){
+    int i = 0;
+    while(i < n && v > (first << i)){
+        ++i;
+    }
+    return i;
+}
+
+void tcp_health::init(){
+    m_enabled = true;
+    metrics::add(export_metrics);
+}
+
+void tcp_health::sample(sort_timer_lst& timers){
+    int stride = http_conn::m_user_count / MAX_SAMPLES + 1;
+    int offset = m_round++ % stride;
+    int sampled = 0;
+    int i = 0;
+    m_round_slow = 0;
+    for(util_timer* t = timers.front(); t; t = t->next, ++i){
+        if(i % stride == offset){
+            t->user_data->tcp_sample();
+            ++sampled;
+        }
+    }
+    m_sampled.store(sampled, std::memory_order_relaxed);
+    m_slow.store(m_round_slow, std::memory_order_relaxed);
+}
+
+void tcp_health::record(uint32_t rtt_us, uint32_t cwnd, uint32_t retrans){
+    m_rtt[bucket_of(rtt_us, 16, RTT_BUCKETS)].fetch_add(1, std::memory_order_relaxed);
+    m_rtt_sum_us.fetch_add(rtt_us, std::memory_order_relaxed);
+    m_cwnd[bucket_of(cwnd, 1, CWND_BUCKETS)].fetch_add(1, std::memory_order_relaxed);
+    m_cwnd_sum.fetch_add(cwnd, std::memory_order_relaxed);
+    // 重传数的第一个桶是0，之后是1、2、4 ...
+    m_retrans[retrans == 0 ? 0 : 1 + bucket_of(retrans, 1, RETRANS_BUCKETS - 1)].fetch_add(1, std::memory_order_relaxed);
+    m_retrans_total.fetch_add(retrans, std::memory_order_relaxed);
+}
+
+void tcp_health::slow_send(bool first){
+    ++m_round_slow;
+    if(first){
+        m_slow_total.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+// RTT、拥塞窗口和每周期重传数的直方图，采样数和发送停滞的连接数，见metrics.h
+void tcp_health::export_metrics(std::string& out){
+    static double rtt_bounds[RTT_BUCKETS];
+    static double cwnd_bounds[CWND_BUCKETS];
+    static double retrans_bounds[RETRANS_BUCKETS];
+    static bool ready = []{
+        for(int i = 0; i < RTT_BUCKETS; ++i){
+            rtt_bounds[i] = (double)(16ull << i) / 1e6;
+        }
+        for(int i = 0; i < CWND_BUCKETS; ++i){
+            cwnd_bounds[i] = (double)(1ull << i);
+        }
+        retrans_bounds[0] = 0;
+        for(int i = 1; i < RETRANS_BUCKETS; ++i){
+            retrans_bounds[i] = (double)(1ull << (i - 1));
+        }
+        return true;
+    }();
+    (void)ready;
+
+    metrics::histogram(out, "tinyhttp_tcp_rtt_seconds", "Smoothed RTT of sampled client connections (TCP_INFO).",
+        rtt_bounds, RTT_BUCKETS, m_rtt, m_rtt_sum_us.load(std::memory_order_relaxed) / 1e6);
+    metrics::histogram(out, "tinyhttp_tcp_cwnd_segments", "Congestion window of sampled client connections.",
+        cwnd_bounds, CWND_BUCKETS, m_cwnd, m_cwnd_sum.load(std::memory_order_relaxed));
+    metrics::histogram(out, "tinyhttp_tcp_retransmits_per_interval", "Segments retransmitted on a connection between two samples.",
+        retrans_bounds, RETRANS_BUCKETS, m_retrans, m_retrans_total.load(std::memory_order_relaxed));
+    metrics::value(out, "tinyhttp_tcp_retransmits_total", "Segments retransmitted on sampled client connections.", "counter",
+        m_retrans_total.load(std::memory_order_relaxed));
+    metrics::value(out, "tinyhttp_tcp_sampled_connections", "Connections sampled in the last timer interval.", "gauge",
+        m_sampled.load(std::memory_order_relaxed));
+    metrics::value(out, "tinyhttp_tcp_slow_send_connections", "Connections with a send backlog and no acknowledged data in the last interval.", "gauge",
+        m_slow.load(std::memory_order_relaxed));
+    metrics::value(out, "tinyhttp_tcp_slow_send_total", "Connections that entered the slow-send state.", "counter",
+        m_slow_total.load(std::memory_order_relaxed));
+}
+
+// 采样一次TCP_INFO，只在主线程调用
+// 发送积压按内核的发送队列计算（未确认的报文段加上还没有发出的字节），不读取工作线程可能正在修改的bytes_to_send
+void http_conn::tcp_sample(){
+    if(m_sockfd < 0){
+        return;
+    }
+    tcp_info ti;
+    memset(&ti, 0, sizeof(ti));
+    socklen_t len = sizeof(ti);
+    if(getsockopt(m_sockfd, IPPROTO_TCP, TCP_INFO, &ti, &len) != 0 || ti.tcpi_state != STATE_ESTABLISHED){
+        return;
+    }
+    uint32_t retrans = ti.tcpi_total_retrans - m_tcp.total_retrans;
+    m_tcp.total_retrans = ti.tcpi_total_retrans;
+    tcp_health::record(ti.tcpi_rtt, ti.tcpi_snd_cwnd, retrans);
+
+    // 老内核没有bytes_acked和notsent_bytes，不判断发送停滞
+    if(len < offsetof(tcp_info, tcpi_notsent_bytes) + sizeof(ti.tcpi_notsent_bytes)){
+        return;
+    }
+    uint64_t backlog = (uint64_t)ti.tcpi_unacked * ti.tcpi_snd_mss + ti.tcpi_notsent_bytes;
+    bool stalled = backlog >= (uint64_t)tcp_health::SLOW_SEND_BYTES && ti.tcpi_bytes_acked == m_tcp.bytes_acked;
+    m_tcp.bytes_acked = ti.tcpi_bytes_acked;
+    if(!stalled){
+        m_tcp.slow_rounds = 0;
+        return;
+    }
+    tcp_health::slow_send(++m_tcp.slow_rounds == 1);
+    if(m_tcp.slow_rounds == 1){
+        char peer[INET6_ADDRSTRLEN + 8];
+        char buf[256];
+        peer_name(peer, sizeof(peer));
+        snprintf(buf, sizeof(buf), "tcp: slow send to %s fd %d, %lu bytes queued, nothing acked in %ds, rtt %.1fms, rto %ums, cwnd %u, retrans %u, peer window %u\n",
+            peer, m_sockfd, (unsigned long)backlog, TIMESLOT * (http_conn::m_user_count / tcp_health::MAX_SAMPLES + 1), ti.tcpi_rtt / 1000.0, ti.tcpi_rto / 1000,
+            ti.tcpi_snd_cwnd, ti.tcpi_total_retrans, ti.tcpi_snd_wnd);
+        log(buf);
+    }
+}
@@ -0,0 +1,57 @@
+#ifndef TCP_HEALTH_H
+#define TCP_HEALTH_H
+#include <stdint.h>
+#include <atomic>
+#include <string>
+
+class sort_timer_lst;
+
+// 每个连接上一次采样的结果，用来计算两次采样之间的变化
+struct tcp_conn_sample{
+    uint64_t bytes_acked = 0;       // 对方确认的累计字节数
+    uint32_t total_retrans = 0;     // 累计重传的报文段数
+    int slow_rounds = 0;            // 连续没有发送进展的采样次数
+};
+
+// 连接的网络状况：主线程在每个定时器周期（TIMESLOT秒）遍历定时器链表，对连接调用一次getsockopt(TCP_INFO)，
+// 把RTT、拥塞窗口和两次采样之间的重传数计入直方图，和其它指标一起导出（见metrics.h），请求的处理路径上没有开销
+// 内核发送队列中积压了至少SLOW_SEND_BYTES字节而对方在一个采样周期内没有确认任何数据的连接记为发送停滞，写入日志
+// 一个周期最多采样MAX_SAMPLES个连接，连接更多时每个周期按不同的起点间隔采样，轮流覆盖所有连接
+class tcp_health{
+public:
+    static const int MAX_SAMPLES = 4096;
+    static const int SLOW_SEND_BYTES = 64 * 1024;
+    static const int RTT_BUCKETS = 22;      // RTT的上界为16us、32us ... 2^25us(约33秒)
+    static const int CWND_BUCKETS = 15;     // 拥塞窗口的上界为1、2、4 ... 2^14个报文段
+    static const int RETRANS_BUCKETS = 11;  // 一个周期内重传数的上界为0、1、2、4 ... 512
+
+    static void init();                     // 启动阶段调用，开启采样并注册到metrics
+    static bool enabled(){ return m_enabled; }
+
+    // 主线程：定时器周期中采样链表上的连接
+    static void sample(sort_timer_lst& timers);
+
+    // 一个连接的采样结果，由http_conn::tcp_sample调用
+    static void record(uint32_t rtt_us, uint32_t cwnd, uint32_t retrans);
+    static void slow_send(bool first);
+
+private:
+    static void export_metrics(std::string& out);
+
+private:
+    static bool m_enabled;
+    static uint64_t m_round;                // 采样的周期数，决定间隔采样的起点
+
+    static std::atomic<uint64_t> m_rtt[RTT_BUCKETS + 1];
+    static std::atomic<uint64_t> m_rtt_sum_us;
+    static std::atomic<uint64_t> m_cwnd[CWND_BUCKETS + 1];
+    static std::atomic<uint64_t> m_cwnd_sum;
+    static std::atomic<uint64_t> m_retrans[RETRANS_BUCKETS + 1];
+    static std::atomic<uint64_t> m_retrans_total;
+    static std::atomic<int> m_sampled;      // 最近一个周期采样的连接数
+    static std::atomic<int> m_slow;         // 最近一个周期发送停滞的连接数
+    static std::atomic<uint64_t> m_slow_total;  // 新出现的发送停滞的连接累计数
+    static int m_round_slow;
+};
+
+#endif
@@ -3,99 +3,319 @@
 #include <pthread.h>
 #include <exception>
 #include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
 #include <list>
+#include <deque>
+#include <unordered_map>
+#include <vector>
+#include <atomic>
+#include <string>
+#include <algorithm>
 #include "locker.h"
+#include "probes.h"
+#include "metrics.h"
+
+extern void log(std::string str);
 
 // 线程池类，定义模板类，提高代码的复用性，模板参数T是任务类
+// 线程数在[min_threads, max_threads]之间按负载调整：监控线程每个周期统计请求在队列中的平均等待时间、
+// 工作线程的忙碌比例和进程的CPU利用率，等待时间长而CPU还有余量时扩容，持续空闲时逐个退出线程
+// min_threads等于max_threads时线程数固定，不创建监控线程
+// 默认按到达顺序处理请求；set_fair之后按append给出的类做差额轮询（DRR），见fair_sched.h
+// 只唤醒睡眠中的线程：忙碌的线程处理完当前请求后直接从队列取下一个，队列空了才登记为空闲并睡眠，
+// 提交请求时按空闲线程数唤醒，所有线程都在忙时提交不需要sem_post
 template<typename T>
 class threadpool{
 public:
-    threadpool(int m_thread_number = 8, int max_requests = 10000);
+    threadpool(int min_threads = 8, int max_threads = 8, int max_requests = 10000);
     ~threadpool();
-    bool append(T* request);
+    bool append(T* request, uint64_t key = 0, int weight = 1);
+
+    // 批量提交：主线程把一轮事件循环中读完的请求收集起来，一次加锁全部入队，最多唤醒min(请求数, 空闲线程数)个线程
+    // 成功入队的从batch中移除，留下的是队列已满被拒绝的，返回入队的个数
+    struct submission{
+        T* request;
+        uint64_t key;
+        int weight;
+    };
+    int append_batch(std::vector<submission>& batch);
+
+    // 开启按类的公平调度，class_queue为每类最多排队的请求数，在第一次append之前调用
+    void set_fair(int class_queue);
+
+    // 空闲的线程先自旋等待spin_us微秒再睡眠，请求到达时不用经过调度器唤醒，在创建后、第一次append之前调用
+    void set_spin(int spin_us){ m_spin_ns = (uint64_t)spin_us * 1000; }
+
+    static const int ADJUST_INTERVAL_MS = 200;  // 调整周期
+    static const int GROW_WAIT_US = 1000;       // 平均等待超过这个时间时考虑扩容
+    static const int SHRINK_PERIODS = 10;       // 连续这么多个周期空闲时退出一个线程
+    static const int QUANTUM_NS = 100000;       // 公平调度：每轮给一个类的服务时间额度，乘以它的权重
+    static const int MAX_DEBT_ROUNDS = 64;      // 一个类最多欠下这么多轮的额度，空闲前的大请求不会让它等得太久
+    static const int MAX_CLASS_SHARE = 75;      // 一个类最多同时占用的线程比例(%)，其余的线程留给别的客户端
+
+    // 最近一个周期的统计和累计的调整次数
+    struct stats{
+        int threads;        // 当前的工作线程数
+        int queued;         // 队列中等待的请求数
+        double wait_us;     // 请求在队列中的平均等待时间
+        double busy;        // 工作线程处于忙碌的时间比例
+        double cpu;         // 进程的CPU利用率，按CPU个数归一
+        long grows;         // 扩容次数
+        long shrinks;       // 缩容次数
+    };
+    stats snapshot();
+
+    // 把snapshot导出到指标URL，见metrics.h；只对处理请求的线程池调用一次
+    // 线程数固定时没有监控线程，等待时间、忙碌比例和CPU利用率不统计，为0
+    void add_metrics();
+
 private:
     static void* worker(void * arg);
+    static void* monitor(void * arg);
     void run();
+    void adjust();
+    bool spawn();
+    bool spin_wait();
+    static void export_metrics(std::string& out);
+    bool push(T* request, uint64_t key, int weight, uint64_t now);
+    void wake(int n);
+    static uint64_t now_ns();
 
 private:
-    // 线程数量
-    int m_thread_number;
+    // 线程数的范围
+    int m_min_threads;
+    int m_max_threads;
+
+    // 工作线程，运行中的和已经退出、等待join的
+    std::vector<pthread_t> m_threads;
+    std::vector<pthread_t> m_exited;
 
-    // 线程池数组，大小为m_thread_number
-    pthread_t * m_threads;
+    // 需要退出的线程数，缩容时增加，空闲的线程被唤醒后领取
+    int m_retire;
 
     // 请求队列中最多允许的，等待处理的请求数量
     int m_max_requests;
 
-    // 请求队列
-    std::list< T*> m_workqueue;
+    // 请求队列，记录入队时间用于统计等待时间
+    struct fair_class;
+    struct task{
+        T* request;
+        uint64_t enqueue_ns;
+        fair_class* cls;        // 公平调度时请求所属的类
+        int64_t charged;        // 出队时按类的平均服务时间预扣的额度，完成后按实际时间结算
+    };
+    std::list<task> m_workqueue;
+    size_t m_queued;            // 排队的请求数，两种调度方式共用
 
-    // 互斥锁
+    // 公平调度：每个有请求排队或者正在处理的客户端一个类，有请求排队的类按轮询顺序放在m_active中
+    // 轮到的类额度为正时取出它的一个请求，预扣平均服务时间；额度不为正时补一轮额度，移到末尾
+    // 请求处理完按实际服务时间结算，慢请求多的类欠下额度，要等更多轮才能再被取出
+    // 另外一个类正在处理的请求数不超过线程数的MAX_CLASS_SHARE，慢请求不会占满所有线程，新来的客户端总有线程可用
+    struct fair_class{
+        uint64_t key;
+        int weight;
+        int64_t deficit;        // 剩余额度（纳秒）
+        int64_t cost;           // 服务时间的滑动平均（纳秒）
+        int inflight;           // 正在处理的请求数
+        bool active;            // 在m_active中
+        std::deque<task> queue;
+    };
+    bool m_fair;
+    int m_class_queue;
+    std::unordered_map<uint64_t, fair_class*> m_classes;
+    std::deque<fair_class*> m_active;
+
+    int pop(task& t);
+    void settle(task& t, uint64_t service_ns);
+
+    // 互斥锁，保护队列、线程列表和下面的统计
     locker m_queuelocker;
 
-    // 信号量，判断是否有任务需要处理
+    // 信号量，唤醒空闲的线程
     sem m_queuestat;
 
+    // 登记为空闲、睡眠或即将睡眠在m_queuestat上的线程数，唤醒时在锁内减去，sem_post的次数不会超过它
+    int m_idle;
+
     // 是否结束线程
     bool m_stop;
 
+    // 自旋等待的时长，0表示直接睡眠；同时自旋的线程数不超过CPU数减一，给主线程留一个CPU，其余空闲线程直接睡眠
+    uint64_t m_spin_ns;
+    std::atomic<int> m_spinners;
+
+    // 监控线程，析构时通过m_monitor_stop唤醒并结束
+    pthread_t m_monitor;
+    bool m_has_monitor;
+    sem m_monitor_stop;
+
+    // 统计：等待时间在出队时累加，忙碌时间在任务完成后累加
+    uint64_t m_wait_ns;
+    uint64_t m_wait_count;
+    std::atomic<uint64_t> m_busy_ns;
+    uint64_t m_last_cpu_ns;
+    int m_idle_periods;
+    stats m_stats;
+
+    // 导出指标的线程池，指标函数没有参数
+    static threadpool* m_metrics_pool;
 };
+
 template<typename T>
-threadpool<T>::threadpool(int m_thread_number, int max_requests):
-    m_thread_number(m_thread_number), m_max_requests(max_requests),
-    m_stop(false), m_threads(NULL){
+threadpool<T>* threadpool<T>::m_metrics_pool = NULL;
 
-        if((m_thread_number <= 0) || (max_requests <= 0)){
-            throw std::exception();
-        }
+template<typename T>
+threadpool<T>::threadpool(int min_threads, int max_threads, int max_requests):
+    m_min_threads(min_threads), m_max_threads(max_threads), m_retire(0), m_max_requests(max_requests), m_queued(0),
+    m_fair(false), m_class_queue(0),
+    m_idle(0), m_stop(false), m_spin_ns(0), m_spinners(0), m_has_monitor(false), m_wait_ns(0), m_wait_count(0), m_busy_ns(0), m_last_cpu_ns(0), m_idle_periods(0),
+    m_stats(){
 
-        m_threads = new pthread_t[m_thread_number];
-        if(!m_threads){
+        if((min_threads <= 0) || (max_threads < min_threads) || (max_requests <= 0)){
             throw std::exception();
         }
 
-        // 创建thread_number个线程，并将它们设置为线程脱离
-        for (int i = 0; i < m_thread_number; i++){
+        // 先创建min_threads个线程，之后由监控线程调整
+        for (int i = 0; i < min_threads; i++){
             printf("create the %dth thread\n", i);
-            if(pthread_create(m_threads + i, NULL, worker, this) != 0){
-                delete [] m_threads;
+            if(!spawn()){
                 throw std::exception();
             }
-            
-            if(pthread_detach(m_threads[i])){
-                delete[] m_threads;
-                throw std::exception();                
+        }
+        m_stats.threads = min_threads;
+
+        if(min_threads < max_threads){
+            if(pthread_create(&m_monitor, NULL, monitor, this) != 0){
+                throw std::exception();
             }
+            m_has_monitor = true;
         }
 }
 
+// 通知所有线程结束并等待它们退出
 template<typename T>
 threadpool<T>::~threadpool(){
-    delete[] m_threads;
+    if(m_has_monitor){
+        m_monitor_stop.post();
+        pthread_join(m_monitor, NULL);
+    }
+    m_queuelocker.lock();
     m_stop = true;
+    std::vector<pthread_t> threads = m_threads;
+    threads.insert(threads.end(), m_exited.begin(), m_exited.end());
+    m_queuelocker.unlock();
+
+    for(size_t i = 0; i < threads.size(); ++i){
+        m_queuestat.post();
+    }
+    for(pthread_t t : threads){
+        pthread_join(t, NULL);
+    }
+    for(auto& c : m_classes){
+        delete c.second;
+    }
 }
 
-// 添加任务到队列
 template<typename T>
-bool threadpool<T>::append(T* request){
-    m_queuelocker.lock();
+void threadpool<T>::set_fair(int class_queue){
+    m_fair = true;
+    m_class_queue = class_queue;
+}
 
-    // 如果任务队列中的请求数已经达到了最大数量，则解锁并返回false
-    if(m_workqueue.size() > m_max_requests){
-        m_queuelocker.unlock();
+// 创建一个工作线程，调用者持有锁或者在构造函数中
+template<typename T>
+bool threadpool<T>::spawn(){
+    pthread_t t;
+    if(pthread_create(&t, NULL, worker, this) != 0){
         return false;
     }
+    m_threads.push_back(t);
+    return true;
+}
 
-    // 如果可以添加请求，则将请求加入请求队列中，并解锁互斥锁m_queuelocker
-    m_workqueue.push_back(request);
-    m_queuelocker.unlock();
+template<typename T>
+uint64_t threadpool<T>::now_ns(){
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
 
-    // 向信号量m_queuestat发送信号，说明有任务需要处理
-    m_queuestat.post();
+// 请求入队，调用者持有锁；队列已满（公平调度时是这一类排队已满）时返回false
+template<typename T>
+bool threadpool<T>::push(T* request, uint64_t key, int weight, uint64_t now){
+    // 如果任务队列中的请求数已经达到了最大数量，则返回false
+    if(m_queued > (size_t)m_max_requests){
+        return false;
+    }
+    if(!m_fair){
+        m_workqueue.push_back(task{request, now, NULL, 0});
+    }else{
+        fair_class*& c = m_classes[key];
+        if(!c){
+            c = new fair_class{key, weight, 0, QUANTUM_NS, 0, false, {}};
+        }
+        if(c->queue.size() >= (size_t)m_class_queue){
+            return false;
+        }
+        c->queue.push_back(task{request, now, c, 0});
+        if(!c->active){
+            c->active = true;
+            m_active.push_back(c);
+        }
+    }
+    ++m_queued;
+    PROBE(pool_enqueue, request, m_queued);
+    return true;
+}
 
+// 唤醒最多n个空闲线程，调用者持有锁；在锁内扣除空闲数，解锁后再sem_post
+template<typename T>
+void threadpool<T>::wake(int n){
+    n = std::min(n, m_idle);
+    m_idle -= n;
+    m_queuelocker.unlock();
+    for(int i = 0; i < n; ++i){
+        m_queuestat.post();
+    }
+}
+
+// 添加任务到队列
+// 公平调度时key为请求所属的类，weight为类的权重；这一类排队已满时也返回false
+template<typename T>
+bool threadpool<T>::append(T* request, uint64_t key, int weight){
+    uint64_t now = now_ns();
+    m_queuelocker.lock();
+    if(!push(request, key, weight, now)){
+        m_queuelocker.unlock();
+        return false;
+    }
+    // 有空闲的线程时唤醒一个，说明有任务需要处理
+    wake(1);
     return true;
 }
 
+template<typename T>
+int threadpool<T>::append_batch(std::vector<submission>& batch){
+    if(batch.empty()){
+        return 0;
+    }
+    uint64_t now = now_ns();
+    size_t rejected = 0;
+    m_queuelocker.lock();
+    for(submission& s : batch){
+        if(!push(s.request, s.key, s.weight, now)){
+            batch[rejected++] = s;
+        }
+    }
+    int added = batch.size() - rejected;
+    wake(added);
+    batch.resize(rejected);
+    return added;
+}
+
 template<typename T>
 void* threadpool<T>::worker(void * arg){
     threadpool * pool = (threadpool* )arg;
@@ -105,28 +325,258 @@ void* threadpool<T>::worker(void * arg){
 
 template<typename T>
 void threadpool<T>::run(){
-    while (!m_stop){
-        // 队列中取任务，然后做任务
-        m_queuestat.wait();
-        m_queuelocker.lock();
+    task t;
+    uint64_t wait_ns = 0;
+    int wait_count = 0;
+    m_queuelocker.lock();
+    while (true){
+        // 上一个请求的等待时间在这里一起计入统计
+        m_wait_ns += wait_ns;
+        m_wait_count += wait_count;
+        wait_ns = 0;
+        wait_count = 0;
+        if(m_stop){
+            m_queuelocker.unlock();
+            break;
+        }
 
-        // 如果工作队列为空，解锁
-        if(m_workqueue.empty()){
+        // 每次只取一个请求，处理完再回到队列取下一个：处理函数可能阻塞很久（接管连接的路由、等待上游的反向代理），
+        // 一次取走多个时后面的请求要等它结束，别的线程空闲了也拿不到
+        // 出队和上一个请求的统计共用一次加锁，每个请求加锁一次
+        if(pop(t) <= 0){
+            // 没有取到请求：有退出名额时领取一个后结束，留给监控线程join
+            // 否则登记为空闲，解锁后睡眠等待唤醒；公平调度时排队的类都占满了线程，也在这里等待有请求处理完
+            if(m_retire > 0){
+                --m_retire;
+                pthread_t self = pthread_self();
+                m_threads.erase(std::find_if(m_threads.begin(), m_threads.end(), [&](pthread_t th){ return pthread_equal(th, self); }));
+                m_exited.push_back(self);
+                m_queuelocker.unlock();
+                break;
+            }
+            ++m_idle;
             m_queuelocker.unlock();
+            if(!m_spin_ns || !spin_wait()){
+                m_queuestat.wait();
+            }
+            m_queuelocker.lock();
             continue;
         }
-        
-        // 不为空获取工作队列第一个，并解锁
-        T* request = m_workqueue.front();
-        m_workqueue.pop_front();
         m_queuelocker.unlock();
 
-        // 没有取到任务
-        if(!request){
-            continue;
+        uint64_t start = now_ns();
+        wait_ns += start - t.enqueue_ns;
+        ++wait_count;
+        PROBE(pool_dequeue, t.request, start - t.enqueue_ns, m_queued);
+        if(t.request){
+            t.request -> process();
+        }
+        uint64_t service = now_ns() - start;
+        m_busy_ns.fetch_add(service, std::memory_order_relaxed);
+        if(t.cls){
+            settle(t, service);
+        }
+        m_queuelocker.lock();
+    }
+}
+
+// 自旋等待信号量，在m_spin_ns内取到返回true，否则返回false，由调用者睡眠等待
+// 自旋的线程没有睡在信号量上，sem_post也不需要系统调用去唤醒
+template<typename T>
+bool threadpool<T>::spin_wait(){
+    static const int max_spinners = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+    if(m_spinners.fetch_add(1, std::memory_order_relaxed) >= max_spinners){
+        m_spinners.fetch_sub(1, std::memory_order_relaxed);
+        return false;
+    }
+    bool got = false;
+    uint64_t deadline = now_ns() + m_spin_ns;
+    do{
+        for(int i = 0; i < 64 && !got; ++i){
+            got = m_queuestat.trywait();
+            cpu_relax();
+        }
+    }while(!got && now_ns() < deadline);
+    m_spinners.fetch_sub(1, std::memory_order_relaxed);
+    return got;
+}
+
+// 取出下一个请求，调用者持有锁：取到返回1，没有请求返回0，公平调度时排队的类都占满了线程返回-1
+template<typename T>
+int threadpool<T>::pop(task& t){
+    if(m_queued == 0){
+        return 0;
+    }
+    if(!m_fair){
+        --m_queued;
+        t = m_workqueue.front();
+        m_workqueue.pop_front();
+        return 1;
+    }
+    int cap = std::max(1, (int)m_threads.size() * MAX_CLASS_SHARE / 100);
+    if(std::none_of(m_active.begin(), m_active.end(), [cap](fair_class* c){ return c->inflight < cap; })){
+        return -1;
+    }
+    // 占满线程的类直接轮过；额度不为正的类补一轮额度后排到末尾，每次补的额度对应一段服务时间，循环的次数和处理的工作量成正比
+    while(m_active.front()->inflight >= cap || m_active.front()->deficit <= 0){
+        fair_class* c = m_active.front();
+        if(c->inflight < cap){
+            c->deficit += (int64_t)QUANTUM_NS * c->weight;
+        }
+        m_active.pop_front();
+        m_active.push_back(c);
+    }
+    --m_queued;
+    fair_class* c = m_active.front();
+    t = c->queue.front();
+    c->queue.pop_front();
+    t.charged = c->cost;
+    c->deficit -= c->cost;
+    ++c->inflight;
+    // 队列空了的类退出轮询，没用完的额度不保留，欠下的额度在类被删除之前一直有效
+    if(c->queue.empty()){
+        m_active.pop_front();
+        c->active = false;
+        c->deficit = std::min<int64_t>(c->deficit, 0);
+    }
+    return 1;
+}
+
+// 请求处理完：按实际服务时间结算额度，类没有排队也没有正在处理的请求时删除
+// 还有请求排队时唤醒一个空闲线程：它可能是因为排队的类都占满了线程而睡眠的
+template<typename T>
+void threadpool<T>::settle(task& t, uint64_t service_ns){
+    m_queuelocker.lock();
+    fair_class* c = t.cls;
+    c->deficit += t.charged - (int64_t)service_ns;
+    c->deficit = std::max(c->deficit, -(int64_t)QUANTUM_NS * c->weight * MAX_DEBT_ROUNDS);
+    c->cost += ((int64_t)service_ns - c->cost) / 8;
+    if(--c->inflight == 0 && !c->active){
+        m_classes.erase(c->key);
+        delete c;
+    }
+    wake(m_queued > 0 ? 1 : 0);
+}
+
+template<typename T>
+void* threadpool<T>::monitor(void * arg){
+    threadpool * pool = (threadpool* )arg;
+    while(true){
+        timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += ADJUST_INTERVAL_MS * 1000000L;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000;
+        deadline.tv_nsec %= 1000000000;
+        if(pool->m_monitor_stop.timewait(deadline)){
+            break;
         }
-        request -> process();
+        pool->adjust();
+    }
+    return pool;
+}
+
+// 每个周期调用一次：统计上个周期的负载并决定是否调整线程数
+// 队列等待时间长说明所有线程都在忙；这时CPU还有余量，说明线程阻塞在I/O上（如反向代理等待上游），增加线程能提高并行度，
+// CPU已经用满时增加线程只会增加切换，不扩容；忙碌比例持续很低时逐个退出多余的线程
+template<typename T>
+void threadpool<T>::adjust(){
+    static const long ncpu = std::max(1L, sysconf(_SC_NPROCESSORS_ONLN));
+    const double interval_ns = ADJUST_INTERVAL_MS * 1e6;
+
+    rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    uint64_t cpu_ns = (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000000ull + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1000ull;
+    uint64_t busy_ns = m_busy_ns.exchange(0, std::memory_order_relaxed);
+
+    std::vector<pthread_t> exited;
+    m_queuelocker.lock();
+    exited.swap(m_exited);
+    int threads = m_threads.size();
+    stats& s = m_stats;
+    s.threads = threads;
+    s.queued = m_queued;
+    s.wait_us = m_wait_count ? m_wait_ns / 1000.0 / m_wait_count : 0;
+    // 还在队列里的请求也计入等待，队列积压而没有线程出队时同样能发现
+    if(!m_workqueue.empty()){
+        s.wait_us = std::max(s.wait_us, (now_ns() - m_workqueue.front().enqueue_ns) / 1000.0);
+    }
+    for(fair_class* c : m_active){
+        s.wait_us = std::max(s.wait_us, (now_ns() - c->queue.front().enqueue_ns) / 1000.0);
+    }
+    s.busy = threads ? std::min(1.0, busy_ns / (interval_ns * threads)) : 0;
+    s.cpu = m_last_cpu_ns ? (cpu_ns - m_last_cpu_ns) / (interval_ns * ncpu) : 0;
+    m_last_cpu_ns = cpu_ns;
+    m_wait_ns = 0;
+    m_wait_count = 0;
+
+    int target = threads;
+    if(s.wait_us > GROW_WAIT_US && s.cpu < 0.9 && threads < m_max_threads){
+        target = std::min(m_max_threads, threads + std::max(1, threads / 4));
+        m_idle_periods = 0;
+    }else if(s.busy < 0.5 && s.wait_us < GROW_WAIT_US / 4 && threads - m_retire > m_min_threads){
+        if(++m_idle_periods >= SHRINK_PERIODS){
+            target = threads - 1;
+            m_idle_periods = 0;
+        }
+    }else{
+        m_idle_periods = 0;
+    }
+
+    while((int)m_threads.size() < target && spawn()){
     }
+    // 线程多了，每类可以占用的线程也多了，唤醒空闲的线程重新取请求
+    int wakeups = ((int)m_threads.size() > threads && m_queued > 0) ? m_idle : 0;
+    bool shrink = target < threads;
+    if(shrink){
+        ++m_retire;
+        ++s.shrinks;
+    }else if((int)m_threads.size() > threads){
+        ++s.grows;
+    }
+    int now_threads = m_threads.size() - m_retire;
+    stats decision = s;
+    // 缩容时唤醒一个空闲线程领取退出名额，没有空闲线程时由下一个取不到请求的线程领取
+    wake(shrink ? 1 : wakeups);
+
+    for(pthread_t t : exited){
+        pthread_join(t, NULL);
+    }
+
+    // 调整记录写入日志
+    if(now_threads != threads){
+        char buf[160];
+        snprintf(buf, sizeof(buf), "threadpool: %d -> %d threads, wait %.0fus, busy %.0f%%, cpu %.0f%%, queued %d\n",
+            threads, now_threads, decision.wait_us, decision.busy * 100, decision.cpu * 100, decision.queued);
+        log(buf);
+    }
+}
+
+template<typename T>
+typename threadpool<T>::stats threadpool<T>::snapshot(){
+    m_queuelocker.lock();
+    stats s = m_stats;
+    s.threads = m_threads.size() - m_retire;
+    s.queued = m_queued;
+    m_queuelocker.unlock();
+    return s;
+}
+
+template<typename T>
+void threadpool<T>::add_metrics(){
+    m_metrics_pool = this;
+    metrics::add(export_metrics);
+}
+
+template<typename T>
+void threadpool<T>::export_metrics(std::string& out){
+    stats s = m_metrics_pool->snapshot();
+    metrics::value(out, "tinyhttp_threadpool_threads", "Worker threads handling requests.", "gauge", s.threads);
+    metrics::value(out, "tinyhttp_threadpool_queued", "Requests waiting in the thread pool queue.", "gauge", s.queued);
+    metrics::value(out, "tinyhttp_threadpool_queue_wait_seconds", "Average queue wait in the last sizing period.", "gauge", s.wait_us / 1e6);
+    metrics::value(out, "tinyhttp_threadpool_busy_ratio", "Fraction of time the worker threads were busy in the last sizing period.", "gauge", s.busy);
+    metrics::value(out, "tinyhttp_threadpool_cpu_ratio", "Process CPU use per CPU in the last sizing period.", "gauge", s.cpu);
+    metrics::value(out, "tinyhttp_threadpool_grows_total", "Sizing decisions that added threads.", "counter", s.grows);
+    metrics::value(out, "tinyhttp_threadpool_shrinks_total", "Sizing decisions that retired a thread.", "counter", s.shrinks);
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,181 @@
+#include "tls.h"
+#include <string>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/sendfile.h>
+#include <openssl/err.h>
+#include "http_conn.h"
+
+extern void log(std::string str);
+
+SSL_CTX* tls_context::m_ctx = NULL;
+
+// ALPN：客户端支持时优先选择h2，否则使用http/1.1
+static int select_alpn(SSL*, const unsigned char** out, unsigned char* outlen, const unsigned char* in, unsigned int inlen, void*){
+    static const unsigned char protos[] = "\x02h2\x08http/1.1";
+    if(SSL_select_next_proto((unsigned char**)out, outlen, protos, sizeof(protos) - 1, in, inlen) != OPENSSL_NPN_NEGOTIATED){
+        return SSL_TLSEXT_ERR_NOACK;
+    }
+    return SSL_TLSEXT_ERR_OK;
+}
+
+bool tls_context::init(const char* cert_file, const char* key_file){
+    SSL_CTX* ctx = SSL_CTX_new(TLS_server_method());
+    if(!ctx){
+        return false;
+    }
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+
+    // kTLS只支持AES-GCM和ChaCha20-Poly1305，TLS 1.2优先选择AES-GCM
+    SSL_CTX_set_cipher_list(ctx, "ECDHE+AESGCM:ECDHE+CHACHA20");
+    SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS | SSL_OP_NO_RENEGOTIATION | SSL_OP_CIPHER_SERVER_PREFERENCE);
+
+    // 非阻塞socket上允许部分写入，重试时缓冲区地址可以变化（writev的iovec会移动）
+    // 空闲连接释放读写缓冲区，节省长连接的内存
+    SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER | SSL_MODE_RELEASE_BUFFERS);
+
+    // 会话恢复：TLS 1.3用无状态票据，票据密钥由OpenSSL生成并定期轮换；TLS 1.2同时保留服务端会话缓存
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_set_session_id_context(ctx, (const unsigned char*)"TinyHTTP", 8);
+    SSL_CTX_set_num_tickets(ctx, 1);
+    SSL_CTX_set_alpn_select_cb(ctx, select_alpn, NULL);
+
+    if(SSL_CTX_use_certificate_chain_file(ctx, cert_file) <= 0
+        || SSL_CTX_use_PrivateKey_file(ctx, key_file, SSL_FILETYPE_PEM) <= 0
+        || !SSL_CTX_check_private_key(ctx)){
+        char err[256];
+        ERR_error_string_n(ERR_get_error(), err, sizeof(err));
+        log(std::string("TLS certificate error: ") + err + "\n");
+        SSL_CTX_free(ctx);
+        return false;
+    }
+    // 重新加载（多进程模型的平滑重启）成功后才替换，失败时继续使用原来的证书
+    if(m_ctx){
+        SSL_CTX_free(m_ctx);
+    }
+    m_ctx = ctx;
+    return true;
+}
+
+SSL* tls_context::accept(int fd){
+    if(!m_ctx){
+        return NULL;
+    }
+    SSL* ssl = SSL_new(m_ctx);
+    if(ssl && !SSL_set_fd(ssl, fd)){
+        SSL_free(ssl);
+        return NULL;
+    }
+    if(ssl){
+        SSL_set_accept_state(ssl);
+    }
+    return ssl;
+}
+
+int http_conn::tls_handshake(){
+    int ret = SSL_do_handshake(m_ssl);
+    if(ret == 1){
+        m_tls_ready = true;
+        // OpenSSL在握手完成、切换到应用数据密钥时尝试把密钥装入内核
+        m_ktls_send = BIO_get_ktls_send(SSL_get_wbio(m_ssl));
+        m_ktls_recv = BIO_get_ktls_recv(SSL_get_rbio(m_ssl));
+
+        // 协商了h2的连接直接切换到HTTP/2
+        const unsigned char* alpn = NULL;
+        unsigned int alpn_len = 0;
+        SSL_get0_alpn_selected(m_ssl, &alpn, &alpn_len);
+        if(alpn_len == 2 && memcmp(alpn, "h2", 2) == 0 && !h2_start(false)){
+            return -1;
+        }
+        return 0;
+    }
+    switch(SSL_get_error(m_ssl, ret)){
+        case SSL_ERROR_WANT_READ:
+            return EPOLLIN;
+        case SSL_ERROR_WANT_WRITE:
+            return EPOLLOUT;
+        default:
+            ERR_clear_error();
+            return -1;
+    }
+}
+
+// 把OpenSSL的结果转换成系统调用的约定：需要等待时返回-1并置errno为EAGAIN，对方关闭返回0
+static ssize_t ssl_result(SSL* ssl, int ret){
+    if(ret > 0){
+        return ret;
+    }
+    switch(SSL_get_error(ssl, ret)){
+        case SSL_ERROR_WANT_READ:
+        case SSL_ERROR_WANT_WRITE:
+            errno = EAGAIN;
+            return -1;
+        case SSL_ERROR_ZERO_RETURN:
+            return 0;
+        default:
+            ERR_clear_error();
+            errno = EIO;
+            return -1;
+    }
+}
+
+ssize_t http_conn::sock_recv(char* buf, size_t len){
+    if(!m_ssl || m_ktls_recv){
+        return recv(m_sockfd, buf, len, 0);
+    }
+    return ssl_result(m_ssl, SSL_read(m_ssl, buf, len));
+}
+
+int http_conn::sock_pending() const{
+    if(!m_ssl || m_ktls_recv){
+        return 0;
+    }
+    return SSL_pending(m_ssl);
+}
+
+ssize_t http_conn::sock_send(const char* buf, size_t len, int flags){
+    if(!m_ssl || m_ktls_send){
+        return send(m_sockfd, buf, len, flags);
+    }
+    return ssl_result(m_ssl, SSL_write(m_ssl, buf, len));
+}
+
+// 用户态TLS逐段加密发送，写不进去时返回已经发送的字节数，下次从同一位置重试
+ssize_t http_conn::sock_writev(const struct iovec* iov, int count){
+    if(!m_ssl || m_ktls_send){
+        return writev(m_sockfd, iov, count);
+    }
+    ssize_t total = 0;
+    for(int i = 0; i < count; ++i){
+        if(iov[i].iov_len == 0){
+            continue;
+        }
+        ssize_t n = ssl_result(m_ssl, SSL_write(m_ssl, iov[i].iov_base, iov[i].iov_len));
+        if(n <= 0){
+            return (total > 0) ? total : n;
+        }
+        total += n;
+        if((size_t)n < iov[i].iov_len){
+            break;
+        }
+    }
+    return total;
+}
+
+// kTLS发送方向下sendfile由内核加密，文件内容仍然不经过用户空间；用户态TLS只能读出来加密
+ssize_t http_conn::sock_sendfile(int in_fd, off_t* offset, size_t count){
+    if(!m_ssl || m_ktls_send){
+        return sendfile(m_sockfd, in_fd, offset, count);
+    }
+    char buf[16384];
+    ssize_t n = pread(in_fd, buf, (count < sizeof(buf)) ? count : sizeof(buf), *offset);
+    if(n <= 0){
+        return n;
+    }
+    ssize_t ret = ssl_result(m_ssl, SSL_write(m_ssl, buf, n));
+    if(ret > 0){
+        *offset += ret;
+    }
+    return ret;
+}
@@ -0,0 +1,22 @@
+#ifndef TLS_H
+#define TLS_H
+#include <openssl/ssl.h>
+
+// TLS终结
+// 握手在epoll循环中非阻塞地推进（状态机模型由主线程，协程模型由连接协程）
+// 握手完成后如果内核支持kTLS，OpenSSL把会话密钥装入内核，之后socket上的recv/writev/sendfile由内核加解密，
+// 原有的零拷贝发送路径不需要改动；内核不支持的方向退回到用户态的SSL_read/SSL_write
+class tls_context{
+public:
+    // 加载证书链和私钥，启用kTLS和会话恢复（TLS 1.3会话票据、TLS 1.2会话缓存），启动阶段调用
+    // 多进程模型的master在平滑重启时再次调用，之后fork的worker使用新的证书
+    static bool init(const char* cert_file, const char* key_file);
+
+    // 为新连接创建TLS会话，失败返回NULL
+    static SSL* accept(int fd);
+
+private:
+    static SSL_CTX* m_ctx;
+};
+
+#endif
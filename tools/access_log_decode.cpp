@@ -0,0 +1,248 @@
+// 访问日志解码：把服务器 -A 选项写出的二进制环形文件转换成文本/CSV/JSON，或者按URL汇总
+// 编译: g++ -std=c++20 -O2 -I. tools/access_log_decode.cpp -o access_log_decode
+// 用法: ./access_log_decode [-f text|csv|json] [-a] 日志文件
+//   -f  输出格式，默认text；json为每行一个对象(JSON Lines)
+//   -a  不输出每条记录，按URL汇总请求数、字节数、服务时间的平均值/p50/p99/最大值和各类状态码的个数
+// 服务器运行时也可以读取，得到的是当时已经写完的记录
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include "access_log.h"
+
+static const char* method_names[] = {"GET", "POST", "HEAD", "PUT", "DELETE", "TRACE", "OPTIONS", "CONNECT"};
+
+enum FORMAT {FORMAT_TEXT = 0, FORMAT_CSV, FORMAT_JSON};
+
+static std::unordered_map<uint64_t, std::string> paths;
+
+static std::string path_of(uint64_t hash){
+    auto it = paths.find(hash);
+    if(it != paths.end()){
+        return it->second;
+    }
+    char buf[32];
+    snprintf(buf, sizeof(buf), "#%016llx", (unsigned long long)hash);
+    return buf;
+}
+
+static const char* method_of(int m){
+    return (m >= 0 && m < 8) ? method_names[m] : "-";
+}
+
+static const char* proto_of(uint8_t proto){
+    bool tls = proto & PROTO_TLS;
+    return (proto & 0x0f) == PROTO_HTTP2 ? (tls ? "h2" : "h2c") : (tls ? "https" : "http/1.1");
+}
+
+// CSV字段两边加引号，引号写两次；JSON字符串转义引号、反斜杠和控制字符
+static std::string csv_quote(const std::string& s){
+    std::string out = "\"";
+    for(char c : s){
+        if(c == '"'){
+            out += '"';
+        }
+        out += c;
+    }
+    return out + "\"";
+}
+
+static std::string json_quote(const std::string& s){
+    std::string out = "\"";
+    for(char c : s){
+        if(c == '"' || c == '\\'){
+            out += '\\';
+            out += c;
+        }else if((unsigned char)c < 0x20){
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out += buf;
+        }else{
+            out += c;
+        }
+    }
+    return out + "\"";
+}
+
+static void print_record(const access_log_record& r, int format){
+    char addr[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &r.addr, addr, sizeof(addr));
+    int port = ntohs(r.port);
+    std::string path = path_of(r.url_hash);
+
+    time_t sec = r.time_us / 1000000;
+    struct tm tm;
+    localtime_r(&sec, &tm);
+    char when[64];
+    size_t n = strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &tm);
+    snprintf(when + n, sizeof(when) - n, ".%06llu", (unsigned long long)(r.time_us % 1000000));
+
+    switch(format){
+        case FORMAT_TEXT:
+            printf("%s %s:%d %s %s %d %llu %uus %s\n", when, addr, port, method_of(r.method), path.c_str(), r.status,
+                (unsigned long long)r.bytes, r.service_us, proto_of(r.proto));
+            break;
+        case FORMAT_CSV:
+            printf("%llu,%s,%d,%s,%s,%d,%llu,%u,%s\n", (unsigned long long)r.time_us, addr, port, method_of(r.method),
+                csv_quote(path).c_str(), r.status, (unsigned long long)r.bytes, r.service_us, proto_of(r.proto));
+            break;
+        case FORMAT_JSON:
+            printf("{\"time_us\":%llu,\"addr\":\"%s\",\"port\":%d,\"method\":\"%s\",\"path\":%s,\"status\":%d,\"bytes\":%llu,"
+                "\"service_us\":%u,\"proto\":\"%s\"}\n", (unsigned long long)r.time_us, addr, port, method_of(r.method),
+                json_quote(path).c_str(), r.status, (unsigned long long)r.bytes, r.service_us, proto_of(r.proto));
+            break;
+    }
+}
+
+// 一个URL的汇总
+struct url_stat{
+    uint64_t hash = 0;
+    uint64_t bytes = 0;
+    unsigned long long status_class[6] = {0};   // 按状态码的百位计数，0表示没有状态码（连接被接管）
+    std::vector<uint32_t> service;              // 所有请求的服务时间，排序后取分位数
+};
+
+static void print_aggregates(std::vector<url_stat>& stats, int format){
+    std::sort(stats.begin(), stats.end(), [](const url_stat& a, const url_stat& b){ return a.service.size() > b.service.size(); });
+    if(format == FORMAT_TEXT){
+        printf("%-40s %10s %14s %10s %10s %10s %10s %8s %8s %8s %8s\n", "path", "requests", "bytes", "avg(us)", "p50(us)",
+            "p99(us)", "max(us)", "2xx", "3xx", "4xx", "5xx");
+    }else if(format == FORMAT_CSV){
+        printf("path,requests,bytes,avg_us,p50_us,p99_us,max_us,2xx,3xx,4xx,5xx\n");
+    }
+    for(url_stat& u : stats){
+        std::vector<uint32_t>& v = u.service;
+        std::sort(v.begin(), v.end());
+        uint64_t total = 0;
+        for(uint32_t t : v){
+            total += t;
+        }
+        size_t count = v.size();
+        uint64_t avg = total / count;
+        uint32_t p50 = v[count / 2];
+        uint32_t p99 = v[std::min(count - 1, count * 99 / 100)];
+        uint32_t max = v.back();
+        std::string path = path_of(u.hash);
+        unsigned long long bytes = u.bytes;
+        const unsigned long long* c = u.status_class;
+        switch(format){
+            case FORMAT_TEXT:
+                printf("%-40s %10zu %14llu %10llu %10u %10u %10u %8llu %8llu %8llu %8llu\n", path.c_str(), count, bytes,
+                    (unsigned long long)avg, p50, p99, max, c[2], c[3], c[4], c[5]);
+                break;
+            case FORMAT_CSV:
+                printf("%s,%zu,%llu,%llu,%u,%u,%u,%llu,%llu,%llu,%llu\n", csv_quote(path).c_str(), count, bytes,
+                    (unsigned long long)avg, p50, p99, max, c[2], c[3], c[4], c[5]);
+                break;
+            case FORMAT_JSON:
+                printf("{\"path\":%s,\"requests\":%zu,\"bytes\":%llu,\"avg_us\":%llu,\"p50_us\":%u,\"p99_us\":%u,\"max_us\":%u,"
+                    "\"2xx\":%llu,\"3xx\":%llu,\"4xx\":%llu,\"5xx\":%llu}\n", json_quote(path).c_str(), count, bytes,
+                    (unsigned long long)avg, p50, p99, max, c[2], c[3], c[4], c[5]);
+                break;
+        }
+    }
+}
+
+int main(int argc, char* argv[]){
+    int format = FORMAT_TEXT;
+    bool aggregate = false;
+    int opt;
+    while((opt = getopt(argc, argv, "f:a")) != -1){
+        if(opt == 'f' && strcmp(optarg, "text") == 0){
+            format = FORMAT_TEXT;
+        }else if(opt == 'f' && strcmp(optarg, "csv") == 0){
+            format = FORMAT_CSV;
+        }else if(opt == 'f' && strcmp(optarg, "json") == 0){
+            format = FORMAT_JSON;
+        }else if(opt == 'a'){
+            aggregate = true;
+        }else{
+            optind = argc;
+            break;
+        }
+    }
+    if(optind >= argc){
+        printf("usage: %s [-f text|csv|json] [-a] file\n", argv[0]);
+        return 1;
+    }
+
+    int fd = open(argv[optind], O_RDONLY);
+    struct stat st;
+    if(fd < 0 || fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(access_log_header)){
+        printf("cannot open %s\n", argv[optind]);
+        return 1;
+    }
+    char* base = (char*)mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(base == MAP_FAILED){
+        printf("cannot map %s\n", argv[optind]);
+        return 1;
+    }
+    const access_log_header* h = (const access_log_header*)base;
+    if(memcmp(h->magic, ACCESS_LOG_MAGIC, sizeof(h->magic)) != 0 || h->record_size != sizeof(access_log_record)
+        || h->region_offset + h->region_size * h->region_count > (uint64_t)st.st_size){
+        printf("%s is not an access log\n", argv[optind]);
+        return 1;
+    }
+
+    // 路径表：文本写完的槽位
+    const access_log_path* slots = (const access_log_path*)(base + h->path_offset);
+    const char* text = base + h->text_offset;
+    for(uint32_t i = 0; i < h->path_slots; ++i){
+        uint64_t hash = slots[i].hash.load(std::memory_order_relaxed);
+        uint32_t len = slots[i].len.load(std::memory_order_acquire);
+        if(hash && len && slots[i].offset + len <= h->path_bytes){
+            paths[hash] = std::string(text + slots[i].offset, len);
+        }
+    }
+
+    // 每个区域保存着最近的region_records条记录，合并后按时间排序
+    std::vector<access_log_record> records;
+    uint32_t regions = std::min(h->regions_used.load(std::memory_order_relaxed), h->region_count);
+    for(uint32_t r = 0; r < regions; ++r){
+        const access_log_region* region = (const access_log_region*)(base + h->region_offset + h->region_size * r);
+        const access_log_record* ring = (const access_log_record*)(region + 1);
+        uint64_t written = region->written.load(std::memory_order_acquire);
+        uint64_t count = std::min<uint64_t>(written, h->region_records);
+        for(uint64_t i = written - count; i < written; ++i){
+            records.push_back(ring[i % h->region_records]);
+        }
+    }
+    std::sort(records.begin(), records.end(), [](const access_log_record& a, const access_log_record& b){ return a.time_us < b.time_us; });
+
+    if(!aggregate){
+        if(format == FORMAT_CSV){
+            printf("time_us,addr,port,method,path,status,bytes,service_us,proto\n");
+        }
+        for(const access_log_record& r : records){
+            print_record(r, format);
+        }
+        return 0;
+    }
+
+    std::unordered_map<uint64_t, size_t> index;
+    std::vector<url_stat> stats;
+    for(const access_log_record& r : records){
+        auto it = index.find(r.url_hash);
+        if(it == index.end()){
+            it = index.emplace(r.url_hash, stats.size()).first;
+            stats.emplace_back();
+            stats.back().hash = r.url_hash;
+        }
+        url_stat& u = stats[it->second];
+        u.bytes += r.bytes;
+        u.status_class[std::min(r.status / 100, 5)]++;
+        u.service.push_back(r.service_us);
+    }
+    print_aggregates(stats, format);
+    return 0;
+}
@@ -0,0 +1,187 @@
+// 公平调度测试：一个“吵闹”的客户端(127.0.0.2)用很多长连接不停请求经反向代理转发的慢接口，
+// 同时若干轻量客户端(127.0.0.10起，每个一个连接)间隔请求静态小文件，统计轻量客户端的延迟分布
+// 本程序同时充当慢上游：每个请求等待delay毫秒后应答
+// 服务器需要以 -P /slow/=127.0.0.1:上游端口 启动，对比加上 -F ip 前后的结果
+// 编译: g++ -std=c++20 -O2 -pthread tools/fair_bench.cpp -o fair_bench
+// 用法: ./fair_bench 端口 上游端口 [吵闹连接数] [轻量客户端数] [秒数] [上游延迟ms]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+
+static std::atomic<bool> running(true);
+static int delay_ms = 50;
+
+// 缓冲区开头是一个完整的报文（请求没有请求体）时返回它的长度，否则返回0
+static size_t message_len(const std::string& buf){
+    size_t head = buf.find("\r\n\r\n");
+    if(head == std::string::npos){
+        return 0;
+    }
+    size_t content_length = 0;
+    const char* p = strcasestr(buf.c_str(), "Content-Length:");
+    if(p && p < buf.c_str() + head){
+        content_length = atol(p + 15);
+    }
+    size_t total = head + 4 + content_length;
+    return buf.size() >= total ? total : 0;
+}
+
+// 读一个完整的报文，连接关闭时返回false
+static bool read_message(int fd, std::string& buf){
+    char tmp[16384];
+    size_t len;
+    while((len = message_len(buf)) == 0){
+        int ret = recv(fd, tmp, sizeof(tmp), 0);
+        if(ret <= 0){
+            return false;
+        }
+        buf.append(tmp, ret);
+    }
+    buf.erase(0, len);
+    return true;
+}
+
+// 慢上游：每个连接一个线程，支持长连接
+static void upstream(int port){
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    int reuse = 1;
+    setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(bind(lfd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(lfd, 1024) < 0){
+        perror("upstream");
+        exit(1);
+    }
+    while(true){
+        int fd = accept(lfd, NULL, NULL);
+        if(fd < 0){
+            continue;
+        }
+        std::thread([fd]{
+            static const char resp[] = "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok";
+            std::string buf;
+            while(read_message(fd, buf)){
+                std::this_thread::sleep_for(std::chrono::milliseconds(delay_ms));
+                send(fd, resp, sizeof(resp) - 1, MSG_NOSIGNAL);
+            }
+            close(fd);
+        }).detach();
+    }
+}
+
+// 从指定的本地回环地址连接服务器
+static int connect_from(const char* local, int port){
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in src = {};
+    src.sin_family = AF_INET;
+    inet_pton(AF_INET, local, &src.sin_addr);
+    sockaddr_in dst = {};
+    dst.sin_family = AF_INET;
+    dst.sin_port = htons(port);
+    dst.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if(bind(fd, (sockaddr*)&src, sizeof(src)) < 0 || connect(fd, (sockaddr*)&dst, sizeof(dst)) < 0){
+        perror("connect");
+        exit(1);
+    }
+    return fd;
+}
+
+int main(int argc, char* argv[]){
+    if(argc < 3){
+        printf("usage: %s port upstream_port [heavy_conns] [light_clients] [seconds] [delay_ms]\n", argv[0]);
+        return 1;
+    }
+    int port = atoi(argv[1]);
+    int up_port = atoi(argv[2]);
+    int heavy = (argc > 3) ? atoi(argv[3]) : 64;
+    int light = (argc > 4) ? atoi(argv[4]) : 16;
+    int seconds = (argc > 5) ? atoi(argv[5]) : 10;
+    delay_ms = (argc > 6) ? atoi(argv[6]) : 50;
+
+    std::thread(upstream, up_port).detach();
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    static const char heavy_req[] = "GET /slow/x HTTP/1.1\r\nHost: 127.0.0.1\r\nConnection: keep-alive\r\n\r\n";
+    static const char light_req[] = "GET /index.html HTTP/1.1\r\nHost: 127.0.0.1\r\nConnection: keep-alive\r\n\r\n";
+
+    // 先逐个建立所有连接，避免同时发起大量连接时在服务器的监听队列上重试
+    std::vector<int> heavy_fds, light_fds;
+    for(int i = 0; i < heavy; ++i){
+        heavy_fds.push_back(connect_from("127.0.0.2", port));
+    }
+    for(int i = 0; i < light; ++i){
+        char local[32];
+        snprintf(local, sizeof(local), "127.0.%d.%d", (10 + i) / 250, (10 + i) % 250 + 1);
+        light_fds.push_back(connect_from(local, port));
+    }
+
+    std::atomic<long> heavy_done(0);
+    std::mutex lock;
+    std::vector<double> latency;   // 轻量客户端每个请求的延迟(ms)
+    std::vector<std::thread> threads;
+    for(int fd : heavy_fds){
+        threads.emplace_back([&, fd]{
+            std::string buf;
+            while(running){
+                if(send(fd, heavy_req, sizeof(heavy_req) - 1, MSG_NOSIGNAL) < 0 || !read_message(fd, buf)){
+                    break;
+                }
+                ++heavy_done;
+            }
+        });
+    }
+    for(int fd : light_fds){
+        threads.emplace_back([&, fd]{
+            std::string buf;
+            std::vector<double> mine;
+            while(running){
+                auto start = std::chrono::steady_clock::now();
+                if(send(fd, light_req, sizeof(light_req) - 1, MSG_NOSIGNAL) < 0 || !read_message(fd, buf)){
+                    break;
+                }
+                mine.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+                std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            }
+            std::lock_guard<std::mutex> guard(lock);
+            latency.insert(latency.end(), mine.begin(), mine.end());
+        });
+    }
+
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    running = false;
+    // 关闭连接让阻塞在recv上的线程退出
+    for(int fd : heavy_fds){
+        shutdown(fd, SHUT_RDWR);
+    }
+    for(int fd : light_fds){
+        shutdown(fd, SHUT_RDWR);
+    }
+    for(std::thread& t : threads){
+        t.join();
+    }
+
+    std::sort(latency.begin(), latency.end());
+    size_t n = latency.size();
+    printf("heavy: %ld requests, %.0f req/s\n", heavy_done.load(), heavy_done.load() / (double)seconds);
+    if(n){
+        printf("light: %zu requests, p50 %.2f ms, p99 %.2f ms, max %.2f ms\n", n, latency[n / 2],
+            latency[std::min(n - 1, n * 99 / 100)], latency.back());
+    }
+    return 0;
+}
@@ -0,0 +1,207 @@
+// 请求头解析测试：构造带有很多头部的请求（默认32个），对比三种做法每个请求的解析时间和内存分配次数
+//   chain：原来的parse_headers，逐个strncasecmp比较已知的头部，其余的打印一行"unknown header"（输出到/dev/null）
+//   copy ：在chain的基础上把全部头部复制到std::unordered_map<std::string, std::string>，其它功能需要别的头部时只能这样
+//   map  ：现在的做法，全部头部以string_view放进header_map，超出内嵌数组的放进请求的arena，已知的头部按哈希分派
+// 每种做法解析完后都查找3个头部（其中一个不存在）
+// 编译: g++ -std=c++20 -O2 -I. tools/header_bench.cpp -o header_bench
+// 用法: ./header_bench [头部个数] [迭代次数]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <string>
+#include <unordered_map>
+#include <chrono>
+#include <algorithm>
+#include "header_map.h"
+
+// 统计malloc的次数，operator new也经过这里
+static long mallocs = 0;
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* malloc(size_t size){
+    ++mallocs;
+    return __libc_malloc(size);
+}
+
+static FILE* devnull;
+
+// 按server的方式把请求头切成以'\0'结尾的行，返回行数
+static int split_lines(char* buf, size_t len, char** lines){
+    int n = 0;
+    char* p = buf;
+    char* end = buf + len;
+    while(p < end){
+        char* cr = (char*)memchr(p, '\r', end - p);
+        if(!cr){
+            break;
+        }
+        cr[0] = '\0';
+        cr[1] = '\0';
+        lines[n++] = p;
+        p = cr + 2;
+    }
+    return n;
+}
+
+struct parsed{
+    bool linger = false;
+    long content_length = 0;
+    const char* host = NULL;
+    bool chunked = false;
+};
+
+static void parse_chain(char* text, parsed& r){
+    if(strncasecmp(text, "Connection:", 11) == 0){
+        text += 11;
+        text += strspn(text, " \t");
+        r.linger = strcasecmp(text, "keep-alive") == 0;
+    }else if(strncasecmp(text, "Content-Length:", 15) == 0){
+        text += 15;
+        text += strspn(text, " \t");
+        r.content_length = atol(text);
+    }else if(strncasecmp(text, "Host:", 5) == 0){
+        text += 5;
+        text += strspn(text, " \t");
+        r.host = text;
+    }else if(strncasecmp(text, "Transfer-Encoding:", 18) == 0){
+        text += 18;
+        text += strspn(text, " \t");
+        r.chunked = strcasecmp(text, "chunked") == 0;
+    }else if(strncasecmp(text, "Expect:", 7) == 0){
+    }else if(strncasecmp(text, "Upgrade:", 8) == 0){
+    }else if(strncasecmp(text, "HTTP2-Settings:", 15) == 0){
+    }else{
+        fprintf(devnull, "unknown header %s\n", text);
+    }
+}
+
+static bool token_is(std::string_view v, std::string_view s){
+    return v.size() == s.size() && strncasecmp(v.data(), s.data(), s.size()) == 0;
+}
+
+static void parse_map(char* text, header_map& headers, parsed& r){
+    char* colon = strchr(text, ':');
+    if(!colon){
+        return;
+    }
+    std::string_view name(text, colon - text);
+    char* value = colon + 1;
+    value += strspn(value, " \t");
+    size_t len = strlen(value);
+    while(len && (value[len - 1] == ' ' || value[len - 1] == '\t')){
+        --len;
+    }
+    std::string_view v(value, len);
+    uint32_t hash = header_hash(name);
+    headers.add(hash, name, v);
+    switch(hash){
+        case header_hash("connection"):
+            r.linger = token_is(name, "connection") && token_is(v, "keep-alive");
+            break;
+        case header_hash("content-length"):
+            if(token_is(name, "content-length")){
+                r.content_length = atol(value);
+            }
+            break;
+        case header_hash("host"):
+            if(token_is(name, "host")){
+                r.host = value;
+            }
+            break;
+        case header_hash("transfer-encoding"):
+            r.chunked = token_is(name, "transfer-encoding") && token_is(v, "chunked");
+            break;
+    }
+}
+
+int main(int argc, char* argv[]){
+    int count = (argc > 1) ? atoi(argv[1]) : 32;
+    long iterations = (argc > 2) ? atol(argv[2]) : 200000;
+    devnull = fopen("/dev/null", "w");
+
+    // 典型浏览器请求的头部，不够时补充X-Custom-n
+    static const char* common[] = {"Host: example.com", "Connection: keep-alive", "User-Agent: Mozilla/5.0 (X11; Linux x86_64)",
+        "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8", "Accept-Language: en-US,en;q=0.5",
+        "Accept-Encoding: gzip, deflate, br", "Referer: https://example.com/index.html", "Cookie: session=abcdef0123456789; theme=dark",
+        "Upgrade-Insecure-Requests: 1", "Sec-Fetch-Dest: document", "Sec-Fetch-Mode: navigate", "Sec-Fetch-Site: same-origin",
+        "Sec-Fetch-User: ?1", "Cache-Control: max-age=0", "DNT: 1", "If-None-Match: \"5d8c72a5edda8\""};
+    std::string request;
+    for(int i = 0; i < count; ++i){
+        if(i < (int)(sizeof(common) / sizeof(common[0]))){
+            request += common[i];
+        }else{
+            request += "X-Custom-" + std::to_string(i) + ": value-" + std::to_string(i * 7919);
+        }
+        request += "\r\n";
+    }
+
+    std::string buf(request.size() + 1, '\0');
+    char* lines[1024];
+    request_arena arena;
+    header_map headers;
+    headers.set_arena(&arena);
+    const char* names[] = {"accept-encoding", "Cookie", "X-Missing"};
+
+    for(int mode = 0; mode < 3; ++mode){
+        long start_mallocs = 0;
+        size_t found = 0;
+        double total_ns = 0;
+        for(long it = -1000; it < iterations; ++it){
+            if(it == 0){
+                start_mallocs = mallocs;
+            }
+            memcpy(&buf[0], request.data(), request.size());
+            auto start = std::chrono::steady_clock::now();
+            int n = split_lines(&buf[0], request.size(), lines);
+            parsed r;
+            if(mode == 0){
+                for(int i = 0; i < n; ++i){
+                    parse_chain(lines[i], r);
+                }
+                // 没有保存的头部只能重新扫描一遍
+                for(const char* name : names){
+                    size_t len = strlen(name);
+                    for(int i = 0; i < n; ++i){
+                        if(strncasecmp(lines[i], name, len) == 0 && lines[i][len] == ':'){
+                            ++found;
+                            break;
+                        }
+                    }
+                }
+            }else if(mode == 1){
+                std::unordered_map<std::string, std::string> copy;
+                for(int i = 0; i < n; ++i){
+                    parse_chain(lines[i], r);
+                    char* colon = strchr(lines[i], ':');
+                    if(colon){
+                        std::string name(lines[i], colon - lines[i]);
+                        std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+                        copy[name] = colon + 1 + strspn(colon + 1, " \t");
+                    }
+                }
+                for(const char* name : names){
+                    std::string key(name);
+                    std::transform(key.begin(), key.end(), key.begin(), ::tolower);
+                    found += copy.count(key);
+                }
+            }else{
+                headers.clear();
+                arena.reset();
+                for(int i = 0; i < n; ++i){
+                    parse_map(lines[i], headers, r);
+                }
+                for(const char* name : names){
+                    found += headers.find(name) != NULL;
+                }
+            }
+            if(it >= 0){
+                total_ns += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+            }
+            found += r.linger ? 0 : 1000000;     // 解析结果也要用到，避免被优化掉
+        }
+        static const char* mode_names[] = {"chain", "copy", "map"};
+        printf("%-6s %d headers: %8.0f ns/request, %6.2f mallocs/request, %zu lookups hit\n", mode_names[mode], count,
+            total_ns / iterations, (mallocs - start_mallocs) / (double)iterations, found / (iterations + 1000));
+    }
+    return 0;
+}
@@ -0,0 +1,102 @@
+// 长连接压测：建立N个keep-alive连接，每个连接收到完整的响应后立即发送下一个请求，统计持续时间内的请求速率
+// 编译: g++ -std=c++20 -O2 tools/keepalive_bench.cpp -o keepalive_bench
+// 用法: ./keepalive_bench 端口 [连接数] [秒数] [路径]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <string>
+#include <vector>
+#include <chrono>
+
+struct client{
+    int fd;
+    std::string buf;    // 收到的还没有凑成完整响应的数据
+};
+
+// 缓冲区开头是一个完整的响应时返回它的长度，否则返回0
+static size_t response_len(const std::string& buf){
+    size_t head = buf.find("\r\n\r\n");
+    if(head == std::string::npos){
+        return 0;
+    }
+    size_t content_length = 0;
+    const char* p = strcasestr(buf.c_str(), "Content-Length:");
+    if(p && p < buf.c_str() + head){
+        content_length = atol(p + 15);
+    }
+    size_t total = head + 4 + content_length;
+    return buf.size() >= total ? total : 0;
+}
+
+int main(int argc, char* argv[]){
+    if(argc < 2){
+        printf("usage: %s port [conns] [seconds] [path]\n", argv[0]);
+        return 1;
+    }
+    int port = atoi(argv[1]);
+    int conns = (argc > 2) ? atoi(argv[2]) : 50;
+    int seconds = (argc > 3) ? atoi(argv[3]) : 10;
+    const char* path = (argc > 4) ? argv[4] : "/index.html";
+
+    char request[512];
+    int request_len = snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: 127.0.0.1\r\nConnection: keep-alive\r\n\r\n", path);
+
+    int epollfd = epoll_create1(0);
+    std::vector<client> clients(conns);
+    for(int i = 0; i < conns; ++i){
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if(connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0){
+            perror("connect");
+            return 1;
+        }
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        clients[i].fd = fd;
+        epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.u32 = i;
+        epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &ev);
+        send(fd, request, request_len, 0);
+    }
+
+    long done = 0, closed = 0;
+    char buf[65536];
+    epoll_event events[1024];
+    auto start = std::chrono::steady_clock::now();
+    auto end = start + std::chrono::seconds(seconds);
+    while(std::chrono::steady_clock::now() < end){
+        int num = epoll_wait(epollfd, events, 1024, 100);
+        for(int i = 0; i < num; ++i){
+            client& c = clients[events[i].data.u32];
+            int ret;
+            while((ret = recv(c.fd, buf, sizeof(buf), 0)) > 0){
+                c.buf.append(buf, ret);
+            }
+            if(ret == 0){
+                // 服务器关闭了连接，不再使用它
+                ++closed;
+                epoll_ctl(epollfd, EPOLL_CTL_DEL, c.fd, NULL);
+                close(c.fd);
+                continue;
+            }
+            size_t len;
+            while((len = response_len(c.buf)) > 0){
+                c.buf.erase(0, len);
+                ++done;
+                send(c.fd, request, request_len, 0);
+            }
+        }
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("%ld requests in %.1fs, %.0f req/s, %ld connections closed by server\n", done, elapsed, done / elapsed, closed);
+    return 0;
+}
@@ -0,0 +1,175 @@
+// 请求延迟测试：每个连接发送一个请求、收到完整响应后间隔gap微秒再发下一个，统计每个请求的延迟分布
+// 给出服务器的pid时同时统计测试期间服务器进程消耗的CPU时间和每个请求的上下文切换次数，用来对比不同模式的延迟与代价
+// 编译: g++ -std=c++20 -O2 -pthread tools/latency_bench.cpp -o latency_bench
+// 用法: ./latency_bench 端口 [连接数] [秒数] [间隔us] [路径] [服务器pid]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+
+// 缓冲区开头是一个完整的响应时返回它的长度，否则返回0
+static size_t response_len(const std::string& buf){
+    size_t head = buf.find("\r\n\r\n");
+    if(head == std::string::npos){
+        return 0;
+    }
+    size_t content_length = 0;
+    const char* p = strcasestr(buf.c_str(), "Content-Length:");
+    if(p && p < buf.c_str() + head){
+        content_length = atol(p + 15);
+    }
+    size_t total = head + 4 + content_length;
+    return buf.size() >= total ? total : 0;
+}
+
+// 进程消耗的CPU时间(秒)，读/proc/pid/stat的utime和stime
+static double cpu_seconds(int pid){
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    FILE* f = fopen(path, "r");
+    if(!f){
+        return 0;
+    }
+    char buf[1024];
+    size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[n] = '\0';
+    // 第2项是括号中的进程名，可能带空格，从最后一个右括号之后开始数
+    const char* p = strrchr(buf, ')');
+    unsigned long utime = 0, stime = 0;
+    if(p){
+        sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime);
+    }
+    return (utime + stime) / (double)sysconf(_SC_CLK_TCK);
+}
+
+// 进程所有线程的上下文切换次数之和（主动+被动），读/proc/pid/task/*/status
+static long context_switches(int pid){
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/task", pid);
+    DIR* dir = opendir(path);
+    if(!dir){
+        return 0;
+    }
+    long total = 0;
+    while(dirent* d = readdir(dir)){
+        if(d->d_name[0] == '.'){
+            continue;
+        }
+        char status[PATH_MAX];
+        snprintf(status, sizeof(status), "/proc/%d/task/%s/status", pid, d->d_name);
+        FILE* f = fopen(status, "r");
+        if(!f){
+            continue;
+        }
+        char line[256];
+        long n;
+        while(fgets(line, sizeof(line), f)){
+            if(sscanf(line, "voluntary_ctxt_switches: %ld", &n) == 1 || sscanf(line, "nonvoluntary_ctxt_switches: %ld", &n) == 1){
+                total += n;
+            }
+        }
+        fclose(f);
+    }
+    closedir(dir);
+    return total;
+}
+
+int main(int argc, char* argv[]){
+    if(argc < 2){
+        printf("usage: %s port [conns] [seconds] [gap_us] [path] [server_pid]\n", argv[0]);
+        return 1;
+    }
+    int port = atoi(argv[1]);
+    int conns = (argc > 2) ? atoi(argv[2]) : 1;
+    int seconds = (argc > 3) ? atoi(argv[3]) : 10;
+    int gap_us = (argc > 4) ? atoi(argv[4]) : 1000;
+    const char* path = (argc > 5) ? argv[5] : "/index.html";
+    int pid = (argc > 6) ? atoi(argv[6]) : 0;
+
+    char request[512];
+    int request_len = snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: 127.0.0.1\r\nConnection: keep-alive\r\n\r\n", path);
+
+    std::atomic<bool> running(true);
+    std::mutex lock;
+    std::vector<double> latency;   // 每个请求的延迟(us)
+    std::vector<std::thread> threads;
+    double cpu_start = pid ? cpu_seconds(pid) : 0;
+    long cs_start = pid ? context_switches(pid) : 0;
+    for(int i = 0; i < conns; ++i){
+        threads.emplace_back([&]{
+            int fd = socket(AF_INET, SOCK_STREAM, 0);
+            sockaddr_in addr = {};
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons(port);
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            if(connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0){
+                perror("connect");
+                return;
+            }
+            std::vector<double> mine;
+            std::string buf;
+            char tmp[65536];
+            while(running){
+                auto start = std::chrono::steady_clock::now();
+                if(send(fd, request, request_len, MSG_NOSIGNAL) < 0){
+                    break;
+                }
+                size_t len;
+                int ret = 1;
+                while((len = response_len(buf)) == 0 && (ret = recv(fd, tmp, sizeof(tmp), 0)) > 0){
+                    buf.append(tmp, ret);
+                }
+                if(ret <= 0){
+                    break;
+                }
+                buf.erase(0, len);
+                mine.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+                if(gap_us){
+                    std::this_thread::sleep_for(std::chrono::microseconds(gap_us));
+                }
+            }
+            close(fd);
+            std::lock_guard<std::mutex> guard(lock);
+            latency.insert(latency.end(), mine.begin(), mine.end());
+        });
+    }
+    auto start = std::chrono::steady_clock::now();
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    running = false;
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double cpu = pid ? cpu_seconds(pid) - cpu_start : 0;
+    long cs = pid ? context_switches(pid) - cs_start : 0;
+    for(std::thread& t : threads){
+        t.join();
+    }
+
+    std::sort(latency.begin(), latency.end());
+    size_t n = latency.size();
+    if(n == 0){
+        printf("no responses\n");
+        return 1;
+    }
+    printf("%zu requests, %.0f req/s, p50 %.1f us, p99 %.1f us, p99.9 %.1f us, max %.1f us", n, n / elapsed,
+        latency[n / 2], latency[std::min(n - 1, n * 99 / 100)], latency[std::min(n - 1, n * 999 / 1000)], latency.back());
+    if(pid){
+        printf(", server cpu %.0f%%, %.2f context switches/request", cpu / elapsed * 100, cs / (double)n);
+    }
+    printf("\n");
+    return 0;
+}
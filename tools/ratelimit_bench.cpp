@@ -0,0 +1,89 @@
+// 限流性能测试：哈希表中跟踪1M个客户端时，单次on_request的耗时（随机客户端、单个热点客户端、多线程）
+// 限流读取coarse_clock的单调时间，和服务器的主线程一样由一个线程每毫秒调用一次update，令牌桶才会按时间补充
+// 编译: g++ -std=c++20 -O2 -I. tools/ratelimit_bench.cpp ratelimit.cpp coarse_clock.cpp -o ratelimit_bench -pthread
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <atomic>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include "ratelimit.h"
+#include "coarse_clock.h"
+
+static double bench(const std::vector<in_addr_t>& addrs, int rounds, long* allowed){
+    long ok = 0;
+    auto start = std::chrono::steady_clock::now();
+    for(int r = 0; r < rounds; ++r){
+        for(in_addr_t a : addrs){
+            ok += rate_limiter::on_request(a);
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    *allowed = ok;
+    double ns = std::chrono::duration<double, std::nano>(end - start).count();
+    return ns / ((double)rounds * addrs.size());
+}
+
+int main(int argc, char* argv[]){
+    int clients = (argc > 1) ? atoi(argv[1]) : 1000000;
+    int threads = (argc > 2) ? atoi(argv[2]) : 4;
+    if(!rate_limiter::init("100,200")){
+        printf("init failed\n");
+        return 1;
+    }
+
+    // 代替服务器的事件循环更新时钟
+    coarse_clock::update();
+    std::atomic<bool> stop(false);
+    std::thread clock([&]{
+        while(!stop.load(std::memory_order_relaxed)){
+            coarse_clock::update();
+            usleep(1000);
+        }
+    });
+
+    // 随机的IPv4地址，先插入一遍，之后的查找都命中已经跟踪的客户端
+    std::vector<in_addr_t> addrs(clients);
+    srand(1);
+    for(in_addr_t& a : addrs){
+        a = ((in_addr_t)rand() << 16) ^ (in_addr_t)rand();
+    }
+    long allowed = 0;
+    auto insert_start = std::chrono::steady_clock::now();
+    bench(addrs, 1, &allowed);
+    auto insert_end = std::chrono::steady_clock::now();
+    printf("insert %d clients: %.1f ns/client\n", clients,
+        std::chrono::duration<double, std::nano>(insert_end - insert_start).count() / clients);
+
+    // 打乱顺序，避免和插入时的访问模式相同
+    std::vector<in_addr_t> shuffled = addrs;
+    for(size_t i = shuffled.size() - 1; i > 0; --i){
+        std::swap(shuffled[i], shuffled[rand() % (i + 1)]);
+    }
+    double ns = bench(shuffled, 5, &allowed);
+    printf("random tracked client: %.1f ns/request, allowed %.1f%%\n", ns, 100.0 * allowed / (5.0 * clients));
+
+    std::vector<in_addr_t> hot(1000000, addrs[0]);
+    ns = bench(hot, 1, &allowed);
+    printf("single hot client: %.1f ns/request, allowed %ld\n", ns, allowed);
+
+    // 多个线程同时访问同一张表
+    std::vector<std::thread> workers;
+    std::vector<double> results(threads);
+    for(int t = 0; t < threads; ++t){
+        workers.emplace_back([&, t]{
+            long ok;
+            results[t] = bench(shuffled, 2, &ok);
+        });
+    }
+    for(std::thread& w : workers){
+        w.join();
+    }
+    for(int t = 0; t < threads; ++t){
+        printf("thread %d: %.1f ns/request\n", t, results[t]);
+    }
+    stop.store(true, std::memory_order_relaxed);
+    clock.join();
+    return 0;
+}
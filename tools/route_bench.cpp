@@ -0,0 +1,99 @@
+// 路由查找性能测试：10k条路由（静态、参数、前缀各占一部分）下单次查找的耗时
+// 编译: g++ -std=c++20 -O2 -I. tools/route_bench.cpp router.cpp -o route_bench
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <chrono>
+#include "router.h"
+#include "http_conn.h"
+
+static void dummy_handler(const http_request&, http_response&){}
+
+// 编译期路由表
+constexpr route_def static_defs[] = {
+    {http_conn::GET, "/", dummy_handler, NULL},
+    {http_conn::GET, "/index.html", dummy_handler, NULL},
+    {http_conn::GET, "/api/v1/users", dummy_handler, NULL},
+    {http_conn::POST, "/api/v1/users", dummy_handler, NULL},
+    {http_conn::GET, "/api/v1/users/:id", dummy_handler, NULL},
+    {http_conn::PUT, "/api/v1/users/:id", dummy_handler, NULL},
+    {http_conn::DELETE, "/api/v1/users/:id", dummy_handler, NULL},
+    {http_conn::GET, "/api/v1/users/:id/posts/:post", dummy_handler, NULL},
+    {http_conn::GET, "/api/v1/status", dummy_handler, NULL},
+    {http_conn::GET, "/static/*path", dummy_handler, NULL},
+    {http_conn::GET, "/images/*path", dummy_handler, NULL},
+};
+constexpr static_router<route_node_bound(static_defs)> static_routes(static_defs);
+static_assert(static_routes.ok(), "static route table overflow");
+
+static double bench(route_view routes, const std::vector<std::string>& paths, int rounds, int* hits){
+    route_params params;
+    *hits = 0;
+    auto start = std::chrono::steady_clock::now();
+    for(int r = 0; r < rounds; ++r){
+        for(const std::string& p : paths){
+            params.count = 0;
+            if(route_match(routes, p, params)){
+                ++*hits;
+            }
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    double ns = std::chrono::duration<double, std::nano>(end - start).count();
+    return ns / ((double)rounds * paths.size());
+}
+
+int main(int argc, char* argv[]){
+    int route_count = (argc > 1) ? atoi(argv[1]) : 10000;
+    const int ROUNDS = 20;
+    char buf[128];
+
+    // 40% 静态路由，30% 参数路由，30% 前缀路由
+    router routes;
+    for(int i = 0; i < route_count; ++i){
+        int kind = i % 10;
+        if(kind < 4){
+            snprintf(buf, sizeof(buf), "/api/v%d/resource%d/items", i % 7, i);
+        }else if(kind < 7){
+            snprintf(buf, sizeof(buf), "/users%d/:id/posts/:post", i);
+        }else{
+            snprintf(buf, sizeof(buf), "/static%d/*path", i);
+        }
+        routes.add(http_conn::GET, buf, dummy_handler);
+    }
+    auto build_start = std::chrono::steady_clock::now();
+    route_view view = routes.finalize();
+    auto build_end = std::chrono::steady_clock::now();
+
+    std::vector<std::string> paths;
+    for(int i = 0; i < 100000; ++i){
+        int r = rand() % route_count;
+        int kind = r % 10;
+        if(i % 10 == 9){
+            snprintf(buf, sizeof(buf), "/missing/path%d", r);
+        }else if(kind < 4){
+            snprintf(buf, sizeof(buf), "/api/v%d/resource%d/items", r % 7, r);
+        }else if(kind < 7){
+            snprintf(buf, sizeof(buf), "/users%d/%d/posts/%d", r, rand(), rand());
+        }else{
+            snprintf(buf, sizeof(buf), "/static%d/css/site%d.css", r, rand() % 100);
+        }
+        paths.push_back(buf);
+    }
+
+    int hits = 0;
+    double ns = bench(view, paths, ROUNDS, &hits);
+    printf("runtime router: %d routes, %d nodes, finalize %.2f ms\n", route_count, view.count,
+        std::chrono::duration<double, std::milli>(build_end - build_start).count());
+    printf("  %.1f ns/lookup, hit rate %.1f%%\n", ns, 100.0 * hits / ((double)ROUNDS * paths.size()));
+
+    std::vector<std::string> static_paths = {
+        "/", "/index.html", "/api/v1/users", "/api/v1/users/42", "/api/v1/users/42/posts/7",
+        "/api/v1/status", "/static/js/app.js", "/images/logo.png", "/nothing/here",
+    };
+    ns = bench(static_routes.view(), static_paths, 1000000, &hits);
+    printf("static router: %zu routes, %d nodes\n", sizeof(static_defs) / sizeof(static_defs[0]), static_routes.view().count);
+    printf("  %.1f ns/lookup\n", ns);
+    return 0;
+}
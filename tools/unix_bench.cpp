@@ -0,0 +1,177 @@
+// 回环TCP和UNIX socket的对比测试：同一个服务器同时监听TCP端口和UNIX socket（-L unix:/path），
+// 依次在两种连接上用相同的连接数和时长发送keep-alive请求，每个连接收到完整响应后马上发下一个，输出吞吐和延迟分布
+// 给出服务器的pid时同时统计每个请求消耗的服务器CPU时间
+// 编译: g++ -std=c++20 -O2 -pthread tools/unix_bench.cpp -o unix_bench
+// 用法: ./unix_bench 端口 socket路径(@开头为抽象命名空间) [连接数] [秒数] [路径] [服务器pid]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stddef.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+
+// 缓冲区开头是一个完整的响应时返回它的长度，否则返回0
+static size_t response_len(const std::string& buf){
+    size_t head = buf.find("\r\n\r\n");
+    if(head == std::string::npos){
+        return 0;
+    }
+    size_t content_length = 0;
+    const char* p = strcasestr(buf.c_str(), "Content-Length:");
+    if(p && p < buf.c_str() + head){
+        content_length = atol(p + 15);
+    }
+    size_t total = head + 4 + content_length;
+    return buf.size() >= total ? total : 0;
+}
+
+// 进程消耗的CPU时间(秒)，读/proc/pid/stat的utime和stime
+static double cpu_seconds(int pid){
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    FILE* f = fopen(path, "r");
+    if(!f){
+        return 0;
+    }
+    char buf[1024];
+    size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[n] = '\0';
+    const char* p = strrchr(buf, ')');
+    unsigned long utime = 0, stime = 0;
+    if(p){
+        sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime);
+    }
+    return (utime + stime) / (double)sysconf(_SC_CLK_TCK);
+}
+
+static int port;
+static const char* unix_path;
+
+static int connect_to(bool use_unix){
+    if(use_unix){
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        size_t len = strlen(unix_path);
+        memcpy(addr.sun_path, unix_path, len);
+        if(unix_path[0] == '@'){
+            addr.sun_path[0] = '\0';    // 抽象命名空间，名字不以'\0'结尾
+        }else{
+            ++len;
+        }
+        if(connect(fd, (sockaddr*)&addr, offsetof(sockaddr_un, sun_path) + len) < 0){
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if(connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0){
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// 在一种连接上测试seconds秒，输出一行结果
+static void run(bool use_unix, int conns, int seconds, const char* request, int request_len, int pid){
+    std::atomic<bool> running(true);
+    std::mutex lock;
+    std::vector<double> latency;   // 每个请求的延迟(us)
+    std::vector<int> fds;
+    for(int i = 0; i < conns; ++i){
+        int fd = connect_to(use_unix);
+        if(fd < 0){
+            perror("connect");
+            break;
+        }
+        fds.push_back(fd);
+    }
+
+    std::vector<std::thread> threads;
+    double cpu_start = pid ? cpu_seconds(pid) : 0;
+    auto start = std::chrono::steady_clock::now();
+    for(int fd : fds){
+        threads.emplace_back([&, fd]{
+            std::vector<double> mine;
+            std::string buf;
+            char tmp[65536];
+            while(running){
+                auto begin = std::chrono::steady_clock::now();
+                if(send(fd, request, request_len, MSG_NOSIGNAL) < 0){
+                    break;
+                }
+                size_t len;
+                int ret = 1;
+                while((len = response_len(buf)) == 0 && (ret = recv(fd, tmp, sizeof(tmp), 0)) > 0){
+                    buf.append(tmp, ret);
+                }
+                if(ret <= 0){
+                    break;
+                }
+                buf.erase(0, len);
+                mine.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - begin).count());
+            }
+            close(fd);
+            std::lock_guard<std::mutex> guard(lock);
+            latency.insert(latency.end(), mine.begin(), mine.end());
+        });
+    }
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    running = false;
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double cpu = pid ? cpu_seconds(pid) - cpu_start : 0;
+    for(std::thread& t : threads){
+        t.join();
+    }
+
+    std::sort(latency.begin(), latency.end());
+    size_t n = latency.size();
+    if(n == 0){
+        printf("%-5s no responses\n", use_unix ? "unix" : "tcp");
+        return;
+    }
+    printf("%-5s %zu requests, %.0f req/s, p50 %.1f us, p99 %.1f us, p99.9 %.1f us, max %.1f us", use_unix ? "unix" : "tcp",
+        n, n / elapsed, latency[n / 2], latency[std::min(n - 1, n * 99 / 100)], latency[std::min(n - 1, n * 999 / 1000)], latency.back());
+    if(pid){
+        printf(", server cpu %.1f us/request", cpu * 1e6 / n);
+    }
+    printf("\n");
+}
+
+int main(int argc, char* argv[]){
+    if(argc < 3){
+        printf("usage: %s port unix_path [conns] [seconds] [path] [server_pid]\n", argv[0]);
+        return 1;
+    }
+    port = atoi(argv[1]);
+    unix_path = argv[2];
+    int conns = (argc > 3) ? atoi(argv[3]) : 16;
+    int seconds = (argc > 4) ? atoi(argv[4]) : 10;
+    const char* path = (argc > 5) ? argv[5] : "/index.html";
+    int pid = (argc > 6) ? atoi(argv[6]) : 0;
+
+    char request[512];
+    int request_len = snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: 127.0.0.1\r\nConnection: keep-alive\r\n\r\n", path);
+    run(false, conns, seconds, request, request_len, pid);
+    run(true, conns, seconds, request, request_len, pid);
+    return 0;
+}
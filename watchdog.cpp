@@ -0,0 +1,182 @@
+#include "watchdog.h"
+#include "metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <execinfo.h>
+#include <algorithm>
+
+extern void log(std::string str);
+
+bool loop_watchdog::m_enabled = false;
+uint64_t loop_watchdog::m_threshold_ns = 0;
+pthread_t loop_watchdog::m_main;
+pthread_t loop_watchdog::m_thread;
+std::atomic<uint64_t> loop_watchdog::m_busy_since(0);
+std::atomic<uint64_t> loop_watchdog::m_iteration(0);
+std::atomic<int> loop_watchdog::m_events(0);
+std::atomic<int> loop_watchdog::m_cur_fd(-1);
+std::atomic<uint32_t> loop_watchdog::m_cur_events(0);
+std::atomic<uint64_t> loop_watchdog::m_recent[RECENT];
+std::atomic<uint64_t> loop_watchdog::m_hist[BUCKETS];
+std::atomic<uint64_t> loop_watchdog::m_sum_ns(0);
+std::atomic<uint64_t> loop_watchdog::m_stalls(0);
+void* loop_watchdog::m_frames[MAX_FRAMES];
+int loop_watchdog::m_frame_count = 0;
+std::atomic<bool> loop_watchdog::m_captured(false);
+
+// 抓取调用栈用的信号，只发给主线程
+static int stack_signal(){
+    return SIGRTMIN + 1;
+}
+
+bool loop_watchdog::init(const char* spec, router& routes){
+    char url[256] = "";
+    int ms = 0;
+    if(sscanf(spec, "%d,%255s", &ms, url) < 1 || ms <= 0 || (url[0] && url[0] != '/')){
+        return false;
+    }
+    if(url[0] && !metrics::serve(url, routes)){
+        return false;
+    }
+    metrics::add(export_metrics);
+    m_threshold_ns = (uint64_t)ms * 1000000;
+
+    // backtrace第一次调用时会加载libgcc，先在这里调用一次，之后在信号处理函数中调用不会分配内存
+    void* warmup[2];
+    backtrace(warmup, 2);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sa.sa_flags = SA_RESTART;
+    sigfillset(&sa.sa_mask);
+    return sigaction(stack_signal(), &sa, NULL) == 0;
+}
+
+bool loop_watchdog::start(){
+    if(!m_threshold_ns){
+        return true;
+    }
+    m_main = pthread_self();
+    m_enabled = true;
+    if(pthread_create(&m_thread, NULL, monitor, NULL) != 0){
+        m_enabled = false;
+        return false;
+    }
+    pthread_detach(m_thread);
+    return true;
+}
+
+// 主线程：这一轮的耗时计入直方图和最近的记录
+void loop_watchdog::record(){
+    uint64_t ns = now_ns() - m_busy_since.load(std::memory_order_relaxed);
+    m_busy_since.store(0, std::memory_order_relaxed);
+    uint64_t us = ns / 1000;
+    int bucket = us <= 1 ? 0 : 64 - __builtin_clzll(us - 1);
+    bucket = std::min(bucket, BUCKETS - 1);
+    m_hist[bucket].fetch_add(1, std::memory_order_relaxed);
+    m_sum_ns.fetch_add(ns, std::memory_order_relaxed);
+
+    uint64_t iteration = m_iteration.load(std::memory_order_relaxed);
+    uint64_t events = std::min(m_events.load(std::memory_order_relaxed), 0xffff);
+    m_recent[iteration % RECENT].store((us << 16) | events, std::memory_order_relaxed);
+    m_iteration.store(iteration + 1, std::memory_order_release);
+}
+
+// 主线程上的信号处理函数：只记录返回地址，符号在监控线程上解析
+void loop_watchdog::on_signal(int){
+    m_frame_count = backtrace(m_frames, MAX_FRAMES);
+    m_captured.store(true, std::memory_order_release);
+}
+
+// 检查的间隔为阈值的1/4，卡顿最多晚1/4个阈值被发现
+// 同一轮只报告一次，这一轮结束后再记录它的总耗时
+void* loop_watchdog::monitor(void*){
+    timespec interval;
+    uint64_t interval_ns = std::max<uint64_t>(m_threshold_ns / 4, 1000000);
+    interval.tv_sec = interval_ns / 1000000000;
+    interval.tv_nsec = interval_ns % 1000000000;
+    uint64_t stalled = UINT64_MAX;      // 正在卡顿的那一轮
+    while(true){
+        nanosleep(&interval, NULL);
+        uint64_t since = m_busy_since.load(std::memory_order_relaxed);
+        uint64_t iteration = m_iteration.load(std::memory_order_acquire);
+        if(stalled != UINT64_MAX && iteration != stalled){
+            char buf[128];
+            snprintf(buf, sizeof(buf), "watchdog: reactor iteration %lu finished after %.1f ms\n", (unsigned long)stalled,
+                (m_recent[stalled % RECENT].load(std::memory_order_relaxed) >> 16) / 1000.0);
+            log(buf);
+            stalled = UINT64_MAX;
+        }
+        if(stalled == UINT64_MAX && since){
+            uint64_t running = now_ns() - since;
+            if(running > m_threshold_ns){
+                stalled = iteration;
+                m_stalls.fetch_add(1, std::memory_order_relaxed);
+                report(iteration, running);
+            }
+        }
+    }
+    return NULL;
+}
+
+// 抓取主线程的调用栈，连同正在处理的事件和最近几轮的耗时写入日志
+void loop_watchdog::report(uint64_t iteration, uint64_t running_ns){
+    int fd = m_cur_fd.load(std::memory_order_relaxed);
+    uint32_t events = m_cur_events.load(std::memory_order_relaxed);
+
+    // 信号处理函数在主线程上运行，最多等待100ms；主线程屏蔽了信号或者卡在不可中断的系统调用中时没有调用栈
+    // 信号以SA_RESTART安装，被打断的读写会自动重新开始，但nanosleep、epoll_wait等不会重启的调用会提前返回EINTR
+    m_captured.store(false, std::memory_order_relaxed);
+    pthread_kill(m_main, stack_signal());
+    for(int i = 0; i < 100 && !m_captured.load(std::memory_order_acquire); ++i){
+        usleep(1000);
+    }
+
+    std::string out;
+    char buf[256];
+    snprintf(buf, sizeof(buf), "watchdog: reactor iteration %lu running for %.1f ms (threshold %lu ms), %d events, handling fd %d events 0x%x\n",
+        (unsigned long)iteration, running_ns / 1e6, (unsigned long)(m_threshold_ns / 1000000), m_events.load(std::memory_order_relaxed), fd, events);
+    out += buf;
+    if(m_captured.load(std::memory_order_acquire)){
+        out += "main thread stack:\n";
+        char** symbols = backtrace_symbols(m_frames, m_frame_count);
+        for(int i = 0; i < m_frame_count; ++i){
+            snprintf(buf, sizeof(buf), "  #%d %s\n", i, symbols ? symbols[i] : "?");
+            out += buf;
+        }
+        free(symbols);
+    }else{
+        out += "main thread stack: not captured\n";
+    }
+
+    // 最近16轮的耗时(us)和事件数，从旧到新
+    out += "recent iterations (us/events):";
+    int n = std::min<uint64_t>(iteration, 16);
+    for(uint64_t i = iteration - n; i < iteration; ++i){
+        uint64_t v = m_recent[i % RECENT].load(std::memory_order_relaxed);
+        snprintf(buf, sizeof(buf), " %lu/%lu", (unsigned long)(v >> 16), (unsigned long)(v & 0xffff));
+        out += buf;
+    }
+    out += "\n";
+    log(out);
+}
+
+// 每轮耗时的直方图和卡顿次数，见metrics.h
+void loop_watchdog::export_metrics(std::string& out){
+    static double bounds[BUCKETS - 1];
+    static bool ready = []{
+        for(int i = 0; i < BUCKETS - 1; ++i){
+            bounds[i] = (double)(1ull << i) / 1e6;
+        }
+        return true;
+    }();
+    (void)ready;
+    metrics::histogram(out, "tinyhttp_loop_iteration_seconds", "Time the reactor spends handling one epoll_wait batch.",
+        bounds, BUCKETS - 1, m_hist, m_sum_ns.load(std::memory_order_relaxed) / 1e9);
+    metrics::value(out, "tinyhttp_loop_stalls_total", "Reactor iterations that exceeded the watchdog threshold.", "counter",
+        m_stalls.load(std::memory_order_relaxed));
+}
@@ -0,0 +1,87 @@
+#ifndef WATCHDOG_H
+#define WATCHDOG_H
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <atomic>
+#include <string>
+
+class router;
+
+// 主线程卡顿监控：主线程在epoll_wait返回后记录这一轮开始的时间，每处理一个事件记录它的fd，再次等待前结束这一轮
+// 监控线程定期检查，一轮运行超过阈值时向主线程发信号抓取调用栈，连同正在处理的事件和最近几轮的耗时写入日志
+// 每轮的耗时按2的幂(us)计入直方图，和其它指标一起导出，见metrics.h
+// 主线程上只有两次clock_gettime和几次relaxed原子写，不开启时只有一次判断
+class loop_watchdog{
+public:
+    static const int BUCKETS = 25;      // 直方图的上界为1us、2us、4us ... 2^23us(约8.4秒)，最后一个是+Inf
+    static const int RECENT = 64;       // 保存最近多少轮的耗时
+    static const int MAX_FRAMES = 64;   // 调用栈的最大深度
+
+    // 启动阶段在主线程调用，spec为"阈值ms[,导出指标的URL]"，routes用于注册导出的URL
+    static bool init(const char* spec, router& routes);
+    // 在主线程启动监控线程，没有调用init时什么也不做；多进程模型下由每个worker在fork之后调用
+    static bool start();
+    static bool enabled(){ return m_enabled; }
+
+    // 主线程：epoll_wait返回后开始一轮，events为这一轮的事件数
+    static void loop_begin(int events){
+        if(m_enabled){
+            m_events.store(events, std::memory_order_relaxed);
+            m_busy_since.store(now_ns(), std::memory_order_relaxed);
+        }
+    }
+    // 主线程：开始处理一个事件
+    static void on_event(int fd, uint32_t events){
+        if(m_enabled){
+            m_cur_fd.store(fd, std::memory_order_relaxed);
+            m_cur_events.store(events, std::memory_order_relaxed);
+        }
+    }
+    // 主线程：再次等待事件之前结束这一轮，记录耗时
+    static void loop_end(){
+        if(m_enabled && m_busy_since.load(std::memory_order_relaxed)){
+            record();
+        }
+    }
+
+private:
+    static uint64_t now_ns(){
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    }
+    static void record();
+    static void* monitor(void* arg);
+    static void report(uint64_t iteration, uint64_t running_ns);
+    static void on_signal(int sig);
+    static void export_metrics(std::string& out);
+
+private:
+    static bool m_enabled;
+    static uint64_t m_threshold_ns;
+    static pthread_t m_main;            // 被监控的主线程
+    static pthread_t m_thread;          // 监控线程
+
+    // 主线程发布的心跳：这一轮开始的时间(0表示正在等待事件)、已经结束的轮数、正在处理的事件
+    static std::atomic<uint64_t> m_busy_since;
+    static std::atomic<uint64_t> m_iteration;
+    static std::atomic<int> m_events;
+    static std::atomic<int> m_cur_fd;
+    static std::atomic<uint32_t> m_cur_events;
+
+    // 最近RECENT轮的耗时(us)和事件数，按轮数取模存放，耗时在高48位
+    static std::atomic<uint64_t> m_recent[RECENT];
+
+    // 每轮耗时的直方图，只有主线程写
+    static std::atomic<uint64_t> m_hist[BUCKETS];
+    static std::atomic<uint64_t> m_sum_ns;
+    static std::atomic<uint64_t> m_stalls;
+
+    // 信号处理函数在主线程上抓取的调用栈
+    static void* m_frames[MAX_FRAMES];
+    static int m_frame_count;
+    static std::atomic<bool> m_captured;
+};
+
+#endif
@@ -1,4 +1,6 @@
 #include "web_timer.h"
+#include "probes.h"
+#include "conn_deadline.h"
 
 // 添加到链表中
 void sort_timer_lst::add_timer(util_timer* timer){
@@ -50,6 +52,27 @@ void sort_timer_lst::adjust_timer(util_timer* timer){
 
 }
 
+// 推后时和adjust_timer一样往尾部移动；提前时从链表中取出，从头部开始重新插入
+void sort_timer_lst::reset_timer(util_timer* timer, time_t expire){
+    if(expire >= timer -> expire){
+        timer -> expire = expire;
+        adjust_timer(timer);
+        return;
+    }
+    timer -> expire = expire;
+    if(timer == head){
+        return;
+    }
+    timer -> prev -> next = timer -> next;
+    if(timer == tail){
+        tail = timer -> prev;
+    }else{
+        timer -> next -> prev = timer -> prev;
+    }
+    timer -> prev = timer -> next = NULL;
+    add_timer(timer);
+}
+
 /* 一个重载的辅助函数，它被公有的 add_timer 函数和 adjust_timer 函数调用
 该函数表示将目标定时器 timer 添加到节点 lst_head 之后的部分链表中 */
 void sort_timer_lst::add_timer(util_timer* timer, util_timer* lst_head){
@@ -114,7 +137,7 @@ void sort_timer_lst::tick(){
         return;
     }
 
-    time_t curr_time = time(NULL);
+    time_t curr_time = coarse_clock::now();
     util_timer* temp = head;
     // 从头节点依次处理每个定时器，直到遇到一个尚未到期的定时器
 
@@ -124,11 +147,54 @@ void sort_timer_lst::tick(){
             break;
         }
 
+        // 连接被处理函数接管，工作线程还在使用它，推迟到下一个周期再检查
+        if(temp -> user_data -> hijacked()){
+            temp -> expire = curr_time + TIMESLOT;
+            adjust_timer(temp);
+            temp = head;
+            continue;
+        }
+
+        // 连接的截止时间在工作线程上被推后了（进入了下一个阶段或者发送有进展），按新的时间放回链表
+        // 已经关闭的连接直接删除定时器
+        http_conn* conn = temp -> user_data;
+        int phase = conn -> deadline_phase();
+        time_t deadline = conn -> deadline();
+        if(conn -> get_sockfd() >= 0 && deadline > curr_time){
+            temp -> expire = conn_deadline::next_check(curr_time, deadline);
+            adjust_timer(temp);
+            temp = head;
+            continue;
+        }
+
         // 调用定时器的回调函数，以执行定时任务，关闭连接
-        temp -> user_data -> close_conn();
+        if(conn -> get_sockfd() >= 0){
+            conn_deadline::expired(phase);
+            PROBE(timer_expire, conn -> get_sockfd(), phase);
+        }
+        conn -> close_conn();
         
         // 删除定时器
+        temp -> user_data -> timer = NULL;
         del_timer(temp);
         temp = head;
     }
-}
\ No newline at end of file
+}
+// 定时器在每次读到数据时被移到后面，链表同时是按最后一次活动时间排序的LRU
+// 空闲的连接没有工作线程在使用，和到期一样关闭连接并删除定时器
+int sort_timer_lst::evict_idle(int n, int max_scan){
+    int closed = 0;
+    util_timer* temp = head;
+    for(int scanned = 0; temp && closed < n && scanned < max_scan; ++scanned){
+        util_timer* next = temp -> next;
+        if(temp -> user_data -> idle()){
+            PROBE(conn_evict, temp -> user_data -> get_sockfd());
+            temp -> user_data -> close_conn();
+            temp -> user_data -> timer = NULL;
+            del_timer(temp);
+            ++closed;
+        }
+        temp = next;
+    }
+    return closed;
+}
@@ -41,6 +41,9 @@ public:
     // 只考虑超时时间延长的情况，即该定时器需要往链表的尾部移动
     void adjust_timer(util_timer* timer);
 
+    // 把定时器的超时时间改为expire，提前或者推后都可以，见conn_deadline.h
+    void reset_timer(util_timer* timer, time_t expire);
+
     // 将目标定时器从链表中删除
     void del_timer(util_timer* timer);
 
@@ -48,6 +51,13 @@ public:
     // 以处理链表上到期的任务
     void tick();
 
+    // 从链表头部（最久没有活动的连接）开始关闭最多n个空闲的长连接，最多检查max_scan个定时器，返回关闭的连接数
+    // 见conn_limit.h，只在主线程使用
+    int evict_idle(int n, int max_scan);
+
+    // 链表的第一个定时器，用于遍历所有连接（如tcp_health的采样），只在主线程使用
+    util_timer* front() const { return head; }
+
 private:
     //  重载辅助函数，被公有的add_timer函数和adjust_timer
     // 函数调用，将目标定时器timer添加到节点lst_head之后的部分链表中